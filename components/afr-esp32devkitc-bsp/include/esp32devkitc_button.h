@@ -14,26 +14,38 @@ extern "C" {
 
 #include "esp_system.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "driver/gpio.h"
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "freertos/event_groups.h"
 
 #include "esp32devkitc_event.h"
+#include "esp32devkitc_gesture.h"
 
 #define ESP32DEVKITC_BUTTON_GPIO      GPIO_NUM_0
 
 ESP_EVENT_DECLARE_BASE(ESP32DEVKITC_BUTTON_EVENT_BASE); /*!< BASE event of button */
 
+/*!< One task serves all the buttons */
 #define ESP32DEVKITC_BUTTON_TASK_STACK_DEPTH   2048
+#define ESP32DEVKITC_BUTTON_TASK_PRIORITY      20
 
-/*!< event_group flag bits */
-#define ESP32DEVKITC_BUTTON_PUSH_BIT      0b00000001
-#define ESP32DEVKITC_BUTTON_POP_BIT       0b00000010
+/*!< Buttons the driver can serve at once */
+#define ESP32DEVKITC_BUTTON_MAX_BUTTONS     4
+
+/*!< Edges recorded by the ISR and not consumed yet, for all buttons, a power of two */
+#define ESP32DEVKITC_BUTTON_EDGE_RING_SIZE  32
+
+/*!< Task notification bits */
+#define ESP32DEVKITC_BUTTON_EDGE_BIT        0b00000001
+#define ESP32DEVKITC_BUTTON_TIMER_BIT       0b00000010
 
 /*!< Time constants */
-#define ESP32DEVKITC_BUTTON_DEBOUNCE_TIME   10
+#define ESP32DEVKITC_BUTTON_DEBOUNCE_TIME   10      /*!< Quiet time after the last edge for the level to be settled */
 #define ESP32DEVKITC_BUTTON_HOLD_TIME       2000
+#define ESP32DEVKITC_BUTTON_MULTI_CLICK_TIME 300    /*!< Longest release between clicks of a double or triple click */
+#define ESP32DEVKITC_BUTTON_MAX_CLICKS      3
 
 /**
  * List of possible events this module can trigger
@@ -41,34 +53,64 @@ ESP_EVENT_DECLARE_BASE(ESP32DEVKITC_BUTTON_EVENT_BASE); /*!< BASE event of butto
 typedef enum {
     ESP32DEVKITC_BUTTON_CLICK_EVENT = 0,        /*!< Normal button press */
     ESP32DEVKITC_BUTTON_HOLD_EVENT,             /*!< Button hold */
+    ESP32DEVKITC_BUTTON_DOUBLE_CLICK_EVENT,     /*!< Two clicks in a row */
+    ESP32DEVKITC_BUTTON_TRIPLE_CLICK_EVENT,     /*!< Three clicks in a row */
+    ESP32DEVKITC_BUTTON_LONG_PRESS_EVENT,       /*!< Release after a hold */
     ESP32DEVKITC_BUTTON_EVENT_MAX
 } esp32devkitc_button_event_id_t;
 
+/**
+ * Event data of all button events
+ */
+typedef struct {
+    int64_t press_time_us;                              /*!< esp_timer time of the physical press that started the gesture */
+    uint32_t duration_ms;                               /*!< Press duration, for ESP32DEVKITC_BUTTON_LONG_PRESS_EVENT */
+} esp32devkitc_button_event_t;
+
+/**
+ * An edge seen by the ISR
+ */
+typedef struct {
+    int64_t time_us;                                    /*!< esp_timer time of the edge */
+    uint8_t index;                                      /*!< Slot of the button in the driver */
+    uint8_t level;                                      /*!< GPIO level right after the edge */
+} esp32devkitc_button_edge_t;
+
+/**
+ * A button. Only the configuration is set by the application, the rest is
+ * state of the driver: a few tens of bytes, plus one esp_timer.
+ */
 typedef struct {
     gpio_num_t gpio;                                    /*!< Button GPIO number */
     uint32_t debounce_time;                             /*!< Button debounce time */
     uint32_t hold_time;                                 /*!< Button hold time */
+    uint32_t multi_click_time;                          /*!< Button multi-click window, 0 for single clicks only */
+    uint32_t max_clicks;                                /*!< Button clicks decided without waiting for the window */
     esp_event_base_t esp_event_base;                    /*!< Button event base */
-    EventGroupHandle_t event_group;                     /*!< Event group handle */
-    TaskHandle_t task;                                  /*!< Button task handle */
-    #if defined(CONFIG_SUPPORT_STATIC_ALLOCATION)
-    StaticEventGroup_t event_group_buffer;              /*!< Event group buffer for static allocation */
-    StaticTask_t task_buffer;                           /*!< Task buffer for static allocation */
-    StackType_t task_stack[ESP32DEVKITC_BUTTON_TASK_STACK_DEPTH];  /*!< Task stack for static allocation */
-    #endif // STATIC_ALLOCATION
+    uint8_t index;                                      /*!< Slot of the button in the driver */
+    bool bouncing;                                      /*!< Edges seen, level not settled yet */
+    bool pressed;                                       /*!< Debounced state */
+    uint8_t last_level;                                 /*!< Level after the last edge seen */
+    int64_t bounce_start_us;                            /*!< First edge of the unsettled bounces */
+    int64_t last_edge_us;                               /*!< Last edge of the unsettled bounces */
+    int64_t sequence_start_us;                          /*!< Press that started the current click sequence */
+    int64_t last_press_us;                              /*!< Last debounced press */
+    esp32devkitc_gesture_recognizer_t gesture;          /*!< Button gesture state */
+    esp_timer_handle_t timer;                           /*!< One-shot timer of the next debounce or gesture deadline */
 } esp32devkitc_button_t;
 
-extern esp32devkitc_button_t esp32devkitc_button;       /*!< Button is the button on the front of M5StickC */
+extern esp32devkitc_button_t esp32devkitc_button;       /*!< Button is the BOOT button of the DevkitC */
 
 /**
- * @brief   Button interrupt service routine.
+ * @brief   Button interrupt service routine, shared by all the buttons.
  */
 void IRAM_ATTR esp32devkitc_button_isr_handler(void* arg);
 
 /**
  * @brief   Initialize buttons
  *
- *          Initializes common resources shared by all buttons. It does not enable any buttons.
+ *          Initializes the resources shared by all buttons: ISR service, edge ring
+ *          and task. Then enables the BOOT button.
  *
  * @return  ESP_OK success
  *          ESP_FAIL failed
@@ -81,6 +123,7 @@ esp_err_t eESP32DevkitcButtonInit();
  * @param   button button to enable
  * @return  ESP_OK success
  *          ESP_FAIL failed
+ *          ESP_ERR_NO_MEM ESP32DEVKITC_BUTTON_MAX_BUTTONS already enabled
  */
 esp_err_t eESP32DevkitcButtonEnable(esp32devkitc_button_t * button);
 
@@ -136,13 +179,14 @@ bool bIsESP32DevkitcButtonPressed(esp32devkitc_button_t * button);
 /**
  * @brief   Generates button events
  *
- *          This task generates button events such as press and release. It includes a debouncing mechanism.
- *          First, the task will wait for a key push or pop. When detected, it will "propose" a candidate event to be sent
- *          and configure a timer of 100ms. If the timer expires the candidate event is posted to the default loop. If
- *          button state changes before the timeout, it will propose the new state of button as candidate for event and
- *          restart timer again.
+ *          One task generates the gestures of all the buttons: single, double and triple clicks, hold and long
+ *          press. The ISR records every edge with its time and button in a ring buffer. The task reads them, and
+ *          once the level of a button has been quiet for its debounce time, feeds its recognizer with the time of
+ *          the first edge of the bounces. Each button has a one-shot esp_timer armed at its next debounce or
+ *          gesture deadline, which wakes the task: it never sleeps on a button. Events carry the time of the
+ *          physical press.
  *
- * @param   pvParameter pointer to esp32devkitc_button
+ * @param   pvParameter unused
  */
 void vESP32DevkitcButtonTask(void * pvParameter);
 
@@ -150,4 +194,4 @@ void vESP32DevkitcButtonTask(void * pvParameter);
 }
 #endif
 
-#endif // _ESP32DEVKITC_BUTTON_H_
\ No newline at end of file
+#endif // _ESP32DEVKITC_BUTTON_H_
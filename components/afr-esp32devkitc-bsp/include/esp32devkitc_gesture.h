@@ -0,0 +1,95 @@
+/**
+ * esp32devkitc_gesture.h
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#ifndef _ESP32DEVKITC_GESTURE_H_
+#define _ESP32DEVKITC_GESTURE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief No deadline pending: wait for the next edge only.
+ */
+#define ESP32DEVKITC_GESTURE_NO_DEADLINE    UINT32_MAX
+
+/**
+ * List of gestures the recognizer can decide
+ */
+typedef enum {
+    ESP32DEVKITC_GESTURE_NONE = 0,
+    ESP32DEVKITC_GESTURE_SINGLE_CLICK,          /*!< One click, no other one within the multi-click window */
+    ESP32DEVKITC_GESTURE_DOUBLE_CLICK,          /*!< Two clicks */
+    ESP32DEVKITC_GESTURE_TRIPLE_CLICK,          /*!< Three clicks */
+    ESP32DEVKITC_GESTURE_HOLD,                  /*!< Button still pressed after the hold time */
+    ESP32DEVKITC_GESTURE_LONG_PRESS,            /*!< Release of a held button, with the press duration */
+} esp32devkitc_gesture_t;
+
+typedef enum {
+    ESP32DEVKITC_GESTURE_STATE_IDLE = 0,        /*!< Released, no click pending */
+    ESP32DEVKITC_GESTURE_STATE_PRESSED,         /*!< Pressed, shorter than the hold time so far */
+    ESP32DEVKITC_GESTURE_STATE_RELEASED,        /*!< Released, waiting for another click */
+    ESP32DEVKITC_GESTURE_STATE_HELD             /*!< Pressed, HOLD already decided */
+} esp32devkitc_gesture_state_t;
+
+typedef struct {
+    uint32_t multi_click_time;                  /*!< Longest release between two clicks of a sequence, 0 to disable multi-clicks */
+    uint32_t hold_time;                         /*!< Shortest press that is a hold */
+    uint32_t max_clicks;                        /*!< Clicks after which the sequence is decided without waiting, 1 to 3 */
+    esp32devkitc_gesture_state_t state;
+    uint32_t clicks;                            /*!< Clicks of the current sequence */
+    uint32_t press_time;                        /*!< Time of the last press */
+    uint32_t release_time;                      /*!< Time of the last release */
+} esp32devkitc_gesture_recognizer_t;
+
+typedef struct {
+    esp32devkitc_gesture_t gesture;
+    uint32_t duration;                          /*!< Press duration, for ESP32DEVKITC_GESTURE_LONG_PRESS */
+} esp32devkitc_gesture_result_t;
+
+/**
+ * @brief   Initialize a recognizer, the button being released.
+ *
+ *          The recognizer only deals with time: it does not depend on FreeRTOS
+ *          and can be fed recorded edge timelines. Times are in milliseconds
+ *          and may wrap.
+ */
+void vESP32DevkitcGestureInit(esp32devkitc_gesture_recognizer_t * recognizer, uint32_t multi_click_time, uint32_t hold_time, uint32_t max_clicks);
+
+/**
+ * @brief   Feed a debounced edge. A deadline that passed before the edge must
+ *          be handled first with bESP32DevkitcGestureTimeout.
+ *
+ * @param   pressed new state of the button
+ * @param   now time of the edge
+ * @param   result set when a gesture is decided by this edge
+ * @return  true a gesture was decided
+ */
+bool bESP32DevkitcGestureEdge(esp32devkitc_gesture_recognizer_t * recognizer, bool pressed, uint32_t now, esp32devkitc_gesture_result_t * result);
+
+/**
+ * @brief   Time left before a gesture can be decided without another edge.
+ *
+ * @return  milliseconds, 0 if already due, ESP32DEVKITC_GESTURE_NO_DEADLINE if none
+ */
+uint32_t ulESP32DevkitcGestureTimeToDeadline(const esp32devkitc_gesture_recognizer_t * recognizer, uint32_t now);
+
+/**
+ * @brief   Decide the pending gesture if its deadline has passed.
+ *
+ * @return  true a gesture was decided
+ */
+bool bESP32DevkitcGestureTimeout(esp32devkitc_gesture_recognizer_t * recognizer, uint32_t now, esp32devkitc_gesture_result_t * result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _ESP32DEVKITC_GESTURE_H_
@@ -14,22 +14,60 @@ ESP_EVENT_DEFINE_BASE(ESP32DEVKITC_BUTTON_EVENT_BASE);
 esp32devkitc_button_t esp32devkitc_button = {
     .gpio = ESP32DEVKITC_BUTTON_GPIO,
     .debounce_time = ESP32DEVKITC_BUTTON_DEBOUNCE_TIME,
-    .hold_time = ESP32DEVKITC_BUTTON_HOLD_TIME
+    .hold_time = ESP32DEVKITC_BUTTON_HOLD_TIME,
+    .multi_click_time = ESP32DEVKITC_BUTTON_MULTI_CLICK_TIME,
+    .max_clicks = ESP32DEVKITC_BUTTON_MAX_CLICKS
 };
 
+/**
+ * State shared by all the buttons
+ */
+static struct {
+    esp32devkitc_button_t * buttons[ESP32DEVKITC_BUTTON_MAX_BUTTONS];   /*!< Enabled buttons, by slot */
+    esp32devkitc_button_edge_t edges[ESP32DEVKITC_BUTTON_EDGE_RING_SIZE];  /*!< Edges, written by the ISR, read by the task */
+    uint32_t edge_head;                                 /*!< Edges written, only modified by the ISR */
+    uint32_t edge_tail;                                 /*!< Edges read, only modified by the task */
+    uint32_t edges_dropped;                             /*!< Edges lost because the ring was full */
+    uint32_t edges_dropped_seen;                        /*!< Edges lost, as last reported by the task */
+    TaskHandle_t task;                                  /*!< Task of all the buttons */
+    #if defined(CONFIG_SUPPORT_STATIC_ALLOCATION)
+    StaticTask_t task_buffer;                           /*!< Task buffer for static allocation */
+    StackType_t task_stack[ESP32DEVKITC_BUTTON_TASK_STACK_DEPTH];  /*!< Task stack for static allocation */
+    #endif // STATIC_ALLOCATION
+} button_driver;
+
 void IRAM_ATTR esp32devkitc_button_isr_handler(void* arg)
 {
     BaseType_t xHigherPriorityTaskWoken = pdFALSE;
 
     esp32devkitc_button_t * button = (esp32devkitc_button_t *) arg;
 
-    if(gpio_get_level(button->gpio) == 0) {
-        xEventGroupSetBitsFromISR(button->event_group, ESP32DEVKITC_BUTTON_PUSH_BIT, &xHigherPriorityTaskWoken);
+    // The GPIO ISR service calls the handlers of all the buttons one after
+    // the other, from the same interrupt: the ring has a single producer.
+    // The slot is filled before the head publishes it.
+    uint32_t head = button_driver.edge_head;
+    if(head - __atomic_load_n(&button_driver.edge_tail, __ATOMIC_ACQUIRE) < ESP32DEVKITC_BUTTON_EDGE_RING_SIZE) {
+        esp32devkitc_button_edge_t * edge = &button_driver.edges[head & (ESP32DEVKITC_BUTTON_EDGE_RING_SIZE - 1)];
+        edge->time_us = esp_timer_get_time();
+        edge->index = button->index;
+        edge->level = (uint8_t)gpio_get_level(button->gpio);
+        __atomic_store_n(&button_driver.edge_head, head + 1, __ATOMIC_RELEASE);
     } else {
-        xEventGroupSetBitsFromISR(button->event_group, ESP32DEVKITC_BUTTON_POP_BIT, &xHigherPriorityTaskWoken);
+        button_driver.edges_dropped++;
+    }
+
+    xTaskNotifyFromISR(button_driver.task, ESP32DEVKITC_BUTTON_EDGE_BIT, eSetBits, &xHigherPriorityTaskWoken);
+
+    if(xHigherPriorityTaskWoken == pdTRUE) {
+        portYIELD_FROM_ISR();
     }
 }
 
+static void prvTimerCallback(void * arg)
+{
+    xTaskNotify(button_driver.task, ESP32DEVKITC_BUTTON_TIMER_BIT, eSetBits);
+}
+
 esp_err_t eESP32DevkitcButtonInit()
 {
     esp_err_t e;
@@ -45,6 +83,21 @@ esp_err_t eESP32DevkitcButtonInit()
         return ESP_FAIL;
     }
 
+    // Start the task of all the buttons
+    #if defined(CONFIG_SUPPORT_STATIC_ALLOCATION)
+    button_driver.task = xTaskCreateStatic(vESP32DevkitcButtonTask, "button_task", ESP32DEVKITC_BUTTON_TASK_STACK_DEPTH, NULL, ESP32DEVKITC_BUTTON_TASK_PRIORITY, button_driver.task_stack, &(button_driver.task_buffer));
+    if(button_driver.task == NULL) {
+        ESP_LOGE(TAG, "Error creating button_task");
+        return ESP_FAIL;
+    }
+    #else
+    BaseType_t r = xTaskCreate(vESP32DevkitcButtonTask, "button_task", ESP32DEVKITC_BUTTON_TASK_STACK_DEPTH, NULL, ESP32DEVKITC_BUTTON_TASK_PRIORITY, &(button_driver.task));
+    if(r != pdPASS) {
+        ESP_LOGE(TAG, "Error creating button_task");
+        return ESP_FAIL;
+    }
+    #endif
+
     e = eESP32DevkitcButtonEnable(&esp32devkitc_button);
     if(e == ESP_OK) {
         ESP_LOGD(TAG, "Button enabled");
@@ -62,55 +115,61 @@ esp_err_t eESP32DevkitcButtonInit()
 esp_err_t eESP32DevkitcButtonEnable(esp32devkitc_button_t * button)
 {
     esp_err_t e;
+    uint32_t i;
 
     if(button == NULL) {
         return ESP_ERR_INVALID_ARG;
     }
 
+    // Find a slot
+    for(i = 0; i < ESP32DEVKITC_BUTTON_MAX_BUTTONS; i++) {
+        if(button_driver.buttons[i] == NULL) {
+            break;
+        }
+    }
+    if(i == ESP32DEVKITC_BUTTON_MAX_BUTTONS) {
+        ESP_LOGE(TAG, "No slot left for button on GPIO %d", button->gpio);
+        return ESP_ERR_NO_MEM;
+    }
+    button->index = (uint8_t)i;
+
     // Set gpio as input
     e = eESP32DevkitcButtonSetAsInput(button);
     if(e != ESP_OK) {
         return ESP_FAIL;
     }
 
-    // Init event_group
-    #if defined(CONFIG_SUPPORT_STATIC_ALLOCATION)
-    button->event_group = xEventGroupCreateStatic(&(button->event_group_buffer));
-    #else
-    button->event_group = xEventGroupCreate();
-    #endif
-    if(button->event_group == NULL) {
-        ESP_LOGE(TAG, "Error creating button event group");
-        return ESP_FAIL;
-    }
-
-    // Start task
-    #if defined(CONFIG_SUPPORT_STATIC_ALLOCATION)
-    button->task = xTaskCreateStatic(vESP32DevkitcButtonTask, "button_task", ESP32DEVKITC_BUTTON_TASK_STACK_DEPTH, (void *) button, 20, button->task_stack, &(button->task_buffer));
-    if(button->task == NULL) {
-        ESP_LOGE(TAG, "Error creating button_task");
-        vEventGroupDelete(button->event_group);
-        return ESP_FAIL;
-    }
-    #else
-    BaseType_t r = xTaskCreate(vESP32DevkitcButtonTask, "button_task", ESP32DEVKITC_BUTTON_TASK_STACK_DEPTH, (void *) button, 20, &(button->task));
-    if(r != pdPASS) {
-        ESP_LOGE(TAG, "Error creating button_task");
-        vEventGroupDelete(button->event_group);
+    // Init state
+    button->bouncing = false;
+    button->pressed = bIsESP32DevkitcButtonPressed(button);
+    vESP32DevkitcGestureInit(&button->gesture, button->multi_click_time, button->hold_time, button->max_clicks);
+
+    // Init deadline timer
+    esp_timer_create_args_t timer_args = {
+        .callback = prvTimerCallback,
+        .arg = (void *) button,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "button"
+    };
+    e = esp_timer_create(&timer_args, &button->timer);
+    if(e != ESP_OK) {
+        ESP_LOGE(TAG, "Error creating button timer");
         return ESP_FAIL;
     }
-    #endif
 
     // Set interrupt type
     e = gpio_set_intr_type(button->gpio, GPIO_INTR_ANYEDGE);
     if(e != ESP_OK) {
+        esp_timer_delete(button->timer);
         return e;
     }
 
     // Enable interrupt
+    button_driver.buttons[i] = button;
     e = eESP32DevkitcButtonEnableInterrupt(button);
     if(e != ESP_OK) {
-        vTaskDelete(button->task);
+        button_driver.buttons[i] = NULL;
+        esp_timer_delete(button->timer);
         return ESP_FAIL;
     }
 
@@ -119,12 +178,15 @@ esp_err_t eESP32DevkitcButtonEnable(esp32devkitc_button_t * button)
 
 esp_err_t eESP32DevkitcButtonDisable(esp32devkitc_button_t * button)
 {
-    if(button == NULL) {
+    if(button == NULL || button_driver.buttons[button->index] != button) {
         return ESP_ERR_INVALID_ARG;
     }
 
-    vEventGroupDelete(button->event_group);
-    vTaskDelete(button->task);
+    eESP32DevkitcButtonDisableInterrupt(button);
+    button_driver.buttons[button->index] = NULL;
+
+    esp_timer_stop(button->timer);
+    esp_timer_delete(button->timer);
 
     return ESP_OK;
 }
@@ -164,26 +226,197 @@ bool bIsESP32DevkitcButtonPressed(esp32devkitc_button_t * button)
     return (gpio_get_level(button->gpio) == 0) ? true : false;
 }
 
+static uint32_t prvToMs(int64_t time_us)
+{
+    /* Wraps every 49 days, the recognizer only uses differences. */
+    return (uint32_t)(time_us / 1000);
+}
+
+static void prvPostGesture(esp32devkitc_button_t * button, const esp32devkitc_gesture_result_t * result)
+{
+    esp32devkitc_button_event_t event = {
+        .press_time_us = button->sequence_start_us,
+        .duration_ms = 0
+    };
+    int32_t id;
+
+    switch(result->gesture) {
+        case ESP32DEVKITC_GESTURE_SINGLE_CLICK: id = ESP32DEVKITC_BUTTON_CLICK_EVENT; break;
+        case ESP32DEVKITC_GESTURE_DOUBLE_CLICK: id = ESP32DEVKITC_BUTTON_DOUBLE_CLICK_EVENT; break;
+        case ESP32DEVKITC_GESTURE_TRIPLE_CLICK: id = ESP32DEVKITC_BUTTON_TRIPLE_CLICK_EVENT; break;
+        case ESP32DEVKITC_GESTURE_HOLD:
+            id = ESP32DEVKITC_BUTTON_HOLD_EVENT;
+            event.press_time_us = button->last_press_us;
+            break;
+        case ESP32DEVKITC_GESTURE_LONG_PRESS:
+            id = ESP32DEVKITC_BUTTON_LONG_PRESS_EVENT;
+            event.press_time_us = button->last_press_us;
+            event.duration_ms = result->duration;
+            break;
+        default:
+            return;
+    }
+
+    esp_event_post_to(esp32devkitc_event_loop, button->esp_event_base, id, &event, sizeof(event), portMAX_DELAY);
+    ESP_LOGD(TAG, "Button %u event %d, pressed at %lld us, %u ms", button->index, id, (long long)event.press_time_us, event.duration_ms);
+}
+
+/**
+ * @brief Hand the edges recorded by the ISR to their buttons.
+ */
+static void prvDrainEdges(int64_t now_us)
+{
+    uint32_t head = __atomic_load_n(&button_driver.edge_head, __ATOMIC_ACQUIRE);
+    uint32_t tail = button_driver.edge_tail;
+    uint32_t dropped = __atomic_load_n(&button_driver.edges_dropped, __ATOMIC_RELAXED);
+    esp32devkitc_button_t * button;
+    uint32_t i;
+
+    while(tail != head) {
+        const esp32devkitc_button_edge_t * edge = &button_driver.edges[tail & (ESP32DEVKITC_BUTTON_EDGE_RING_SIZE - 1)];
+
+        button = (edge->index < ESP32DEVKITC_BUTTON_MAX_BUTTONS) ? button_driver.buttons[edge->index] : NULL;
+        if(button != NULL) {
+            if(!button->bouncing) {
+                button->bouncing = true;
+                button->bounce_start_us = edge->time_us;
+            }
+            button->last_edge_us = edge->time_us;
+            button->last_level = edge->level;
+        }
+        tail++;
+    }
+
+    // Hand the slots back to the ISR once they are read
+    __atomic_store_n(&button_driver.edge_tail, tail, __ATOMIC_RELEASE);
+
+    // Edges were lost: the last levels recorded may not be the current ones
+    if(dropped != button_driver.edges_dropped_seen) {
+        ESP_LOGW(TAG, "%u button edges dropped", dropped - button_driver.edges_dropped_seen);
+        button_driver.edges_dropped_seen = dropped;
+
+        for(i = 0; i < ESP32DEVKITC_BUTTON_MAX_BUTTONS; i++) {
+            button = button_driver.buttons[i];
+            if(button != NULL) {
+                if(!button->bouncing) {
+                    button->bouncing = true;
+                    button->bounce_start_us = now_us;
+                }
+                button->last_edge_us = now_us;
+                button->last_level = (uint8_t)gpio_get_level(button->gpio);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Check whether the bounces of a button have settled on a new level.
+ *
+ * @param   edge_us set to the time of the first edge of the bounces
+ * @return  true the debounced state changed
+ */
+static bool prvSettled(esp32devkitc_button_t * button, int64_t now_us, int64_t * edge_us)
+{
+    bool pressed;
+
+    if(!button->bouncing || now_us - button->last_edge_us < (int64_t)button->debounce_time * 1000) {
+        return false;
+    }
+
+    button->bouncing = false;
+    pressed = (button->last_level == 0);
+
+    if(pressed == button->pressed) {
+        // Glitch, back to where it was
+        return false;
+    }
+
+    button->pressed = pressed;
+    *edge_us = button->bounce_start_us;
+
+    return true;
+}
+
+/**
+ * @brief Arm the timer of a button at its next deadline: end of the bounces,
+ * or decision of the pending gesture. Gestures wait for the bounces, which
+ * may be a press within the multi-click window.
+ */
+static void prvArmTimer(esp32devkitc_button_t * button, int64_t now_us)
+{
+    int64_t delay_us;
+    uint32_t deadline;
+
+    esp_timer_stop(button->timer);
+
+    if(button->bouncing) {
+        delay_us = button->last_edge_us + (int64_t)button->debounce_time * 1000 - now_us;
+    } else {
+        deadline = ulESP32DevkitcGestureTimeToDeadline(&button->gesture, prvToMs(now_us));
+        if(deadline == ESP32DEVKITC_GESTURE_NO_DEADLINE) {
+            return;
+        }
+        // Deadlines are in whole milliseconds of the recognizer
+        delay_us = (int64_t)deadline * 1000 - now_us % 1000;
+    }
+
+    esp_timer_start_once(button->timer, (delay_us > 0) ? (uint64_t)delay_us : 1);
+}
+
+/**
+ * @brief Run the debounce and gesture state machines of a button.
+ */
+static void prvProcessButton(esp32devkitc_button_t * button, int64_t now_us)
+{
+    esp32devkitc_gesture_result_t result;
+    int64_t edge_us;
+
+    if(prvSettled(button, now_us, &edge_us)) {
+        // Deadlines that passed before the edge are decided first
+        if(bESP32DevkitcGestureTimeout(&button->gesture, prvToMs(edge_us), &result)) {
+            prvPostGesture(button, &result);
+        }
+
+        if(button->pressed) {
+            if(button->gesture.state == ESP32DEVKITC_GESTURE_STATE_IDLE) {
+                button->sequence_start_us = edge_us;
+            }
+            button->last_press_us = edge_us;
+        }
+
+        if(bESP32DevkitcGestureEdge(&button->gesture, button->pressed, prvToMs(edge_us), &result)) {
+            prvPostGesture(button, &result);
+        }
+    }
+
+    if(!button->bouncing && bESP32DevkitcGestureTimeout(&button->gesture, prvToMs(now_us), &result)) {
+        prvPostGesture(button, &result);
+    }
+
+    prvArmTimer(button, now_us);
+}
+
 void vESP32DevkitcButtonTask(void * pvParameter)
 {
-    EventBits_t event;
-    esp32devkitc_button_t * button = (esp32devkitc_button_t *) pvParameter;
+    esp32devkitc_button_t * button;
+    uint32_t notification;
+    int64_t now_us;
+    uint32_t i;
 
     ESP_LOGD(TAG, "Button task started");
 
     while(1) {
-        event = xEventGroupWaitBits(button->event_group, ESP32DEVKITC_BUTTON_PUSH_BIT, pdTRUE, pdFALSE, portMAX_DELAY);
-        if((event & ESP32DEVKITC_BUTTON_PUSH_BIT) != 0) {
-            vTaskDelay(button->debounce_time/portTICK_PERIOD_MS);
-            xEventGroupClearBits(button->event_group, ESP32DEVKITC_BUTTON_POP_BIT);
-            event = xEventGroupWaitBits(button->event_group, ESP32DEVKITC_BUTTON_POP_BIT, pdTRUE, pdFALSE, button->hold_time / portTICK_PERIOD_MS);
-            if((event & ESP32DEVKITC_BUTTON_POP_BIT) != 0) {
-                esp_event_post_to(esp32devkitc_event_loop, button->esp_event_base, ESP32DEVKITC_BUTTON_CLICK_EVENT, NULL, 0, portMAX_DELAY);
-                ESP_LOGD(TAG, "BUTTON_CLICK event");
-            } else {
-                esp_event_post_to(esp32devkitc_event_loop, button->esp_event_base, ESP32DEVKITC_BUTTON_HOLD_EVENT, NULL, 0, portMAX_DELAY);
-                ESP_LOGD(TAG, "BUTTON_HOLD event");
+        // Woken by the ISR on edges, and by the timers on deadlines
+        xTaskNotifyWait(0, UINT32_MAX, &notification, portMAX_DELAY);
+
+        now_us = esp_timer_get_time();
+        prvDrainEdges(now_us);
+
+        for(i = 0; i < ESP32DEVKITC_BUTTON_MAX_BUTTONS; i++) {
+            button = button_driver.buttons[i];
+            if(button != NULL) {
+                prvProcessButton(button, now_us);
             }
         }
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,130 @@
+/**
+ * esp32devkitc_gesture.c
+ *
+ * Button gestures from press and release times:
+ *
+ *  IDLE --press--> PRESSED --release--> RELEASED --window elapsed--> N clicks
+ *                     |                    |
+ *                     |                    +--press--> PRESSED (next click)
+ *                     +--hold time--> HELD --release--> LONG_PRESS
+ *                                     (HOLD)
+ *
+ * A sequence is decided as soon as it reaches max_clicks, without waiting for
+ * the window. A hold ends a click sequence: the clicks before it are dropped.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include <stddef.h>
+
+#include "esp32devkitc_gesture.h"
+
+static const esp32devkitc_gesture_t clicks_gestures[] = {
+    ESP32DEVKITC_GESTURE_NONE,
+    ESP32DEVKITC_GESTURE_SINGLE_CLICK,
+    ESP32DEVKITC_GESTURE_DOUBLE_CLICK,
+    ESP32DEVKITC_GESTURE_TRIPLE_CLICK
+};
+
+#define ESP32DEVKITC_GESTURE_MAX_CLICKS     ( sizeof(clicks_gestures) / sizeof(clicks_gestures[0]) - 1 )
+
+static bool prvDecide(esp32devkitc_gesture_recognizer_t * recognizer, esp32devkitc_gesture_t gesture, uint32_t duration, esp32devkitc_gesture_result_t * result)
+{
+    recognizer->state = ESP32DEVKITC_GESTURE_STATE_IDLE;
+    recognizer->clicks = 0;
+
+    result->gesture = gesture;
+    result->duration = duration;
+
+    return true;
+}
+
+void vESP32DevkitcGestureInit(esp32devkitc_gesture_recognizer_t * recognizer, uint32_t multi_click_time, uint32_t hold_time, uint32_t max_clicks)
+{
+    if(max_clicks == 0 || max_clicks > ESP32DEVKITC_GESTURE_MAX_CLICKS) {
+        max_clicks = ESP32DEVKITC_GESTURE_MAX_CLICKS;
+    }
+
+    recognizer->multi_click_time = multi_click_time;
+    recognizer->hold_time = hold_time;
+    /* Without a window there is nothing to wait for after the first click. */
+    recognizer->max_clicks = (multi_click_time == 0) ? 1 : max_clicks;
+    recognizer->state = ESP32DEVKITC_GESTURE_STATE_IDLE;
+    recognizer->clicks = 0;
+    recognizer->press_time = 0;
+    recognizer->release_time = 0;
+}
+
+bool bESP32DevkitcGestureEdge(esp32devkitc_gesture_recognizer_t * recognizer, bool pressed, uint32_t now, esp32devkitc_gesture_result_t * result)
+{
+    switch(recognizer->state) {
+        case ESP32DEVKITC_GESTURE_STATE_IDLE:
+        case ESP32DEVKITC_GESTURE_STATE_RELEASED:
+            if(pressed) {
+                recognizer->state = ESP32DEVKITC_GESTURE_STATE_PRESSED;
+                recognizer->press_time = now;
+            }
+            break;
+
+        case ESP32DEVKITC_GESTURE_STATE_PRESSED:
+            if(!pressed) {
+                recognizer->clicks++;
+                recognizer->release_time = now;
+                recognizer->state = ESP32DEVKITC_GESTURE_STATE_RELEASED;
+
+                if(recognizer->clicks >= recognizer->max_clicks) {
+                    return prvDecide(recognizer, clicks_gestures[recognizer->clicks], 0, result);
+                }
+            }
+            break;
+
+        case ESP32DEVKITC_GESTURE_STATE_HELD:
+            if(!pressed) {
+                return prvDecide(recognizer, ESP32DEVKITC_GESTURE_LONG_PRESS, now - recognizer->press_time, result);
+            }
+            break;
+    }
+
+    return false;
+}
+
+uint32_t ulESP32DevkitcGestureTimeToDeadline(const esp32devkitc_gesture_recognizer_t * recognizer, uint32_t now)
+{
+    uint32_t elapsed;
+    uint32_t limit;
+
+    if(recognizer->state == ESP32DEVKITC_GESTURE_STATE_PRESSED) {
+        elapsed = now - recognizer->press_time;
+        limit = recognizer->hold_time;
+    } else if(recognizer->state == ESP32DEVKITC_GESTURE_STATE_RELEASED) {
+        elapsed = now - recognizer->release_time;
+        limit = recognizer->multi_click_time;
+    } else {
+        return ESP32DEVKITC_GESTURE_NO_DEADLINE;
+    }
+
+    return (elapsed >= limit) ? 0 : limit - elapsed;
+}
+
+bool bESP32DevkitcGestureTimeout(esp32devkitc_gesture_recognizer_t * recognizer, uint32_t now, esp32devkitc_gesture_result_t * result)
+{
+    if(ulESP32DevkitcGestureTimeToDeadline(recognizer, now) != 0) {
+        return false;
+    }
+
+    if(recognizer->state == ESP32DEVKITC_GESTURE_STATE_PRESSED) {
+        /* Still pressed: a hold, whatever clicks came before. */
+        recognizer->state = ESP32DEVKITC_GESTURE_STATE_HELD;
+        recognizer->clicks = 0;
+        result->gesture = ESP32DEVKITC_GESTURE_HOLD;
+        result->duration = now - recognizer->press_time;
+        return true;
+    }
+
+    if(recognizer->state == ESP32DEVKITC_GESTURE_STATE_RELEASED) {
+        return prvDecide(recognizer, clicks_gestures[recognizer->clicks], 0, result);
+    }
+
+    return false;
+}
@@ -0,0 +1,66 @@
+/**
+ * @file FreeRTOSConfig.h
+ * @brief Host build: FreeRTOS kernel configuration for the POSIX port.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#ifndef FREERTOS_CONFIG_H
+#define FREERTOS_CONFIG_H
+
+#define configUSE_PREEMPTION                        1
+#define configUSE_PORT_OPTIMISED_TASK_SELECTION     0
+#define configUSE_IDLE_HOOK                         0
+#define configUSE_TICK_HOOK                         0
+#define configUSE_DAEMON_TASK_STARTUP_HOOK          0
+#define configTICK_RATE_HZ                          ( 1000 )
+#define configMINIMAL_STACK_SIZE                    ( ( unsigned short ) 768 )
+#define configTOTAL_HEAP_SIZE                       ( ( size_t ) ( 16 * 1024 * 1024 ) )
+#define configMAX_TASK_NAME_LEN                     ( 16 )
+#define configUSE_TRACE_FACILITY                    1
+#define configUSE_16_BIT_TICKS                      0
+#define configIDLE_SHOULD_YIELD                     1
+#define configUSE_MUTEXES                           1
+#define configUSE_RECURSIVE_MUTEXES                 1
+#define configUSE_COUNTING_SEMAPHORES               1
+#define configQUEUE_REGISTRY_SIZE                   20
+#define configCHECK_FOR_STACK_OVERFLOW              0
+#define configUSE_MALLOC_FAILED_HOOK                0
+#define configUSE_APPLICATION_TASK_TAG              0
+#define configMAX_PRIORITIES                        ( 25 )
+#define configSUPPORT_STATIC_ALLOCATION             1
+#define configSUPPORT_DYNAMIC_ALLOCATION            1
+
+#define configUSE_TIMERS                            1
+#define configTIMER_TASK_PRIORITY                   ( configMAX_PRIORITIES - 1 )
+#define configTIMER_QUEUE_LENGTH                    20
+#define configTIMER_TASK_STACK_DEPTH                ( configMINIMAL_STACK_SIZE * 4 )
+
+#define INCLUDE_vTaskPrioritySet                    1
+#define INCLUDE_uxTaskPriorityGet                   1
+#define INCLUDE_vTaskDelete                         1
+#define INCLUDE_vTaskSuspend                        1
+#define INCLUDE_vTaskDelayUntil                     1
+#define INCLUDE_vTaskDelay                          1
+#define INCLUDE_xTaskGetSchedulerState              1
+#define INCLUDE_xTaskGetCurrentTaskHandle           1
+#define INCLUDE_uxTaskGetStackHighWaterMark         1
+#define INCLUDE_xTimerPendFunctionCall              1
+#define INCLUDE_xSemaphoreGetMutexHolder            1
+
+/* The ESP32 runs tasks on two cores, the host build on one. */
+#define tskNO_AFFINITY                              ( 0x7FFFFFFF )
+#define xTaskCreatePinnedToCore( pvTaskCode, pcName, usStackDepth, pvParameters, uxPriority, pvCreatedTask, xCoreID ) \
+    xTaskCreate( ( pvTaskCode ), ( pcName ), ( usStackDepth ), ( pvParameters ), ( uxPriority ), ( pvCreatedTask ) )
+
+#define configASSERT( x )                           if( ( x ) == 0 ) vAssertCalled( __FILE__, __LINE__ )
+extern void vAssertCalled( const char * pcFile, unsigned long ulLine );
+
+/* Logging of the Amazon FreeRTOS libraries. */
+#define configPRINTF( X )                           vLoggingPrintf X
+#define configPRINT_STRING( X )                     vLoggingPrint( X )
+extern void vLoggingPrintf( const char * pcFormat, ... );
+extern void vLoggingPrint( const char * pcMessage );
+
+#endif /* FREERTOS_CONFIG_H */
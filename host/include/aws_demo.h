@@ -0,0 +1,52 @@
+/**
+ * @file aws_demo.h
+ * @brief Host build: the demo runner interface of Amazon FreeRTOS, without its
+ * network manager.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#ifndef _HOST_AWS_DEMO_H_
+#define _HOST_AWS_DEMO_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "platform/iot_network.h"
+
+#ifndef AWSIOT_NETWORK_TYPE_WIFI
+    #define AWSIOT_NETWORK_TYPE_NONE    0x00000000
+    #define AWSIOT_NETWORK_TYPE_WIFI    0x00000001
+    #define AWSIOT_NETWORK_TYPE_BLE     0x00000002
+    #define AWSIOT_NETWORK_TYPE_ETH     0x00000004
+#endif
+
+typedef void (* networkConnectedCallback_t)( bool awsIotMqttMode,
+                                             const char * pIdentifier,
+                                             void * pNetworkServerInfo,
+                                             void * pNetworkCredentialInfo,
+                                             const IotNetworkInterface_t * pNetworkInterface );
+
+typedef void (* networkDisconnectedCallback_t)( const IotNetworkInterface_t * pNetworkInterface );
+
+typedef int (* demoFunction_t)( bool awsIotMqttMode,
+                                const char * pIdentifier,
+                                void * pNetworkServerInfo,
+                                void * pNetworkCredentialInfo,
+                                const IotNetworkInterface_t * pNetworkInterface );
+
+typedef struct demoContext
+{
+    uint32_t networkTypes;
+    demoFunction_t demoFunction;
+    networkConnectedCallback_t networkConnectedCallback;
+    networkDisconnectedCallback_t networkDisconnectedCallback;
+} demoContext_t;
+
+/**
+ * @brief   Run the demo function against the local broker. See host_demo_runner.c.
+ */
+void runDemoTask( void * pArgument );
+
+#endif /* ifndef _HOST_AWS_DEMO_H_ */
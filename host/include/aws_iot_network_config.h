@@ -0,0 +1,15 @@
+/**
+ * @file aws_iot_network_config.h
+ * @brief Host build: the host is always connected.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#ifndef AWS_IOT_NETWORK_CONFIG_H_
+#define AWS_IOT_NETWORK_CONFIG_H_
+
+#define configSUPPORTED_NETWORKS    ( AWSIOT_NETWORK_TYPE_WIFI )
+#define configENABLED_NETWORKS      ( AWSIOT_NETWORK_TYPE_WIFI )
+
+#endif /* ifndef AWS_IOT_NETWORK_CONFIG_H_ */
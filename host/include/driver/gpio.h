@@ -0,0 +1,12 @@
+/**
+ * @file gpio.h
+ * @brief Host build: no GPIO, the fake device layer stands in for the board.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#ifndef _HOST_DRIVER_GPIO_H_
+#define _HOST_DRIVER_GPIO_H_
+
+#endif /* ifndef _HOST_DRIVER_GPIO_H_ */
@@ -0,0 +1,48 @@
+/**
+ * @file esp_event.h
+ * @brief Host build: ESP-IDF user event loops on top of FreeRTOS queues.
+ *
+ * Only what the workshop uses: dedicated loops with their own task, handlers
+ * registered for one base, and posts that copy the event data.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#ifndef _HOST_ESP_EVENT_H_
+#define _HOST_ESP_EVENT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+
+#include "esp_err.h"
+
+typedef const char * esp_event_base_t;
+typedef void * esp_event_loop_handle_t;
+typedef void (*esp_event_handler_t)(void * event_handler_arg, esp_event_base_t event_base, int32_t event_id, void * event_data);
+
+#define ESP_EVENT_DECLARE_BASE(id) extern esp_event_base_t id
+#define ESP_EVENT_DEFINE_BASE(id) esp_event_base_t id = #id
+
+#define ESP_EVENT_ANY_BASE NULL
+#define ESP_EVENT_ANY_ID -1
+
+typedef struct {
+    int32_t queue_size;
+    const char * task_name;
+    UBaseType_t task_priority;
+    uint32_t task_stack_size;
+    BaseType_t task_core_id;
+} esp_event_loop_args_t;
+
+esp_err_t esp_event_loop_create(const esp_event_loop_args_t * event_loop_args, esp_event_loop_handle_t * event_loop);
+
+esp_err_t esp_event_handler_register_with(esp_event_loop_handle_t event_loop, esp_event_base_t event_base, int32_t event_id,
+                                          esp_event_handler_t event_handler, void * event_handler_arg);
+
+esp_err_t esp_event_post_to(esp_event_loop_handle_t event_loop, esp_event_base_t event_base, int32_t event_id,
+                            void * event_data, size_t event_data_size, TickType_t ticks_to_wait);
+
+#endif /* ifndef _HOST_ESP_EVENT_H_ */
@@ -0,0 +1,44 @@
+/**
+ * @file esp_log.h
+ * @brief Host build: ESP-IDF logging macros, printed on stdout.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#ifndef _HOST_ESP_LOG_H_
+#define _HOST_ESP_LOG_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "esp_err.h"
+
+#define ESP_LOG_NONE        0
+#define ESP_LOG_ERROR       1
+#define ESP_LOG_WARN        2
+#define ESP_LOG_INFO        3
+#define ESP_LOG_DEBUG       4
+#define ESP_LOG_VERBOSE     5
+
+#ifndef LOG_LOCAL_LEVEL
+    #define LOG_LOCAL_LEVEL ESP_LOG_INFO
+#endif
+
+uint32_t esp_log_timestamp(void);
+
+#define HOST_LOG(level, letter, tag, format, ...)                                                  \
+    do {                                                                                           \
+        if (LOG_LOCAL_LEVEL >= level)                                                              \
+        {                                                                                          \
+            printf(letter " (%u) %s: " format "\n", esp_log_timestamp(), tag, ##__VA_ARGS__);      \
+        }                                                                                          \
+    } while (0)
+
+#define ESP_LOGE(tag, format, ...) HOST_LOG(ESP_LOG_ERROR, "E", tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) HOST_LOG(ESP_LOG_WARN, "W", tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) HOST_LOG(ESP_LOG_INFO, "I", tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) HOST_LOG(ESP_LOG_DEBUG, "D", tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) HOST_LOG(ESP_LOG_VERBOSE, "V", tag, format, ##__VA_ARGS__)
+
+#endif /* ifndef _HOST_ESP_LOG_H_ */
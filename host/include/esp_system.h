@@ -0,0 +1,26 @@
+/**
+ * @file esp_system.h
+ * @brief Host build: random numbers, MAC address and restart.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#ifndef _HOST_ESP_SYSTEM_H_
+#define _HOST_ESP_SYSTEM_H_
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+uint32_t esp_random(void);
+
+/**
+ * @brief   MAC address of the host device, from the LAB_HOST_MAC environment
+ *          variable (12 hex digits) or a fixed default.
+ */
+esp_err_t esp_efuse_mac_get_default(uint8_t * mac);
+
+void esp_restart(void);
+
+#endif /* ifndef _HOST_ESP_SYSTEM_H_ */
@@ -0,0 +1,19 @@
+/**
+ * @file esp_timer.h
+ * @brief Host build: microsecond clock.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#ifndef _HOST_ESP_TIMER_H_
+#define _HOST_ESP_TIMER_H_
+
+#include <stdint.h>
+
+/**
+ * @brief   Microseconds since the host application started.
+ */
+int64_t esp_timer_get_time(void);
+
+#endif /* ifndef _HOST_ESP_TIMER_H_ */
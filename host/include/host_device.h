@@ -0,0 +1,45 @@
+/**
+ * @file host_device.h
+ * @brief Host build: fake device standing in for the ESP32 boards.
+ *
+ * Characters read on stdin press its buttons:
+ *          c   click the main button
+ *          h   hold the main button
+ *          d   double click the main button
+ *          t   triple click the main button
+ *          l   long press the main button, for 3 s
+ *          r   click the reset button
+ *          R   hold the reset button
+ *          m   dump the latency histograms
+ *          i   dump the IMU sampling statistics
+ *          s   stall the simulated IMU bus for 1 s, overflowing its FIFO
+ *          w   start or stop moving the simulated device, which raises
+ *              its motion interrupt or lets the sampling stop
+ *          u   plug or unplug USB, charging the simulated battery
+ *          f   dump the display framebuffer and compositor statistics
+ *
+ * The battery replays a recorded discharge.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#ifndef _HOST_DEVICE_H_
+#define _HOST_DEVICE_H_
+
+#include <stdint.h>
+
+#include "esp_event.h"
+
+/**
+ * Event data of the button events, as esp32devkitc_button_event_t
+ */
+typedef struct {
+    int64_t press_time_us;                      /*!< esp_timer time of the key press */
+    uint32_t duration_ms;                       /*!< Press duration, for BUTTON_LONG_PRESS */
+} host_button_event_t;
+
+ESP_EVENT_DECLARE_BASE(HOST_BUTTON_MAIN_EVENT_BASE);
+ESP_EVENT_DECLARE_BASE(HOST_BUTTON_RESET_EVENT_BASE);
+
+#endif /* ifndef _HOST_DEVICE_H_ */
@@ -0,0 +1,14 @@
+/**
+ * @file iot_ble_config.h
+ * @brief Host build: no BLE, only the size of the Wi-Fi network list.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#ifndef _IOT_BLE_CONFIG_H_
+#define _IOT_BLE_CONFIG_H_
+
+#define IOT_BLE_WIFI_PROVISIONING_MAX_SAVED_NETWORKS    ( 8 )
+
+#endif /* ifndef _IOT_BLE_CONFIG_H_ */
@@ -0,0 +1,35 @@
+/**
+ * @file iot_config.h
+ * @brief Host build: configuration of the Amazon FreeRTOS libraries. Same as
+ * the device, without the MQTT-over-BLE serializer.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#ifndef IOT_CONFIG_H_
+#define IOT_CONFIG_H_
+
+/* Standard include. */
+#include <stdbool.h>
+
+/* How long the MQTT library will wait for PINGRESPs or PUBACKs. */
+#define IOT_MQTT_RESPONSE_WAIT_MS               ( 10000 )
+
+/* Library logging configuration. */
+#define IOT_LOG_LEVEL_GLOBAL                    IOT_LOG_INFO
+#define IOT_LOG_LEVEL_DEMO                      IOT_LOG_INFO
+#define IOT_LOG_LEVEL_PLATFORM                  IOT_LOG_NONE
+#define IOT_LOG_LEVEL_NETWORK                   IOT_LOG_INFO
+#define IOT_LOG_LEVEL_TASKPOOL                  IOT_LOG_NONE
+#define IOT_LOG_LEVEL_MQTT                      IOT_LOG_INFO
+#define AWS_IOT_LOG_LEVEL_SHADOW                IOT_LOG_INFO
+
+/* Platform thread stack size and priority. */
+#define IOT_THREAD_DEFAULT_STACK_SIZE           6000
+#define IOT_THREAD_DEFAULT_PRIORITY             5
+
+/* Include the common configuration file for FreeRTOS. */
+#include "iot_config_common.h"
+
+#endif /* ifndef IOT_CONFIG_H_ */
@@ -0,0 +1,39 @@
+/**
+ * @file iot_wifi.h
+ * @brief Host build: the Wi-Fi network list of Amazon FreeRTOS, always empty.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#ifndef _HOST_IOT_WIFI_H_
+#define _HOST_IOT_WIFI_H_
+
+#include <stdint.h>
+
+#define wificonfigMAX_SSID_LEN          32
+#define wificonfigMAX_BSSID_LEN         6
+#define wificonfigMAX_PASSPHRASE_LEN    64
+
+typedef enum
+{
+    eWiFiSuccess = 0,
+    eWiFiFailure = 1,
+    eWiFiTimeout = 2,
+    eWiFiNotSupported = 3
+} WIFIReturnCode_t;
+
+typedef struct
+{
+    char cSSID[ wificonfigMAX_SSID_LEN ];
+    uint8_t ucSSIDLength;
+    uint8_t ucBSSID[ wificonfigMAX_BSSID_LEN ];
+    char cPassword[ wificonfigMAX_PASSPHRASE_LEN ];
+    uint8_t ucPasswordLength;
+    int xSecurity;
+} WIFINetworkProfile_t;
+
+WIFIReturnCode_t WIFI_NetworkGet( WIFINetworkProfile_t * pxNetwork, uint16_t usIndex );
+WIFIReturnCode_t WIFI_NetworkDelete( uint16_t usIndex );
+
+#endif /* ifndef _HOST_IOT_WIFI_H_ */
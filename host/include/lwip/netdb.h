@@ -0,0 +1,14 @@
+/**
+ * @file netdb.h
+ * @brief Host build: name resolution of the host.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#ifndef _HOST_LWIP_NETDB_H_
+#define _HOST_LWIP_NETDB_H_
+
+#include <netdb.h>
+
+#endif /* ifndef _HOST_LWIP_NETDB_H_ */
@@ -0,0 +1,19 @@
+/**
+ * @file sockets.h
+ * @brief Host build: lwIP sockets are the BSD sockets of the host.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#ifndef _HOST_LWIP_SOCKETS_H_
+#define _HOST_LWIP_SOCKETS_H_
+
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+
+#endif /* ifndef _HOST_LWIP_SOCKETS_H_ */
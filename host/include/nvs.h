@@ -0,0 +1,41 @@
+/**
+ * @file nvs.h
+ * @brief Host build: NVS backed by files, one per key, under
+ * LAB_HOST_NVS_DIR/<partition>/<namespace>/.
+ *
+ * Writes go straight to the file, so nvs_commit has nothing to do. Entries
+ * survive a restart of the host application, as they do a reboot on the device.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#ifndef _HOST_NVS_H_
+#define _HOST_NVS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#define NVS_DEFAULT_PART_NAME "nvs"
+
+typedef uint32_t nvs_handle;
+
+typedef enum {
+    NVS_READONLY,
+    NVS_READWRITE
+} nvs_open_mode;
+
+esp_err_t nvs_open(const char * name, nvs_open_mode open_mode, nvs_handle * out_handle);
+esp_err_t nvs_open_from_partition(const char * part_name, const char * name, nvs_open_mode open_mode, nvs_handle * out_handle);
+void nvs_close(nvs_handle handle);
+
+esp_err_t nvs_set_u32(nvs_handle handle, const char * key, uint32_t value);
+esp_err_t nvs_get_u32(nvs_handle handle, const char * key, uint32_t * out_value);
+esp_err_t nvs_set_blob(nvs_handle handle, const char * key, const void * value, size_t length);
+esp_err_t nvs_get_blob(nvs_handle handle, const char * key, void * out_value, size_t * length);
+esp_err_t nvs_erase_key(nvs_handle handle, const char * key);
+esp_err_t nvs_commit(nvs_handle handle);
+
+#endif /* ifndef _HOST_NVS_H_ */
@@ -0,0 +1,19 @@
+/**
+ * @file nvs_flash.h
+ * @brief Host build: NVS partitions are directories.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#ifndef _HOST_NVS_FLASH_H_
+#define _HOST_NVS_FLASH_H_
+
+#include "esp_err.h"
+
+esp_err_t nvs_flash_init(void);
+esp_err_t nvs_flash_init_partition(const char * partition_label);
+esp_err_t nvs_flash_erase(void);
+esp_err_t nvs_flash_erase_partition(const char * part_name);
+
+#endif /* ifndef _HOST_NVS_FLASH_H_ */
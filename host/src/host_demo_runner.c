@@ -0,0 +1,140 @@
+/**
+ * @file host_demo_runner.c
+ * @brief Host build: runDemoTask without the network manager. The network is
+ * always up; the demo connects to the broker given by the environment.
+ *
+ *  LAB_HOST_BROKER     broker host name, "localhost" by default
+ *  LAB_HOST_PORT       broker port, 8883 by default
+ *  LAB_HOST_ROOT_CA    PEM file of the root CA, the Amazon root CA if unset
+ *  LAB_HOST_CERT       PEM file of the client certificate
+ *  LAB_HOST_KEY        PEM file of the client private key
+ *  LAB_HOST_AWS_IOT    set to 1 when the broker is AWS IoT
+ *  LAB_HOST_THING_NAME MQTT client identifier, clientcredentialIOT_THING_NAME
+ *                      by default. Required by the Shadow lab.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+/* The config header is always included first. */
+#include "iot_config.h"
+
+/* Standard includes. */
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "aws_clientcredential.h"
+#include "aws_demo.h"
+#include "types/iot_network_types.h"
+#include "esp_log.h"
+
+#include "lab_network_tls.h"
+
+static const char *TAG = "host_demo";
+
+#define HOST_DEMO_DEFAULT_BROKER    "localhost"
+#define HOST_DEMO_DEFAULT_PORT      ( 8883 )
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Read a PEM file named by an environment variable. mbedTLS wants the
+ * terminating NUL counted in the size.
+ */
+static char * prvReadPem(const char * pEnvName, size_t * pSize)
+{
+    const char * pPath = getenv(pEnvName);
+    FILE * pFile = NULL;
+    char * pPem = NULL;
+    long length = 0;
+
+    *pSize = 0;
+
+    if (pPath == NULL)
+    {
+        return NULL;
+    }
+
+    pFile = fopen(pPath, "rb");
+    if (pFile == NULL)
+    {
+        ESP_LOGE(TAG, "Cannot open %s=%s", pEnvName, pPath);
+        return NULL;
+    }
+
+    if (fseek(pFile, 0, SEEK_END) == 0 && (length = ftell(pFile)) > 0 && fseek(pFile, 0, SEEK_SET) == 0)
+    {
+        pPem = malloc((size_t)length + 1);
+        if (pPem != NULL && fread(pPem, 1, (size_t)length, pFile) == (size_t)length)
+        {
+            pPem[length] = '\0';
+            *pSize = (size_t)length + 1;
+        }
+        else
+        {
+            free(pPem);
+            pPem = NULL;
+        }
+    }
+
+    fclose(pFile);
+
+    return pPem;
+}
+
+/*-----------------------------------------------------------*/
+
+void runDemoTask( void * pArgument )
+{
+    demoContext_t * pContext = (demoContext_t *)pArgument;
+    IotNetworkServerInfo_t serverInfo = { 0 };
+    IotNetworkCredentials_t credentials = { 0 };
+    const char * pPort = getenv("LAB_HOST_PORT");
+    const char * pAwsIot = getenv("LAB_HOST_AWS_IOT");
+    bool awsIotMqttMode = (pAwsIot != NULL && strcmp(pAwsIot, "1") == 0);
+    const char * pIdentifier = getenv("LAB_HOST_THING_NAME");
+    char * pRootCa = NULL;
+    char * pClientCert = NULL;
+    char * pPrivateKey = NULL;
+
+    serverInfo.pHostName = getenv("LAB_HOST_BROKER");
+    if (serverInfo.pHostName == NULL)
+    {
+        serverInfo.pHostName = HOST_DEMO_DEFAULT_BROKER;
+    }
+    serverInfo.port = (pPort != NULL) ? (uint16_t)atoi(pPort) : HOST_DEMO_DEFAULT_PORT;
+
+    pRootCa = prvReadPem("LAB_HOST_ROOT_CA", &credentials.rootCaSize);
+    pClientCert = prvReadPem("LAB_HOST_CERT", &credentials.clientCertSize);
+    pPrivateKey = prvReadPem("LAB_HOST_KEY", &credentials.privateKeySize);
+    credentials.pRootCa = pRootCa;
+    credentials.pClientCert = pClientCert;
+    credentials.pPrivateKey = pPrivateKey;
+    credentials.disableSni = !awsIotMqttMode;
+
+    if (pIdentifier == NULL && strlen(clientcredentialIOT_THING_NAME) > 0)
+    {
+        pIdentifier = clientcredentialIOT_THING_NAME;
+    }
+
+    ESP_LOGI(TAG, "Broker %s:%u (%s)", serverInfo.pHostName, serverInfo.port,
+             awsIotMqttMode ? "AWS IoT" : "MQTT");
+
+    if (pContext->networkConnectedCallback != NULL)
+    {
+        pContext->networkConnectedCallback(awsIotMqttMode, pIdentifier, &serverInfo, &credentials, &lab_network_tls_interface);
+    }
+
+    pContext->demoFunction(awsIotMqttMode, pIdentifier, &serverInfo, &credentials, &lab_network_tls_interface);
+
+    if (pContext->networkDisconnectedCallback != NULL)
+    {
+        pContext->networkDisconnectedCallback(&lab_network_tls_interface);
+    }
+
+    free(pRootCa);
+    free(pClientCert);
+    free(pPrivateKey);
+}
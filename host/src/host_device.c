@@ -0,0 +1,224 @@
+/**
+ * @file host_device.c
+ * @brief Host build: fake device standing in for device.c. Buttons are pressed
+ * from stdin, the LED and the display are the log.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <sys/select.h>
+#include <unistd.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "esp_event.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "device.h"
+#include "lab_battery.h"
+#include "lab_display.h"
+#include "lab_imu.h"
+#include "lab_metrics.h"
+
+static const char *TAG = "host_device";
+
+/**
+ * @brief How often stdin is polled. Blocking on it would hold the scheduler.
+ */
+#define HOST_DEVICE_POLL_MS     ( 50 )
+
+/**
+ * @brief Press duration reported by a long press.
+ */
+#define HOST_DEVICE_LONG_PRESS_MS   ( 3000 )
+
+/**
+ * @brief Stall of the simulated IMU bus, longer than its FIFO lasts.
+ */
+#define HOST_DEVICE_IMU_STALL_MS    ( 1000 )
+
+/**
+ * @brief Battery voltage of a M5StickC discharging, in mV, one reading every
+ * LAB_BATTERY_SAMPLE_MS. Replayed in a loop.
+ */
+static const uint16_t host_device_battery_trace[] = {
+    4111, 4098, 4116, 4080, 4095, 4078, 4053, 4066,
+    4032, 4042, 4012, 4002, 4007, 4015, 3968, 3961,
+    3968, 3971, 3940, 3917, 3933, 3872, 3899, 3856,
+    3835, 3819, 3813, 3824, 3777, 3782, 3769, 3741,
+    3734, 3694, 3677, 3669, 3676, 3647, 3625, 3622,
+    3598, 3574, 3581, 3559, 3519, 3518, 3498, 3498
+};
+
+ESP_EVENT_DEFINE_BASE(HOST_BUTTON_MAIN_EVENT_BASE);
+ESP_EVENT_DEFINE_BASE(HOST_BUTTON_RESET_EVENT_BASE);
+
+static esp_event_loop_handle_t host_device_event_loop = NULL;
+static bool host_device_moving = true;
+static bool host_device_charging = false;
+static uint32_t host_device_battery_index = 0;
+
+/*-----------------------------------------------------------*/
+
+static void prvPress(esp_event_base_t base, int32_t id)
+{
+    host_button_event_t event = {
+        .press_time_us = esp_timer_get_time(),
+        .duration_ms = (id == BUTTON_LONG_PRESS) ? HOST_DEVICE_LONG_PRESS_MS : 0
+    };
+
+    if (esp_event_post_to(host_device_event_loop, base, id, &event, sizeof(event), 0) != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Button event dropped");
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static esp_err_t prvBatteryRead(uint32_t *pMillivolts, bool *pCharging)
+{
+    *pMillivolts = host_device_battery_trace[host_device_battery_index];
+    *pCharging = host_device_charging;
+
+    host_device_battery_index = (host_device_battery_index + 1) %
+                                (sizeof(host_device_battery_trace) / sizeof(host_device_battery_trace[0]));
+
+    return ESP_OK;
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvBatteryEventHandler(void * handler_arg, esp_event_base_t base, int32_t id, void * event_data)
+{
+    const lab_battery_event_t * event = (const lab_battery_event_t *)event_data;
+    char pVbatStr[11] = {0};
+
+    snprintf(pVbatStr, sizeof(pVbatStr), "%s:%3u%%", event->charging ? "CHG" : "BAT", event->socPercent);
+    eLabDisplaySetText(LABDISPLAY_WIDGET_BATTERY, pVbatStr);
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvStdinTask(void * pArgument)
+{
+    struct timeval timeout;
+    fd_set readSet;
+    int c = 0;
+
+    for(;;)
+    {
+        FD_ZERO(&readSet);
+        FD_SET(STDIN_FILENO, &readSet);
+        timeout.tv_sec = 0;
+        timeout.tv_usec = 0;
+
+        if (select(STDIN_FILENO + 1, &readSet, NULL, NULL, &timeout) <= 0)
+        {
+            vTaskDelay(pdMS_TO_TICKS(HOST_DEVICE_POLL_MS));
+            continue;
+        }
+
+        c = getchar();
+
+        switch (c)
+        {
+            case 'c': prvPress(HOST_BUTTON_MAIN_EVENT_BASE, BUTTON_CLICK); break;
+            case 'h': prvPress(HOST_BUTTON_MAIN_EVENT_BASE, BUTTON_HOLD); break;
+            case 'd': prvPress(HOST_BUTTON_MAIN_EVENT_BASE, BUTTON_DOUBLE_CLICK); break;
+            case 't': prvPress(HOST_BUTTON_MAIN_EVENT_BASE, BUTTON_TRIPLE_CLICK); break;
+            case 'l': prvPress(HOST_BUTTON_MAIN_EVENT_BASE, BUTTON_LONG_PRESS); break;
+            case 'r': prvPress(HOST_BUTTON_RESET_EVENT_BASE, BUTTON_CLICK); break;
+            case 'R': prvPress(HOST_BUTTON_RESET_EVENT_BASE, BUTTON_HOLD); break;
+            case 'm': vLabMetricsDump(); break;
+            case 'i': vLabImuDump(); break;
+            case 'f':
+                vLabDisplaySimDump();
+                vLabDisplayDump();
+                break;
+            case 's': vLabImuSimStall(HOST_DEVICE_IMU_STALL_MS); break;
+            case 'u':
+                host_device_charging = !host_device_charging;
+                ESP_LOGI(TAG, "USB %s", host_device_charging ? "plugged" : "unplugged");
+                break;
+            case 'w':
+                host_device_moving = !host_device_moving;
+                ESP_LOGI(TAG, "Simulated device %s", host_device_moving ? "moving" : "still");
+                vLabImuSimMotion(host_device_moving);
+                break;
+            case EOF: vTaskDelay(pdMS_TO_TICKS(HOST_DEVICE_POLL_MS)); break;
+            default: break;
+        }
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+esp_err_t eDeviceInit(void)
+{
+    esp_event_loop_args_t loop_args = {
+        .queue_size = 5,
+        .task_name = "host_device",
+        .task_priority = 5,
+        .task_stack_size = 4096,
+        .task_core_id = 0
+    };
+
+    if (esp_event_loop_create(&loop_args, &host_device_event_loop) != ESP_OK)
+    {
+        return ESP_FAIL;
+    }
+
+    if (xTaskCreate(prvStdinTask, "host_stdin", configMINIMAL_STACK_SIZE * 4, NULL, tskIDLE_PRIORITY + 1, NULL) != pdPASS)
+    {
+        return ESP_FAIL;
+    }
+
+    if (eLabDisplayInit() != ESP_OK)
+    {
+        return ESP_FAIL;
+    }
+
+    if (eLabImuInit(host_device_event_loop) != ESP_OK)
+    {
+        return ESP_FAIL;
+    }
+
+    if (esp_event_handler_register_with(host_device_event_loop, LAB_BATTERY_EVENT_BASE, LABBATTERY_EVENT_STATE, prvBatteryEventHandler, NULL) != ESP_OK ||
+        eLabBatteryInit(host_device_event_loop, prvBatteryRead) != ESP_OK)
+    {
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG, "Buttons: c/d/t/h/l click/double/triple/hold/long main, r/R click/hold reset, m dump metrics");
+    ESP_LOGI(TAG, "IMU: i dump sampling statistics, s stall the simulated bus, w start/stop moving");
+    ESP_LOGI(TAG, "Battery: replays a recorded discharge, u plug/unplug USB");
+    ESP_LOGI(TAG, "Display: f dump the framebuffer and the compositor statistics");
+
+    return ESP_OK;
+}
+
+/*-----------------------------------------------------------*/
+
+esp_err_t eDeviceRegisterButtonCallback(esp_event_base_t base, void (*callback)(void * handler_arg, esp_event_base_t base, int32_t id, void * event_data) )
+{
+    return esp_event_handler_register_with(host_device_event_loop, base, ESP_EVENT_ANY_ID, callback, NULL);
+}
+
+/*-----------------------------------------------------------*/
+
+esp_err_t eDeviceRegisterMotionCallback(void (*callback)(void * handler_arg, esp_event_base_t base, int32_t id, void * event_data) )
+{
+    return esp_event_handler_register_with(host_device_event_loop, LAB_IMU_EVENT_BASE, ESP_EVENT_ANY_ID, callback, NULL);
+}
+
+/*-----------------------------------------------------------*/
+
+esp_err_t eDeviceRegisterBatteryCallback(void (*callback)(void * handler_arg, esp_event_base_t base, int32_t id, void * event_data) )
+{
+    return esp_event_handler_register_with(host_device_event_loop, LAB_BATTERY_EVENT_BASE, ESP_EVENT_ANY_ID, callback, NULL);
+}
@@ -0,0 +1,174 @@
+/**
+ * @file host_esp_event.c
+ * @brief Host build: ESP-IDF user event loops on top of FreeRTOS queues.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "queue.h"
+#include "semphr.h"
+#include "task.h"
+
+#include "esp_event.h"
+#include "esp_log.h"
+
+static const char *TAG = "host_esp_event";
+
+#ifndef LAB_HOST_EVENT_MAX_HANDLERS
+    #define LAB_HOST_EVENT_MAX_HANDLERS     ( 8 )
+#endif
+
+typedef struct {
+    esp_event_base_t base;
+    int32_t id;
+    esp_event_handler_t handler;
+    void * arg;
+} _eventHandler_t;
+
+typedef struct {
+    QueueHandle_t queue;
+    SemaphoreHandle_t mutex;
+    _eventHandler_t handlers[LAB_HOST_EVENT_MAX_HANDLERS];
+    uint32_t handlerCount;
+} _eventLoop_t;
+
+/* What goes through the queue: the data is a heap copy, freed once handled. */
+typedef struct {
+    esp_event_base_t base;
+    int32_t id;
+    void * data;
+} _postedEvent_t;
+
+/*-----------------------------------------------------------*/
+
+static void prvEventLoopTask(void * pArgument)
+{
+    _eventLoop_t * pLoop = (_eventLoop_t *)pArgument;
+    _eventHandler_t handlers[LAB_HOST_EVENT_MAX_HANDLERS];
+    _postedEvent_t event;
+    uint32_t count = 0;
+    uint32_t i = 0;
+
+    for(;;)
+    {
+        if (xQueueReceive(pLoop->queue, &event, portMAX_DELAY) != pdTRUE)
+        {
+            continue;
+        }
+
+        /* Handlers may register others: run a snapshot. */
+        xSemaphoreTake(pLoop->mutex, portMAX_DELAY);
+        count = pLoop->handlerCount;
+        memcpy(handlers, pLoop->handlers, sizeof(handlers));
+        xSemaphoreGive(pLoop->mutex);
+
+        for (i = 0; i < count; i++)
+        {
+            if ((handlers[i].base == ESP_EVENT_ANY_BASE || handlers[i].base == event.base) &&
+                (handlers[i].id == ESP_EVENT_ANY_ID || handlers[i].id == event.id))
+            {
+                handlers[i].handler(handlers[i].arg, event.base, event.id, event.data);
+            }
+        }
+
+        free(event.data);
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+esp_err_t esp_event_loop_create(const esp_event_loop_args_t * event_loop_args, esp_event_loop_handle_t * event_loop)
+{
+    _eventLoop_t * pLoop = calloc(1, sizeof(_eventLoop_t));
+
+    if (pLoop == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    pLoop->queue = xQueueCreate(event_loop_args->queue_size, sizeof(_postedEvent_t));
+    pLoop->mutex = xSemaphoreCreateMutex();
+
+    if (pLoop->queue == NULL || pLoop->mutex == NULL ||
+        xTaskCreate(prvEventLoopTask,
+                    event_loop_args->task_name,
+                    event_loop_args->task_stack_size > configMINIMAL_STACK_SIZE * 4 ? event_loop_args->task_stack_size : configMINIMAL_STACK_SIZE * 4,
+                    pLoop,
+                    event_loop_args->task_priority,
+                    NULL) != pdPASS)
+    {
+        ESP_LOGE(TAG, "Failed to create event loop %s", event_loop_args->task_name);
+        return ESP_FAIL;
+    }
+
+    *event_loop = pLoop;
+
+    return ESP_OK;
+}
+
+/*-----------------------------------------------------------*/
+
+esp_err_t esp_event_handler_register_with(esp_event_loop_handle_t event_loop, esp_event_base_t event_base, int32_t event_id,
+                                          esp_event_handler_t event_handler, void * event_handler_arg)
+{
+    _eventLoop_t * pLoop = (_eventLoop_t *)event_loop;
+    esp_err_t res = ESP_ERR_NO_MEM;
+
+    if (pLoop == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    xSemaphoreTake(pLoop->mutex, portMAX_DELAY);
+
+    if (pLoop->handlerCount < LAB_HOST_EVENT_MAX_HANDLERS)
+    {
+        pLoop->handlers[pLoop->handlerCount].base = event_base;
+        pLoop->handlers[pLoop->handlerCount].id = event_id;
+        pLoop->handlers[pLoop->handlerCount].handler = event_handler;
+        pLoop->handlers[pLoop->handlerCount].arg = event_handler_arg;
+        pLoop->handlerCount++;
+        res = ESP_OK;
+    }
+
+    xSemaphoreGive(pLoop->mutex);
+
+    return res;
+}
+
+/*-----------------------------------------------------------*/
+
+esp_err_t esp_event_post_to(esp_event_loop_handle_t event_loop, esp_event_base_t event_base, int32_t event_id,
+                            void * event_data, size_t event_data_size, TickType_t ticks_to_wait)
+{
+    _eventLoop_t * pLoop = (_eventLoop_t *)event_loop;
+    _postedEvent_t event = { .base = event_base, .id = event_id, .data = NULL };
+
+    if (pLoop == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (event_data != NULL && event_data_size > 0)
+    {
+        event.data = malloc(event_data_size);
+        if (event.data == NULL)
+        {
+            return ESP_ERR_NO_MEM;
+        }
+        memcpy(event.data, event_data, event_data_size);
+    }
+
+    if (xQueueSend(pLoop->queue, &event, ticks_to_wait) != pdTRUE)
+    {
+        free(event.data);
+        return ESP_ERR_TIMEOUT;
+    }
+
+    return ESP_OK;
+}
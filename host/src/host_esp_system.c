@@ -0,0 +1,114 @@
+/**
+ * @file host_esp_system.c
+ * @brief Host build: random numbers, MAC address, clocks and errors.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+#include <time.h>
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+
+/*-----------------------------------------------------------*/
+
+uint32_t esp_random(void)
+{
+    uint32_t value = 0;
+
+    if (getrandom(&value, sizeof(value), 0) != sizeof(value))
+    {
+        value = (uint32_t)random();
+    }
+
+    return value;
+}
+
+/*-----------------------------------------------------------*/
+
+esp_err_t esp_efuse_mac_get_default(uint8_t * mac)
+{
+    static const uint8_t defaultMac[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+    const char * env = getenv("LAB_HOST_MAC");
+    unsigned int bytes[6];
+    int i = 0;
+
+    memcpy(mac, defaultMac, sizeof(defaultMac));
+
+    if (env != NULL &&
+        sscanf(env, "%2x%2x%2x%2x%2x%2x", &bytes[0], &bytes[1], &bytes[2], &bytes[3], &bytes[4], &bytes[5]) == 6)
+    {
+        for (i = 0; i < 6; i++)
+        {
+            mac[i] = (uint8_t)bytes[i];
+        }
+    }
+
+    return ESP_OK;
+}
+
+/*-----------------------------------------------------------*/
+
+void esp_restart(void)
+{
+    printf("esp_restart: exiting the host application\n");
+    exit(0);
+}
+
+/*-----------------------------------------------------------*/
+
+/* Tests that simulate time provide their own clock. */
+#ifndef LAB_TEST_SIMULATED_CLOCK
+
+int64_t esp_timer_get_time(void)
+{
+    static int64_t startUs = 0;
+    struct timespec now;
+    int64_t nowUs = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    nowUs = (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+
+    if (startUs == 0)
+    {
+        startUs = nowUs;
+    }
+
+    return nowUs - startUs;
+}
+
+#endif /* ifndef LAB_TEST_SIMULATED_CLOCK */
+
+uint32_t esp_log_timestamp(void)
+{
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+/*-----------------------------------------------------------*/
+
+const char * esp_err_to_name(esp_err_t code)
+{
+    switch (code)
+    {
+        case ESP_OK: return "ESP_OK";
+        case ESP_FAIL: return "ESP_FAIL";
+        case ESP_ERR_NO_MEM: return "ESP_ERR_NO_MEM";
+        case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+        case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+        case ESP_ERR_INVALID_SIZE: return "ESP_ERR_INVALID_SIZE";
+        case ESP_ERR_NOT_FOUND: return "ESP_ERR_NOT_FOUND";
+        case ESP_ERR_NOT_SUPPORTED: return "ESP_ERR_NOT_SUPPORTED";
+        case ESP_ERR_TIMEOUT: return "ESP_ERR_TIMEOUT";
+        case ESP_ERR_NVS_NOT_FOUND: return "ESP_ERR_NVS_NOT_FOUND";
+        case ESP_ERR_NVS_INVALID_HANDLE: return "ESP_ERR_NVS_INVALID_HANDLE";
+        case ESP_ERR_NVS_INVALID_LENGTH: return "ESP_ERR_NVS_INVALID_LENGTH";
+        default: return "UNKNOWN ERROR";
+    }
+}
@@ -0,0 +1,126 @@
+/**
+ * @file host_main.c
+ * @brief Host build: main file. Runs the workshop on the FreeRTOS POSIX port.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include "iot_config.h"
+
+/* Standard includes. */
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* FreeRTOS includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+/* AWS System includes. */
+#include "iot_init.h"
+
+#include "nvs_flash.h"
+#include "esp_log.h"
+
+#include "workshop.h"
+
+static const char *TAG = "host_main";
+
+#define mainWORKSHOP_TASK_STACK_SIZE        ( configMINIMAL_STACK_SIZE * 8 )
+
+/*-----------------------------------------------------------*/
+
+static void prvWorkshopTask( void * pArgument )
+{
+    if( IotSdk_Init() == false )
+    {
+        ESP_LOGE(TAG, "Failed to initialize the common library");
+        exit(EXIT_FAILURE);
+    }
+
+    if( nvs_flash_init() != ESP_OK )
+    {
+        ESP_LOGE(TAG, "Failed to initialize NVS");
+        exit(EXIT_FAILURE);
+    }
+
+    if( eWorkshopRun() != ESP_OK )
+    {
+        ESP_LOGE(TAG, "Failed to run the workshop");
+        exit(EXIT_FAILURE);
+    }
+
+    vTaskDelete( NULL );
+}
+
+/*-----------------------------------------------------------*/
+
+int main( void )
+{
+    /* Button presses are read a character at a time. */
+    setvbuf( stdin, NULL, _IONBF, 0 );
+    setvbuf( stdout, NULL, _IOLBF, 0 );
+
+    xTaskCreate( prvWorkshopTask, "workshop", mainWORKSHOP_TASK_STACK_SIZE, NULL, tskIDLE_PRIORITY + 5, NULL );
+
+    vTaskStartScheduler();
+
+    return EXIT_FAILURE;
+}
+
+/*-----------------------------------------------------------*/
+
+void vAssertCalled( const char * pcFile, unsigned long ulLine )
+{
+    fprintf( stderr, "ASSERT: %s:%lu\n", pcFile, ulLine );
+    abort();
+}
+
+/*-----------------------------------------------------------*/
+
+void vLoggingPrintf( const char * pcFormat, ... )
+{
+    va_list args;
+
+    va_start( args, pcFormat );
+    vprintf( pcFormat, args );
+    va_end( args );
+}
+
+/*-----------------------------------------------------------*/
+
+void vLoggingPrint( const char * pcMessage )
+{
+    fputs( pcMessage, stdout );
+}
+
+/*-----------------------------------------------------------*/
+
+/* configSUPPORT_STATIC_ALLOCATION is set, so the kernel asks for the memory
+ * of its own tasks. */
+void vApplicationGetIdleTaskMemory( StaticTask_t ** ppxIdleTaskTCBBuffer,
+                                    StackType_t ** ppxIdleTaskStackBuffer,
+                                    uint32_t * pulIdleTaskStackSize )
+{
+    static StaticTask_t xIdleTaskTCB;
+    static StackType_t uxIdleTaskStack[ configMINIMAL_STACK_SIZE ];
+
+    *ppxIdleTaskTCBBuffer = &xIdleTaskTCB;
+    *ppxIdleTaskStackBuffer = uxIdleTaskStack;
+    *pulIdleTaskStackSize = configMINIMAL_STACK_SIZE;
+}
+
+/*-----------------------------------------------------------*/
+
+void vApplicationGetTimerTaskMemory( StaticTask_t ** ppxTimerTaskTCBBuffer,
+                                     StackType_t ** ppxTimerTaskStackBuffer,
+                                     uint32_t * pulTimerTaskStackSize )
+{
+    static StaticTask_t xTimerTaskTCB;
+    static StackType_t uxTimerTaskStack[ configTIMER_TASK_STACK_DEPTH ];
+
+    *ppxTimerTaskTCBBuffer = &xTimerTaskTCB;
+    *ppxTimerTaskStackBuffer = uxTimerTaskStack;
+    *pulTimerTaskStackSize = configTIMER_TASK_STACK_DEPTH;
+}
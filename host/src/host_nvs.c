@@ -0,0 +1,270 @@
+/**
+ * @file host_nvs.c
+ * @brief Host build: NVS backed by one file per key.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "esp_log.h"
+#include "nvs.h"
+#include "nvs_flash.h"
+
+static const char *TAG = "host_nvs";
+
+#ifndef LAB_HOST_NVS_MAX_HANDLES
+    #define LAB_HOST_NVS_MAX_HANDLES    ( 8 )
+#endif
+
+#define NVS_PATH_MAX_LENGTH             ( 256 )
+
+typedef struct {
+    bool open;
+    bool readOnly;
+    char path[NVS_PATH_MAX_LENGTH];
+} _nvsHandle_t;
+
+/* Handle n is _handles[n - 1]: 0 is never a valid handle. */
+static _nvsHandle_t _handles[LAB_HOST_NVS_MAX_HANDLES];
+
+/*-----------------------------------------------------------*/
+
+static const char * prvRoot(void)
+{
+    const char * root = getenv("LAB_HOST_NVS_DIR");
+
+    return root != NULL ? root : "host_nvs";
+}
+
+static void prvMakeDirectory(const char * path)
+{
+    if (mkdir(path, 0700) != 0 && errno != EEXIST)
+    {
+        ESP_LOGE(TAG, "Failed to create %s: %s", path, strerror(errno));
+    }
+}
+
+static _nvsHandle_t * prvHandle(nvs_handle handle)
+{
+    if (handle == 0 || handle > LAB_HOST_NVS_MAX_HANDLES || !_handles[handle - 1].open)
+    {
+        return NULL;
+    }
+
+    return &_handles[handle - 1];
+}
+
+static esp_err_t prvKeyPath(nvs_handle handle, const char * key, char * path)
+{
+    _nvsHandle_t * pHandle = prvHandle(handle);
+
+    if (pHandle == NULL)
+    {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+
+    if (snprintf(path, NVS_PATH_MAX_LENGTH, "%s/%s", pHandle->path, key) >= NVS_PATH_MAX_LENGTH)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t prvWrite(nvs_handle handle, const char * key, const void * value, size_t length)
+{
+    char path[NVS_PATH_MAX_LENGTH];
+    char tmpPath[NVS_PATH_MAX_LENGTH + 4];
+    esp_err_t res = prvKeyPath(handle, key, path);
+    FILE * file = NULL;
+
+    if (res != ESP_OK)
+    {
+        return res;
+    }
+    if (prvHandle(handle)->readOnly)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    /* Write then rename: a key is either the old or the new value, as on flash. */
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+    file = fopen(tmpPath, "wb");
+    if (file == NULL)
+    {
+        return ESP_FAIL;
+    }
+
+    if (fwrite(value, 1, length, file) != length)
+    {
+        res = ESP_FAIL;
+    }
+    if (fclose(file) != 0)
+    {
+        res = ESP_FAIL;
+    }
+    if (res == ESP_OK && rename(tmpPath, path) != 0)
+    {
+        res = ESP_FAIL;
+    }
+
+    return res;
+}
+
+static esp_err_t prvRead(nvs_handle handle, const char * key, void * value, size_t * length)
+{
+    char path[NVS_PATH_MAX_LENGTH];
+    esp_err_t res = prvKeyPath(handle, key, path);
+    struct stat info;
+    FILE * file = NULL;
+
+    if (res != ESP_OK)
+    {
+        return res;
+    }
+    if (stat(path, &info) != 0)
+    {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+
+    if (value == NULL)
+    {
+        *length = (size_t)info.st_size;
+        return ESP_OK;
+    }
+    if (*length < (size_t)info.st_size)
+    {
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+
+    file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+
+    *length = fread(value, 1, (size_t)info.st_size, file);
+    fclose(file);
+
+    return *length == (size_t)info.st_size ? ESP_OK : ESP_FAIL;
+}
+
+/*-----------------------------------------------------------*/
+
+esp_err_t nvs_flash_init(void)
+{
+    return nvs_flash_init_partition(NVS_DEFAULT_PART_NAME);
+}
+
+esp_err_t nvs_flash_init_partition(const char * partition_label)
+{
+    char path[NVS_PATH_MAX_LENGTH];
+
+    prvMakeDirectory(prvRoot());
+    snprintf(path, sizeof(path), "%s/%s", prvRoot(), partition_label);
+    prvMakeDirectory(path);
+
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void)
+{
+    return nvs_flash_erase_partition(NVS_DEFAULT_PART_NAME);
+}
+
+esp_err_t nvs_flash_erase_partition(const char * part_name)
+{
+    char command[NVS_PATH_MAX_LENGTH + 16];
+
+    snprintf(command, sizeof(command), "rm -rf '%s/%s'", prvRoot(), part_name);
+
+    return system(command) == 0 ? ESP_OK : ESP_FAIL;
+}
+
+/*-----------------------------------------------------------*/
+
+esp_err_t nvs_open(const char * name, nvs_open_mode open_mode, nvs_handle * out_handle)
+{
+    return nvs_open_from_partition(NVS_DEFAULT_PART_NAME, name, open_mode, out_handle);
+}
+
+esp_err_t nvs_open_from_partition(const char * part_name, const char * name, nvs_open_mode open_mode, nvs_handle * out_handle)
+{
+    uint32_t i = 0;
+
+    for (i = 0; i < LAB_HOST_NVS_MAX_HANDLES; i++)
+    {
+        if (!_handles[i].open)
+        {
+            snprintf(_handles[i].path, NVS_PATH_MAX_LENGTH, "%s/%s/%s", prvRoot(), part_name, name);
+            prvMakeDirectory(_handles[i].path);
+
+            _handles[i].open = true;
+            _handles[i].readOnly = (open_mode == NVS_READONLY);
+            *out_handle = i + 1;
+            return ESP_OK;
+        }
+    }
+
+    return ESP_ERR_NO_MEM;
+}
+
+void nvs_close(nvs_handle handle)
+{
+    _nvsHandle_t * pHandle = prvHandle(handle);
+
+    if (pHandle != NULL)
+    {
+        pHandle->open = false;
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+esp_err_t nvs_set_u32(nvs_handle handle, const char * key, uint32_t value)
+{
+    return prvWrite(handle, key, &value, sizeof(value));
+}
+
+esp_err_t nvs_get_u32(nvs_handle handle, const char * key, uint32_t * out_value)
+{
+    size_t length = sizeof(uint32_t);
+
+    return prvRead(handle, key, out_value, &length);
+}
+
+esp_err_t nvs_set_blob(nvs_handle handle, const char * key, const void * value, size_t length)
+{
+    return prvWrite(handle, key, value, length);
+}
+
+esp_err_t nvs_get_blob(nvs_handle handle, const char * key, void * out_value, size_t * length)
+{
+    return prvRead(handle, key, out_value, length);
+}
+
+esp_err_t nvs_erase_key(nvs_handle handle, const char * key)
+{
+    char path[NVS_PATH_MAX_LENGTH];
+    esp_err_t res = prvKeyPath(handle, key, path);
+
+    if (res == ESP_OK && unlink(path) != 0)
+    {
+        res = ESP_ERR_NVS_NOT_FOUND;
+    }
+
+    return res;
+}
+
+esp_err_t nvs_commit(nvs_handle handle)
+{
+    return prvHandle(handle) != NULL ? ESP_OK : ESP_ERR_NVS_INVALID_HANDLE;
+}
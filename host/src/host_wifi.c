@@ -0,0 +1,24 @@
+/**
+ * @file host_wifi.c
+ * @brief Host build: no Wi-Fi networks are ever stored.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include "iot_wifi.h"
+
+WIFIReturnCode_t WIFI_NetworkGet( WIFINetworkProfile_t * pxNetwork, uint16_t usIndex )
+{
+    ( void ) pxNetwork;
+    ( void ) usIndex;
+
+    return eWiFiFailure;
+}
+
+WIFIReturnCode_t WIFI_NetworkDelete( uint16_t usIndex )
+{
+    ( void ) usIndex;
+
+    return eWiFiFailure;
+}
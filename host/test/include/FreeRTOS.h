@@ -0,0 +1,41 @@
+/**
+ * @file FreeRTOS.h
+ * @brief Host tests: the FreeRTOS types and macros the workshop uses, without
+ * the kernel. The functions are declared in task.h, queue.h and semphr.h;
+ * each test links the implementation it needs: lab_test_freertos.c runs the
+ * tasks as threads, or the test simulates them itself.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#ifndef INC_FREERTOS_H
+#define INC_FREERTOS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+typedef uint32_t TickType_t;
+typedef uint8_t StackType_t;
+
+#define pdFALSE                     ( ( BaseType_t ) 0 )
+#define pdTRUE                      ( ( BaseType_t ) 1 )
+#define pdPASS                      ( pdTRUE )
+#define pdFAIL                      ( pdFALSE )
+
+#define portMAX_DELAY               ( ( TickType_t ) 0xffffffffUL )
+#define configTICK_RATE_HZ          ( 1000 )
+#define portTICK_PERIOD_MS          ( ( TickType_t ) 1000 / configTICK_RATE_HZ )
+#define pdMS_TO_TICKS( xTimeInMs )  ( ( TickType_t ) ( ( ( TickType_t ) ( xTimeInMs ) * ( TickType_t ) configTICK_RATE_HZ ) / ( TickType_t ) 1000 ) )
+
+#define configMINIMAL_STACK_SIZE    ( ( unsigned short ) 768 )
+#define configMAX_PRIORITIES        ( 25 )
+#define tskIDLE_PRIORITY            ( ( UBaseType_t ) 0U )
+
+#define configASSERT( x )           do { if( !( x ) ) { abort(); } } while( 0 )
+#define portYIELD_FROM_ISR()
+
+#endif /* ifndef INC_FREERTOS_H */
@@ -0,0 +1,55 @@
+/**
+ * @file gpio.h
+ * @brief Host tests: the GPIO driver calls of the button driver. The test
+ * provides them, with the levels and the interrupts of its scenario.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#ifndef _HOST_DRIVER_GPIO_H_
+#define _HOST_DRIVER_GPIO_H_
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#define IRAM_ATTR
+
+typedef enum
+{
+    GPIO_NUM_0 = 0,
+    GPIO_NUM_4 = 4,
+    GPIO_NUM_37 = 37,
+    GPIO_NUM_39 = 39,
+    GPIO_NUM_MAX = 40
+} gpio_num_t;
+
+typedef enum
+{
+    GPIO_MODE_INPUT = 1,
+} gpio_mode_t;
+
+typedef enum
+{
+    GPIO_INTR_DISABLE = 0,
+    GPIO_INTR_ANYEDGE = 3,
+} gpio_int_type_t;
+
+typedef void (* gpio_isr_t)( void * );
+
+esp_err_t gpio_install_isr_service(int intr_alloc_flags);
+
+esp_err_t gpio_isr_handler_add(gpio_num_t gpio_num, gpio_isr_t isr_handler, void * args);
+
+esp_err_t gpio_isr_handler_remove(gpio_num_t gpio_num);
+
+void gpio_pad_select_gpio(uint8_t gpio_num);
+
+esp_err_t gpio_set_direction(gpio_num_t gpio_num, gpio_mode_t mode);
+
+esp_err_t gpio_set_intr_type(gpio_num_t gpio_num, gpio_int_type_t intr_type);
+
+int gpio_get_level(gpio_num_t gpio_num);
+
+#endif /* ifndef _HOST_DRIVER_GPIO_H_ */
@@ -0,0 +1,47 @@
+/**
+ * @file esp_timer.h
+ * @brief Host tests: microsecond clock and one-shot timers. The clock comes
+ * from the host build unless the test simulates time, in which case the test
+ * provides the clock and the timers.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#ifndef _HOST_ESP_TIMER_H_
+#define _HOST_ESP_TIMER_H_
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+typedef struct esp_timer * esp_timer_handle_t;
+typedef void (* esp_timer_cb_t)( void * arg );
+
+typedef enum
+{
+    ESP_TIMER_TASK,
+} esp_timer_dispatch_t;
+
+typedef struct
+{
+    esp_timer_cb_t callback;
+    void * arg;
+    esp_timer_dispatch_t dispatch_method;
+    const char * name;
+} esp_timer_create_args_t;
+
+/**
+ * @brief   Microseconds since the test started.
+ */
+int64_t esp_timer_get_time(void);
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t * create_args, esp_timer_handle_t * out_handle);
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us);
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer);
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer);
+
+#endif /* ifndef _HOST_ESP_TIMER_H_ */
@@ -0,0 +1,9 @@
+/**
+ * @file FreeRTOS.h
+ * @brief Host tests: ESP-IDF include path of the FreeRTOS stand-in.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include "../FreeRTOS.h"
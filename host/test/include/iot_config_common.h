@@ -0,0 +1,13 @@
+/**
+ * @file iot_config_common.h
+ * @brief Host tests: stands in for the common configuration of the Amazon
+ * FreeRTOS libraries, which the modules under test do not use.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#ifndef _TEST_IOT_CONFIG_COMMON_H_
+#define _TEST_IOT_CONFIG_COMMON_H_
+
+#endif /* ifndef _TEST_IOT_CONFIG_COMMON_H_ */
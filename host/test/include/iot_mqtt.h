@@ -0,0 +1,37 @@
+/**
+ * @file iot_mqtt.h
+ * @brief Host tests: the publish description of the Amazon FreeRTOS MQTT
+ * library, without the library.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#ifndef _TEST_IOT_MQTT_H_
+#define _TEST_IOT_MQTT_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum IotMqttQos
+{
+    IOT_MQTT_QOS_0 = 0,
+    IOT_MQTT_QOS_1 = 1
+} IotMqttQos_t;
+
+typedef struct IotMqttPublishInfo
+{
+    IotMqttQos_t qos;
+    bool retain;
+    const char * pTopicName;
+    uint16_t topicNameLength;
+    const void * pPayload;
+    size_t payloadLength;
+    uint32_t retryMs;
+    uint32_t retryLimit;
+} IotMqttPublishInfo_t;
+
+#define IOT_MQTT_PUBLISH_INFO_INITIALIZER   { .qos = IOT_MQTT_QOS_0 }
+
+#endif /* ifndef _TEST_IOT_MQTT_H_ */
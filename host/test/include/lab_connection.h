@@ -0,0 +1,22 @@
+/**
+ * @file lab_connection.h
+ * @brief Host tests: the publish buffer size of lab_connection, without the
+ * connection and its libraries. The modules tested with it are built with
+ * their publishing disabled.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#ifndef _TEST_LAB_CONNECTION_H_
+#define _TEST_LAB_CONNECTION_H_
+
+#include "esp_err.h"
+
+#include "lab_payload.h"
+
+#ifndef LAB_CONNECTION_POOL_PAYLOAD_LENGTH
+    #define LAB_CONNECTION_POOL_PAYLOAD_LENGTH          ( 256 )
+#endif
+
+#endif /* ifndef _TEST_LAB_CONNECTION_H_ */
@@ -0,0 +1,77 @@
+/**
+ * @file lab_test.h
+ * @brief Host tests: checks that count failures instead of stopping at the
+ * first one, and a scratch directory for the tests that persist data.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#ifndef _LAB_TEST_H_
+#define _LAB_TEST_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int _labTestFailures = 0;
+
+/**
+ * @brief Check a condition, logging it with its location when it fails.
+ */
+#define LAB_TEST_CHECK(condition)                                                   \
+    do {                                                                            \
+        if (!(condition))                                                           \
+        {                                                                           \
+            printf("FAILED %s:%d: %s\n", __FILE__, __LINE__, #condition);           \
+            _labTestFailures++;                                                     \
+        }                                                                           \
+    } while (0)
+
+/**
+ * @brief Check two integers are equal, logging both when they are not.
+ */
+#define LAB_TEST_CHECK_EQUAL(expected, actual)                                      \
+    do {                                                                            \
+        long long _expected = (long long)(expected);                                \
+        long long _actual = (long long)(actual);                                    \
+        if (_expected != _actual)                                                   \
+        {                                                                           \
+            printf("FAILED %s:%d: %s == %s, %lld != %lld\n", __FILE__, __LINE__,    \
+                   #expected, #actual, _expected, _actual);                         \
+            _labTestFailures++;                                                     \
+        }                                                                           \
+    } while (0)
+
+/**
+ * @brief Run a test function, named in the log.
+ */
+#define LAB_TEST_RUN(test)                                                          \
+    do {                                                                            \
+        int _before = _labTestFailures;                                             \
+        printf("RUN    %s\n", #test);                                               \
+        test();                                                                     \
+        printf("%s %s\n", _labTestFailures == _before ? "OK    " : "FAILED", #test); \
+    } while (0)
+
+/**
+ * @brief Exit status of the test executable.
+ */
+static inline int iLabTestResult(void)
+{
+    printf("%d check(s) failed\n", _labTestFailures);
+    return _labTestFailures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ * @brief Point LAB_HOST_NVS_DIR at a new scratch directory, for the host NVS.
+ */
+static inline bool bLabTestNvsDirectory(void)
+{
+    static char directory[] = "/tmp/lab_test_nvs_XXXXXX";
+
+    return mkdtemp(directory) != NULL && setenv("LAB_HOST_NVS_DIR", directory, 1) == 0;
+}
+
+#endif /* ifndef _LAB_TEST_H_ */
@@ -0,0 +1,55 @@
+/**
+ * @file lab_test_sim.h
+ * @brief Host tests: FreeRTOS tasks in simulated time.
+ *
+ * Each task created with xTaskCreate is a thread, but only one thread runs at
+ * a time: a task runs until it blocks, then the test thread moves the clock
+ * to the next deadline or scheduled action. Time only passes while all tasks
+ * are blocked, so runs are deterministic and as fast as the code under test.
+ *
+ * The test thread starts the simulation with vLabTestSimRunUntil and has it
+ * to itself when that returns, all tasks blocked.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#ifndef _LAB_TEST_SIM_H_
+#define _LAB_TEST_SIM_H_
+
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "esp_timer.h"
+
+/**
+ * @brief Tasks and scheduled actions of one test executable.
+ */
+#ifndef LAB_TEST_SIM_MAX_TASKS
+    #define LAB_TEST_SIM_MAX_TASKS      ( 8 )
+#endif
+
+#ifndef LAB_TEST_SIM_MAX_ACTIONS
+    #define LAB_TEST_SIM_MAX_ACTIONS    ( 32 )
+#endif
+
+/**
+ * @brief   Call pAction(pArg) from the test thread when the clock reaches
+ *          timeUs, as an interrupt or an outside event would.
+ */
+void vLabTestSimAt(int64_t timeUs, void (*pAction)(void *), void *pArg);
+
+/**
+ * @brief   Run the tasks until the clock reaches timeUs and they are all
+ *          blocked.
+ */
+void vLabTestSimRunUntil(int64_t timeUs);
+
+/**
+ * @brief   Run the tasks for durationUs from now.
+ */
+void vLabTestSimRunFor(int64_t durationUs);
+
+#endif /* ifndef _LAB_TEST_SIM_H_ */
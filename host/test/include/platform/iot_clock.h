@@ -0,0 +1,22 @@
+/**
+ * @file iot_clock.h
+ * @brief Host tests: the clock of the Amazon FreeRTOS platform layer, on
+ * esp_timer_get_time so that tests simulating time drive it too.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#ifndef _TEST_IOT_CLOCK_H_
+#define _TEST_IOT_CLOCK_H_
+
+#include <stdint.h>
+
+#include "esp_timer.h"
+
+static inline uint64_t IotClock_GetTimeMs(void)
+{
+    return (uint64_t)(esp_timer_get_time() / 1000);
+}
+
+#endif /* ifndef _TEST_IOT_CLOCK_H_ */
@@ -0,0 +1,46 @@
+/**
+ * @file iot_threads.h
+ * @brief Host tests: the mutexes of the Amazon FreeRTOS platform layer, on
+ * pthreads.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#ifndef _TEST_IOT_THREADS_H_
+#define _TEST_IOT_THREADS_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+
+typedef pthread_mutex_t IotMutex_t;
+
+static inline bool IotMutex_Create(IotMutex_t * pNewMutex, bool recursive)
+{
+    pthread_mutexattr_t attributes;
+    bool created = false;
+
+    pthread_mutexattr_init(&attributes);
+    pthread_mutexattr_settype(&attributes, recursive ? PTHREAD_MUTEX_RECURSIVE : PTHREAD_MUTEX_NORMAL);
+    created = pthread_mutex_init(pNewMutex, &attributes) == 0;
+    pthread_mutexattr_destroy(&attributes);
+
+    return created;
+}
+
+static inline void IotMutex_Destroy(IotMutex_t * pMutex)
+{
+    pthread_mutex_destroy(pMutex);
+}
+
+static inline void IotMutex_Lock(IotMutex_t * pMutex)
+{
+    pthread_mutex_lock(pMutex);
+}
+
+static inline void IotMutex_Unlock(IotMutex_t * pMutex)
+{
+    pthread_mutex_unlock(pMutex);
+}
+
+#endif /* ifndef _TEST_IOT_THREADS_H_ */
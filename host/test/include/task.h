@@ -0,0 +1,71 @@
+/**
+ * @file task.h
+ * @brief Host tests: FreeRTOS tasks and direct-to-task notifications.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#ifndef INC_TASK_H
+#define INC_TASK_H
+
+#include "FreeRTOS.h"
+
+typedef struct tskTaskControlBlock * TaskHandle_t;
+typedef void (* TaskFunction_t)( void * );
+
+typedef struct
+{
+    uint8_t unused;
+} StaticTask_t;
+
+typedef enum
+{
+    eNoAction = 0,
+    eSetBits,
+    eIncrement,
+    eSetValueWithOverwrite,
+    eSetValueWithoutOverwrite
+} eNotifyAction;
+
+BaseType_t xTaskCreate( TaskFunction_t pxTaskCode,
+                        const char * const pcName,
+                        const uint32_t usStackDepth,
+                        void * const pvParameters,
+                        UBaseType_t uxPriority,
+                        TaskHandle_t * const pxCreatedTask );
+
+void vTaskDelete( TaskHandle_t xTaskToDelete );
+
+void vTaskDelay( const TickType_t xTicksToDelay );
+
+void vTaskDelayUntil( TickType_t * const pxPreviousWakeTime,
+                      const TickType_t xTimeIncrement );
+
+TickType_t xTaskGetTickCount( void );
+
+TaskHandle_t xTaskGetCurrentTaskHandle( void );
+
+BaseType_t xTaskNotify( TaskHandle_t xTaskToNotify,
+                        uint32_t ulValue,
+                        eNotifyAction eAction );
+
+BaseType_t xTaskNotifyFromISR( TaskHandle_t xTaskToNotify,
+                               uint32_t ulValue,
+                               eNotifyAction eAction,
+                               BaseType_t * pxHigherPriorityTaskWoken );
+
+BaseType_t xTaskNotifyWait( uint32_t ulBitsToClearOnEntry,
+                            uint32_t ulBitsToClearOnExit,
+                            uint32_t * pulNotificationValue,
+                            TickType_t xTicksToWait );
+
+#define xTaskNotifyGive( xTaskToNotify )    xTaskNotify( ( xTaskToNotify ), 0, eIncrement )
+
+void vTaskNotifyGiveFromISR( TaskHandle_t xTaskToNotify,
+                             BaseType_t * pxHigherPriorityTaskWoken );
+
+uint32_t ulTaskNotifyTake( BaseType_t xClearCountOnExit,
+                           TickType_t xTicksToWait );
+
+#endif /* ifndef INC_TASK_H */
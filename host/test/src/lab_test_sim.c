@@ -0,0 +1,456 @@
+/**
+ * @file lab_test_sim.c
+ * @brief Host tests: FreeRTOS tasks in simulated time, see lab_test_sim.h.
+ *
+ * The threads hand the processor to each other under _sim.lock: _sim.pCurrent
+ * is the task allowed to run, NULL for the test thread.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "lab_test_sim.h"
+
+#define LAB_TEST_SIM_NEVER      INT64_MAX
+
+struct tskTaskControlBlock
+{
+    pthread_t thread;
+    pthread_cond_t cond;
+    TaskFunction_t pCode;
+    void * pParameters;
+    bool ready;                 /* Runs at the next switch */
+    bool deleted;
+    bool waitingNotification;
+    int64_t wakeUs;             /* End of the current block, LAB_TEST_SIM_NEVER for none */
+    uint32_t notificationValue;
+    bool notificationPending;
+};
+
+typedef struct
+{
+    int64_t timeUs;
+    void (*pAction)(void *);
+    void * pArg;
+} _action_t;
+
+static struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;        /* The test thread's */
+    TaskHandle_t pCurrent;
+    int64_t nowUs;
+    struct tskTaskControlBlock tasks[LAB_TEST_SIM_MAX_TASKS];
+    uint32_t taskCount;
+    _action_t actions[LAB_TEST_SIM_MAX_ACTIONS];
+    uint32_t actionCount;
+} _sim = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Hand the processor back to the test thread until the task is ready
+ * and scheduled again. Called with the lock held, by the current task.
+ */
+static void _block(TaskHandle_t pTask, int64_t wakeUs)
+{
+    pTask->wakeUs = wakeUs;
+    _sim.pCurrent = NULL;
+    pthread_cond_signal(&_sim.cond);
+
+    while (_sim.pCurrent != pTask)
+    {
+        pthread_cond_wait(&pTask->cond, &_sim.lock);
+    }
+}
+
+static void _ready(TaskHandle_t pTask)
+{
+    pTask->wakeUs = LAB_TEST_SIM_NEVER;
+    pTask->ready = true;
+}
+
+static void * _taskThread(void * pArgument)
+{
+    TaskHandle_t pTask = (TaskHandle_t)pArgument;
+
+    pthread_mutex_lock(&_sim.lock);
+    while (_sim.pCurrent != pTask)
+    {
+        pthread_cond_wait(&pTask->cond, &_sim.lock);
+    }
+    pthread_mutex_unlock(&_sim.lock);
+
+    pTask->pCode(pTask->pParameters);
+
+    /* Tasks do not return, but in case. */
+    vTaskDelete(NULL);
+
+    return NULL;
+}
+
+/*-----------------------------------------------------------*/
+
+int64_t esp_timer_get_time(void)
+{
+    /* Only the running thread reads it, and the handover orders it. */
+    return _sim.nowUs;
+}
+
+/*-----------------------------------------------------------*/
+
+void vLabTestSimAt(int64_t timeUs, void (*pAction)(void *), void *pArg)
+{
+    configASSERT(_sim.actionCount < LAB_TEST_SIM_MAX_ACTIONS);
+
+    pthread_mutex_lock(&_sim.lock);
+    _sim.actions[_sim.actionCount++] = (_action_t) { timeUs, pAction, pArg };
+    pthread_mutex_unlock(&_sim.lock);
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Run the ready tasks one after the other until all are blocked.
+ */
+static void _runReadyTasks(void)
+{
+    TaskHandle_t pTask = NULL;
+    uint32_t i = 0;
+
+    do
+    {
+        pTask = NULL;
+        for (i = 0; i < _sim.taskCount && pTask == NULL; i++)
+        {
+            if (_sim.tasks[i].ready && !_sim.tasks[i].deleted)
+            {
+                pTask = &_sim.tasks[i];
+            }
+        }
+
+        if (pTask != NULL)
+        {
+            pTask->ready = false;
+            _sim.pCurrent = pTask;
+            pthread_cond_signal(&pTask->cond);
+
+            while (_sim.pCurrent != NULL)
+            {
+                pthread_cond_wait(&_sim.cond, &_sim.lock);
+            }
+        }
+    } while (pTask != NULL);
+}
+
+void vLabTestSimRunUntil(int64_t timeUs)
+{
+    int64_t nextUs = 0;
+    uint32_t i = 0;
+
+    pthread_mutex_lock(&_sim.lock);
+
+    for (;;)
+    {
+        _runReadyTasks();
+
+        /* Next deadline of a task or an action. */
+        nextUs = LAB_TEST_SIM_NEVER;
+        for (i = 0; i < _sim.taskCount; i++)
+        {
+            if (!_sim.tasks[i].deleted && _sim.tasks[i].wakeUs < nextUs)
+            {
+                nextUs = _sim.tasks[i].wakeUs;
+            }
+        }
+        for (i = 0; i < _sim.actionCount; i++)
+        {
+            if (_sim.actions[i].timeUs < nextUs)
+            {
+                nextUs = _sim.actions[i].timeUs;
+            }
+        }
+
+        if (nextUs > timeUs)
+        {
+            break;
+        }
+
+        if (nextUs > _sim.nowUs)
+        {
+            _sim.nowUs = nextUs;
+        }
+
+        /* Actions first, in the order they were scheduled: the tasks they wake
+         * run after, as from an interrupt. */
+        for (i = 0; i < _sim.actionCount; )
+        {
+            if (_sim.actions[i].timeUs <= _sim.nowUs)
+            {
+                _action_t action = _sim.actions[i];
+
+                memmove(&_sim.actions[i], &_sim.actions[i + 1], (_sim.actionCount - i - 1) * sizeof(_action_t));
+                _sim.actionCount--;
+
+                pthread_mutex_unlock(&_sim.lock);
+                action.pAction(action.pArg);
+                pthread_mutex_lock(&_sim.lock);
+            }
+            else
+            {
+                i++;
+            }
+        }
+
+        for (i = 0; i < _sim.taskCount; i++)
+        {
+            if (!_sim.tasks[i].deleted && _sim.tasks[i].wakeUs <= _sim.nowUs)
+            {
+                _ready(&_sim.tasks[i]);
+            }
+        }
+    }
+
+    if (timeUs > _sim.nowUs)
+    {
+        _sim.nowUs = timeUs;
+    }
+
+    pthread_mutex_unlock(&_sim.lock);
+}
+
+void vLabTestSimRunFor(int64_t durationUs)
+{
+    vLabTestSimRunUntil(_sim.nowUs + durationUs);
+}
+
+/*-----------------------------------------------------------*/
+
+BaseType_t xTaskCreate(TaskFunction_t pxTaskCode, const char * const pcName, const uint32_t usStackDepth,
+                       void * const pvParameters, UBaseType_t uxPriority, TaskHandle_t * const pxCreatedTask)
+{
+    TaskHandle_t pTask = NULL;
+
+    pthread_mutex_lock(&_sim.lock);
+
+    if (_sim.taskCount < LAB_TEST_SIM_MAX_TASKS)
+    {
+        pTask = &_sim.tasks[_sim.taskCount++];
+        pTask->pCode = pxTaskCode;
+        pTask->pParameters = pvParameters;
+        pthread_cond_init(&pTask->cond, NULL);
+        _ready(pTask);
+
+        if (pthread_create(&pTask->thread, NULL, _taskThread, pTask) != 0)
+        {
+            _sim.taskCount--;
+            pTask = NULL;
+        }
+    }
+
+    pthread_mutex_unlock(&_sim.lock);
+
+    if (pxCreatedTask != NULL)
+    {
+        *pxCreatedTask = pTask;
+    }
+
+    return pTask != NULL ? pdPASS : pdFAIL;
+}
+
+void vTaskDelete(TaskHandle_t xTaskToDelete)
+{
+    TaskHandle_t pTask = xTaskToDelete != NULL ? xTaskToDelete : _sim.pCurrent;
+
+    pthread_mutex_lock(&_sim.lock);
+    pTask->deleted = true;
+
+    if (pTask == _sim.pCurrent)
+    {
+        _sim.pCurrent = NULL;
+        pthread_cond_signal(&_sim.cond);
+        pthread_mutex_unlock(&_sim.lock);
+        pthread_exit(NULL);
+    }
+
+    pthread_mutex_unlock(&_sim.lock);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return _sim.pCurrent;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return (TickType_t)(_sim.nowUs / (1000 * portTICK_PERIOD_MS));
+}
+
+void vTaskDelay(const TickType_t xTicksToDelay)
+{
+    pthread_mutex_lock(&_sim.lock);
+
+    /* A zero delay yields: the others ready run first. */
+    if (xTicksToDelay == 0)
+    {
+        _sim.pCurrent->ready = true;
+    }
+    _block(_sim.pCurrent, xTicksToDelay == 0 ? LAB_TEST_SIM_NEVER :
+           _sim.nowUs + (int64_t)xTicksToDelay * 1000 * portTICK_PERIOD_MS);
+
+    pthread_mutex_unlock(&_sim.lock);
+}
+
+void vTaskDelayUntil(TickType_t * const pxPreviousWakeTime, const TickType_t xTimeIncrement)
+{
+    int64_t wakeUs = 0;
+
+    *pxPreviousWakeTime += xTimeIncrement;
+    wakeUs = (int64_t)*pxPreviousWakeTime * 1000 * portTICK_PERIOD_MS;
+
+    pthread_mutex_lock(&_sim.lock);
+
+    if (wakeUs <= _sim.nowUs)
+    {
+        _sim.pCurrent->ready = true;
+        wakeUs = LAB_TEST_SIM_NEVER;
+    }
+    _block(_sim.pCurrent, wakeUs);
+
+    pthread_mutex_unlock(&_sim.lock);
+}
+
+/*-----------------------------------------------------------*/
+
+BaseType_t xTaskNotify(TaskHandle_t xTaskToNotify, uint32_t ulValue, eNotifyAction eAction)
+{
+    BaseType_t result = pdPASS;
+
+    pthread_mutex_lock(&_sim.lock);
+
+    switch (eAction)
+    {
+        case eSetBits: xTaskToNotify->notificationValue |= ulValue; break;
+        case eIncrement: xTaskToNotify->notificationValue++; break;
+        case eSetValueWithOverwrite: xTaskToNotify->notificationValue = ulValue; break;
+        case eSetValueWithoutOverwrite:
+            if (xTaskToNotify->notificationPending)
+            {
+                result = pdFAIL;
+            }
+            else
+            {
+                xTaskToNotify->notificationValue = ulValue;
+            }
+            break;
+        default: break;
+    }
+    xTaskToNotify->notificationPending = true;
+
+    if (xTaskToNotify->waitingNotification)
+    {
+        xTaskToNotify->waitingNotification = false;
+        _ready(xTaskToNotify);
+    }
+
+    pthread_mutex_unlock(&_sim.lock);
+
+    return result;
+}
+
+BaseType_t xTaskNotifyFromISR(TaskHandle_t xTaskToNotify, uint32_t ulValue, eNotifyAction eAction,
+                              BaseType_t * pxHigherPriorityTaskWoken)
+{
+    if (pxHigherPriorityTaskWoken != NULL)
+    {
+        *pxHigherPriorityTaskWoken = pdTRUE;
+    }
+
+    return xTaskNotify(xTaskToNotify, ulValue, eAction);
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t xTaskToNotify, BaseType_t * pxHigherPriorityTaskWoken)
+{
+    xTaskNotifyFromISR(xTaskToNotify, 0, eIncrement, pxHigherPriorityTaskWoken);
+}
+
+/**
+ * @brief Block the current task until notified or the ticks elapsed.
+ * Called with the lock held.
+ */
+static void _waitNotification(TickType_t xTicksToWait)
+{
+    TaskHandle_t pTask = _sim.pCurrent;
+
+    if (xTicksToWait == 0)
+    {
+        return;
+    }
+
+    pTask->waitingNotification = true;
+    _block(pTask, xTicksToWait == portMAX_DELAY ? LAB_TEST_SIM_NEVER :
+           _sim.nowUs + (int64_t)xTicksToWait * 1000 * portTICK_PERIOD_MS);
+    pTask->waitingNotification = false;
+}
+
+BaseType_t xTaskNotifyWait(uint32_t ulBitsToClearOnEntry, uint32_t ulBitsToClearOnExit,
+                           uint32_t * pulNotificationValue, TickType_t xTicksToWait)
+{
+    TaskHandle_t pTask = NULL;
+    BaseType_t result = pdFALSE;
+
+    pthread_mutex_lock(&_sim.lock);
+    pTask = _sim.pCurrent;
+
+    if (!pTask->notificationPending)
+    {
+        pTask->notificationValue &= ~ulBitsToClearOnEntry;
+        _waitNotification(xTicksToWait);
+    }
+
+    if (pulNotificationValue != NULL)
+    {
+        *pulNotificationValue = pTask->notificationValue;
+    }
+
+    if (pTask->notificationPending)
+    {
+        pTask->notificationValue &= ~ulBitsToClearOnExit;
+        pTask->notificationPending = false;
+        result = pdTRUE;
+    }
+
+    pthread_mutex_unlock(&_sim.lock);
+
+    return result;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t xClearCountOnExit, TickType_t xTicksToWait)
+{
+    TaskHandle_t pTask = NULL;
+    uint32_t value = 0;
+
+    pthread_mutex_lock(&_sim.lock);
+    pTask = _sim.pCurrent;
+
+    if (pTask->notificationValue == 0)
+    {
+        _waitNotification(xTicksToWait);
+    }
+
+    value = pTask->notificationValue;
+    if (value != 0)
+    {
+        pTask->notificationValue = xClearCountOnExit ? 0 : value - 1;
+    }
+    pTask->notificationPending = false;
+
+    pthread_mutex_unlock(&_sim.lock);
+
+    return value;
+}
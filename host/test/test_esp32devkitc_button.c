@@ -0,0 +1,484 @@
+/**
+ * @file test_esp32devkitc_button.c
+ * @brief Host tests of the DevKitC button driver, in simulated time.
+ *
+ * The test plays the GPIOs, the esp_timers and the scheduler: the button task
+ * runs in the test thread, and each time it waits for a notification the
+ * simulation moves the clock to the next edge of the scenario or the next
+ * timer, and calls the ISR or the timer callback. A scenario ends when there
+ * is neither left. The times of the events are then exact.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include <setjmp.h>
+
+#include "lab_test.h"
+
+#include "esp32devkitc_button.h"
+
+#define TEST_MAX_TIMERS     ( ESP32DEVKITC_BUTTON_MAX_BUTTONS )
+#define TEST_MAX_EVENTS     16
+
+/**
+ * @brief An edge of the scenario, in microseconds from its start.
+ */
+typedef struct
+{
+    int64_t timeUs;
+    gpio_num_t gpio;
+    int level;
+} _edge_t;
+
+#define PRESS(timeUs)       { (timeUs), GPIO_NUM_0, 0 }
+#define RELEASE(timeUs)     { (timeUs), GPIO_NUM_0, 1 }
+#define PRESS_4(timeUs)     { (timeUs), GPIO_NUM_4, 0 }
+#define RELEASE_4(timeUs)   { (timeUs), GPIO_NUM_4, 1 }
+
+typedef struct
+{
+    int64_t timeUs;
+    esp_event_base_t base;
+    int32_t id;
+    esp32devkitc_button_event_t data;
+} _event_t;
+
+struct esp_timer
+{
+    bool created;
+    bool armed;
+    int64_t deadlineUs;
+    esp_timer_cb_t callback;
+    void * arg;
+};
+
+static struct
+{
+    int64_t nowUs;
+    int levels[GPIO_NUM_MAX];
+    gpio_isr_t handlers[GPIO_NUM_MAX];
+    void * handlerArgs[GPIO_NUM_MAX];
+    struct esp_timer timers[TEST_MAX_TIMERS];
+    uint32_t notification;
+
+    /* Time the task takes to run after it is notified. */
+    int64_t taskLatencyUs;
+
+    const _edge_t * pEdges;
+    size_t edges;
+    size_t nextEdge;
+    int64_t startUs;
+    jmp_buf end;
+
+    _event_t events[TEST_MAX_EVENTS];
+    size_t eventCount;
+} _sim;
+
+esp_event_loop_handle_t esp32devkitc_event_loop = NULL;
+
+ESP_EVENT_DEFINE_BASE(TEST_BUTTON_4_EVENT_BASE);
+
+/*-----------------------------------------------------------*/
+
+int64_t esp_timer_get_time(void)
+{
+    return _sim.nowUs;
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t * create_args, esp_timer_handle_t * out_handle)
+{
+    size_t i = 0;
+
+    for (i = 0; i < TEST_MAX_TIMERS; i++)
+    {
+        if (!_sim.timers[i].created)
+        {
+            _sim.timers[i] = (struct esp_timer) { true, false, 0, create_args->callback, create_args->arg };
+            *out_handle = &_sim.timers[i];
+            return ESP_OK;
+        }
+    }
+
+    return ESP_ERR_NO_MEM;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+    if (timer->armed)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    timer->armed = true;
+    timer->deadlineUs = _sim.nowUs + (int64_t)timeout_us;
+
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+    bool armed = timer->armed;
+
+    timer->armed = false;
+
+    return armed ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer)
+{
+    timer->created = false;
+    timer->armed = false;
+
+    return ESP_OK;
+}
+
+/*-----------------------------------------------------------*/
+
+esp_err_t gpio_install_isr_service(int intr_alloc_flags)
+{
+    return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_add(gpio_num_t gpio_num, gpio_isr_t isr_handler, void * args)
+{
+    _sim.handlers[gpio_num] = isr_handler;
+    _sim.handlerArgs[gpio_num] = args;
+
+    return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_remove(gpio_num_t gpio_num)
+{
+    _sim.handlers[gpio_num] = NULL;
+
+    return ESP_OK;
+}
+
+void gpio_pad_select_gpio(uint8_t gpio_num)
+{
+}
+
+esp_err_t gpio_set_direction(gpio_num_t gpio_num, gpio_mode_t mode)
+{
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_intr_type(gpio_num_t gpio_num, gpio_int_type_t intr_type)
+{
+    return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t gpio_num)
+{
+    return _sim.levels[gpio_num];
+}
+
+/*-----------------------------------------------------------*/
+
+esp_err_t esp_event_post_to(esp_event_loop_handle_t event_loop, esp_event_base_t event_base, int32_t event_id,
+                            void * event_data, size_t event_data_size, TickType_t ticks_to_wait)
+{
+    _event_t * pEvent = NULL;
+
+    LAB_TEST_CHECK_EQUAL(sizeof(esp32devkitc_button_event_t), event_data_size);
+    LAB_TEST_CHECK(_sim.eventCount < TEST_MAX_EVENTS);
+
+    if (_sim.eventCount < TEST_MAX_EVENTS)
+    {
+        pEvent = &_sim.events[_sim.eventCount++];
+        pEvent->timeUs = _sim.nowUs - _sim.startUs;
+        pEvent->base = event_base;
+        pEvent->id = event_id;
+        memcpy(&pEvent->data, event_data, sizeof(pEvent->data));
+    }
+
+    return ESP_OK;
+}
+
+/*-----------------------------------------------------------*/
+
+BaseType_t xTaskCreate(TaskFunction_t pxTaskCode, const char * const pcName, const uint32_t usStackDepth,
+                       void * const pvParameters, UBaseType_t uxPriority, TaskHandle_t * const pxCreatedTask)
+{
+    /* The task runs in the test thread, see _run. */
+    *pxCreatedTask = (TaskHandle_t)&_sim;
+
+    return pdPASS;
+}
+
+BaseType_t xTaskNotify(TaskHandle_t xTaskToNotify, uint32_t ulValue, eNotifyAction eAction)
+{
+    _sim.notification |= ulValue;
+
+    return pdPASS;
+}
+
+BaseType_t xTaskNotifyFromISR(TaskHandle_t xTaskToNotify, uint32_t ulValue, eNotifyAction eAction,
+                              BaseType_t * pxHigherPriorityTaskWoken)
+{
+    *pxHigherPriorityTaskWoken = pdTRUE;
+
+    return xTaskNotify(xTaskToNotify, ulValue, eAction);
+}
+
+/**
+ * @brief Move the clock to the next edge or timer deadline, and run it.
+ * Ends the scenario when there is none.
+ */
+static void _advance(void)
+{
+    struct esp_timer * pTimer = NULL;
+    int64_t edgeUs = INT64_MAX;
+    int64_t taskUs = 0;
+    size_t i = 0;
+
+    if (_sim.nextEdge < _sim.edges)
+    {
+        edgeUs = _sim.startUs + _sim.pEdges[_sim.nextEdge].timeUs;
+    }
+
+    for (i = 0; i < TEST_MAX_TIMERS; i++)
+    {
+        if (_sim.timers[i].armed && (pTimer == NULL || _sim.timers[i].deadlineUs < pTimer->deadlineUs))
+        {
+            pTimer = &_sim.timers[i];
+        }
+    }
+
+    if (pTimer != NULL && pTimer->deadlineUs < edgeUs)
+    {
+        _sim.nowUs = pTimer->deadlineUs;
+        pTimer->armed = false;
+        pTimer->callback(pTimer->arg);
+    }
+    else if (edgeUs != INT64_MAX)
+    {
+        /* The edges until the task runs all reach the ISR first. */
+        taskUs = edgeUs + _sim.taskLatencyUs;
+        while (_sim.nextEdge < _sim.edges && _sim.startUs + _sim.pEdges[_sim.nextEdge].timeUs <= taskUs)
+        {
+            const _edge_t * pEdge = &_sim.pEdges[_sim.nextEdge++];
+
+            _sim.nowUs = _sim.startUs + pEdge->timeUs;
+            _sim.levels[pEdge->gpio] = pEdge->level;
+            if (_sim.handlers[pEdge->gpio] != NULL)
+            {
+                _sim.handlers[pEdge->gpio](_sim.handlerArgs[pEdge->gpio]);
+            }
+        }
+        _sim.nowUs = taskUs;
+    }
+    else
+    {
+        longjmp(_sim.end, 1);
+    }
+}
+
+BaseType_t xTaskNotifyWait(uint32_t ulBitsToClearOnEntry, uint32_t ulBitsToClearOnExit,
+                           uint32_t * pulNotificationValue, TickType_t xTicksToWait)
+{
+    while (_sim.notification == 0)
+    {
+        _advance();
+    }
+
+    *pulNotificationValue = _sim.notification;
+    _sim.notification = 0;
+
+    return pdTRUE;
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Play a scenario, starting on the next second, until the button task
+ * has nothing left to do.
+ */
+static void _run(const _edge_t * pEdges, size_t edges)
+{
+    _sim.startUs = (_sim.nowUs / 1000000 + 1) * 1000000;
+    _sim.pEdges = pEdges;
+    _sim.edges = edges;
+    _sim.nextEdge = 0;
+    _sim.eventCount = 0;
+
+    if (setjmp(_sim.end) == 0)
+    {
+        vESP32DevkitcButtonTask(NULL);
+    }
+}
+
+#define TEST_RUN_SCENARIO(edges) _run((edges), sizeof(edges) / sizeof((edges)[0]))
+
+static void _checkEvent(size_t index, int64_t timeUs, int32_t id, int64_t pressUs, uint32_t durationMs)
+{
+    LAB_TEST_CHECK(index < _sim.eventCount);
+    if (index < _sim.eventCount)
+    {
+        LAB_TEST_CHECK_EQUAL(timeUs, _sim.events[index].timeUs);
+        LAB_TEST_CHECK_EQUAL(id, _sim.events[index].id);
+        LAB_TEST_CHECK_EQUAL(pressUs, _sim.events[index].data.press_time_us - _sim.startUs);
+        LAB_TEST_CHECK_EQUAL(durationMs, _sim.events[index].data.duration_ms);
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_bounces_make_one_click(void)
+{
+    static const _edge_t edges[] = {
+        PRESS(100000), RELEASE(100300), PRESS(100700), RELEASE(101200), PRESS(101500),
+        RELEASE(200000), PRESS(200400), RELEASE(200900),
+    };
+
+    TEST_RUN_SCENARIO(edges);
+
+    /* Decided when the window after the first release edge closes, with the
+     * time of the first press edge. */
+    LAB_TEST_CHECK_EQUAL(1, _sim.eventCount);
+    _checkEvent(0, 500000, ESP32DEVKITC_BUTTON_CLICK_EVENT, 100000, 0);
+}
+
+static void test_glitches_are_ignored(void)
+{
+    static const _edge_t edges[] = { PRESS(100000), RELEASE(102000), PRESS(300000), RELEASE(300050) };
+
+    TEST_RUN_SCENARIO(edges);
+
+    LAB_TEST_CHECK_EQUAL(0, _sim.eventCount);
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_double_click_and_long_press(void)
+{
+    static const _edge_t edges[] = {
+        PRESS(100000), RELEASE(200000), PRESS(350000), RELEASE(420000),
+        PRESS(2000000), RELEASE(4500000),
+    };
+
+    TEST_RUN_SCENARIO(edges);
+
+    LAB_TEST_CHECK_EQUAL(3, _sim.eventCount);
+    _checkEvent(0, 720000, ESP32DEVKITC_BUTTON_DOUBLE_CLICK_EVENT, 100000, 0);
+    _checkEvent(1, 4000000, ESP32DEVKITC_BUTTON_HOLD_EVENT, 2000000, 0);
+    /* The release is settled after the debounce time, its time is the edge's. */
+    _checkEvent(2, 4510000, ESP32DEVKITC_BUTTON_LONG_PRESS_EVENT, 2000000, 2500);
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_edge_ring_overflow(void)
+{
+    _edge_t edges[ESP32DEVKITC_BUTTON_EDGE_RING_SIZE + 8];
+    size_t i = 0;
+
+    /* Fast bounces while the task is late: the ring overflows, and the level
+     * of the button is read back from the GPIO. */
+    for (i = 0; i < ESP32DEVKITC_BUTTON_EDGE_RING_SIZE + 7; i++)
+    {
+        edges[i] = (_edge_t) { 100000 + 50 * (int64_t)i, GPIO_NUM_0, (i % 2 == 0) ? 0 : 1 };
+    }
+    edges[i] = (_edge_t) RELEASE(300000);
+
+    _sim.taskLatencyUs = 5000;
+    TEST_RUN_SCENARIO(edges);
+    _sim.taskLatencyUs = 0;
+
+    LAB_TEST_CHECK_EQUAL(1, _sim.eventCount);
+    _checkEvent(0, 600000, ESP32DEVKITC_BUTTON_CLICK_EVENT, 100000, 0);
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_buttons_are_independent(void)
+{
+    /* Faster debounce and hold, single clicks only. */
+    static esp32devkitc_button_t button = {
+        .gpio = GPIO_NUM_4,
+        .debounce_time = 5,
+        .hold_time = 1000,
+        .multi_click_time = 0,
+        .max_clicks = 1,
+    };
+    static const _edge_t edges[] = {
+        PRESS(100000), PRESS_4(150000), RELEASE(200000), RELEASE_4(250000),
+        PRESS_4(1000000), PRESS(1100000), RELEASE(1200000), RELEASE_4(2500000),
+    };
+
+    button.esp_event_base = TEST_BUTTON_4_EVENT_BASE;
+    LAB_TEST_CHECK_EQUAL(ESP_OK, eESP32DevkitcButtonEnable(&button));
+
+    TEST_RUN_SCENARIO(edges);
+
+    LAB_TEST_CHECK_EQUAL(5, _sim.eventCount);
+    /* Without a window, the release decides. */
+    _checkEvent(0, 255000, ESP32DEVKITC_BUTTON_CLICK_EVENT, 150000, 0);
+    _checkEvent(1, 500000, ESP32DEVKITC_BUTTON_CLICK_EVENT, 100000, 0);
+    _checkEvent(2, 1500000, ESP32DEVKITC_BUTTON_CLICK_EVENT, 1100000, 0);
+    _checkEvent(3, 2000000, ESP32DEVKITC_BUTTON_HOLD_EVENT, 1000000, 0);
+    _checkEvent(4, 2505000, ESP32DEVKITC_BUTTON_LONG_PRESS_EVENT, 1000000, 1500);
+    LAB_TEST_CHECK(_sim.events[0].base == TEST_BUTTON_4_EVENT_BASE);
+    LAB_TEST_CHECK(_sim.events[1].base == ESP32DEVKITC_BUTTON_EVENT_BASE);
+    LAB_TEST_CHECK(_sim.events[2].base == ESP32DEVKITC_BUTTON_EVENT_BASE);
+    LAB_TEST_CHECK(_sim.events[3].base == TEST_BUTTON_4_EVENT_BASE);
+
+    LAB_TEST_CHECK_EQUAL(ESP_OK, eESP32DevkitcButtonDisable(&button));
+    LAB_TEST_CHECK(_sim.handlers[GPIO_NUM_4] == NULL);
+    LAB_TEST_CHECK_EQUAL(ESP_ERR_INVALID_ARG, eESP32DevkitcButtonDisable(&button));
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_slots(void)
+{
+    static esp32devkitc_button_t buttons[ESP32DEVKITC_BUTTON_MAX_BUTTONS];
+    size_t i = 0;
+
+    /* The BOOT button has a slot already. */
+    for (i = 0; i < ESP32DEVKITC_BUTTON_MAX_BUTTONS; i++)
+    {
+        buttons[i] = esp32devkitc_button;
+        buttons[i].gpio = GPIO_NUM_4;
+        LAB_TEST_CHECK_EQUAL((i < ESP32DEVKITC_BUTTON_MAX_BUTTONS - 1) ? ESP_OK : ESP_ERR_NO_MEM,
+                             eESP32DevkitcButtonEnable(&buttons[i]));
+    }
+
+    /* A freed slot is reused. */
+    LAB_TEST_CHECK_EQUAL(ESP_OK, eESP32DevkitcButtonDisable(&buttons[1]));
+    LAB_TEST_CHECK_EQUAL(ESP_OK, eESP32DevkitcButtonEnable(&buttons[3]));
+    LAB_TEST_CHECK_EQUAL(buttons[1].index, buttons[3].index);
+
+    LAB_TEST_CHECK_EQUAL(ESP_OK, eESP32DevkitcButtonDisable(&buttons[0]));
+    LAB_TEST_CHECK_EQUAL(ESP_OK, eESP32DevkitcButtonDisable(&buttons[2]));
+    LAB_TEST_CHECK_EQUAL(ESP_OK, eESP32DevkitcButtonDisable(&buttons[3]));
+
+    /* What an extra button costs, besides its esp_timer. */
+    printf("esp32devkitc_button_t: %zu bytes\n", sizeof(esp32devkitc_button_t));
+    LAB_TEST_CHECK(sizeof(esp32devkitc_button_t) <= 128);
+}
+
+/*-----------------------------------------------------------*/
+
+int main(void)
+{
+    size_t i = 0;
+
+    /* Buttons are active low. */
+    for (i = 0; i < GPIO_NUM_MAX; i++)
+    {
+        _sim.levels[i] = 1;
+    }
+
+    LAB_TEST_CHECK_EQUAL(ESP_OK, eESP32DevkitcButtonInit());
+
+    LAB_TEST_RUN(test_bounces_make_one_click);
+    LAB_TEST_RUN(test_glitches_are_ignored);
+    LAB_TEST_RUN(test_double_click_and_long_press);
+    LAB_TEST_RUN(test_edge_ring_overflow);
+    LAB_TEST_RUN(test_buttons_are_independent);
+    LAB_TEST_RUN(test_slots);
+
+    return iLabTestResult();
+}
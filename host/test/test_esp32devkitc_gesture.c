@@ -0,0 +1,219 @@
+/**
+ * @file test_esp32devkitc_gesture.c
+ * @brief Host tests of the button gesture recognizer, replaying edge
+ * timelines: the deadlines are handled as the button task does, before the
+ * next edge.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include "lab_test.h"
+
+#include "esp32devkitc_gesture.h"
+
+#define TEST_MULTI_CLICK_TIME   300
+#define TEST_HOLD_TIME          1000
+#define TEST_MAX_GESTURES       8
+
+typedef struct
+{
+    uint32_t time;
+    bool pressed;
+} _edge_t;
+
+typedef struct
+{
+    uint32_t time;
+    esp32devkitc_gesture_t gesture;
+    uint32_t duration;
+} _decision_t;
+
+#define PRESS(time)     { (time), true }
+#define RELEASE(time)   { (time), false }
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Feed the edges, starting at the given time, and collect the
+ * gestures with the time they were decided at.
+ *
+ * @return  number of gestures
+ */
+static size_t _replay(esp32devkitc_gesture_recognizer_t *pRecognizer, uint32_t start,
+                      const _edge_t *pEdges, size_t edges, _decision_t *pDecisions)
+{
+    esp32devkitc_gesture_result_t result;
+    uint32_t now = start;
+    uint32_t deadline = 0;
+    size_t decisions = 0;
+    size_t i = 0;
+
+    for (i = 0; i <= edges && decisions < TEST_MAX_GESTURES; i++)
+    {
+        /* The deadlines before the edge, or all of them after the last one. */
+        while ((deadline = ulESP32DevkitcGestureTimeToDeadline(pRecognizer, now)) != ESP32DEVKITC_GESTURE_NO_DEADLINE &&
+               (i == edges || deadline <= pEdges[i].time + start - now) &&
+               decisions < TEST_MAX_GESTURES)
+        {
+            now += deadline;
+            if (bESP32DevkitcGestureTimeout(pRecognizer, now, &result))
+            {
+                pDecisions[decisions++] = (_decision_t) { now - start, result.gesture, result.duration };
+            }
+        }
+
+        if (i < edges)
+        {
+            now = pEdges[i].time + start;
+            if (bESP32DevkitcGestureEdge(pRecognizer, pEdges[i].pressed, now, &result))
+            {
+                pDecisions[decisions++] = (_decision_t) { now - start, result.gesture, result.duration };
+            }
+        }
+    }
+
+    return decisions;
+}
+
+static void _check(const _decision_t *pExpected, size_t expected, const _decision_t *pActual, size_t actual)
+{
+    size_t i = 0;
+
+    LAB_TEST_CHECK_EQUAL(expected, actual);
+    for (i = 0; i < expected && i < actual; i++)
+    {
+        LAB_TEST_CHECK_EQUAL(pExpected[i].time, pActual[i].time);
+        LAB_TEST_CHECK_EQUAL(pExpected[i].gesture, pActual[i].gesture);
+        LAB_TEST_CHECK_EQUAL(pExpected[i].duration, pActual[i].duration);
+    }
+}
+
+/**
+ * @brief Replay a timeline with the default settings, from the given time.
+ */
+#define TEST_TIMELINE(start, edges, expected)                                               \
+    do {                                                                                    \
+        esp32devkitc_gesture_recognizer_t recognizer;                                       \
+        _decision_t decisions[TEST_MAX_GESTURES];                                           \
+        vESP32DevkitcGestureInit(&recognizer, TEST_MULTI_CLICK_TIME, TEST_HOLD_TIME, 3);    \
+        _check(expected, sizeof(expected) / sizeof(expected[0]), decisions,                 \
+               _replay(&recognizer, (start), edges, sizeof(edges) / sizeof(edges[0]), decisions)); \
+    } while (0)
+
+/*-----------------------------------------------------------*/
+
+static void test_clicks(void)
+{
+    static const _edge_t single[] = { PRESS(0), RELEASE(100) };
+    static const _decision_t singleGestures[] = { { 400, ESP32DEVKITC_GESTURE_SINGLE_CLICK, 0 } };
+    static const _edge_t twice[] = { PRESS(0), RELEASE(100), PRESS(250), RELEASE(320) };
+    static const _decision_t twiceGestures[] = { { 620, ESP32DEVKITC_GESTURE_DOUBLE_CLICK, 0 } };
+    static const _edge_t thrice[] = { PRESS(0), RELEASE(100), PRESS(250), RELEASE(320), PRESS(500), RELEASE(560) };
+    /* The third click is the last one: no need to wait for the window. */
+    static const _decision_t thriceGestures[] = { { 560, ESP32DEVKITC_GESTURE_TRIPLE_CLICK, 0 } };
+
+    TEST_TIMELINE(0, single, singleGestures);
+    TEST_TIMELINE(0, twice, twiceGestures);
+    TEST_TIMELINE(0, thrice, thriceGestures);
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_window_elapsed_between_clicks(void)
+{
+    /* The second press comes as the window closes: two single clicks. */
+    static const _edge_t edges[] = { PRESS(0), RELEASE(100), PRESS(400), RELEASE(450) };
+    static const _decision_t expected[] = {
+        { 400, ESP32DEVKITC_GESTURE_SINGLE_CLICK, 0 },
+        { 750, ESP32DEVKITC_GESTURE_SINGLE_CLICK, 0 },
+    };
+
+    TEST_TIMELINE(0, edges, expected);
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_hold_and_long_press(void)
+{
+    static const _edge_t edges[] = { PRESS(0), RELEASE(2500) };
+    static const _decision_t expected[] = {
+        { 1000, ESP32DEVKITC_GESTURE_HOLD, 1000 },
+        { 2500, ESP32DEVKITC_GESTURE_LONG_PRESS, 2500 },
+    };
+
+    TEST_TIMELINE(0, edges, expected);
+}
+
+static void test_hold_drops_the_clicks_before_it(void)
+{
+    static const _edge_t edges[] = { PRESS(0), RELEASE(100), PRESS(200), RELEASE(1500), PRESS(1600), RELEASE(1650) };
+    static const _decision_t expected[] = {
+        { 1200, ESP32DEVKITC_GESTURE_HOLD, 1000 },
+        { 1500, ESP32DEVKITC_GESTURE_LONG_PRESS, 1300 },
+        { 1950, ESP32DEVKITC_GESTURE_SINGLE_CLICK, 0 },
+    };
+
+    TEST_TIMELINE(0, edges, expected);
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_time_wraps(void)
+{
+    static const _edge_t edges[] = { PRESS(0), RELEASE(100), PRESS(250), RELEASE(320), PRESS(700), RELEASE(2000) };
+    static const _decision_t expected[] = {
+        { 620, ESP32DEVKITC_GESTURE_DOUBLE_CLICK, 0 },
+        { 1700, ESP32DEVKITC_GESTURE_HOLD, 1000 },
+        { 2000, ESP32DEVKITC_GESTURE_LONG_PRESS, 1300 },
+    };
+
+    /* The millisecond clock wraps after the first release. */
+    TEST_TIMELINE(UINT32_MAX - 150, edges, expected);
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_settings(void)
+{
+    static const _edge_t edges[] = { PRESS(0), RELEASE(100), PRESS(250), RELEASE(320), PRESS(500), RELEASE(560) };
+    esp32devkitc_gesture_recognizer_t recognizer;
+    _decision_t decisions[TEST_MAX_GESTURES];
+    size_t count = 0;
+
+    /* Up to double clicks: the second click decides at once. */
+    vESP32DevkitcGestureInit(&recognizer, TEST_MULTI_CLICK_TIME, TEST_HOLD_TIME, 2);
+    count = _replay(&recognizer, 0, edges, sizeof(edges) / sizeof(edges[0]), decisions);
+    LAB_TEST_CHECK_EQUAL(2, count);
+    LAB_TEST_CHECK_EQUAL(320, decisions[0].time);
+    LAB_TEST_CHECK_EQUAL(ESP32DEVKITC_GESTURE_DOUBLE_CLICK, decisions[0].gesture);
+    LAB_TEST_CHECK_EQUAL(860, decisions[1].time);
+    LAB_TEST_CHECK_EQUAL(ESP32DEVKITC_GESTURE_SINGLE_CLICK, decisions[1].gesture);
+
+    /* Without a window, every release is a single click. */
+    vESP32DevkitcGestureInit(&recognizer, 0, TEST_HOLD_TIME, 3);
+    count = _replay(&recognizer, 0, edges, sizeof(edges) / sizeof(edges[0]), decisions);
+    LAB_TEST_CHECK_EQUAL(3, count);
+    LAB_TEST_CHECK_EQUAL(100, decisions[0].time);
+    LAB_TEST_CHECK_EQUAL(320, decisions[1].time);
+    LAB_TEST_CHECK_EQUAL(560, decisions[2].time);
+    LAB_TEST_CHECK_EQUAL(ESP32DEVKITC_GESTURE_SINGLE_CLICK, decisions[2].gesture);
+
+    /* Out of range: as many clicks as there are gestures. */
+    vESP32DevkitcGestureInit(&recognizer, TEST_MULTI_CLICK_TIME, TEST_HOLD_TIME, 10);
+    LAB_TEST_CHECK_EQUAL(3, recognizer.max_clicks);
+}
+
+/*-----------------------------------------------------------*/
+
+int main(void)
+{
+    LAB_TEST_RUN(test_clicks);
+    LAB_TEST_RUN(test_window_elapsed_between_clicks);
+    LAB_TEST_RUN(test_hold_and_long_press);
+    LAB_TEST_RUN(test_hold_drops_the_clicks_before_it);
+    LAB_TEST_RUN(test_time_wraps);
+    LAB_TEST_RUN(test_settings);
+
+    return iLabTestResult();
+}
@@ -0,0 +1,104 @@
+/**
+ * @file test_host_nvs.c
+ * @brief Host tests of the NVS stand-in of the host build: it has to behave
+ * as flash does for the modules that persist data.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include "lab_test.h"
+
+#include "nvs.h"
+#include "nvs_flash.h"
+
+#define TEST_PARTITION      "test"
+#define TEST_NAMESPACE      "ns"
+
+/*-----------------------------------------------------------*/
+
+static void test_values_survive_reopening(void)
+{
+    nvs_handle handle = 0;
+    uint32_t value = 0;
+    char blob[8] = { 0 };
+    size_t length = sizeof(blob);
+
+    LAB_TEST_CHECK_EQUAL(ESP_OK, nvs_flash_init_partition(TEST_PARTITION));
+    LAB_TEST_CHECK_EQUAL(ESP_OK, nvs_open_from_partition(TEST_PARTITION, TEST_NAMESPACE, NVS_READWRITE, &handle));
+    LAB_TEST_CHECK_EQUAL(ESP_OK, nvs_set_u32(handle, "u32", 0xdeadbeef));
+    LAB_TEST_CHECK_EQUAL(ESP_OK, nvs_set_blob(handle, "blob", "abc", 3));
+    LAB_TEST_CHECK_EQUAL(ESP_OK, nvs_commit(handle));
+    nvs_close(handle);
+
+    LAB_TEST_CHECK_EQUAL(ESP_OK, nvs_open_from_partition(TEST_PARTITION, TEST_NAMESPACE, NVS_READONLY, &handle));
+    LAB_TEST_CHECK_EQUAL(ESP_OK, nvs_get_u32(handle, "u32", &value));
+    LAB_TEST_CHECK_EQUAL(0xdeadbeef, value);
+
+    /* The length alone, then the value. */
+    LAB_TEST_CHECK_EQUAL(ESP_OK, nvs_get_blob(handle, "blob", NULL, &length));
+    LAB_TEST_CHECK_EQUAL(3, length);
+    LAB_TEST_CHECK_EQUAL(ESP_OK, nvs_get_blob(handle, "blob", blob, &length));
+    LAB_TEST_CHECK(memcmp(blob, "abc", 3) == 0);
+
+    /* Read-only handles are read-only. */
+    LAB_TEST_CHECK_EQUAL(ESP_ERR_INVALID_STATE, nvs_set_u32(handle, "u32", 1));
+    nvs_close(handle);
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_missing_and_erased_keys(void)
+{
+    nvs_handle handle = 0;
+    uint32_t value = 0;
+    char blob[2] = { 0 };
+    size_t length = sizeof(blob);
+
+    LAB_TEST_CHECK_EQUAL(ESP_OK, nvs_open_from_partition(TEST_PARTITION, TEST_NAMESPACE, NVS_READWRITE, &handle));
+    LAB_TEST_CHECK_EQUAL(ESP_ERR_NVS_NOT_FOUND, nvs_get_u32(handle, "missing", &value));
+
+    /* Too small a buffer is refused, as on the device. */
+    LAB_TEST_CHECK_EQUAL(ESP_ERR_NVS_INVALID_LENGTH, nvs_get_blob(handle, "blob", blob, &length));
+
+    LAB_TEST_CHECK_EQUAL(ESP_OK, nvs_erase_key(handle, "u32"));
+    LAB_TEST_CHECK_EQUAL(ESP_ERR_NVS_NOT_FOUND, nvs_get_u32(handle, "u32", &value));
+    LAB_TEST_CHECK_EQUAL(ESP_ERR_NVS_NOT_FOUND, nvs_erase_key(handle, "u32"));
+    nvs_close(handle);
+
+    /* Closed handles are invalid. */
+    LAB_TEST_CHECK_EQUAL(ESP_ERR_NVS_INVALID_HANDLE, nvs_commit(handle));
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_erase_partition(void)
+{
+    nvs_handle handle = 0;
+    char blob[8] = { 0 };
+    size_t length = sizeof(blob);
+
+    LAB_TEST_CHECK_EQUAL(ESP_OK, nvs_flash_erase_partition(TEST_PARTITION));
+    LAB_TEST_CHECK_EQUAL(ESP_OK, nvs_flash_init_partition(TEST_PARTITION));
+    LAB_TEST_CHECK_EQUAL(ESP_OK, nvs_open_from_partition(TEST_PARTITION, TEST_NAMESPACE, NVS_READWRITE, &handle));
+    LAB_TEST_CHECK_EQUAL(ESP_ERR_NVS_NOT_FOUND, nvs_get_blob(handle, "blob", blob, &length));
+    nvs_close(handle);
+
+    LAB_TEST_CHECK_EQUAL(ESP_OK, nvs_flash_erase_partition(TEST_PARTITION));
+}
+
+/*-----------------------------------------------------------*/
+
+int main(void)
+{
+    if (!bLabTestNvsDirectory())
+    {
+        return EXIT_FAILURE;
+    }
+
+    LAB_TEST_RUN(test_values_survive_reopening);
+    LAB_TEST_RUN(test_missing_and_erased_keys);
+    LAB_TEST_RUN(test_erase_partition);
+
+    return iLabTestResult();
+}
@@ -0,0 +1,313 @@
+/**
+ * @file test_lab2_shadow_state.c
+ * @brief Host tests of the lab2 Shadow schema: the reported documents, their
+ * size bound and the deltas generated from it, the dirty fields sent, and the
+ * snapshot read while it is published.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include <pthread.h>
+
+#include "lab_test.h"
+
+#include "lab2_shadow_state.h"
+
+/**
+ * @brief Read a document, a string literal, into values.
+ */
+#define TEST_READ(document, pObjectKey, pValues) \
+    eLab2ShadowReadState(document, sizeof(document) - 1, pObjectKey, pValues)
+
+/*-----------------------------------------------------------*/
+
+static void test_reported_document(void)
+{
+    static const char expected[] = "{\"state\":{\"reported\":{\"powerOn\":0,\"temperature\":35}},\"clientToken\":\"000123\"}";
+    char buffer[LAB2_SHADOW_REPORTED_JSON_LENGTH + 1];
+    lab2_shadow_state_t state;
+    lab_json_value_t values[LAB2SHADOW_FIELD_COUNT];
+    size_t length = 0;
+
+    /* The initial state of the schema, in full. */
+    vLab2ShadowStateInit(&state);
+    length = xLab2ShadowWriteReported(&state, LAB2_SHADOW_ALL_FIELDS, 123, buffer, sizeof(buffer));
+    LAB_TEST_CHECK_EQUAL(sizeof(expected) - 1, length);
+    LAB_TEST_CHECK(strncmp(buffer, expected, length) == 0);
+
+    /* What is written is what a Shadow read gives back. */
+    LAB_TEST_CHECK_EQUAL(ESP_OK, eLab2ShadowReadState(buffer, length, "state.reported", values));
+    LAB_TEST_CHECK(values[LAB2SHADOW_FIELD_powerOn].found && values[LAB2SHADOW_FIELD_powerOn].value == 0);
+    LAB_TEST_CHECK(values[LAB2SHADOW_FIELD_temperature].found && values[LAB2SHADOW_FIELD_temperature].value == 35);
+
+    /* The largest values of the C types fit the bound; bools stay 0 or 1. */
+    memset(&state, 0xff, sizeof(state));
+    length = xLab2ShadowWriteReported(&state, LAB2_SHADOW_ALL_FIELDS, 999999, buffer, sizeof(buffer));
+    LAB_TEST_CHECK(length > 0 && length <= LAB2_SHADOW_REPORTED_JSON_LENGTH);
+    LAB_TEST_CHECK(strstr(buffer, "\"powerOn\":1,") != NULL);
+
+    /* Too small a buffer is an error, not a truncated document. */
+    LAB_TEST_CHECK_EQUAL(0, xLab2ShadowWriteReported(&state, LAB2_SHADOW_ALL_FIELDS, 0, buffer, length - 1));
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_delta(void)
+{
+    lab2_shadow_state_t desired = { 0 };
+    lab_json_value_t delta[LAB2SHADOW_FIELD_COUNT];
+
+    /* A delta with metadata: the fields of "state" only. */
+    LAB_TEST_CHECK_EQUAL(ESP_OK, TEST_READ(
+        "{\"version\":12,\"timestamp\":1571234567,\"state\":{\"powerOn\":true,\"temperature\":22},"
+        "\"metadata\":{\"powerOn\":{\"timestamp\":1571234567},\"temperature\":{\"timestamp\":1571234567}}}",
+        "state", delta));
+    LAB_TEST_CHECK_EQUAL((1UL << LAB2SHADOW_FIELD_powerOn) | (1UL << LAB2SHADOW_FIELD_temperature),
+                         ulLab2ShadowApplyDelta(delta, &desired));
+    LAB_TEST_CHECK_EQUAL(1, desired.powerOn);
+    LAB_TEST_CHECK_EQUAL(22, desired.temperature);
+
+    /* The same again: nothing changes. */
+    LAB_TEST_CHECK_EQUAL(0, ulLab2ShadowApplyDelta(delta, &desired));
+
+    /* Out of range, or of the wrong type: ignored, the other fields applied. */
+    LAB_TEST_CHECK_EQUAL(ESP_OK, TEST_READ("{\"state\":{\"powerOn\":0,\"temperature\":100}}", "state", delta));
+    LAB_TEST_CHECK_EQUAL(1UL << LAB2SHADOW_FIELD_powerOn, ulLab2ShadowApplyDelta(delta, &desired));
+    LAB_TEST_CHECK_EQUAL(ESP_OK, TEST_READ("{\"state\":{\"powerOn\":2,\"temperature\":-1}}", "state", delta));
+    LAB_TEST_CHECK_EQUAL(0, ulLab2ShadowApplyDelta(delta, &desired));
+    LAB_TEST_CHECK_EQUAL(0, desired.powerOn);
+    LAB_TEST_CHECK_EQUAL(22, desired.temperature);
+
+    /* The desired section of a Shadow read. */
+    LAB_TEST_CHECK_EQUAL(ESP_OK, TEST_READ(
+        "{\"state\":{\"desired\":{\"temperature\":18},\"reported\":{\"temperature\":35}},\"version\":13}",
+        "state.desired", delta));
+    LAB_TEST_CHECK(!delta[LAB2SHADOW_FIELD_powerOn].found);
+    LAB_TEST_CHECK_EQUAL(1UL << LAB2SHADOW_FIELD_temperature, ulLab2ShadowApplyDelta(delta, &desired));
+    LAB_TEST_CHECK_EQUAL(18, desired.temperature);
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_report_fields(void)
+{
+    const lab_report_field_t *pFields = pxLab2ShadowReportFields();
+    lab2_shadow_state_t state;
+    int32_t values[LAB2SHADOW_FIELD_COUNT];
+
+    /* powerOn at once, the temperature out of its deadband. */
+    LAB_TEST_CHECK(strcmp(pFields[LAB2SHADOW_FIELD_powerOn].pName, "powerOn") == 0);
+    LAB_TEST_CHECK(pFields[LAB2SHADOW_FIELD_powerOn].immediate);
+    LAB_TEST_CHECK(strcmp(pFields[LAB2SHADOW_FIELD_temperature].pName, "temperature") == 0);
+    LAB_TEST_CHECK(!pFields[LAB2SHADOW_FIELD_temperature].immediate);
+    LAB_TEST_CHECK_EQUAL(LAB2_REPORT_TEMPERATURE_DEADBAND, pFields[LAB2SHADOW_FIELD_temperature].deadband);
+
+    vLab2ShadowStateInit(&state);
+    state.powerOn = 1;
+    vLab2ShadowStateGetValues(&state, values);
+    LAB_TEST_CHECK_EQUAL(1, values[LAB2SHADOW_FIELD_powerOn]);
+    LAB_TEST_CHECK_EQUAL(35, values[LAB2SHADOW_FIELD_temperature]);
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_sparse_payload(void)
+{
+    char buffer[LAB2_SHADOW_REPORTED_JSON_LENGTH + 1];
+    lab2_shadow_state_t state;
+    size_t empty = 0, full = 0, sum = 0, length = 0;
+    uint32_t i = 0;
+
+    vLab2ShadowStateInit(&state);
+    state.powerOn = 1;
+    state.temperature = 22;
+
+    /* Each field adds its own key and value, and nothing else: the document
+     * grows with the fields sent, not with the schema. */
+    empty = xLab2ShadowWriteReported(&state, 0, 0, buffer, sizeof(buffer));
+    full = xLab2ShadowWriteReported(&state, LAB2_SHADOW_ALL_FIELDS, 0, buffer, sizeof(buffer));
+    LAB_TEST_CHECK(empty > 0);
+
+    for (i = 0; i < LAB2SHADOW_FIELD_COUNT; i++)
+    {
+        length = xLab2ShadowWriteReported(&state, 1UL << i, 0, buffer, sizeof(buffer));
+        LAB_TEST_CHECK(length > empty && length < full);
+        sum += length - empty;
+    }
+
+    /* A comma between fields. */
+    LAB_TEST_CHECK_EQUAL(full - empty, sum + LAB2SHADOW_FIELD_COUNT - 1);
+
+    length = xLab2ShadowWriteReported(&state, 1UL << LAB2SHADOW_FIELD_temperature, 0, buffer, sizeof(buffer));
+    LAB_TEST_CHECK(strstr(buffer, "\"powerOn\"") == NULL);
+    LAB_TEST_CHECK_EQUAL(empty + strlen("\"temperature\":22"), length);
+    printf("lab2 shadow: %zu bytes without fields, %zu with the temperature, %zu with all %u fields\n",
+           empty, length, full, LAB2SHADOW_FIELD_COUNT);
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_dirty_until_accepted(void)
+{
+    lab2_shadow_reported_t reported = { 0 };
+    lab2_shadow_state_t state;
+    int32_t values[LAB2SHADOW_FIELD_COUNT];
+    const uint32_t temperature = 1UL << LAB2SHADOW_FIELD_temperature;
+
+    /* A new session: all dirty until accepted. */
+    vLab2ShadowStateInit(&state);
+    vLab2ShadowStateGetValues(&state, values);
+    vLab2ShadowReportedReset(&reported);
+    LAB_TEST_CHECK_EQUAL(LAB2_SHADOW_ALL_FIELDS, ulLab2ShadowReportedDirty(&reported, values));
+
+    vLab2ShadowReportedSent(&reported, LAB2_SHADOW_ALL_FIELDS, values, 0);
+    LAB_TEST_CHECK(reported.inFlight);
+    LAB_TEST_CHECK(bLab2ShadowReportedResponse(&reported, reported.sequence, true));
+    LAB_TEST_CHECK_EQUAL(0, ulLab2ShadowReportedDirty(&reported, values));
+
+    /* The temperature changes: only it is dirty, and stays so when rejected. */
+    state.temperature = 30;
+    vLab2ShadowStateGetValues(&state, values);
+    LAB_TEST_CHECK_EQUAL(temperature, ulLab2ShadowReportedDirty(&reported, values));
+    vLab2ShadowReportedSent(&reported, temperature, values, 1000000);
+    LAB_TEST_CHECK(bLab2ShadowReportedResponse(&reported, reported.sequence, false));
+    LAB_TEST_CHECK(!reported.inFlight);
+    LAB_TEST_CHECK_EQUAL(temperature, ulLab2ShadowReportedDirty(&reported, values));
+
+    /* Sent again and lost: dirty once the response is overdue; its late
+     * response is of no use. */
+    vLab2ShadowReportedSent(&reported, temperature, values, 2000000);
+    LAB_TEST_CHECK(!bLab2ShadowReportedExpired(&reported, 2000000 + LAB2_REPORT_RESPONSE_TIMEOUT_MS * 1000LL));
+    LAB_TEST_CHECK(bLab2ShadowReportedExpired(&reported, 2000001 + LAB2_REPORT_RESPONSE_TIMEOUT_MS * 1000LL));
+    LAB_TEST_CHECK(!bLab2ShadowReportedResponse(&reported, reported.sequence, true));
+    LAB_TEST_CHECK_EQUAL(temperature, ulLab2ShadowReportedDirty(&reported, values));
+
+    /* Sent again and accepted: clean. */
+    vLab2ShadowReportedSent(&reported, temperature, values, 40000000);
+    LAB_TEST_CHECK(!bLab2ShadowReportedResponse(&reported, reported.sequence - 1, true));
+    LAB_TEST_CHECK(bLab2ShadowReportedResponse(&reported, reported.sequence, true));
+    LAB_TEST_CHECK_EQUAL(0, ulLab2ShadowReportedDirty(&reported, values));
+
+    /* Back to a value accepted before a change: nothing dirty. */
+    state.temperature = 31;
+    vLab2ShadowStateGetValues(&state, values);
+    vLab2ShadowReportedSent(&reported, temperature, values, 50000000);
+    LAB_TEST_CHECK(bLab2ShadowReportedResponse(&reported, reported.sequence, false));
+    state.temperature = 30;
+    vLab2ShadowStateGetValues(&state, values);
+    LAB_TEST_CHECK_EQUAL(0, ulLab2ShadowReportedDirty(&reported, values));
+}
+
+/*-----------------------------------------------------------*/
+
+#define TEST_READERS        ( 3 )
+#define TEST_PUBLISHES      ( 2000000 )
+
+static lab2_shadow_snapshot_t _snapshot;
+static bool _publishing = true;
+static uint32_t _readersStarted = 0;
+
+typedef struct {
+    uint32_t reads;
+    uint32_t torn;
+} _reader_t;
+
+/**
+ * @brief The states published: both at the same temperature, on when it is
+ * odd. A torn read breaks it.
+ */
+static void _setStates(uint32_t i, lab2_shadow_state_t *pReported, lab2_shadow_state_t *pDesired)
+{
+    pReported->temperature = (uint8_t)(i % 100);
+    pReported->powerOn = pReported->temperature & 1;
+    *pDesired = *pReported;
+}
+
+static void * _readSnapshot(void *pArg)
+{
+    char buffer[LAB2_SHADOW_REPORTED_JSON_LENGTH + 1];
+    lab2_shadow_state_t reported, desired;
+    lab_json_value_t values[LAB2SHADOW_FIELD_COUNT];
+    _reader_t *pReader = (_reader_t *)pArg;
+    size_t length = 0;
+
+    __atomic_fetch_add(&_readersStarted, 1, __ATOMIC_RELAXED);
+
+    while (__atomic_load_n(&_publishing, __ATOMIC_RELAXED))
+    {
+        vLab2ShadowSnapshotRead(&_snapshot, &reported, &desired);
+
+        /* As the Shadow callbacks report it. */
+        length = xLab2ShadowWriteReported(&reported, LAB2_SHADOW_ALL_FIELDS, 0, buffer, sizeof(buffer));
+
+        if (length == 0 ||
+            eLab2ShadowReadState(buffer, length, "state.reported", values) != ESP_OK ||
+            values[LAB2SHADOW_FIELD_temperature].value != desired.temperature ||
+            values[LAB2SHADOW_FIELD_powerOn].value != (desired.temperature & 1) ||
+            desired.powerOn != (desired.temperature & 1))
+        {
+            pReader->torn++;
+        }
+
+        pReader->reads++;
+    }
+
+    return NULL;
+}
+
+static void test_snapshot_concurrent(void)
+{
+    pthread_t readers[TEST_READERS];
+    _reader_t results[TEST_READERS] = { 0 };
+    lab2_shadow_state_t reported, desired;
+    uint32_t i = 0;
+
+    _setStates(0, &reported, &desired);
+    vLab2ShadowSnapshotInit(&_snapshot, &reported, &desired);
+
+    for (i = 0; i < TEST_READERS; i++)
+    {
+        pthread_create(&readers[i], NULL, _readSnapshot, &results[i]);
+    }
+
+    while (__atomic_load_n(&_readersStarted, __ATOMIC_RELAXED) < TEST_READERS)
+    {
+    }
+
+    /* The AirCon task, the single writer. */
+    for (i = 1; i <= TEST_PUBLISHES; i++)
+    {
+        _setStates(i, &reported, &desired);
+        vLab2ShadowSnapshotPublish(&_snapshot, &reported, &desired);
+    }
+
+    __atomic_store_n(&_publishing, false, __ATOMIC_RELAXED);
+
+    for (i = 0; i < TEST_READERS; i++)
+    {
+        pthread_join(readers[i], NULL);
+        LAB_TEST_CHECK(results[i].reads > 0);
+        LAB_TEST_CHECK_EQUAL(0, results[i].torn);
+        printf("lab2 snapshot: reader %u, %u reads during %u publishes\n", i, results[i].reads, TEST_PUBLISHES);
+    }
+
+    /* The last states published are read. */
+    vLab2ShadowSnapshotRead(&_snapshot, &reported, &desired);
+    LAB_TEST_CHECK_EQUAL(TEST_PUBLISHES % 100, desired.temperature);
+    LAB_TEST_CHECK_EQUAL(TEST_PUBLISHES % 100, reported.temperature);
+}
+
+/*-----------------------------------------------------------*/
+
+int main(void)
+{
+    LAB_TEST_RUN(test_reported_document);
+    LAB_TEST_RUN(test_delta);
+    LAB_TEST_RUN(test_report_fields);
+    LAB_TEST_RUN(test_sparse_payload);
+    LAB_TEST_RUN(test_dirty_until_accepted);
+    LAB_TEST_RUN(test_snapshot_concurrent);
+
+    return iLabTestResult();
+}
@@ -0,0 +1,197 @@
+/**
+ * @file test_lab_backoff.c
+ * @brief Host tests of the reconnection backoff: a fleet of devices dropped by
+ * the same broker outage, each retrying with its own backoff, and when they
+ * come back.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include "lab_test.h"
+
+#include "lab_backoff.h"
+
+#define TEST_DEVICES        ( 1000 )
+
+/* Attempts the broker sees in each second, up to an hour. */
+#define TEST_MAX_SECONDS    ( 3600 )
+
+typedef struct {
+    lab_backoff_t backoff;
+    uint32_t attempts;
+    uint64_t reconnectMs;
+} _device_t;
+
+static _device_t _devices[TEST_DEVICES];
+static uint32_t _attemptsPerSecond[TEST_MAX_SECONDS];
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Drop all devices at 0 and have them retry until the broker is back
+ * at outageMs. Attempts are instant.
+ *
+ * @return  the most attempts the broker saw in a second once it was back
+ */
+static uint32_t _runOutage(uint64_t outageMs)
+{
+    uint64_t nowMs = 0;
+    uint32_t delayMs = 0, busiest = 0;
+    uint32_t i = 0;
+
+    memset(_attemptsPerSecond, 0, sizeof(_attemptsPerSecond));
+
+    for (i = 0; i < TEST_DEVICES; i++)
+    {
+        _device_t *pDevice = &_devices[i];
+
+        vLabBackoffInit(&pDevice->backoff, 0, 0, 0);
+        pDevice->attempts = 0;
+        nowMs = 0;
+
+        do
+        {
+            delayMs = ulLabBackoffNextDelayMs(&pDevice->backoff);
+
+            if (pDevice->attempts == 0)
+            {
+                LAB_TEST_CHECK(delayMs <= LAB_BACKOFF_FIRST_RETRY_MS);
+            }
+            else
+            {
+                LAB_TEST_CHECK(delayMs >= LAB_BACKOFF_BASE_MS);
+            }
+            LAB_TEST_CHECK(delayMs <= LAB_BACKOFF_CAP_MS);
+
+            nowMs += delayMs;
+            pDevice->attempts++;
+
+            if (nowMs / 1000 < TEST_MAX_SECONDS)
+            {
+                _attemptsPerSecond[nowMs / 1000]++;
+            }
+        } while (nowMs < outageMs);
+
+        pDevice->reconnectMs = nowMs;
+    }
+
+    for (i = outageMs / 1000; i < TEST_MAX_SECONDS; i++)
+    {
+        if (_attemptsPerSecond[i] > busiest)
+        {
+            busiest = _attemptsPerSecond[i];
+        }
+    }
+
+    return busiest;
+}
+
+/**
+ * @brief Time by which a share of the devices reconnected.
+ */
+static uint64_t _reconnectedBy(uint32_t percent)
+{
+    uint32_t counts[TEST_MAX_SECONDS] = { 0 };
+    uint32_t i = 0, reconnected = 0;
+
+    for (i = 0; i < TEST_DEVICES; i++)
+    {
+        counts[_devices[i].reconnectMs / 1000 < TEST_MAX_SECONDS ? _devices[i].reconnectMs / 1000 : TEST_MAX_SECONDS - 1]++;
+    }
+
+    for (i = 0; i < TEST_MAX_SECONDS; i++)
+    {
+        reconnected += counts[i];
+        if (reconnected * 100 >= TEST_DEVICES * percent)
+        {
+            break;
+        }
+    }
+
+    return (i + 1) * 1000ULL;
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_glitch(void)
+{
+    uint32_t i = 0, minMs = UINT32_MAX, maxMs = 0;
+
+    /* A glitch: the first retry is all it takes, within a second, spread. */
+    (void)_runOutage(0);
+
+    for (i = 0; i < TEST_DEVICES; i++)
+    {
+        LAB_TEST_CHECK_EQUAL(1, _devices[i].attempts);
+        minMs = _devices[i].reconnectMs < minMs ? _devices[i].reconnectMs : minMs;
+        maxMs = _devices[i].reconnectMs > maxMs ? _devices[i].reconnectMs : maxMs;
+    }
+
+    LAB_TEST_CHECK(maxMs <= LAB_BACKOFF_FIRST_RETRY_MS);
+    LAB_TEST_CHECK(maxMs - minMs >= LAB_BACKOFF_FIRST_RETRY_MS / 2);
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_outage(void)
+{
+    static const uint64_t outagesMs[] = { 10000, 60000, 600000 };
+    uint32_t busiest = 0, i = 0, j = 0, maxAttempts = 0;
+
+    for (i = 0; i < sizeof(outagesMs) / sizeof(outagesMs[0]); i++)
+    {
+        busiest = _runOutage(outagesMs[i]);
+
+        for (j = 0, maxAttempts = 0; j < TEST_DEVICES; j++)
+        {
+            maxAttempts = _devices[j].attempts > maxAttempts ? _devices[j].attempts : maxAttempts;
+
+            /* Back within a capped delay of the broker. */
+            LAB_TEST_CHECK(_devices[j].reconnectMs >= outagesMs[i]);
+            LAB_TEST_CHECK(_devices[j].reconnectMs <= outagesMs[i] + LAB_BACKOFF_CAP_MS);
+        }
+
+        printf("backoff: %u devices, %llu s outage: busiest second %u attempts, half back by +%llu s, "
+               "all by +%llu s, %u attempts at most\n",
+               TEST_DEVICES, (unsigned long long)outagesMs[i] / 1000, busiest,
+               (unsigned long long)(_reconnectedBy(50) - outagesMs[i]) / 1000,
+               (unsigned long long)(_reconnectedBy(100) - outagesMs[i]) / 1000, maxAttempts);
+
+        /* Not in lockstep, where the whole fleet would retry in the same
+         * second: a short outage still finds the delays short and close. */
+        LAB_TEST_CHECK(busiest < TEST_DEVICES / 4);
+        LAB_TEST_CHECK(outagesMs[i] < 60000 || busiest < TEST_DEVICES / 10);
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_reset(void)
+{
+    lab_backoff_t backoff;
+    uint32_t i = 0;
+
+    vLabBackoffInit(&backoff, 100, 200, 5000);
+
+    for (i = 0; i < 50; i++)
+    {
+        LAB_TEST_CHECK(ulLabBackoffNextDelayMs(&backoff) <= 5000);
+    }
+
+    /* Once connected, the next loss starts over with a fast retry. */
+    vLabBackoffReset(&backoff);
+    LAB_TEST_CHECK(ulLabBackoffNextDelayMs(&backoff) <= 100);
+    LAB_TEST_CHECK(ulLabBackoffNextDelayMs(&backoff) >= 200);
+}
+
+/*-----------------------------------------------------------*/
+
+int main(void)
+{
+    LAB_TEST_RUN(test_glitch);
+    LAB_TEST_RUN(test_outage);
+    LAB_TEST_RUN(test_reset);
+
+    return iLabTestResult();
+}
@@ -0,0 +1,237 @@
+/**
+ * @file test_lab_battery.c
+ * @brief Host tests of the battery monitor, replaying a voltage trace: through
+ * the filter directly, then through the battery task in simulated time.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include "lab_test.h"
+#include "lab_test_sim.h"
+
+#include "lab_battery.h"
+
+#define TEST_MINUTE_US      ( 60LL * 1000000 )
+#define TEST_SAMPLE_US      ( LAB_BATTERY_SAMPLE_MS * 1000LL )
+#define TEST_HEARTBEAT_US   ( LAB_BATTERY_HEARTBEAT_MS * 1000LL )
+#define TEST_MAX_REPORTS    ( 64 )
+
+/**
+ * @brief A discharge of two and a half hours, then USB plugged in: the battery
+ * voltage once a minute, in mV, with a few mV of ADC noise.
+ */
+static const uint16_t _trace[] = {
+    4152, 4139, 4140, 4122, 4116, 4110, 4111, 4094, 4102, 4085, 4073, 4069,
+    4075, 4070, 4054, 4054, 4044, 4050, 4033, 4030, 4029, 4018, 4024, 4008,
+    4009, 3998, 3996, 3996, 3995, 3981, 3975, 3978, 3970, 3965, 3965, 3966,
+    3955, 3951, 3946, 3948, 3954, 3948, 3942, 3943, 3939, 3933, 3928, 3922,
+    3917, 3916, 3907, 3911, 3915, 3910, 3902, 3903, 3894, 3884, 3882, 3891,
+    3885, 3874, 3877, 3868, 3876, 3872, 3857, 3855, 3861, 3858, 3856, 3858,
+    3854, 3839, 3837, 3840, 3844, 3829, 3825, 3830, 3833, 3825, 3825, 3822,
+    3808, 3819, 3814, 3805, 3800, 3810, 3793, 3795, 3796, 3788, 3788, 3791,
+    3788, 3788, 3773, 3773, 3779, 3775, 3768, 3761, 3768, 3760, 3762, 3758,
+    3756, 3748, 3743, 3738, 3738, 3735, 3735, 3732, 3723, 3735, 3722, 3723,
+    3721, 3707, 3706, 3710, 3703, 3697, 3686, 3693, 3673, 3681, 3674, 3669,
+    3664, 3659, 3645, 3652, 3644, 3628, 3628, 3619, 3618, 3612, 3589, 3573,
+    3566, 3543, 3531, 3514, 3504, 3489, 3953, 3958, 3975, 3992, 4011, 4014,
+    4029, 4041, 4050, 4063, 4058, 4065, 4083, 4088, 4095, 4100, 4098, 4095,
+    4101, 4104, 4114, 4115, 4125, 4118, 4131, 4117, 4125, 4137, 4134, 4128,
+};
+
+#define TEST_TRACE_MINUTES  ( sizeof(_trace) / sizeof(_trace[0]) )
+#define TEST_PLUGGED_MINUTE ( 150 )
+
+typedef struct
+{
+    int64_t timeUs;
+    lab_battery_event_t event;
+} _report_t;
+
+static _report_t _reports[TEST_MAX_REPORTS];
+static size_t _reportCount = 0;
+
+/* Posts to the event loop: attempts, and the attempt that fails. */
+static int _eventLoop = 0;
+static uint32_t _posts = 0;
+static uint32_t _failedPost = 0;
+static int64_t _failedPostUs = 0;
+
+/*-----------------------------------------------------------*/
+
+static void _traceReading(int64_t timeUs, uint32_t *pMillivolts, bool *pCharging)
+{
+    uint32_t minute = (uint32_t)(timeUs / TEST_MINUTE_US);
+
+    *pMillivolts = _trace[minute < TEST_TRACE_MINUTES ? minute : TEST_TRACE_MINUTES - 1];
+    *pCharging = minute >= TEST_PLUGGED_MINUTE;
+}
+
+static void _addReport(int64_t timeUs, const lab_battery_event_t *pEvent)
+{
+    LAB_TEST_CHECK(_reportCount < TEST_MAX_REPORTS);
+    if (_reportCount < TEST_MAX_REPORTS)
+    {
+        _reports[_reportCount].timeUs = timeUs;
+        _reports[_reportCount].event = *pEvent;
+        _reportCount++;
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static esp_err_t _read(uint32_t *pMillivolts, bool *pCharging)
+{
+    _traceReading(esp_timer_get_time(), pMillivolts, pCharging);
+
+    return ESP_OK;
+}
+
+esp_err_t esp_event_post_to(esp_event_loop_handle_t event_loop, esp_event_base_t event_base, int32_t event_id,
+                            void * event_data, size_t event_data_size, TickType_t ticks_to_wait)
+{
+    LAB_TEST_CHECK(event_loop == &_eventLoop);
+    LAB_TEST_CHECK(event_base == LAB_BATTERY_EVENT_BASE);
+    LAB_TEST_CHECK_EQUAL(LABBATTERY_EVENT_STATE, event_id);
+    LAB_TEST_CHECK_EQUAL(sizeof(lab_battery_event_t), event_data_size);
+
+    /* The loop's queue is full. */
+    if (++_posts == _failedPost)
+    {
+        _failedPostUs = esp_timer_get_time();
+        return ESP_ERR_TIMEOUT;
+    }
+
+    _addReport(esp_timer_get_time(), event_data);
+
+    return ESP_OK;
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_soc_curve(void)
+{
+    uint32_t millivolts = 0, previous = 0, soc = 0;
+
+    LAB_TEST_CHECK_EQUAL(0, ulLabBatterySocPercent(0));
+    LAB_TEST_CHECK_EQUAL(0, ulLabBatterySocPercent(3300));
+    LAB_TEST_CHECK_EQUAL(50, ulLabBatterySocPercent(3790));
+    LAB_TEST_CHECK_EQUAL(55, ulLabBatterySocPercent(3810));
+    LAB_TEST_CHECK_EQUAL(100, ulLabBatterySocPercent(4150));
+    LAB_TEST_CHECK_EQUAL(100, ulLabBatterySocPercent(5000));
+
+    /* Continuous and increasing. */
+    for (millivolts = 3000; millivolts <= 4300; millivolts++)
+    {
+        soc = ulLabBatterySocPercent(millivolts);
+        LAB_TEST_CHECK(soc >= previous && soc <= previous + 1);
+        previous = soc;
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_trace(void)
+{
+    lab_battery_monitor_t monitor;
+    lab_battery_event_t event;
+    uint32_t millivolts = 0, rawSoc = 0, rawChanges = 0, readings = 0;
+    uint32_t previousRawSoc = UINT32_MAX;
+    bool charging = false;
+    int64_t timeUs = 0;
+    size_t i = 0;
+
+    _reportCount = 0;
+    vLabBatteryMonitorInit(&monitor);
+
+    for (timeUs = 0; timeUs < (int64_t)TEST_TRACE_MINUTES * TEST_MINUTE_US; timeUs += TEST_SAMPLE_US)
+    {
+        _traceReading(timeUs, &millivolts, &charging);
+        readings++;
+
+        /* What reporting every change of the reading would send. */
+        rawSoc = ulLabBatterySocPercent(millivolts);
+        rawChanges += rawSoc != previousRawSoc;
+        previousRawSoc = rawSoc;
+
+        if (bLabBatteryMonitorUpdate(&monitor, millivolts, charging, timeUs, &event))
+        {
+            vLabBatteryMonitorReported(&monitor, &event, timeUs);
+            _addReport(timeUs, &event);
+        }
+    }
+
+    printf("battery: %u readings, %u changes of the unfiltered state of charge, %zu reports\n",
+           readings, rawChanges, _reportCount);
+    LAB_TEST_CHECK(_reportCount > 0 && _reportCount * 20 < readings && _reportCount * 3 < rawChanges);
+
+    /* The first reading, as is. */
+    LAB_TEST_CHECK_EQUAL(0, _reports[0].timeUs);
+    LAB_TEST_CHECK_EQUAL(_trace[0], _reports[0].event.millivolts);
+
+    for (i = 1; i < _reportCount; i++)
+    {
+        const lab_battery_event_t *pPrevious = &_reports[i - 1].event;
+        const lab_battery_event_t *pEvent = &_reports[i].event;
+        int64_t sinceUs = _reports[i].timeUs - _reports[i - 1].timeUs;
+        uint32_t change = abs(pEvent->socPercent - pPrevious->socPercent);
+
+        /* Never longer than the heartbeat; sooner only for a change worth it. */
+        LAB_TEST_CHECK(sinceUs <= TEST_HEARTBEAT_US);
+        LAB_TEST_CHECK(sinceUs == TEST_HEARTBEAT_US || pEvent->charging != pPrevious->charging ||
+                       change >= LAB_BATTERY_DEADBAND_PERCENT || pEvent->socPercent == 100);
+
+        /* The noise is filtered out: down while discharging, up while charging. */
+        if (pEvent->charging == pPrevious->charging)
+        {
+            LAB_TEST_CHECK(pEvent->charging ? pEvent->socPercent >= pPrevious->socPercent
+                                            : pEvent->socPercent <= pPrevious->socPercent);
+        }
+    }
+
+    /* Plugged in: reported at once. */
+    for (i = 0; i < _reportCount && !_reports[i].event.charging; i++)
+    {
+    }
+    LAB_TEST_CHECK(i < _reportCount);
+    LAB_TEST_CHECK(i < _reportCount && _reports[i].timeUs == TEST_PLUGGED_MINUTE * TEST_MINUTE_US);
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_task_reports_a_dropped_event_again(void)
+{
+    lab_battery_event_t state;
+
+    _reportCount = 0;
+    _posts = 0;
+    _failedPost = 2;
+
+    LAB_TEST_CHECK(!bLabBatteryGetState(&state));
+    LAB_TEST_CHECK_EQUAL(ESP_OK, eLabBatteryInit(&_eventLoop, _read));
+
+    vLabTestSimRunFor((int64_t)TEST_TRACE_MINUTES * TEST_MINUTE_US);
+
+    /* The report that was dropped is posted at the next reading, instead of
+     * waiting for the next change or heartbeat. */
+    LAB_TEST_CHECK(_reportCount >= 2);
+    LAB_TEST_CHECK(_failedPostUs > 0);
+    LAB_TEST_CHECK(_reportCount >= 2 && _reports[1].timeUs == _failedPostUs + TEST_SAMPLE_US);
+    LAB_TEST_CHECK_EQUAL(_posts, _reportCount + 1);
+
+    /* The last state, for the consumers that start late. */
+    LAB_TEST_CHECK(bLabBatteryGetState(&state));
+    LAB_TEST_CHECK_EQUAL(_reports[_reportCount - 1].event.socPercent, state.socPercent);
+    LAB_TEST_CHECK(state.charging);
+}
+
+/*-----------------------------------------------------------*/
+
+int main(void)
+{
+    LAB_TEST_RUN(test_soc_curve);
+    LAB_TEST_RUN(test_trace);
+    LAB_TEST_RUN(test_task_reports_a_dropped_event_again);
+
+    return iLabTestResult();
+}
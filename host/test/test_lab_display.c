@@ -0,0 +1,185 @@
+/**
+ * @file test_lab_display.c
+ * @brief Host tests of the display compositor, drawing to the simulated
+ * framebuffer in simulated time.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include "lab_test.h"
+#include "lab_test_sim.h"
+
+#include "lab_display.h"
+
+#define TEST_FRAME_US       ( LAB_DISPLAY_FRAME_MS * 1000LL )
+
+/* Layout on the 160x80 framebuffer, 6x8 cells: rows and first columns. */
+#define TEST_TITLE_ROW      ( 2 )
+#define TEST_LAB_ROW        ( 44 )
+#define TEST_FOOTER_ROW     ( 67 )
+#define TEST_LINE_ROW       ( 64 )
+#define TEST_BATTERY_COLUMN ( 0 )
+#define TEST_STATUS_COLUMN  ( 17 )
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Check the characters at a cell of the framebuffer.
+ */
+static void _checkText(uint16_t row, size_t column, const char *pExpected)
+{
+    const char *pRow = pcLabDisplaySimRow(row);
+
+    LAB_TEST_CHECK(pRow != NULL && strncmp(pRow + column, pExpected, strlen(pExpected)) == 0);
+    if (pRow != NULL && strncmp(pRow + column, pExpected, strlen(pExpected)) != 0)
+    {
+        printf("       row %u: \"%s\", expected \"%s\" at %zu\n", row, pRow, pExpected, column);
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_layout(void)
+{
+    lab_display_stats_t stats;
+
+    /* Only the footer line, until a widget is set. */
+    vLabTestSimRunFor(TEST_FRAME_US);
+    vLabDisplayGetStats(&stats);
+    LAB_TEST_CHECK_EQUAL(0, stats.frames);
+    _checkText(TEST_LINE_ROW, 0, "--------------------------");
+    _checkText(TEST_TITLE_ROW, 0, "                          ");
+
+    /* Centered, left and right aligned. */
+    LAB_TEST_CHECK_EQUAL(ESP_OK, eLabDisplaySetText(LABDISPLAY_WIDGET_TITLE, "Amazon FreeRTOS"));
+    LAB_TEST_CHECK_EQUAL(ESP_OK, eLabDisplaySetText(LABDISPLAY_WIDGET_BATTERY, "87%"));
+    LAB_TEST_CHECK_EQUAL(ESP_OK, eLabDisplaySetText(LABDISPLAY_WIDGET_STATUS, "ON 22C"));
+    vLabTestSimRunFor(TEST_FRAME_US);
+
+    _checkText(TEST_TITLE_ROW, 0, "     Amazon FreeRTOS      ");
+    _checkText(TEST_FOOTER_ROW, TEST_BATTERY_COLUMN, "87%     ");
+    _checkText(TEST_FOOTER_ROW, TEST_STATUS_COLUMN, "   ON 22C");
+
+    /* All in one frame, one rectangle per widget. */
+    vLabDisplayGetStats(&stats);
+    LAB_TEST_CHECK_EQUAL(1, stats.frames);
+    LAB_TEST_CHECK_EQUAL(3, stats.rects);
+    LAB_TEST_CHECK_EQUAL(3, stats.updates);
+    LAB_TEST_CHECK_EQUAL(0, stats.coalesced);
+
+    /* Cut to the widget. */
+    LAB_TEST_CHECK_EQUAL(ESP_OK, eLabDisplaySetText(LABDISPLAY_WIDGET_STATUS, "HEATING 22C"));
+    vLabTestSimRunFor(TEST_FRAME_US);
+    _checkText(TEST_FOOTER_ROW, TEST_STATUS_COLUMN, "HEATING 2");
+
+    LAB_TEST_CHECK_EQUAL(ESP_ERR_INVALID_ARG, eLabDisplaySetText(LABDISPLAY_WIDGET_COUNT, "x"));
+    LAB_TEST_CHECK_EQUAL(ESP_ERR_INVALID_ARG, eLabDisplaySetText(LABDISPLAY_WIDGET_TITLE, NULL));
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_only_changes_are_drawn(void)
+{
+    lab_display_stats_t before, after;
+
+    vLabDisplayGetStats(&before);
+
+    /* One character of the battery widget. */
+    LAB_TEST_CHECK_EQUAL(ESP_OK, eLabDisplaySetText(LABDISPLAY_WIDGET_BATTERY, "86%"));
+    vLabTestSimRunFor(TEST_FRAME_US);
+    _checkText(TEST_FOOTER_ROW, TEST_BATTERY_COLUMN, "86%");
+
+    vLabDisplayGetStats(&after);
+    LAB_TEST_CHECK_EQUAL(1, after.frames - before.frames);
+    LAB_TEST_CHECK_EQUAL(1, after.rects - before.rects);
+    LAB_TEST_CHECK_EQUAL(1, after.chars - before.chars);
+
+    /* The same text again: nothing to draw. */
+    before = after;
+    LAB_TEST_CHECK_EQUAL(ESP_OK, eLabDisplaySetText(LABDISPLAY_WIDGET_BATTERY, "86%"));
+    vLabTestSimRunFor(TEST_FRAME_US);
+
+    vLabDisplayGetStats(&after);
+    LAB_TEST_CHECK_EQUAL(1, after.updates - before.updates);
+    LAB_TEST_CHECK_EQUAL(0, after.frames - before.frames);
+    LAB_TEST_CHECK_EQUAL(0, after.chars - before.chars);
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_burst_keeps_the_latest_text(void)
+{
+    lab_display_stats_t before, after;
+    char text[LAB_DISPLAY_TEXT_MAX + 1];
+    uint32_t i = 0;
+
+    vLabDisplayGetStats(&before);
+
+    /* Far more updates than a frame takes, none is refused. */
+    for (i = 0; i <= 100; i++)
+    {
+        snprintf(text, sizeof(text), "%u%%", 100 - i);
+        LAB_TEST_CHECK_EQUAL(ESP_OK, eLabDisplaySetText(LABDISPLAY_WIDGET_BATTERY, text));
+    }
+    vLabTestSimRunFor(TEST_FRAME_US);
+
+    vLabDisplayGetStats(&after);
+    _checkText(TEST_FOOTER_ROW, TEST_BATTERY_COLUMN, "0%      ");
+    LAB_TEST_CHECK_EQUAL(101, after.updates - before.updates);
+    LAB_TEST_CHECK_EQUAL(100, after.coalesced - before.coalesced);
+    LAB_TEST_CHECK_EQUAL(1, after.frames - before.frames);
+}
+
+/*-----------------------------------------------------------*/
+
+static void _tick(void *pArg)
+{
+    uint32_t *pCount = pArg;
+    char text[LAB_DISPLAY_TEXT_MAX + 1];
+
+    snprintf(text, sizeof(text), "T+%u", ++(*pCount));
+    eLabDisplaySetText(LABDISPLAY_WIDGET_LAB, text);
+
+    if (*pCount < 100)
+    {
+        vLabTestSimAt(esp_timer_get_time() + 10000, _tick, pArg);
+    }
+}
+
+static void test_frame_rate(void)
+{
+    static uint32_t count = 0;
+    lab_display_stats_t before, after;
+
+    vLabDisplayGetStats(&before);
+
+    /* An update every 10 ms for a second: a frame per LAB_DISPLAY_FRAME_MS. */
+    vLabTestSimAt(esp_timer_get_time() + 10000, _tick, &count);
+    vLabTestSimRunFor(1000000 + TEST_FRAME_US);
+
+    vLabDisplayGetStats(&after);
+    LAB_TEST_CHECK_EQUAL(100, count);
+    LAB_TEST_CHECK_EQUAL(100, after.updates - before.updates);
+    LAB_TEST_CHECK(after.frames - before.frames <= 1000 / LAB_DISPLAY_FRAME_MS + 1);
+    LAB_TEST_CHECK_EQUAL(after.updates - before.updates - (after.frames - before.frames),
+                         after.coalesced - before.coalesced);
+    _checkText(TEST_LAB_ROW, 0, "          T+100           ");
+}
+
+/*-----------------------------------------------------------*/
+
+int main(void)
+{
+    LAB_TEST_CHECK_EQUAL(ESP_ERR_INVALID_STATE, eLabDisplaySetText(LABDISPLAY_WIDGET_TITLE, "x"));
+    LAB_TEST_CHECK_EQUAL(ESP_OK, eLabDisplayInit());
+
+    LAB_TEST_RUN(test_layout);
+    LAB_TEST_RUN(test_only_changes_are_drawn);
+    LAB_TEST_RUN(test_burst_keeps_the_latest_text);
+    LAB_TEST_RUN(test_frame_rate);
+
+    vLabDisplaySimDump();
+
+    return iLabTestResult();
+}
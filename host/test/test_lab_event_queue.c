@@ -0,0 +1,269 @@
+/**
+ * @file test_lab_event_queue.c
+ * @brief Host tests of the connection event queue: the order the events are
+ * handed out in, the state events coalesced, the oversize ones refused, and
+ * callbacks posting to it at their own pace while a slow handler falls
+ * behind, in simulated time.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include "lab_test.h"
+#include "lab_test_sim.h"
+
+#include "lab_event_queue.h"
+
+/* Events as lab_connection posts them. */
+enum {
+    TEST_NETWORK_CONNECTED = 0,
+    TEST_NETWORK_DISCONNECTED,
+    TEST_MQTT_CONNECTED,
+    TEST_MQTT_DISCONNECTED,
+    TEST_RECONNECT_SCHEDULED
+};
+
+#define TEST_STATE_NETWORK  ( 0 )
+#define TEST_STATE_MQTT     ( 1 )
+
+/* A callback posting every 10 ms for 2 s, a handler taking 50 ms. */
+#define TEST_POST_PERIOD_MS ( 10 )
+#define TEST_POSTS          ( 200 )
+#define TEST_HANDLER_MS     ( 50 )
+
+/* Posting never waits on the handler: no simulated time passes. */
+#define TEST_MAX_POST_US    ( 0 )
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Take the next event and check it is the given one.
+ */
+static void _expect(int32_t id)
+{
+    lab_event_queue_event_t event;
+
+    LAB_TEST_CHECK(bLabEventQueueTake(&event));
+    LAB_TEST_CHECK_EQUAL(id, event.id);
+}
+
+static void _expectEmpty(void)
+{
+    lab_event_queue_event_t event;
+
+    LAB_TEST_CHECK(!bLabEventQueueTake(&event));
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_order(void)
+{
+    lab_connection_event_stats_t before, stats;
+
+    vLabEventQueueGetStats(&before);
+
+    /* The reconnection scheduled after the session was lost is handled
+     * before the session that followed it. */
+    LAB_TEST_CHECK_EQUAL(ESP_OK, eLabEventQueuePost(TEST_MQTT_DISCONNECTED, TEST_STATE_MQTT, NULL, 0));
+    LAB_TEST_CHECK_EQUAL(ESP_OK, eLabEventQueuePost(TEST_RECONNECT_SCHEDULED, LAB_EVENT_QUEUE_NO_STATE, NULL, 0));
+    LAB_TEST_CHECK_EQUAL(ESP_OK, eLabEventQueuePost(TEST_MQTT_CONNECTED, TEST_STATE_MQTT, NULL, 0));
+    _expect(TEST_RECONNECT_SCHEDULED);
+    _expect(TEST_MQTT_CONNECTED);
+    _expectEmpty();
+
+    /* Only the events still queued are coalesced, each state on its own. */
+    LAB_TEST_CHECK_EQUAL(ESP_OK, eLabEventQueuePost(TEST_NETWORK_CONNECTED, TEST_STATE_NETWORK, NULL, 0));
+    _expect(TEST_NETWORK_CONNECTED);
+    LAB_TEST_CHECK_EQUAL(ESP_OK, eLabEventQueuePost(TEST_NETWORK_DISCONNECTED, TEST_STATE_NETWORK, NULL, 0));
+    LAB_TEST_CHECK_EQUAL(ESP_OK, eLabEventQueuePost(TEST_MQTT_DISCONNECTED, TEST_STATE_MQTT, NULL, 0));
+    LAB_TEST_CHECK_EQUAL(ESP_OK, eLabEventQueuePost(TEST_NETWORK_CONNECTED, TEST_STATE_NETWORK, NULL, 0));
+    _expect(TEST_MQTT_DISCONNECTED);
+    _expect(TEST_NETWORK_CONNECTED);
+    _expectEmpty();
+
+    vLabEventQueueGetStats(&stats);
+    LAB_TEST_CHECK_EQUAL(before.posted + 7, stats.posted);
+    LAB_TEST_CHECK_EQUAL(before.coalesced + 2, stats.coalesced);
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_data(void)
+{
+    static const char identifier[] = "mydevice-0123456789";
+    uint8_t data[LAB_CONNECTION_EVENT_DATA_MAX_SIZE + 1] = { 0 };
+    lab_connection_event_stats_t before, stats;
+    lab_event_queue_event_t event;
+
+    vLabEventQueueGetStats(&before);
+
+    /* The data is copied, with its NULL terminator. */
+    LAB_TEST_CHECK_EQUAL(ESP_OK, eLabEventQueuePost(TEST_NETWORK_CONNECTED, TEST_STATE_NETWORK,
+                                                    identifier, sizeof(identifier)));
+    LAB_TEST_CHECK(bLabEventQueueTake(&event));
+    LAB_TEST_CHECK_EQUAL(sizeof(identifier), event.size);
+    LAB_TEST_CHECK(strcmp((const char *)event.data, identifier) == 0);
+
+    /* Data of the largest size fits, larger data is refused rather than cut. */
+    LAB_TEST_CHECK_EQUAL(ESP_OK, eLabEventQueuePost(TEST_RECONNECT_SCHEDULED, LAB_EVENT_QUEUE_NO_STATE,
+                                                    data, LAB_CONNECTION_EVENT_DATA_MAX_SIZE));
+    LAB_TEST_CHECK_EQUAL(ESP_ERR_INVALID_SIZE, eLabEventQueuePost(TEST_RECONNECT_SCHEDULED, LAB_EVENT_QUEUE_NO_STATE,
+                                                                  data, sizeof(data)));
+    LAB_TEST_CHECK_EQUAL(ESP_ERR_INVALID_SIZE, eLabEventQueuePost(TEST_MQTT_CONNECTED, TEST_STATE_MQTT,
+                                                                  data, sizeof(data)));
+    LAB_TEST_CHECK(bLabEventQueueTake(&event));
+    LAB_TEST_CHECK_EQUAL(LAB_CONNECTION_EVENT_DATA_MAX_SIZE, event.size);
+    _expectEmpty();
+
+    vLabEventQueueGetStats(&stats);
+    LAB_TEST_CHECK_EQUAL(before.oversize + 2, stats.oversize);
+    LAB_TEST_CHECK_EQUAL(before.dropped, stats.dropped);
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_full(void)
+{
+    lab_connection_event_stats_t before, stats;
+    uint32_t i = 0;
+
+    vLabEventQueueGetStats(&before);
+
+    for (i = 0; i < LAB_CONNECTION_EVENT_RING_SIZE; i++)
+    {
+        LAB_TEST_CHECK_EQUAL(ESP_OK, eLabEventQueuePost(TEST_RECONNECT_SCHEDULED, LAB_EVENT_QUEUE_NO_STATE, NULL, 0));
+    }
+    LAB_TEST_CHECK_EQUAL(ESP_ERR_NO_MEM, eLabEventQueuePost(TEST_RECONNECT_SCHEDULED, LAB_EVENT_QUEUE_NO_STATE, NULL, 0));
+
+    /* The states still get through a full ring. */
+    LAB_TEST_CHECK_EQUAL(ESP_OK, eLabEventQueuePost(TEST_MQTT_DISCONNECTED, TEST_STATE_MQTT, NULL, 0));
+    LAB_TEST_CHECK_EQUAL(ESP_OK, eLabEventQueuePost(TEST_NETWORK_DISCONNECTED, TEST_STATE_NETWORK, NULL, 0));
+
+    for (i = 0; i < LAB_CONNECTION_EVENT_RING_SIZE; i++)
+    {
+        _expect(TEST_RECONNECT_SCHEDULED);
+    }
+    _expect(TEST_MQTT_DISCONNECTED);
+    _expect(TEST_NETWORK_DISCONNECTED);
+    _expectEmpty();
+
+    vLabEventQueueGetStats(&stats);
+    LAB_TEST_CHECK_EQUAL(before.dropped + 1, stats.dropped);
+}
+
+/*-----------------------------------------------------------*/
+
+static TaskHandle_t _dispatcher = NULL;
+static uint32_t _handled = 0;
+static int32_t _lastState = -1;
+static int64_t _maxLateUs = 0;
+
+/**
+ * @brief The dispatcher task of lab_connection, with a handler that takes
+ * TEST_HANDLER_MS for each event.
+ */
+static void _dispatchTask(void *pArg)
+{
+    lab_event_queue_event_t event;
+
+    for (;;)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        while (bLabEventQueueTake(&event))
+        {
+            vTaskDelay(pdMS_TO_TICKS(TEST_HANDLER_MS));
+            _handled++;
+
+            if (event.id == TEST_MQTT_CONNECTED || event.id == TEST_MQTT_DISCONNECTED)
+            {
+                _lastState = event.id;
+            }
+        }
+    }
+}
+
+/**
+ * @brief A callback thread of the MQTT library: an event every
+ * TEST_POST_PERIOD_MS, the session lost and back every tenth.
+ */
+static void _callbackTask(void *pArg)
+{
+    TickType_t xNext = xTaskGetTickCount();
+    int64_t dueUs = esp_timer_get_time();
+    uint32_t i = 0;
+
+    for (i = 0; i < TEST_POSTS; i++)
+    {
+        if (esp_timer_get_time() - dueUs > _maxLateUs)
+        {
+            _maxLateUs = esp_timer_get_time() - dueUs;
+        }
+
+        if (i % 10 == 9)
+        {
+            (void)eLabEventQueuePost((i / 10) % 2 ? TEST_MQTT_CONNECTED : TEST_MQTT_DISCONNECTED,
+                                     TEST_STATE_MQTT, NULL, 0);
+        }
+        else
+        {
+            (void)eLabEventQueuePost(TEST_RECONNECT_SCHEDULED, LAB_EVENT_QUEUE_NO_STATE, &i, sizeof(i));
+        }
+        xTaskNotifyGive(_dispatcher);
+
+        dueUs += TEST_POST_PERIOD_MS * 1000LL;
+        vTaskDelayUntil(&xNext, pdMS_TO_TICKS(TEST_POST_PERIOD_MS));
+    }
+
+    vTaskDelete(NULL);
+}
+
+static void test_slow_handler(void)
+{
+    lab_connection_event_stats_t before, stats;
+    uint32_t posted = 0;
+
+    vLabEventQueueGetStats(&before);
+
+    xTaskCreate(_dispatchTask, "dispatch", 2048, NULL, 6, &_dispatcher);
+    xTaskCreate(_callbackTask, "callback", 2048, NULL, 5, NULL);
+
+    /* Until the handler is done with what is left. */
+    vLabTestSimRunFor((TEST_POSTS * TEST_POST_PERIOD_MS + (LAB_CONNECTION_EVENT_RING_SIZE + 2) * TEST_HANDLER_MS) * 1000LL);
+
+    vLabEventQueueGetStats(&stats);
+    posted = stats.posted - before.posted;
+    printf("event queue: %u posted, %u handled, %u dropped, %u coalesced, longest post %u us, callback late by %lld us at most\n",
+           posted, _handled, stats.dropped - before.dropped, stats.coalesced - before.coalesced,
+           stats.maxPostUs, (long long)_maxLateUs);
+
+    /* The callback kept its pace, whatever the handler. */
+    LAB_TEST_CHECK_EQUAL(TEST_POSTS, posted);
+    LAB_TEST_CHECK(stats.maxPostUs <= TEST_MAX_POST_US);
+    LAB_TEST_CHECK_EQUAL(0, _maxLateUs);
+
+    /* What the handler could not keep up with is counted. */
+    LAB_TEST_CHECK(stats.dropped > before.dropped);
+    LAB_TEST_CHECK_EQUAL(posted, _handled + (stats.dropped - before.dropped) + (stats.coalesced - before.coalesced));
+    _expectEmpty();
+
+    /* The handler saw the last state. */
+    LAB_TEST_CHECK_EQUAL((TEST_POSTS / 10 - 1) % 2 ? TEST_MQTT_CONNECTED : TEST_MQTT_DISCONNECTED, _lastState);
+}
+
+/*-----------------------------------------------------------*/
+
+int main(void)
+{
+    if (eLabEventQueueInit() != ESP_OK)
+    {
+        return EXIT_FAILURE;
+    }
+
+    LAB_TEST_RUN(test_order);
+    LAB_TEST_RUN(test_data);
+    LAB_TEST_RUN(test_full);
+    LAB_TEST_RUN(test_slow_handler);
+
+    return iLabTestResult();
+}
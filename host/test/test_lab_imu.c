@@ -0,0 +1,204 @@
+/**
+ * @file test_lab_imu.c
+ * @brief Host tests of the IMU sampling task and its ring, on the simulated
+ * IMU and in simulated time. Built once per decimation.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include <time.h>
+
+#include "lab_test.h"
+#include "lab_test_sim.h"
+
+#include "lab_imu.h"
+
+#if LAB_IMU_MOTION_THRESHOLD_MG != 0
+    #error "test_lab_imu samples continuously, see test_lab_imu_motion"
+#endif
+
+/* Time between two ring samples. */
+#define TEST_PERIOD_US      ( (int64_t)LAB_IMU_DECIMATION * 1000000 / LAB_IMU_ODR_HZ )
+
+#define TEST_SAMPLES(durationUs)    ( (uint32_t)((durationUs) / TEST_PERIOD_US) )
+
+static lab_imu_sample_t _samples[LAB_IMU_RING_SIZE];
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Check the samples are in the simulated signal's range, and count
+ * the gaps between them longer than the period.
+ *
+ * @param   pPreviousUs time of the sample before, 0 for none; updated
+ */
+static uint32_t _checkSamples(const lab_imu_sample_t *pSamples, size_t count, int64_t *pPreviousUs)
+{
+    uint32_t gaps = 0;
+    size_t i = 0;
+
+    for (i = 0; i < count; i++)
+    {
+        /* 1 g and the vibration on Z, gravity free X and Y but for the sway. */
+        LAB_TEST_CHECK(pSamples[i].accel[2] > 0.9 * LAB_IMU_ACCEL_LSB_PER_G &&
+                       pSamples[i].accel[2] < 1.1 * LAB_IMU_ACCEL_LSB_PER_G);
+        LAB_TEST_CHECK(abs(pSamples[i].accel[0]) < 0.25 * LAB_IMU_ACCEL_LSB_PER_G);
+        LAB_TEST_CHECK_EQUAL(0, pSamples[i].accel[1]);
+        LAB_TEST_CHECK_EQUAL(164, pSamples[i].gyro[2]);
+        LAB_TEST_CHECK_EQUAL(1634, pSamples[i].temp);
+
+        if (*pPreviousUs != 0)
+        {
+            LAB_TEST_CHECK(pSamples[i].timeUs - *pPreviousUs >= TEST_PERIOD_US);
+            if (pSamples[i].timeUs - *pPreviousUs > TEST_PERIOD_US)
+            {
+                gaps++;
+            }
+        }
+        *pPreviousUs = pSamples[i].timeUs;
+    }
+
+    return gaps;
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_samples_at_the_ring_rate(void)
+{
+    lab_imu_reader_t reader;
+    lab_imu_stats_t before, after;
+    int64_t previousUs = 0;
+    uint32_t total = 0, gaps = 0, i = 0;
+    size_t count = 0;
+
+    vLabImuGetStats(&before);
+    vLabImuReaderInit(&reader);
+
+    /* A consumer reading every 100 ms, for a second. */
+    for (i = 0; i < 10; i++)
+    {
+        vLabTestSimRunFor(100000);
+        count = xLabImuRead(&reader, _samples, LAB_IMU_RING_SIZE);
+        gaps += _checkSamples(_samples, count, &previousUs);
+        total += count;
+    }
+
+    vLabImuGetStats(&after);
+    LAB_TEST_CHECK_EQUAL(TEST_SAMPLES(1000000), total);
+    LAB_TEST_CHECK_EQUAL(0, gaps);
+    LAB_TEST_CHECK_EQUAL(0, reader.lost);
+    LAB_TEST_CHECK_EQUAL(LAB_IMU_ODR_HZ, after.frames - before.frames);
+    LAB_TEST_CHECK_EQUAL(TEST_SAMPLES(1000000), after.samples - before.samples);
+
+    /* Drained every LAB_IMU_POLL_MS, the FIFO never fills. */
+    LAB_TEST_CHECK_EQUAL(LAB_IMU_POLL_MS * LAB_IMU_ODR_HZ / 1000, after.maxFifoFrames);
+    LAB_TEST_CHECK_EQUAL(0, after.fifoOverruns);
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_slow_reader_loses_the_oldest(void)
+{
+    lab_imu_reader_t reader;
+    lab_imu_stats_t before, after;
+    int64_t previousUs = 0;
+    size_t count = 0;
+
+    vLabImuGetStats(&before);
+    vLabImuReaderInit(&reader);
+
+    /* About twice what the ring holds. */
+    vLabTestSimRunFor(2 * LAB_IMU_RING_SIZE * TEST_PERIOD_US);
+
+    vLabImuGetStats(&after);
+    LAB_TEST_CHECK(after.samples - before.samples >= 2 * LAB_IMU_RING_SIZE - LAB_IMU_POLL_MS * 1000 / TEST_PERIOD_US);
+
+    count = xLabImuRead(&reader, _samples, LAB_IMU_RING_SIZE);
+    LAB_TEST_CHECK_EQUAL(after.samples - before.samples, count + reader.lost);
+    /* The oldest slot may be being overwritten: it is dropped too. */
+    LAB_TEST_CHECK(count >= LAB_IMU_RING_SIZE - 1);
+    LAB_TEST_CHECK_EQUAL(0, _checkSamples(_samples, count, &previousUs));
+
+    /* Caught up. */
+    LAB_TEST_CHECK_EQUAL(0, xLabImuRead(&reader, _samples, LAB_IMU_RING_SIZE));
+}
+
+/*-----------------------------------------------------------*/
+
+static void _stall(void *pArg)
+{
+    vLabImuSimStall(500);
+}
+
+static void test_fifo_overrun(void)
+{
+    lab_imu_reader_t reader;
+    lab_imu_stats_t before, after;
+    int64_t previousUs = 0;
+    uint32_t gaps = 0, i = 0;
+
+    vLabImuGetStats(&before);
+    vLabImuReaderInit(&reader);
+
+    for (i = 0; i < 10; i++)
+    {
+        /* The bus hangs for longer than the FIFO lasts. */
+        if (i == 2)
+        {
+            vLabTestSimAt(esp_timer_get_time() + 20000, _stall, NULL);
+        }
+
+        vLabTestSimRunFor(100000);
+        gaps += _checkSamples(_samples, xLabImuRead(&reader, _samples, LAB_IMU_RING_SIZE), &previousUs);
+    }
+
+    vLabImuGetStats(&after);
+    LAB_TEST_CHECK_EQUAL(1, after.fifoOverruns - before.fifoOverruns);
+    LAB_TEST_CHECK_EQUAL(0, after.readErrors);
+    /* One hole in the samples, then back to the rate. */
+    LAB_TEST_CHECK_EQUAL(1, gaps);
+    LAB_TEST_CHECK_EQUAL(0, reader.lost);
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_reader_benchmark(void)
+{
+    static volatile size_t sink = 0;
+    lab_imu_reader_t reader;
+    struct timespec start, end;
+    uint32_t i = 0;
+    double ns = 0;
+
+    vLabImuReaderInit(&reader);
+    vLabTestSimRunFor(LAB_IMU_RING_SIZE * TEST_PERIOD_US);
+
+    /* Reads of 32 samples, over and over. */
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < 100000; i++)
+    {
+        vLabImuReaderInit(&reader);
+        reader.next -= 32;
+        sink += xLabImuRead(&reader, _samples, 32);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    ns = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / (100000.0 * 32);
+    printf("xLabImuRead: %.1f ns per sample of %zu bytes\n", ns, sizeof(lab_imu_sample_t));
+    LAB_TEST_CHECK_EQUAL(100000 * 32, sink);
+}
+
+/*-----------------------------------------------------------*/
+
+int main(void)
+{
+    LAB_TEST_CHECK_EQUAL(ESP_OK, eLabImuInit(NULL));
+
+    LAB_TEST_RUN(test_samples_at_the_ring_rate);
+    LAB_TEST_RUN(test_slow_reader_loses_the_oldest);
+    LAB_TEST_RUN(test_fifo_overrun);
+    LAB_TEST_RUN(test_reader_benchmark);
+
+    return iLabTestResult();
+}
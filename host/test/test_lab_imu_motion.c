@@ -0,0 +1,224 @@
+/**
+ * @file test_lab_imu_motion.c
+ * @brief Host tests of wake-on-motion: the sampling task sleeps while the
+ * simulated device is still, and posts the motion events, in simulated time.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include "lab_test.h"
+#include "lab_test_sim.h"
+
+#include "lab_imu.h"
+
+#if LAB_IMU_MOTION_THRESHOLD_MG == 0
+    #error "test_lab_imu_motion needs wake-on-motion, see test_lab_imu"
+#endif
+
+#define TEST_POLL_US        ( LAB_IMU_POLL_MS * 1000LL )
+#define TEST_QUIET_US       ( LAB_IMU_MOTION_QUIET_MS * 1000LL )
+#define TEST_MAX_EVENTS     ( 8 )
+
+typedef struct
+{
+    int64_t postedUs;
+    int32_t id;
+    lab_imu_motion_event_t data;
+} _event_t;
+
+static _event_t _events[TEST_MAX_EVENTS];
+static size_t _eventCount = 0;
+
+/* Events are only posted to a loop: any handle will do. */
+static int _eventLoop = 0;
+
+/*-----------------------------------------------------------*/
+
+esp_err_t esp_event_post_to(esp_event_loop_handle_t event_loop, esp_event_base_t event_base, int32_t event_id,
+                            void * event_data, size_t event_data_size, TickType_t ticks_to_wait)
+{
+    LAB_TEST_CHECK(event_loop == &_eventLoop);
+    LAB_TEST_CHECK(event_base == LAB_IMU_EVENT_BASE);
+    LAB_TEST_CHECK_EQUAL(sizeof(lab_imu_motion_event_t), event_data_size);
+    LAB_TEST_CHECK(_eventCount < TEST_MAX_EVENTS);
+
+    if (_eventCount < TEST_MAX_EVENTS)
+    {
+        _events[_eventCount].postedUs = esp_timer_get_time();
+        _events[_eventCount].id = event_id;
+        memcpy(&_events[_eventCount].data, event_data, sizeof(lab_imu_motion_event_t));
+        _eventCount++;
+    }
+
+    return ESP_OK;
+}
+
+/*-----------------------------------------------------------*/
+
+static void _move(void *pArg)
+{
+    vLabImuSimMotion(true);
+}
+
+static void _stop(void *pArg)
+{
+    vLabImuSimMotion(false);
+}
+
+/**
+ * @brief Schedule a motion from startUs to stopUs after now.
+ */
+static void _motion(int64_t startUs, int64_t stopUs)
+{
+    vLabTestSimAt(esp_timer_get_time() + startUs, _move, NULL);
+    vLabTestSimAt(esp_timer_get_time() + stopUs, _stop, NULL);
+}
+
+/**
+ * @brief Check the next event, posted within a poll period after postedUs.
+ */
+static void _checkEvent(size_t index, int32_t id, int64_t postedUs, uint32_t durationMs)
+{
+    LAB_TEST_CHECK(index < _eventCount);
+    if (index >= _eventCount)
+    {
+        return;
+    }
+
+    LAB_TEST_CHECK_EQUAL(id, _events[index].id);
+    LAB_TEST_CHECK(_events[index].postedUs >= postedUs && _events[index].postedUs <= postedUs + TEST_POLL_US);
+    LAB_TEST_CHECK(_events[index].data.timeUs <= _events[index].postedUs);
+    LAB_TEST_CHECK(_events[index].data.durationMs + LAB_IMU_POLL_MS >= durationMs &&
+                   _events[index].data.durationMs <= durationMs);
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_sleeps_until_motion(void)
+{
+    lab_imu_stats_t before, after;
+    int64_t startUs = esp_timer_get_time();
+
+    vLabImuGetStats(&before);
+
+    /* Still: not a sample, not an event. */
+    vLabTestSimRunFor(10000000);
+    vLabImuGetStats(&after);
+    LAB_TEST_CHECK_EQUAL(0, after.frames - before.frames);
+    LAB_TEST_CHECK_EQUAL(0, after.wakeups - before.wakeups);
+    LAB_TEST_CHECK_EQUAL(0, _eventCount);
+    LAB_TEST_CHECK(!bIsLabImuMoving());
+
+    /* Moving for 2 s: sampled until the quiet time after it. */
+    startUs = esp_timer_get_time();
+    _motion(1000000, 2975000);
+    vLabTestSimRunFor(1000000 + TEST_POLL_US);
+    LAB_TEST_CHECK(bIsLabImuMoving());
+    vLabTestSimRunFor(10000000);
+
+    vLabImuGetStats(&after);
+    LAB_TEST_CHECK_EQUAL(1, after.wakeups - before.wakeups);
+    LAB_TEST_CHECK(!bIsLabImuMoving());
+    LAB_TEST_CHECK_EQUAL(2, _eventCount);
+    _checkEvent(0, LABIMU_EVENT_MOTION_START, startUs + 1000000, 0);
+    _checkEvent(1, LABIMU_EVENT_MOTION_STOP, startUs + 2975000 + TEST_QUIET_US - TEST_POLL_US, 1975);
+
+    /* Samples from the wake up to the end of the quiet time, none after. */
+    LAB_TEST_CHECK(after.frames - before.frames >= (1975000 + TEST_QUIET_US - TEST_POLL_US) * LAB_IMU_ODR_HZ / 1000000);
+    LAB_TEST_CHECK(after.frames - before.frames <= (1975000 + TEST_QUIET_US + TEST_POLL_US) * LAB_IMU_ODR_HZ / 1000000);
+    LAB_TEST_CHECK_EQUAL(0, after.fifoOverruns - before.fifoOverruns);
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_twitch(void)
+{
+    int64_t startUs = esp_timer_get_time();
+
+    /* Gone before the first poll: a wake up, no motion afterwards. */
+    _eventCount = 0;
+    _motion(1000000, 1010000);
+    vLabTestSimRunFor(10000000);
+
+    LAB_TEST_CHECK_EQUAL(2, _eventCount);
+    _checkEvent(0, LABIMU_EVENT_MOTION_START, startUs + 1000000, 0);
+    _checkEvent(1, LABIMU_EVENT_MOTION_STOP, startUs + 1000000 + TEST_QUIET_US, 0);
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_motion_within_the_quiet_time(void)
+{
+    lab_imu_stats_t before, after;
+    int64_t startUs = esp_timer_get_time();
+
+    /* Two motions closer than the quiet time are one. */
+    _eventCount = 0;
+    vLabImuGetStats(&before);
+    _motion(1000000, 1975000);
+    _motion(4000000, 4975000);
+    vLabTestSimRunFor(15000000);
+
+    vLabImuGetStats(&after);
+    LAB_TEST_CHECK_EQUAL(1, after.wakeups - before.wakeups);
+    LAB_TEST_CHECK_EQUAL(2, _eventCount);
+    _checkEvent(0, LABIMU_EVENT_MOTION_START, startUs + 1000000, 0);
+    _checkEvent(1, LABIMU_EVENT_MOTION_STOP, startUs + 4975000 + TEST_QUIET_US - TEST_POLL_US, 3975);
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_reader_across_sleep(void)
+{
+    static lab_imu_sample_t samples[LAB_IMU_RING_SIZE];
+    lab_imu_reader_t reader;
+    lab_imu_stats_t before, after;
+    int64_t previousUs = 0;
+    uint32_t total = 0, holes = 0, i = 0;
+    size_t count = 0, n = 0;
+
+    vLabImuGetStats(&before);
+    vLabImuReaderInit(&reader);
+
+    /* Two motions far apart, read every 500 ms: one hole in the timestamps,
+     * the sleep, and no loss. */
+    _motion(1000000, 1500000);
+    _motion(12000000, 12500000);
+    for (i = 0; i < 40; i++)
+    {
+        vLabTestSimRunFor(500000);
+        count = xLabImuRead(&reader, samples, LAB_IMU_RING_SIZE);
+        for (n = 0; n < count; n++)
+        {
+            if (previousUs != 0 && samples[n].timeUs - previousUs > TEST_QUIET_US)
+            {
+                holes++;
+            }
+            previousUs = samples[n].timeUs;
+        }
+        total += count;
+    }
+
+    vLabImuGetStats(&after);
+    LAB_TEST_CHECK_EQUAL(1, holes);
+    LAB_TEST_CHECK_EQUAL(after.samples - before.samples, total);
+    LAB_TEST_CHECK_EQUAL(0, reader.lost);
+    LAB_TEST_CHECK_EQUAL(2, after.wakeups - before.wakeups);
+}
+
+/*-----------------------------------------------------------*/
+
+int main(void)
+{
+    /* Still from the start: the task goes to sleep at once. */
+    vLabImuSimMotion(false);
+    LAB_TEST_CHECK_EQUAL(ESP_OK, eLabImuInit(&_eventLoop));
+
+    LAB_TEST_RUN(test_sleeps_until_motion);
+    LAB_TEST_RUN(test_twitch);
+    LAB_TEST_RUN(test_motion_within_the_quiet_time);
+    LAB_TEST_RUN(test_reader_across_sleep);
+
+    return iLabTestResult();
+}
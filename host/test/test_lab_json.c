@@ -0,0 +1,316 @@
+/**
+ * @file test_lab_json.c
+ * @brief Host tests of the single-pass JSON reader, on Shadow documents, and
+ * its benchmark against a lookup of each key from the start of the document.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include <time.h>
+
+#include "lab_test.h"
+
+#include "lab_json.h"
+
+#define TEST_BENCHMARK_RUNS ( 200000 )
+
+/* A Shadow delta of lab2, and one of a larger schema: metadata, version and
+ * timestamp as the Shadow service sends them. */
+static const char _delta2[] =
+    "{\"version\":1234,\"timestamp\":1571234567,"
+    "\"state\":{\"powerOn\":1,\"temperature\":22},"
+    "\"metadata\":{\"powerOn\":{\"timestamp\":1571234567},\"temperature\":{\"timestamp\":1571234567}}}";
+
+static const char _delta8[] =
+    "{\"version\":1234,\"timestamp\":1571234567,"
+    "\"state\":{\"powerOn\":1,\"temperature\":22,\"fanSpeed\":3,\"mode\":2,"
+    "\"swing\":false,\"timerMinutes\":90,\"ecoMode\":true,\"humidity\":45},"
+    "\"metadata\":{\"powerOn\":{\"timestamp\":1571234567},\"temperature\":{\"timestamp\":1571234567},"
+    "\"fanSpeed\":{\"timestamp\":1571234567},\"mode\":{\"timestamp\":1571234567},"
+    "\"swing\":{\"timestamp\":1571234567},\"timerMinutes\":{\"timestamp\":1571234567},"
+    "\"ecoMode\":{\"timestamp\":1571234567},\"humidity\":{\"timestamp\":1571234567}}}";
+
+static const lab_json_field_t _fields[] = {
+    LAB_JSON_FIELD("powerOn", LABJSON_TYPE_BOOL),
+    LAB_JSON_FIELD("temperature", LABJSON_TYPE_INT),
+    LAB_JSON_FIELD("fanSpeed", LABJSON_TYPE_INT),
+    LAB_JSON_FIELD("mode", LABJSON_TYPE_INT),
+    LAB_JSON_FIELD("swing", LABJSON_TYPE_BOOL),
+    LAB_JSON_FIELD("timerMinutes", LABJSON_TYPE_INT),
+    LAB_JSON_FIELD("ecoMode", LABJSON_TYPE_BOOL),
+    LAB_JSON_FIELD("humidity", LABJSON_TYPE_INT),
+};
+
+#define TEST_FIELD_COUNT    ( sizeof(_fields) / sizeof(_fields[0]) )
+
+static const int32_t _expected8[TEST_FIELD_COUNT] = { 1, 22, 3, 2, 0, 90, 1, 45 };
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Read a document, a string literal, into values.
+ */
+#define TEST_READ(document, pObjectKey, count, pValues) \
+    eLabJsonRead(document, sizeof(document) - 1, pObjectKey, _fields, count, pValues)
+
+static void _checkValue(const lab_json_value_t *pValue, bool found, int32_t value)
+{
+    LAB_TEST_CHECK_EQUAL(found, pValue->found);
+    if (found)
+    {
+        LAB_TEST_CHECK_EQUAL(value, pValue->value);
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_shadow_documents(void)
+{
+    lab_json_value_t values[TEST_FIELD_COUNT];
+    size_t i = 0;
+
+    /* A delta: the keys of "state" only, not those of "metadata". */
+    LAB_TEST_CHECK_EQUAL(ESP_OK, TEST_READ(_delta8, "state", TEST_FIELD_COUNT, values));
+    for (i = 0; i < TEST_FIELD_COUNT; i++)
+    {
+        _checkValue(&values[i], true, _expected8[i]);
+    }
+
+    LAB_TEST_CHECK_EQUAL(ESP_OK, TEST_READ(_delta2, "state", TEST_FIELD_COUNT, values));
+    _checkValue(&values[0], true, 1);
+    _checkValue(&values[1], true, 22);
+    for (i = 2; i < TEST_FIELD_COUNT; i++)
+    {
+        _checkValue(&values[i], false, 0);
+    }
+
+    /* The document of a Shadow read, down a path; the reported section and
+     * white space on the way. */
+    LAB_TEST_CHECK_EQUAL(ESP_OK, TEST_READ(
+        "{ \"state\" : { \"reported\" : { \"powerOn\" : 0, \"temperature\" : 35 },\n"
+        "  \"desired\" : { \"powerOn\" : true, \"temperature\" : 20 } }, \"version\" : 7 }",
+        "state.desired", 2, values));
+    _checkValue(&values[0], true, 1);
+    _checkValue(&values[1], true, 20);
+
+    /* The top-level object itself. */
+    LAB_TEST_CHECK_EQUAL(ESP_OK, TEST_READ("{\"temperature\":-5}", NULL, 2, values));
+    _checkValue(&values[0], false, 0);
+    _checkValue(&values[1], true, -5);
+
+    LAB_TEST_CHECK_EQUAL(ESP_ERR_NOT_FOUND, TEST_READ("{\"version\":3}", "state", 2, values));
+    LAB_TEST_CHECK_EQUAL(ESP_ERR_NOT_FOUND, TEST_READ("{\"state\":{}}", "state.desired", 2, values));
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_values(void)
+{
+    lab_json_value_t values[TEST_FIELD_COUNT];
+
+    /* Of the wrong type, or out of the int32 range: not found. */
+    LAB_TEST_CHECK_EQUAL(ESP_OK, TEST_READ(
+        "{\"powerOn\":2,\"temperature\":\"22\",\"fanSpeed\":2147483648,\"mode\":-2147483648,"
+        "\"swing\":null,\"timerMinutes\":1.5,\"ecoMode\":{\"on\":1},\"humidity\":[45]}",
+        NULL, TEST_FIELD_COUNT, values));
+    _checkValue(&values[0], false, 0);
+    _checkValue(&values[1], false, 0);
+    _checkValue(&values[2], false, 0);
+    _checkValue(&values[3], true, INT32_MIN);
+    _checkValue(&values[4], false, 0);
+    _checkValue(&values[5], false, 0);
+    _checkValue(&values[6], false, 0);
+    _checkValue(&values[7], false, 0);
+
+    /* Keys as written, escapes included; the last of a repeated key. */
+    LAB_TEST_CHECK_EQUAL(ESP_OK, TEST_READ(
+        "{\"power\\\"On\":1,\"x\":\"a\\\\\",\"temperature\":21,\"temperature\":23,\"powerOn\":false}",
+        NULL, 2, values));
+    _checkValue(&values[0], true, 0);
+    _checkValue(&values[1], true, 23);
+
+    /* Not NULL-terminated: the length is the end. */
+    LAB_TEST_CHECK_EQUAL(ESP_OK, eLabJsonRead("{\"temperature\":12}99", 18, NULL, _fields, 2, values));
+    _checkValue(&values[1], true, 12);
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_malformed(void)
+{
+    static const char *const documents[] = {
+        "",
+        "[]",
+        "{\"state\":{\"temperature\":22",
+        "{\"state\":{\"temperature\" 22}}",
+        "{\"state\":{\"temperature\":22,}}",
+        "{\"state\":{\"temperature\":22 \"powerOn\":1}}",
+        "{\"metadata\":{\"a\":[1,2},\"state\":{\"temperature\":22}}",
+        "{\"state\":{\"temperature\":22,\"x\":\"unterminated}}",
+        "{\"a\":[[[[[[[[[[[[[[[[[[0]]]]]]]]]]]]]]]]],\"state\":{\"temperature\":22}}",
+    };
+    lab_json_value_t values[TEST_FIELD_COUNT];
+    size_t i = 0;
+
+    /* Nothing read is used, even what was read before the error. */
+    for (i = 0; i < sizeof(documents) / sizeof(documents[0]); i++)
+    {
+        LAB_TEST_CHECK_EQUAL(ESP_ERR_INVALID_ARG,
+                             eLabJsonRead(documents[i], strlen(documents[i]), "state", _fields, 2, values));
+        _checkValue(&values[1], false, 0);
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief The lookup lab2 made before lab_json, as IotJsonUtils_FindJsonValue
+ * does it: the key searched from the start of the document, then the end of
+ * its value found by matching the brackets.
+ */
+static bool _findJsonValue(const char *pDocument, size_t documentLength,
+                           const char *pKey, size_t keyLength,
+                           const char **ppValue, size_t *pValueLength)
+{
+    size_t i = 0, start = 0, depth = 0;
+    bool inString = false;
+
+    for (i = 0; i + keyLength + 2 < documentLength; i++)
+    {
+        if (pDocument[i] == '"' && strncmp(&pDocument[i + 1], pKey, keyLength) == 0 &&
+            pDocument[i + keyLength + 1] == '"')
+        {
+            break;
+        }
+    }
+
+    for (i += keyLength + 2; i < documentLength && (pDocument[i] == ' ' || pDocument[i] == ':'); i++)
+    {
+    }
+
+    if (i >= documentLength)
+    {
+        return false;
+    }
+
+    for (start = i; i < documentLength; i++)
+    {
+        if (inString)
+        {
+            inString = pDocument[i] != '"' || pDocument[i - 1] == '\\';
+        }
+        else if (pDocument[i] == '"')
+        {
+            inString = true;
+        }
+        else if (pDocument[i] == '{' || pDocument[i] == '[')
+        {
+            depth++;
+        }
+        else if (pDocument[i] == '}' || pDocument[i] == ']')
+        {
+            if (depth == 0)
+            {
+                break;
+            }
+            if (--depth == 0)
+            {
+                i++;
+                break;
+            }
+        }
+        else if (pDocument[i] == ',' && depth == 0)
+        {
+            break;
+        }
+    }
+
+    *ppValue = &pDocument[start];
+    *pValueLength = i - start;
+
+    return true;
+}
+
+/**
+ * @brief What _getDelta did for each key: "state", then the key in it, then
+ * atoi on the slice.
+ */
+static void _readEachKey(const char *pDocument, size_t documentLength, size_t count, int32_t *pValues)
+{
+    const char *pState = NULL, *pValue = NULL;
+    size_t stateLength = 0, valueLength = 0;
+    size_t i = 0;
+
+    for (i = 0; i < count; i++)
+    {
+        if (_findJsonValue(pDocument, documentLength, "state", 5, &pState, &stateLength) &&
+            _findJsonValue(pState, stateLength, _fields[i].pKey, _fields[i].keyLength, &pValue, &valueLength))
+        {
+            pValues[i] = pValue[0] == 't' ? 1 : atoi(pValue);
+        }
+    }
+}
+
+static double _elapsedNs(const struct timespec *pStart, const struct timespec *pEnd)
+{
+    return ((pEnd->tv_sec - pStart->tv_sec) * 1e9 + (pEnd->tv_nsec - pStart->tv_nsec)) / TEST_BENCHMARK_RUNS;
+}
+
+static void _benchmark(const char *pDocument, size_t documentLength, size_t count)
+{
+    static volatile int32_t sink = 0;
+    lab_json_value_t values[TEST_FIELD_COUNT];
+    int32_t previous[TEST_FIELD_COUNT] = {0};
+    struct timespec start, end;
+    double eachKeyNs = 0, onePassNs = 0;
+    uint32_t run = 0;
+    size_t i = 0;
+
+    /* Both read the same values. */
+    _readEachKey(pDocument, documentLength, count, previous);
+    LAB_TEST_CHECK_EQUAL(ESP_OK, eLabJsonRead(pDocument, documentLength, "state", _fields, count, values));
+    for (i = 0; i < count; i++)
+    {
+        LAB_TEST_CHECK_EQUAL(previous[i], values[i].value);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (run = 0; run < TEST_BENCHMARK_RUNS; run++)
+    {
+        _readEachKey(pDocument, documentLength, count, previous);
+        sink += previous[count - 1];
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    eachKeyNs = _elapsedNs(&start, &end);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (run = 0; run < TEST_BENCHMARK_RUNS; run++)
+    {
+        eLabJsonRead(pDocument, documentLength, "state", _fields, count, values);
+        sink += values[count - 1].value;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    onePassNs = _elapsedNs(&start, &end);
+
+    printf("lab_json: %zu keys in %zu bytes, %.0f ns a key at a time, %.0f ns in one pass\n",
+           count, documentLength, eachKeyNs, onePassNs);
+}
+
+static void test_benchmark(void)
+{
+    _benchmark(_delta2, sizeof(_delta2) - 1, 2);
+    _benchmark(_delta8, sizeof(_delta8) - 1, TEST_FIELD_COUNT);
+}
+
+/*-----------------------------------------------------------*/
+
+int main(void)
+{
+    LAB_TEST_RUN(test_shadow_documents);
+    LAB_TEST_RUN(test_values);
+    LAB_TEST_RUN(test_malformed);
+    LAB_TEST_RUN(test_benchmark);
+
+    return iLabTestResult();
+}
@@ -0,0 +1,227 @@
+/**
+ * @file test_lab_metrics.c
+ * @brief Host tests of the latency histograms: the bucket boundaries, the
+ * JSON document published on the metrics topic, and a microbenchmark of
+ * recording an operation.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include <time.h>
+
+#include "lab_test.h"
+
+#include "lab_metrics.h"
+
+#define TEST_BENCH_RECORDS      ( 1000000 )
+
+/* The clock of ulLabMetricsStart and vLabMetricsRecord. */
+static int64_t _nowUs = 0;
+
+int64_t esp_timer_get_time(void)
+{
+    return _nowUs;
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Record an operation that took the given time.
+ */
+static void _record(lab_metrics_op_t op, uint32_t elapsedMs, bool success)
+{
+    uint32_t startMs = ulLabMetricsStart();
+
+    _nowUs += elapsedMs * 1000LL;
+    vLabMetricsRecord(op, startMs, success);
+}
+
+static bool _equals(const char *pBuffer, size_t length, const char *pExpected, size_t expectedLength)
+{
+    if (length != expectedLength || memcmp(pBuffer, pExpected, length) != 0)
+    {
+        printf("got %zu bytes: %.*s\n", length, (int)length, pBuffer);
+        return false;
+    }
+
+    return true;
+}
+
+#define TEST_EQUALS(pBuffer, length, expected) \
+    LAB_TEST_CHECK(_equals((pBuffer), (length), (expected), sizeof(expected) - 1))
+
+/*-----------------------------------------------------------*/
+
+static void test_bucket_boundaries(void)
+{
+    /* Each latency with the bucket it falls in. */
+    static const struct {
+        uint32_t elapsedMs;
+        uint32_t bucket;
+    } latencies[] = {
+        { 0, 0 },
+        { 1, 1 },
+        { 2, 2 }, { 3, 2 },
+        { 4, 3 }, { 7, 3 },
+        { 8, 4 },
+        { (1u << (LAB_METRICS_BUCKETS - 2)) - 1, LAB_METRICS_BUCKETS - 2 },
+        { 1u << (LAB_METRICS_BUCKETS - 2), LAB_METRICS_BUCKETS - 1 },
+        { UINT32_MAX / 2, LAB_METRICS_BUCKETS - 1 },
+    };
+    uint32_t expected[LAB_METRICS_BUCKETS] = { 0 };
+    lab_metrics_histogram_t histogram;
+    uint32_t i = 0;
+
+    for (i = 0; i < sizeof(latencies) / sizeof(latencies[0]); i++)
+    {
+        vLabMetricsReset();
+        _record(LABMETRICS_OP_PUBLISH, latencies[i].elapsedMs, true);
+
+        vLabMetricsGetHistogram(LABMETRICS_OP_PUBLISH, &histogram);
+        if (histogram.buckets[latencies[i].bucket] != 1)
+        {
+            printf("%u ms not in bucket %u\n", latencies[i].elapsedMs, latencies[i].bucket);
+        }
+        LAB_TEST_CHECK_EQUAL(1, histogram.buckets[latencies[i].bucket]);
+        LAB_TEST_CHECK_EQUAL(latencies[i].elapsedMs, histogram.maxMs);
+    }
+
+    /* All of them together, and the totals. */
+    vLabMetricsReset();
+    for (i = 0; i < sizeof(latencies) / sizeof(latencies[0]); i++)
+    {
+        _record(LABMETRICS_OP_CONNECT, latencies[i].elapsedMs, i % 2 == 0);
+        expected[latencies[i].bucket]++;
+    }
+
+    vLabMetricsGetHistogram(LABMETRICS_OP_CONNECT, &histogram);
+    LAB_TEST_CHECK_EQUAL(sizeof(latencies) / sizeof(latencies[0]), histogram.count);
+    LAB_TEST_CHECK_EQUAL(sizeof(latencies) / sizeof(latencies[0]) / 2, histogram.failures);
+    LAB_TEST_CHECK_EQUAL(UINT32_MAX / 2, histogram.maxMs);
+    LAB_TEST_CHECK(memcmp(expected, histogram.buckets, sizeof(expected)) == 0);
+
+    /* The other operations are left alone. */
+    vLabMetricsGetHistogram(LABMETRICS_OP_PUBLISH, &histogram);
+    LAB_TEST_CHECK_EQUAL(0, histogram.count);
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_unknown_op(void)
+{
+    lab_metrics_histogram_t histogram;
+    uint32_t op = 0;
+
+    vLabMetricsReset();
+    _record(LABMETRICS_OP_MAX, 10, true);
+
+    for (op = 0; op < LABMETRICS_OP_MAX; op++)
+    {
+        vLabMetricsGetHistogram(op, &histogram);
+        LAB_TEST_CHECK_EQUAL(0, histogram.count);
+    }
+
+    LAB_TEST_CHECK(strcmp(pcLabMetricsOpName(LABMETRICS_OP_MAX), "unknown") == 0);
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_json(void)
+{
+    char buffer[256];
+    size_t length = 0;
+
+    vLabMetricsReset();
+    _record(LABMETRICS_OP_PUBLISH, 0, true);
+    _record(LABMETRICS_OP_PUBLISH, 5, true);
+    _record(LABMETRICS_OP_PUBLISH, 5, false);
+    _record(LABMETRICS_OP_PUBLISH, 300, true);
+
+    length = xLabMetricsToJson(LABMETRICS_OP_PUBLISH, buffer, sizeof(buffer));
+    TEST_EQUALS(buffer, length,
+                "{\"op\":\"publish\",\"n\":4,\"fail\":1,\"sum\":310,\"max\":300,"
+                "\"b\":[1,0,0,2,0,0,0,0,0,1,0,0,0,0,0,0]}");
+
+    length = xLabMetricsToJson(LABMETRICS_OP_SHADOW_UPDATE, buffer, sizeof(buffer));
+    TEST_EQUALS(buffer, length,
+                "{\"op\":\"shadowUpdate\",\"n\":0,\"fail\":0,\"sum\":0,\"max\":0,"
+                "\"b\":[0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0]}");
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_json_does_not_fit(void)
+{
+    char buffer[256];
+    char small[256];
+    size_t length = 0, size = 0;
+
+    vLabMetricsReset();
+    _record(LABMETRICS_OP_CONNECT, 1234, true);
+    _record(LABMETRICS_OP_CONNECT, 100000, false);
+
+    length = xLabMetricsToJson(LABMETRICS_OP_CONNECT, buffer, sizeof(buffer));
+    LAB_TEST_CHECK(length > 0);
+
+    /* The document and its NULL terminator fit, or nothing is returned. */
+    for (size = 1; size <= length; size++)
+    {
+        LAB_TEST_CHECK_EQUAL(0, xLabMetricsToJson(LABMETRICS_OP_CONNECT, small, size));
+    }
+
+    LAB_TEST_CHECK_EQUAL(length, xLabMetricsToJson(LABMETRICS_OP_CONNECT, small, length + 1));
+    LAB_TEST_CHECK(strcmp(small, buffer) == 0);
+}
+
+/*-----------------------------------------------------------*/
+
+static double _seconds(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static void test_benchmark(void)
+{
+    static volatile size_t sink = 0;
+    char buffer[256];
+    double start = 0, recordNs = 0, jsonNs = 0;
+    uint32_t i = 0;
+
+    vLabMetricsReset();
+
+    start = _seconds();
+    for (i = 0; i < TEST_BENCH_RECORDS; i++)
+    {
+        _nowUs += 1000;
+        vLabMetricsRecord(LABMETRICS_OP_PUBLISH, (uint32_t)(_nowUs / 1000) - (i % 1000), true);
+    }
+    recordNs = (_seconds() - start) * 1e9 / TEST_BENCH_RECORDS;
+
+    start = _seconds();
+    for (i = 0; i < TEST_BENCH_RECORDS / 10; i++)
+    {
+        sink += xLabMetricsToJson(LABMETRICS_OP_PUBLISH, buffer, sizeof(buffer));
+    }
+    jsonNs = (_seconds() - start) * 1e9 / (TEST_BENCH_RECORDS / 10);
+
+    printf("Metrics: record %.1f ns; JSON document %.0f ns, %zu bytes\n",
+           recordNs, jsonNs, xLabMetricsToJson(LABMETRICS_OP_PUBLISH, buffer, sizeof(buffer)));
+}
+
+/*-----------------------------------------------------------*/
+
+int main(void)
+{
+    LAB_TEST_RUN(test_bucket_boundaries);
+    LAB_TEST_RUN(test_unknown_op);
+    LAB_TEST_RUN(test_json);
+    LAB_TEST_RUN(test_json_does_not_fit);
+    LAB_TEST_RUN(test_benchmark);
+
+    return iLabTestResult();
+}
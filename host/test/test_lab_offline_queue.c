@@ -0,0 +1,297 @@
+/**
+ * @file test_lab_offline_queue.c
+ * @brief Host tests of the offline publish queue, on the file-backed NVS of
+ * the host build. Each boot of the device runs in its own process, so that
+ * nothing but the flash survives a reboot.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include <stdint.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "lab_test.h"
+
+#include "lab_offline_queue.h"
+
+/* Built with a small queue: the ring wraps around within a few publishes. */
+#if LAB_OFFLINE_QUEUE_CAPACITY != 4
+    #error "test_lab_offline_queue expects LAB_OFFLINE_QUEUE_CAPACITY 4"
+#endif
+
+#define TEST_TOPIC      "mydevice/test"
+
+/*-----------------------------------------------------------*/
+
+static esp_err_t _push(uint32_t message)
+{
+    IotMqttPublishInfo_t publishInfo = IOT_MQTT_PUBLISH_INFO_INITIALIZER;
+    char payload[16];
+
+    publishInfo.qos = IOT_MQTT_QOS_1;
+    publishInfo.pTopicName = TEST_TOPIC;
+    publishInfo.topicNameLength = sizeof(TEST_TOPIC) - 1;
+    publishInfo.pPayload = payload;
+    publishInfo.payloadLength = (size_t)snprintf(payload, sizeof(payload), "{\"m\":%u}", message);
+
+    return eLabOfflineQueuePush(&publishInfo);
+}
+
+/**
+ * @brief Check the oldest publish is the given message, and pop it.
+ */
+static void _expect(uint32_t message)
+{
+    static lab_offline_queue_entry_t entry;
+    IotMqttPublishInfo_t publishInfo = IOT_MQTT_PUBLISH_INFO_INITIALIZER;
+    char payload[16];
+    uint32_t sequence = 0;
+
+    snprintf(payload, sizeof(payload), "{\"m\":%u}", message);
+
+    LAB_TEST_CHECK_EQUAL(ESP_OK, eLabOfflineQueuePeek(&entry, &sequence));
+    vLabOfflineQueueEntryToPublishInfo(&entry, &publishInfo);
+
+    LAB_TEST_CHECK_EQUAL(IOT_MQTT_QOS_1, publishInfo.qos);
+    LAB_TEST_CHECK(publishInfo.topicNameLength == sizeof(TEST_TOPIC) - 1 &&
+                   memcmp(publishInfo.pTopicName, TEST_TOPIC, publishInfo.topicNameLength) == 0);
+    LAB_TEST_CHECK(publishInfo.payloadLength == strlen(payload) &&
+                   memcmp(publishInfo.pPayload, payload, publishInfo.payloadLength) == 0);
+
+    LAB_TEST_CHECK_EQUAL(ESP_OK, eLabOfflineQueuePop(sequence));
+}
+
+/**
+ * @brief File of the entry at the head of the queue.
+ */
+static void _headEntryPath(char *pPath, size_t size)
+{
+    char path[256];
+    uint32_t head = 0;
+    FILE *pFile = NULL;
+
+    snprintf(path, sizeof(path), "%s/%s/offline_q/head", getenv("LAB_HOST_NVS_DIR"), LAB_OFFLINE_QUEUE_PARTITION);
+    pFile = fopen(path, "rb");
+    LAB_TEST_CHECK(pFile != NULL && fread(&head, sizeof(head), 1, pFile) == 1);
+    if (pFile != NULL)
+    {
+        fclose(pFile);
+    }
+
+    snprintf(pPath, size, "%s/%s/offline_q/m%u", getenv("LAB_HOST_NVS_DIR"), LAB_OFFLINE_QUEUE_PARTITION,
+             (unsigned)(head % LAB_OFFLINE_QUEUE_CAPACITY));
+}
+
+/**
+ * @brief Run a boot of the device in a child process.
+ *
+ * @return  true if all of its checks passed
+ */
+static bool _boot(void (*boot)(void))
+{
+    pid_t child = 0;
+    int status = 0;
+
+    /* Otherwise the child prints what the parent buffered too. */
+    fflush(stdout);
+    child = fork();
+
+    if (child == 0)
+    {
+        LAB_TEST_CHECK_EQUAL(ESP_OK, eLabOfflineQueueInit());
+        boot();
+        fflush(stdout);
+        _exit(_labTestFailures == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    return child > 0 && waitpid(child, &status, 0) == child &&
+           WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+}
+
+/*-----------------------------------------------------------*/
+
+static void _bootFillAndWrap(void)
+{
+    lab_offline_queue_stats_t stats;
+    uint32_t i = 0;
+
+    LAB_TEST_CHECK_EQUAL(0, ulLabOfflineQueueDepth());
+
+    /* Six publishes in four slots: the two oldest are dropped. */
+    for (i = 0; i < 6; i++)
+    {
+        LAB_TEST_CHECK_EQUAL(ESP_OK, _push(i));
+    }
+
+    vLabOfflineQueueGetStats(&stats);
+    LAB_TEST_CHECK_EQUAL(4, stats.depth);
+    LAB_TEST_CHECK_EQUAL(6, stats.enqueued);
+    LAB_TEST_CHECK_EQUAL(2, stats.dropped);
+
+    _expect(2);
+    _expect(3);
+
+    /* These wrap around to the slots of the first publishes. */
+    LAB_TEST_CHECK_EQUAL(ESP_OK, _push(6));
+    LAB_TEST_CHECK_EQUAL(ESP_OK, _push(7));
+    LAB_TEST_CHECK_EQUAL(4, ulLabOfflineQueueDepth());
+}
+
+static void _bootDrain(void)
+{
+    static lab_offline_queue_entry_t entry;
+    lab_offline_queue_stats_t stats;
+    uint32_t sequence = 0;
+
+    /* Depth and drops survive the reboot. */
+    vLabOfflineQueueGetStats(&stats);
+    LAB_TEST_CHECK_EQUAL(4, stats.depth);
+    LAB_TEST_CHECK_EQUAL(2, stats.dropped);
+
+    _expect(4);
+    _expect(5);
+    _expect(6);
+    _expect(7);
+
+    LAB_TEST_CHECK_EQUAL(ESP_ERR_NOT_FOUND, eLabOfflineQueuePeek(&entry, &sequence));
+    LAB_TEST_CHECK_EQUAL(ESP_ERR_NOT_FOUND, eLabOfflineQueuePop(sequence));
+
+    vLabOfflineQueueGetStats(&stats);
+    LAB_TEST_CHECK_EQUAL(4, stats.drained);
+}
+
+static void test_wraparound_and_reboot(void)
+{
+    LAB_TEST_CHECK(_boot(_bootFillAndWrap));
+    LAB_TEST_CHECK(_boot(_bootDrain));
+}
+
+/*-----------------------------------------------------------*/
+
+static void _bootCorrupt(void)
+{
+    static lab_offline_queue_entry_t entry;
+    lab_offline_queue_stats_t stats;
+    char path[256];
+    FILE *pFile = NULL;
+    uint32_t sequence = 0;
+
+    LAB_TEST_CHECK_EQUAL(ESP_OK, _push(10));
+    LAB_TEST_CHECK_EQUAL(ESP_OK, _push(11));
+    LAB_TEST_CHECK_EQUAL(ESP_OK, _push(12));
+
+    /* A torn write: the header is there, the payload is not. */
+    _headEntryPath(path, sizeof(path));
+    pFile = fopen(path, "r+b");
+    LAB_TEST_CHECK(pFile != NULL && ftruncate(fileno(pFile), 8) == 0);
+    if (pFile != NULL)
+    {
+        fclose(pFile);
+    }
+
+    LAB_TEST_CHECK_EQUAL(ESP_ERR_INVALID_STATE, eLabOfflineQueuePeek(&entry, &sequence));
+    /* It is not read again: it has to be popped. */
+    LAB_TEST_CHECK_EQUAL(ESP_ERR_INVALID_STATE, eLabOfflineQueuePeek(&entry, &sequence));
+    LAB_TEST_CHECK_EQUAL(ESP_OK, eLabOfflineQueuePop(sequence));
+
+    /* A lost one. */
+    _headEntryPath(path, sizeof(path));
+    LAB_TEST_CHECK_EQUAL(0, unlink(path));
+    LAB_TEST_CHECK_EQUAL(ESP_ERR_INVALID_STATE, eLabOfflineQueuePeek(&entry, &sequence));
+    LAB_TEST_CHECK_EQUAL(ESP_OK, eLabOfflineQueuePop(sequence));
+
+    _expect(12);
+
+    vLabOfflineQueueGetStats(&stats);
+    LAB_TEST_CHECK_EQUAL(0, stats.depth);
+    LAB_TEST_CHECK_EQUAL(2, stats.corrupted);
+    LAB_TEST_CHECK_EQUAL(1, stats.drained);
+}
+
+static void test_corrupt_entries_are_dropped(void)
+{
+    LAB_TEST_CHECK(_boot(_bootCorrupt));
+}
+
+/*-----------------------------------------------------------*/
+
+static void _bootTooLarge(void)
+{
+    static char payload[LAB_OFFLINE_QUEUE_PAYLOAD_MAX_LENGTH + 1];
+    IotMqttPublishInfo_t publishInfo = IOT_MQTT_PUBLISH_INFO_INITIALIZER;
+    lab_offline_queue_stats_t stats;
+
+    publishInfo.pTopicName = TEST_TOPIC;
+    publishInfo.topicNameLength = sizeof(TEST_TOPIC) - 1;
+    publishInfo.pPayload = payload;
+    publishInfo.payloadLength = sizeof(payload);
+
+    LAB_TEST_CHECK_EQUAL(ESP_ERR_INVALID_SIZE, eLabOfflineQueuePush(&publishInfo));
+
+    vLabOfflineQueueGetStats(&stats);
+    LAB_TEST_CHECK_EQUAL(1, stats.rejected);
+    LAB_TEST_CHECK_EQUAL(0, stats.depth);
+}
+
+static void test_too_large_is_rejected(void)
+{
+    LAB_TEST_CHECK(_boot(_bootTooLarge));
+}
+
+/*-----------------------------------------------------------*/
+
+static void _bootPushWhileSending(void)
+{
+    static lab_offline_queue_entry_t entry;
+    lab_offline_queue_stats_t stats, before;
+    uint32_t sequence = 0;
+    uint32_t i = 0;
+
+    for (i = 20; i < 24; i++)
+    {
+        LAB_TEST_CHECK_EQUAL(ESP_OK, _push(i));
+    }
+    vLabOfflineQueueGetStats(&before);
+
+    /* The drain sends the oldest; the link drops meanwhile and a publish is
+     * queued, dropping the one being sent from the full queue. */
+    LAB_TEST_CHECK_EQUAL(ESP_OK, eLabOfflineQueuePeek(&entry, &sequence));
+    LAB_TEST_CHECK_EQUAL(ESP_OK, _push(24));
+
+    /* Its pop leaves the publishes that were not sent. */
+    LAB_TEST_CHECK_EQUAL(ESP_ERR_NOT_FOUND, eLabOfflineQueuePop(sequence));
+    LAB_TEST_CHECK_EQUAL(4, ulLabOfflineQueueDepth());
+
+    _expect(21);
+    _expect(22);
+    _expect(23);
+    _expect(24);
+
+    vLabOfflineQueueGetStats(&stats);
+    LAB_TEST_CHECK_EQUAL(before.dropped + 1, stats.dropped);
+    LAB_TEST_CHECK_EQUAL(4, stats.drained);
+}
+
+static void test_push_while_sending(void)
+{
+    LAB_TEST_CHECK(_boot(_bootPushWhileSending));
+}
+
+/*-----------------------------------------------------------*/
+
+int main(void)
+{
+    if (!bLabTestNvsDirectory())
+    {
+        return EXIT_FAILURE;
+    }
+
+    LAB_TEST_RUN(test_wraparound_and_reboot);
+    LAB_TEST_RUN(test_corrupt_entries_are_dropped);
+    LAB_TEST_RUN(test_too_large_is_rejected);
+    LAB_TEST_RUN(test_push_while_sending);
+
+    return iLabTestResult();
+}
@@ -0,0 +1,240 @@
+/**
+ * @file test_lab_payload.c
+ * @brief Host tests of the fixed-schema payload writer, in JSON and in CBOR,
+ * and a microbenchmark of the lab1 button message against snprintf.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include <limits.h>
+#include <time.h>
+
+#include "lab_test.h"
+
+#include "lab_payload.h"
+
+#define TEST_SERIAL_NUMBER      "0a1b2c3d4e5f"
+#define TEST_BENCH_MESSAGES     ( 1000000 )
+
+static const lab_payload_fragment_t _keySerialNumber = LAB_PAYLOAD_KEY("serialNumber");
+static const lab_payload_fragment_t _keyClickType = LAB_PAYLOAD_KEY("clickType");
+static const lab_payload_fragment_t _keyDuration = LAB_PAYLOAD_KEY("durationMs");
+static const lab_payload_fragment_t _textSingle = LAB_PAYLOAD_TEXT("SINGLE");
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief The lab1 button message.
+ */
+static size_t _writeClick(uint8_t *pBuffer, size_t size, lab_payload_encoding_t encoding, bool withDuration)
+{
+    lab_payload_writer_t writer;
+
+    vLabPayloadInit(&writer, pBuffer, size, encoding);
+    vLabPayloadBeginMap(&writer, withDuration ? 3 : 2);
+    vLabPayloadKey(&writer, &_keySerialNumber);
+    vLabPayloadString(&writer, TEST_SERIAL_NUMBER, sizeof(TEST_SERIAL_NUMBER) - 1);
+    vLabPayloadKey(&writer, &_keyClickType);
+    vLabPayloadText(&writer, &_textSingle);
+    if (withDuration)
+    {
+        vLabPayloadKey(&writer, &_keyDuration);
+        vLabPayloadUint(&writer, UINT32_MAX);
+    }
+    vLabPayloadEndMap(&writer);
+
+    return xLabPayloadFinish(&writer);
+}
+
+static bool _equals(const uint8_t *pBuffer, size_t length, const char *pExpected, size_t expectedLength)
+{
+    if (length != expectedLength || memcmp(pBuffer, pExpected, length) != 0)
+    {
+        printf("got %zu bytes: %.*s\n", length, (int)length, (const char *)pBuffer);
+        return false;
+    }
+
+    return true;
+}
+
+#define TEST_EQUALS(pBuffer, length, expected) \
+    LAB_TEST_CHECK(_equals((pBuffer), (length), (expected), sizeof(expected) - 1))
+
+/*-----------------------------------------------------------*/
+
+static void test_json_matches_the_format(void)
+{
+    uint8_t buffer[128];
+    char expected[128];
+    size_t length = _writeClick(buffer, sizeof(buffer), LABPAYLOAD_JSON, false);
+
+    snprintf(expected, sizeof(expected), "{\"serialNumber\":\"%s\",\"clickType\":\"%s\"}", TEST_SERIAL_NUMBER, "SINGLE");
+    LAB_TEST_CHECK(_equals(buffer, length, expected, strlen(expected)));
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_json_values(void)
+{
+    static const lab_payload_fragment_t keyA = LAB_PAYLOAD_KEY("a");
+    static const lab_payload_fragment_t keyB = LAB_PAYLOAD_KEY("b");
+    uint8_t buffer[128];
+    lab_payload_writer_t writer;
+
+    vLabPayloadInit(&writer, buffer, sizeof(buffer), LABPAYLOAD_JSON);
+    vLabPayloadBeginMap(&writer, 2);
+    vLabPayloadKey(&writer, &keyA);
+    vLabPayloadBeginArray(&writer, 7);
+    vLabPayloadUint(&writer, 0);
+    vLabPayloadUint(&writer, UINT32_MAX);
+    vLabPayloadInt(&writer, -1);
+    vLabPayloadInt(&writer, INT32_MIN);
+    vLabPayloadInt(&writer, INT32_MAX);
+    vLabPayloadBool(&writer, true);
+    vLabPayloadBool(&writer, false);
+    vLabPayloadEndArray(&writer);
+    vLabPayloadKey(&writer, &keyB);
+    vLabPayloadBeginMap(&writer, 0);
+    vLabPayloadEndMap(&writer);
+    vLabPayloadEndMap(&writer);
+
+    TEST_EQUALS(buffer, xLabPayloadFinish(&writer),
+                "{\"a\":[0,4294967295,-1,-2147483648,2147483647,true,false],\"b\":{}}");
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_cbor_values(void)
+{
+    static const lab_payload_fragment_t keyA = LAB_PAYLOAD_KEY("a");
+    uint8_t buffer[128];
+    lab_payload_writer_t writer;
+
+    /* The examples of RFC 7049, appendix A. */
+    vLabPayloadInit(&writer, buffer, sizeof(buffer), LABPAYLOAD_CBOR);
+    vLabPayloadBeginArray(&writer, 14);
+    vLabPayloadUint(&writer, 0);
+    vLabPayloadUint(&writer, 23);
+    vLabPayloadUint(&writer, 24);
+    vLabPayloadUint(&writer, 100);
+    vLabPayloadUint(&writer, 1000);
+    vLabPayloadUint(&writer, 1000000);
+    vLabPayloadInt(&writer, -1);
+    vLabPayloadInt(&writer, -100);
+    vLabPayloadInt(&writer, -1000);
+    vLabPayloadInt(&writer, INT32_MIN);
+    vLabPayloadBool(&writer, false);
+    vLabPayloadBool(&writer, true);
+    vLabPayloadString(&writer, "a", 1);
+    vLabPayloadBeginMap(&writer, 1);
+    vLabPayloadKey(&writer, &keyA);
+    vLabPayloadUint(&writer, 1);
+    vLabPayloadEndMap(&writer);
+    vLabPayloadEndArray(&writer);
+
+    TEST_EQUALS(buffer, xLabPayloadFinish(&writer),
+                "\x8e"
+                "\x00" "\x17" "\x18\x18" "\x18\x64" "\x19\x03\xe8" "\x1a\x00\x0f\x42\x40"
+                "\x20" "\x38\x63" "\x39\x03\xe7" "\x3a\x7f\xff\xff\xff"
+                "\xf4" "\xf5"
+                "\x61" "a"
+                "\xa1" "\x61" "a" "\x01");
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_sizes_are_upper_bounds(void)
+{
+    uint8_t buffer[128];
+    size_t jsonLength = LAB_PAYLOAD_JSON_MAP_LENGTH(3) +
+                        LAB_PAYLOAD_JSON_KEY_LENGTH("serialNumber") +
+                        LAB_PAYLOAD_JSON_STRING_LENGTH(sizeof(TEST_SERIAL_NUMBER) - 1) +
+                        LAB_PAYLOAD_JSON_KEY_LENGTH("clickType") +
+                        LAB_PAYLOAD_JSON_STRING_LENGTH(sizeof("SINGLE") - 1) +
+                        LAB_PAYLOAD_JSON_KEY_LENGTH("durationMs") +
+                        LAB_PAYLOAD_JSON_UINT_LENGTH;
+    size_t cborLength = LAB_PAYLOAD_CBOR_MAP_LENGTH(3) +
+                        LAB_PAYLOAD_CBOR_KEY_LENGTH("serialNumber") +
+                        LAB_PAYLOAD_CBOR_STRING_LENGTH(sizeof(TEST_SERIAL_NUMBER) - 1) +
+                        LAB_PAYLOAD_CBOR_KEY_LENGTH("clickType") +
+                        LAB_PAYLOAD_CBOR_STRING_LENGTH(sizeof("SINGLE") - 1) +
+                        LAB_PAYLOAD_CBOR_KEY_LENGTH("durationMs") +
+                        LAB_PAYLOAD_CBOR_UINT_LENGTH;
+
+    /* With the largest duration, the sizes are exact. */
+    LAB_TEST_CHECK_EQUAL(jsonLength, _writeClick(buffer, sizeof(buffer), LABPAYLOAD_JSON, true));
+    LAB_TEST_CHECK_EQUAL(cborLength, _writeClick(buffer, sizeof(buffer), LABPAYLOAD_CBOR, true));
+
+    /* A byte short does not fit. */
+    LAB_TEST_CHECK_EQUAL(0, _writeClick(buffer, jsonLength - 1, LABPAYLOAD_JSON, true));
+    LAB_TEST_CHECK_EQUAL(0, _writeClick(buffer, cborLength - 1, LABPAYLOAD_CBOR, true));
+}
+
+/*-----------------------------------------------------------*/
+
+static double _seconds(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * @brief The button message, as written before the payload writer.
+ */
+static size_t _snprintfClick(char *pBuffer, size_t size)
+{
+    int status = snprintf(pBuffer, size, "{\"serialNumber\": \"%s\",\"clickType\": \"SINGLE\"}", TEST_SERIAL_NUMBER);
+
+    return status > 0 && (size_t)status < size ? (size_t)status : 0;
+}
+
+static void test_benchmark(void)
+{
+    static volatile size_t sink = 0;
+    uint8_t buffer[128];
+    double start = 0, formatNs = 0, jsonNs = 0, cborNs = 0;
+    uint32_t i = 0;
+
+    start = _seconds();
+    for (i = 0; i < TEST_BENCH_MESSAGES; i++)
+    {
+        sink += _snprintfClick((char *)buffer, sizeof(buffer));
+    }
+    formatNs = (_seconds() - start) * 1e9 / TEST_BENCH_MESSAGES;
+
+    start = _seconds();
+    for (i = 0; i < TEST_BENCH_MESSAGES; i++)
+    {
+        sink += _writeClick(buffer, sizeof(buffer), LABPAYLOAD_JSON, false);
+    }
+    jsonNs = (_seconds() - start) * 1e9 / TEST_BENCH_MESSAGES;
+
+    start = _seconds();
+    for (i = 0; i < TEST_BENCH_MESSAGES; i++)
+    {
+        sink += _writeClick(buffer, sizeof(buffer), LABPAYLOAD_CBOR, false);
+    }
+    cborNs = (_seconds() - start) * 1e9 / TEST_BENCH_MESSAGES;
+
+    printf("Button message: snprintf %.0f ns, %zu bytes; JSON writer %.0f ns, %zu bytes; CBOR writer %.0f ns, %zu bytes\n",
+           formatNs, _snprintfClick((char *)buffer, sizeof(buffer)),
+           jsonNs, _writeClick(buffer, sizeof(buffer), LABPAYLOAD_JSON, false),
+           cborNs, _writeClick(buffer, sizeof(buffer), LABPAYLOAD_CBOR, false));
+}
+
+/*-----------------------------------------------------------*/
+
+int main(void)
+{
+    LAB_TEST_RUN(test_json_matches_the_format);
+    LAB_TEST_RUN(test_json_values);
+    LAB_TEST_RUN(test_cbor_values);
+    LAB_TEST_RUN(test_sizes_are_upper_bounds);
+    LAB_TEST_RUN(test_benchmark);
+
+    return iLabTestResult();
+}
@@ -0,0 +1,176 @@
+/**
+ * @file test_lab_reconnect.c
+ * @brief Host tests of the connection loop bookkeeping: the loop of lab_run
+ * in simulated time, its session dropped by a glitch and by a broker outage,
+ * and how long it takes to be back against the backoff bounds.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include "lab_test.h"
+#include "lab_test_sim.h"
+
+#include "lab_reconnect.h"
+
+/* A connection attempt, TLS handshake and MQTT CONNECT. */
+#define TEST_CONNECT_MS     ( 300 )
+
+#define TEST_GLITCHES       ( 10 )
+#define TEST_OUTAGE_MS      ( 60000 )
+
+/*-----------------------------------------------------------*/
+
+static lab_reconnect_t _reconnect;
+static TaskHandle_t _connectionTask = NULL;
+
+static bool _brokerUp = true;
+static uint32_t _sessions = 0;
+static int64_t _connectedAtUs = 0;
+static uint32_t _maxDelayMs = 0;
+
+static uint64_t _nowMs(void)
+{
+    return (uint64_t)(esp_timer_get_time() / 1000);
+}
+
+/**
+ * @brief The connection loop of lab_run: connect, hold the session until it
+ * is lost, wait the backoff delay, and again.
+ */
+static void _connectionLoop(void *pArg)
+{
+    uint32_t delayMs = 0;
+
+    for (;;)
+    {
+        vLabReconnectAttempt(&_reconnect, _nowMs());
+        vTaskDelay(pdMS_TO_TICKS(TEST_CONNECT_MS));
+
+        if (_brokerUp)
+        {
+            vLabReconnectEstablished(&_reconnect, _nowMs());
+            vLabReconnectConnected(&_reconnect, _nowMs());
+            _connectedAtUs = esp_timer_get_time();
+            _sessions++;
+
+            /* As lab_run waits for the clean up of the lost session. */
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            vLabReconnectLost(&_reconnect, _nowMs());
+        }
+        else
+        {
+            vLabReconnectFailed(&_reconnect);
+        }
+
+        delayMs = ulLabReconnectNextDelayMs(&_reconnect);
+        _maxDelayMs = delayMs > _maxDelayMs ? delayMs : _maxDelayMs;
+
+        vTaskDelay(pdMS_TO_TICKS(delayMs));
+    }
+}
+
+/**
+ * @brief Drop the session, the broker going down with it or not.
+ */
+static void _drop(void *pArg)
+{
+    _brokerUp = pArg == NULL;
+    xTaskNotifyGive(_connectionTask);
+}
+
+static void _brokerBack(void *pArg)
+{
+    _brokerUp = true;
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_connect(void)
+{
+    vLabReconnectInit(&_reconnect, 0, 0, 0);
+    xTaskCreate(_connectionLoop, "connection", 4096, NULL, 5, &_connectionTask);
+
+    vLabTestSimRunFor(1000000);
+
+    LAB_TEST_CHECK_EQUAL(1, _sessions);
+    LAB_TEST_CHECK_EQUAL(1, _reconnect.stats.attempts);
+    LAB_TEST_CHECK_EQUAL(TEST_CONNECT_MS, _reconnect.stats.lastConnectMs);
+
+    /* No session lost yet. */
+    LAB_TEST_CHECK_EQUAL(0, _reconnect.stats.lastReconnectMs);
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_glitch(void)
+{
+    int64_t dropUs = 0;
+    uint32_t i = 0, sessions = 0, maxReconnectMs = 0;
+
+    for (i = 0; i < TEST_GLITCHES; i++)
+    {
+        sessions = _sessions;
+        dropUs = esp_timer_get_time() + 1000000;
+        vLabTestSimAt(dropUs, _drop, NULL);
+        vLabTestSimRunFor(10000000);
+
+        /* Back after the first retry, drawn below LAB_BACKOFF_FIRST_RETRY_MS. */
+        LAB_TEST_CHECK_EQUAL(sessions + 1, _sessions);
+        LAB_TEST_CHECK_EQUAL((_connectedAtUs - dropUs) / 1000, _reconnect.stats.lastReconnectMs);
+        LAB_TEST_CHECK(_reconnect.stats.lastReconnectMs <= LAB_BACKOFF_FIRST_RETRY_MS + TEST_CONNECT_MS);
+        LAB_TEST_CHECK(_reconnect.stats.lastReconnectMs >= TEST_CONNECT_MS);
+        LAB_TEST_CHECK_EQUAL(0, _reconnect.stats.consecutiveFailures);
+
+        maxReconnectMs = _reconnect.stats.lastReconnectMs > maxReconnectMs ? _reconnect.stats.lastReconnectMs : maxReconnectMs;
+    }
+
+    printf("reconnect: %u glitches, back within %u ms\n", TEST_GLITCHES, maxReconnectMs);
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_outage(void)
+{
+    lab_connection_stats_t before = _reconnect.stats;
+    int64_t dropUs = esp_timer_get_time() + 1000000;
+    int64_t backUs = dropUs + TEST_OUTAGE_MS * 1000LL;
+    uint32_t sessions = _sessions;
+
+    _maxDelayMs = 0;
+    vLabTestSimAt(dropUs, _drop, (void *)1);
+    vLabTestSimAt(backUs, _brokerBack, NULL);
+
+    /* Still out at the end of the outage. */
+    vLabTestSimRunUntil(backUs - 1000);
+    LAB_TEST_CHECK_EQUAL(sessions, _sessions);
+    LAB_TEST_CHECK(_reconnect.stats.consecutiveFailures > 0);
+
+    vLabTestSimRunUntil(backUs + (LAB_BACKOFF_CAP_MS + TEST_CONNECT_MS) * 1000LL);
+
+    printf("reconnect: %u s outage, %u attempts, back %lld ms after the broker, longest delay %u ms\n",
+           TEST_OUTAGE_MS / 1000, _reconnect.stats.attempts - before.attempts,
+           (long long)(_connectedAtUs - backUs) / 1000, _maxDelayMs);
+
+    /* Back within the delay the broker came back in, at most the cap. */
+    LAB_TEST_CHECK_EQUAL(sessions + 1, _sessions);
+    LAB_TEST_CHECK(_maxDelayMs <= LAB_BACKOFF_CAP_MS);
+    LAB_TEST_CHECK((_connectedAtUs - backUs) / 1000 <= _maxDelayMs + TEST_CONNECT_MS);
+    LAB_TEST_CHECK_EQUAL((_connectedAtUs - dropUs) / 1000, _reconnect.stats.lastReconnectMs);
+
+    /* Every attempt during the outage failed, and the next loss starts over. */
+    LAB_TEST_CHECK_EQUAL(_reconnect.stats.attempts - before.attempts - 1, _reconnect.stats.failures - before.failures);
+    LAB_TEST_CHECK_EQUAL(0, _reconnect.stats.consecutiveFailures);
+    LAB_TEST_CHECK_EQUAL(0, _reconnect.backoff.attempt);
+}
+
+/*-----------------------------------------------------------*/
+
+int main(void)
+{
+    LAB_TEST_RUN(test_connect);
+    LAB_TEST_RUN(test_glitch);
+    LAB_TEST_RUN(test_outage);
+
+    return iLabTestResult();
+}
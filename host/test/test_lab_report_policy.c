@@ -0,0 +1,228 @@
+/**
+ * @file test_lab_report_policy.c
+ * @brief Host tests of the report policy: a simulated day of the lab2 AirCon,
+ * reported on change instead of at every period.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include "lab_test.h"
+
+#include "lab_report_policy.h"
+#include "lab2_shadow.h"
+
+#define TEST_PERIOD_US      ( LAB2_AIRCON_PERIOD_MS * 1000LL )
+#define TEST_INTERVAL_US    ( LAB2_REPORT_MIN_INTERVAL_MS * 1000LL )
+#define TEST_HEARTBEAT_US   ( LAB2_REPORT_HEARTBEAT_MS * 1000LL )
+#define TEST_HOUR_US        ( 3600LL * 1000000 )
+#define TEST_DAY_US         ( 24 * TEST_HOUR_US )
+
+enum {
+    TEST_FIELD_powerOn,
+    TEST_FIELD_temperature,
+    TEST_FIELD_COUNT
+};
+
+/* The fields of lab2_shadow.c. */
+static const lab_report_field_t _fields[TEST_FIELD_COUNT] = {
+    [TEST_FIELD_powerOn] = { .pName = "powerOn", .deadband = 0, .immediate = true },
+    [TEST_FIELD_temperature] = { .pName = "temperature", .deadband = LAB2_REPORT_TEMPERATURE_DEADBAND, .immediate = false },
+};
+
+/**
+ * @brief What is desired over the day, from the given time on.
+ */
+typedef struct {
+    int64_t fromUs;
+    int32_t powerOn;
+    int32_t temperature;
+} _desired_t;
+
+static const _desired_t _day[] = {
+    { 0,                                      0, 25 },
+    { 7 * TEST_HOUR_US,                       1, 22 },
+    { 12 * TEST_HOUR_US + TEST_HOUR_US / 2,   1, 20 },
+    { 18 * TEST_HOUR_US,                      0, 20 },
+    { 19 * TEST_HOUR_US + TEST_HOUR_US / 2,   1, 24 },
+    { 23 * TEST_HOUR_US,                      0, 24 },
+};
+
+#define TEST_DAY_CHANGES    ( sizeof(_day) / sizeof(_day[0]) )
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief A period of the AirCon, as _stepAirCon in lab2_shadow.c, read by a
+ * sensor that flickers by a degree every other period.
+ */
+static void _step(const _desired_t *pDesired, int32_t *pTemperature, int32_t *pValues, uint32_t step)
+{
+    pValues[TEST_FIELD_powerOn] = pDesired->powerOn;
+
+    if (pDesired->powerOn)
+    {
+        *pTemperature = *pTemperature - 1 < pDesired->temperature ? pDesired->temperature : *pTemperature - 1;
+    }
+    else
+    {
+        *pTemperature = *pTemperature + 1 > 40 ? 40 : *pTemperature + 1;
+    }
+
+    pValues[TEST_FIELD_temperature] = *pTemperature + (int32_t)(step & 1);
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_simulated_day(void)
+{
+    lab_report_policy_t policy;
+    lab_report_reason_t reason = LABREPORT_NONE;
+    int32_t values[TEST_FIELD_COUNT] = {0};
+    int32_t temperature = 35;
+    int64_t nowUs = 0, sinceUs = 0;
+    uint32_t steps = 0, reports = 0, powerChanges = 0;
+    size_t desired = 0;
+    bool powerOn = false;
+
+    vLabReportPolicyInit(&policy, _fields, TEST_FIELD_COUNT,
+                         LAB2_REPORT_MIN_INTERVAL_MS, LAB2_REPORT_HEARTBEAT_MS);
+
+    for (nowUs = 0; nowUs < TEST_DAY_US; nowUs += TEST_PERIOD_US, steps++)
+    {
+        while (desired + 1 < TEST_DAY_CHANGES && _day[desired + 1].fromUs <= nowUs)
+        {
+            desired++;
+        }
+
+        _step(&_day[desired], &temperature, values, steps);
+        powerChanges += steps > 0 && values[TEST_FIELD_powerOn] != powerOn;
+        powerOn = values[TEST_FIELD_powerOn];
+
+        sinceUs = nowUs - policy.reportedUs;
+        reason = xLabReportPolicyCheck(&policy, values, nowUs);
+
+        switch (reason)
+        {
+            case LABREPORT_NONE:
+            case LABREPORT_RETRY:
+                break;
+
+            case LABREPORT_FIRST:
+                LAB_TEST_CHECK_EQUAL(0, steps);
+                break;
+
+            case LABREPORT_IMMEDIATE:
+                LAB_TEST_CHECK(values[TEST_FIELD_powerOn] != policy.reported[TEST_FIELD_powerOn]);
+                break;
+
+            case LABREPORT_CHANGE:
+                LAB_TEST_CHECK(sinceUs >= TEST_INTERVAL_US);
+                LAB_TEST_CHECK(abs(values[TEST_FIELD_temperature] - policy.reported[TEST_FIELD_temperature]) >=
+                               LAB2_REPORT_TEMPERATURE_DEADBAND);
+                break;
+
+            case LABREPORT_HEARTBEAT:
+                LAB_TEST_CHECK(sinceUs >= TEST_HEARTBEAT_US);
+                break;
+        }
+
+        if (reason != LABREPORT_NONE)
+        {
+            vLabReportPolicyReported(&policy, values, nowUs);
+            reports++;
+        }
+
+        /* What the Shadow shows: powerOn as it is, the temperature within its
+         * deadband or late by the minimum interval at most, and never older
+         * than the heartbeat. */
+        LAB_TEST_CHECK_EQUAL(values[TEST_FIELD_powerOn], policy.reported[TEST_FIELD_powerOn]);
+        LAB_TEST_CHECK(abs(values[TEST_FIELD_temperature] - policy.reported[TEST_FIELD_temperature]) <
+                       LAB2_REPORT_TEMPERATURE_DEADBAND ||
+                       nowUs - policy.reportedUs < TEST_INTERVAL_US);
+        LAB_TEST_CHECK(nowUs - policy.reportedUs < TEST_HEARTBEAT_US);
+    }
+
+    printf("report policy: %u reports in a day instead of %u, %u for powerOn, %u heartbeats, %u deferred\n",
+           reports, steps, policy.stats.immediate, policy.stats.heartbeats, policy.stats.deferred);
+
+    LAB_TEST_CHECK_EQUAL(TEST_DAY_US / TEST_PERIOD_US, steps);
+    LAB_TEST_CHECK_EQUAL(reports, policy.stats.reports);
+    LAB_TEST_CHECK_EQUAL(steps, policy.stats.checks);
+    LAB_TEST_CHECK_EQUAL(powerChanges, policy.stats.immediate);
+    LAB_TEST_CHECK_EQUAL(0, policy.stats.retries);
+
+    /* A heartbeat at most for the quiet periods, a few reports for each
+     * change of what is desired. */
+    LAB_TEST_CHECK(policy.stats.heartbeats <= TEST_DAY_US / TEST_HEARTBEAT_US);
+    LAB_TEST_CHECK(reports * 40 < steps);
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_deferred_change(void)
+{
+    lab_report_policy_t policy;
+    int32_t values[TEST_FIELD_COUNT] = { 1, 30 };
+
+    vLabReportPolicyInit(&policy, _fields, TEST_FIELD_COUNT,
+                         LAB2_REPORT_MIN_INTERVAL_MS, LAB2_REPORT_HEARTBEAT_MS);
+
+    LAB_TEST_CHECK_EQUAL(LABREPORT_FIRST, xLabReportPolicyCheck(&policy, values, 0));
+    vLabReportPolicyReported(&policy, values, 0);
+
+    /* Within the deadband: never, but for the heartbeat. */
+    values[TEST_FIELD_temperature] = 31;
+    LAB_TEST_CHECK_EQUAL(LABREPORT_NONE, xLabReportPolicyCheck(&policy, values, TEST_INTERVAL_US));
+
+    /* Out of it: once the minimum interval is over. */
+    values[TEST_FIELD_temperature] = 28;
+    LAB_TEST_CHECK_EQUAL(LABREPORT_NONE, xLabReportPolicyCheck(&policy, values, TEST_INTERVAL_US - 1000));
+    LAB_TEST_CHECK_EQUAL(1, policy.stats.deferred);
+    LAB_TEST_CHECK_EQUAL(LABREPORT_CHANGE, xLabReportPolicyCheck(&policy, values, TEST_INTERVAL_US));
+
+    /* Not reported: asked again at the next check. */
+    LAB_TEST_CHECK_EQUAL(LABREPORT_CHANGE, xLabReportPolicyCheck(&policy, values, TEST_INTERVAL_US + TEST_PERIOD_US));
+    vLabReportPolicyReported(&policy, values, TEST_INTERVAL_US + TEST_PERIOD_US);
+
+    /* powerOn: at once. */
+    values[TEST_FIELD_powerOn] = 0;
+    LAB_TEST_CHECK_EQUAL(LABREPORT_IMMEDIATE, xLabReportPolicyCheck(&policy, values, TEST_INTERVAL_US + 2 * TEST_PERIOD_US));
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_retry(void)
+{
+    lab_report_policy_t policy;
+    int32_t values[TEST_FIELD_COUNT] = { 1, 30 };
+
+    vLabReportPolicyInit(&policy, _fields, TEST_FIELD_COUNT,
+                         LAB2_REPORT_MIN_INTERVAL_MS, LAB2_REPORT_HEARTBEAT_MS);
+    vLabReportPolicyReported(&policy, values, 0);
+
+    /* Sent, then rejected: at the next check, within the minimum interval
+     * and the deadband. */
+    values[TEST_FIELD_temperature] = 32;
+    LAB_TEST_CHECK_EQUAL(LABREPORT_CHANGE, xLabReportPolicyCheck(&policy, values, TEST_INTERVAL_US));
+    vLabReportPolicyReported(&policy, values, TEST_INTERVAL_US);
+    vLabReportPolicyRetry(&policy);
+    LAB_TEST_CHECK_EQUAL(LABREPORT_RETRY, xLabReportPolicyCheck(&policy, values, TEST_INTERVAL_US + TEST_PERIOD_US));
+    LAB_TEST_CHECK_EQUAL(1, policy.stats.retries);
+
+    /* Until reported. */
+    LAB_TEST_CHECK_EQUAL(LABREPORT_RETRY, xLabReportPolicyCheck(&policy, values, TEST_INTERVAL_US + 2 * TEST_PERIOD_US));
+    vLabReportPolicyReported(&policy, values, TEST_INTERVAL_US + 2 * TEST_PERIOD_US);
+    LAB_TEST_CHECK_EQUAL(LABREPORT_NONE, xLabReportPolicyCheck(&policy, values, TEST_INTERVAL_US + 3 * TEST_PERIOD_US));
+}
+
+/*-----------------------------------------------------------*/
+
+int main(void)
+{
+    LAB_TEST_RUN(test_simulated_day);
+    LAB_TEST_RUN(test_deferred_change);
+    LAB_TEST_RUN(test_retry);
+
+    return iLabTestResult();
+}
@@ -0,0 +1,380 @@
+/**
+ * @file test_lab_shadow_version.c
+ * @brief Host tests of the Shadow version: the state of lab2 synced on
+ * reconnect against a stand-in of the Shadow service, stale deltas dropped,
+ * and the version checked from concurrent tasks.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include <pthread.h>
+
+#include "lab_test.h"
+
+#include "lab_shadow_version.h"
+#include "lab2_shadow_state.h"
+
+/* Latency of the messages each way. */
+#define TEST_LATENCY_US     ( 40000 )
+#define TEST_ROUND_TRIP_US  ( 2 * TEST_LATENCY_US )
+
+#define TEST_MAX_MESSAGES   ( 16 )
+#define TEST_DOCUMENT_MAX   ( 256 )
+
+#define TEST_THREADS        ( 4 )
+#define TEST_THREAD_CHECKS  ( 100000 )
+
+typedef enum {
+    TEST_TO_DEVICE_DELTA,
+    TEST_TO_DEVICE_GET_ACCEPTED,
+    TEST_TO_SERVICE_GET,
+    TEST_TO_SERVICE_UPDATE
+} _message_type_t;
+
+typedef struct {
+    int64_t atUs;
+    _message_type_t type;
+    char document[TEST_DOCUMENT_MAX];
+    size_t length;
+} _message_t;
+
+/**
+ * @brief Messages on their way, in no order.
+ */
+static _message_t _messages[TEST_MAX_MESSAGES];
+static size_t _messageCount = 0;
+static int64_t _nowUs = 0;
+
+/**
+ * @brief The Shadow service stand-in: its document, and whether the device
+ * is subscribed to its deltas.
+ */
+static struct {
+    lab2_shadow_state_t desired;
+    lab2_shadow_state_t reported;
+    uint32_t version;
+    bool connected;
+} _service;
+
+/**
+ * @brief The device side of lab2: what it knows of the Shadow.
+ */
+static struct {
+    uint32_t version;
+    lab2_shadow_state_t desired;
+    uint32_t dropped;
+    int64_t syncedUs;                           /*!< When desired last became the service's */
+} _device;
+
+/*-----------------------------------------------------------*/
+
+static void _send(_message_type_t type, int64_t latencyUs, const char *pDocument, size_t length)
+{
+    LAB_TEST_CHECK(_messageCount < TEST_MAX_MESSAGES && length < TEST_DOCUMENT_MAX);
+    if (_messageCount < TEST_MAX_MESSAGES && length < TEST_DOCUMENT_MAX)
+    {
+        _messages[_messageCount].atUs = _nowUs + latencyUs;
+        _messages[_messageCount].type = type;
+        memcpy(_messages[_messageCount].document, pDocument, length);
+        _messages[_messageCount].length = length;
+        _messageCount++;
+    }
+}
+
+static bool _isSynced(void)
+{
+    return _device.desired.powerOn == _service.desired.powerOn &&
+           _device.desired.temperature == _service.desired.temperature;
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief The service changes what is desired, and sends the delta to the
+ * device if it is connected, after latencyUs.
+ */
+static void _serviceSetDesired(uint8_t powerOn, uint8_t temperature, int64_t latencyUs)
+{
+    char document[TEST_DOCUMENT_MAX];
+    int length = 0;
+
+    _service.desired.powerOn = powerOn;
+    _service.desired.temperature = temperature;
+    _service.version++;
+
+    if (_service.connected)
+    {
+        length = snprintf(document, sizeof(document),
+                          "{\"version\":%u,\"timestamp\":1571234567,\"state\":{\"powerOn\":%u,\"temperature\":%u},"
+                          "\"metadata\":{\"powerOn\":{\"timestamp\":1571234567},\"temperature\":{\"timestamp\":1571234567}}}",
+                          _service.version, powerOn, temperature);
+        _send(TEST_TO_DEVICE_DELTA, latencyUs, document, (size_t)length);
+    }
+}
+
+static void _serviceReceive(const _message_t *pMessage)
+{
+    lab_json_value_t values[LAB2SHADOW_FIELD_COUNT];
+    char document[TEST_DOCUMENT_MAX];
+    int length = 0;
+
+    if (pMessage->type == TEST_TO_SERVICE_GET)
+    {
+        length = snprintf(document, sizeof(document),
+                          "{\"state\":{\"desired\":{\"powerOn\":%u,\"temperature\":%u},"
+                          "\"reported\":{\"powerOn\":%u,\"temperature\":%u}},"
+                          "\"metadata\":{},\"version\":%u,\"timestamp\":1571234567}",
+                          _service.desired.powerOn, _service.desired.temperature,
+                          _service.reported.powerOn, _service.reported.temperature,
+                          _service.version);
+        _send(TEST_TO_DEVICE_GET_ACCEPTED, TEST_LATENCY_US, document, (size_t)length);
+    }
+    else
+    {
+        LAB_TEST_CHECK_EQUAL(ESP_OK, eLab2ShadowReadState(pMessage->document, pMessage->length,
+                                                          "state.reported", values));
+        ulLab2ShadowApplyDelta(values, &_service.reported);
+        _service.version++;
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief What lab2 does with the documents the connection passes on: apply
+ * what is desired, and report it.
+ */
+static void _deviceApply(const lab_json_value_t *pValues)
+{
+    char document[LAB2_SHADOW_REPORTED_JSON_LENGTH + 1];
+    size_t length = 0;
+
+    ulLab2ShadowApplyDelta(pValues, &_device.desired);
+
+    if (_isSynced())
+    {
+        _device.syncedUs = _nowUs;
+    }
+
+    length = xLab2ShadowWriteReported(&_device.desired, LAB2_SHADOW_ALL_FIELDS, (uint32_t)_nowUs,
+                                      document, sizeof(document));
+    _send(TEST_TO_SERVICE_UPDATE, TEST_LATENCY_US, document, length);
+}
+
+static void _deviceReceive(const _message_t *pMessage)
+{
+    lab_json_value_t values[LAB2SHADOW_FIELD_COUNT];
+
+    /* As the connection does: stale documents are not passed on. */
+    if (!bLabShadowVersionCheck(&_device.version, pMessage->document, pMessage->length, NULL))
+    {
+        _device.dropped++;
+        return;
+    }
+
+    LAB_TEST_CHECK_EQUAL(ESP_OK, eLab2ShadowReadState(pMessage->document, pMessage->length,
+                                                      pMessage->type == TEST_TO_DEVICE_DELTA ? "state" : "state.desired",
+                                                      values));
+    _deviceApply(values);
+}
+
+/**
+ * @brief The start of a session: the version starts over, and the Shadow is
+ * read at once if asked.
+ */
+static void _deviceConnect(bool read)
+{
+    _device.version = 0;
+    _service.connected = true;
+
+    if (read)
+    {
+        _send(TEST_TO_SERVICE_GET, TEST_LATENCY_US, "", 0);
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Deliver the messages due by a time, in their order.
+ */
+static void _runUntil(int64_t timeUs)
+{
+    _message_t message;
+    size_t i = 0, next = 0;
+
+    for (;;)
+    {
+        for (i = 0, next = _messageCount; i < _messageCount; i++)
+        {
+            if (_messages[i].atUs <= timeUs && (next == _messageCount || _messages[i].atUs < _messages[next].atUs))
+            {
+                next = i;
+            }
+        }
+
+        if (next == _messageCount)
+        {
+            break;
+        }
+
+        message = _messages[next];
+        _messages[next] = _messages[--_messageCount];
+        _nowUs = message.atUs;
+
+        if (message.type == TEST_TO_DEVICE_DELTA || message.type == TEST_TO_DEVICE_GET_ACCEPTED)
+        {
+            _deviceReceive(&message);
+        }
+        else
+        {
+            _serviceReceive(&message);
+        }
+    }
+
+    _nowUs = timeUs;
+}
+
+static void _reset(void)
+{
+    memset(&_service, 0, sizeof(_service));
+    memset(&_device, 0, sizeof(_device));
+    _messageCount = 0;
+    _nowUs = 0;
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_sync_on_reconnect(void)
+{
+    int64_t connectUs = 0;
+    bool read = false;
+
+    for (read = false; ; read = true)
+    {
+        _reset();
+        _deviceConnect(read);
+        _serviceSetDesired(1, 22, TEST_LATENCY_US);
+        _runUntil(1000000);
+        LAB_TEST_CHECK(_isSynced());
+
+        /* Changed while disconnected: the deltas are lost. */
+        _service.connected = false;
+        _serviceSetDesired(0, 22, TEST_LATENCY_US);
+        _serviceSetDesired(1, 18, TEST_LATENCY_US);
+
+        connectUs = 5000000;
+        _runUntil(connectUs);
+        _deviceConnect(read);
+        _runUntil(connectUs + 10000000);
+
+        printf("shadow sync: %s the Shadow read, %s\n", read ? "with" : "without",
+               _isSynced() ? "synced" : "not synced 10 s after the reconnect");
+
+        if (!read)
+        {
+            /* Until what is desired changes again. */
+            LAB_TEST_CHECK(!_isSynced());
+            continue;
+        }
+
+        /* Within a round trip, the Shadow reported the next. */
+        LAB_TEST_CHECK(_isSynced());
+        LAB_TEST_CHECK_EQUAL(connectUs + TEST_ROUND_TRIP_US, _device.syncedUs);
+        LAB_TEST_CHECK_EQUAL(_service.desired.temperature, _service.reported.temperature);
+        LAB_TEST_CHECK_EQUAL(_service.version, _device.version + 1);
+        break;
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_stale_deltas_dropped(void)
+{
+    _reset();
+    _deviceConnect(false);
+
+    /* Two deltas, the older one overtaken by the newer. */
+    _serviceSetDesired(1, 20, 3 * TEST_LATENCY_US);
+    _serviceSetDesired(1, 24, TEST_LATENCY_US);
+    _runUntil(1000000);
+
+    LAB_TEST_CHECK(_isSynced());
+    LAB_TEST_CHECK_EQUAL(24, _device.desired.temperature);
+    LAB_TEST_CHECK_EQUAL(1, _device.dropped);
+
+    /* A delta overtaken by the Shadow read. */
+    _serviceSetDesired(0, 24, 3 * TEST_LATENCY_US);
+    _serviceSetDesired(1, 19, 10 * TEST_LATENCY_US);
+    _send(TEST_TO_SERVICE_GET, TEST_LATENCY_US, "", 0);
+    _runUntil(2000000);
+
+    LAB_TEST_CHECK(_isSynced());
+    LAB_TEST_CHECK_EQUAL(19, _device.desired.temperature);
+    LAB_TEST_CHECK_EQUAL(2, _device.dropped);
+
+    /* A new session takes any version: the Shadow may have been created
+     * again. */
+    _service.version = 1;
+    _deviceConnect(false);
+    _serviceSetDesired(0, 25, TEST_LATENCY_US);
+    _runUntil(3000000);
+    LAB_TEST_CHECK(_isSynced());
+    LAB_TEST_CHECK_EQUAL(2, _device.dropped);
+}
+
+/*-----------------------------------------------------------*/
+
+static uint32_t _sharedVersion = 0;
+
+static void * _checkVersions(void *pArg)
+{
+    char document[32];
+    uint32_t first = (uint32_t)(uintptr_t)pArg;
+    uint32_t previous = 0, known = 0, i = 0;
+    int length = 0;
+
+    /* Versions interleaved with the other threads. */
+    for (i = 0; i < TEST_THREAD_CHECKS; i++)
+    {
+        length = snprintf(document, sizeof(document), "{\"version\":%u}", first + i * TEST_THREADS);
+        (void)bLabShadowVersionCheck(&_sharedVersion, document, (size_t)length, NULL);
+
+        /* Never back. */
+        known = __atomic_load_n(&_sharedVersion, __ATOMIC_RELAXED);
+        LAB_TEST_CHECK(known >= previous && known >= first + i * TEST_THREADS);
+        previous = known;
+    }
+
+    return NULL;
+}
+
+static void test_concurrent_checks(void)
+{
+    pthread_t threads[TEST_THREADS];
+    uint32_t i = 0;
+
+    for (i = 0; i < TEST_THREADS; i++)
+    {
+        pthread_create(&threads[i], NULL, _checkVersions, (void *)(uintptr_t)(i + 1));
+    }
+
+    for (i = 0; i < TEST_THREADS; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    LAB_TEST_CHECK_EQUAL(TEST_THREADS * TEST_THREAD_CHECKS, _sharedVersion);
+}
+
+/*-----------------------------------------------------------*/
+
+int main(void)
+{
+    LAB_TEST_RUN(test_sync_on_reconnect);
+    LAB_TEST_RUN(test_stale_deltas_dropped);
+    LAB_TEST_RUN(test_concurrent_checks);
+
+    return iLabTestResult();
+}
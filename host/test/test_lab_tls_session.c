@@ -0,0 +1,179 @@
+/**
+ * @file test_lab_tls_session.c
+ * @brief Host tests of the TLS session bookkeeping: which failed handshakes
+ * drop the cached session, the full and resumed handshake accounting, and the
+ * full handshakes a flaky network costs with and without keeping the session
+ * through timeouts and network errors.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include "lab_test.h"
+
+#include "lab_tls_session.h"
+
+/* Reconnections of the flaky network run. */
+#define TEST_RECONNECTIONS  ( 1000 )
+
+/*-----------------------------------------------------------*/
+
+static void test_keep(void)
+{
+    static const lab_tls_handshake_failure_t failures[] = {
+        LAB_TLS_HANDSHAKE_TIMED_OUT,
+        LAB_TLS_HANDSHAKE_NETWORK_ERROR,
+        LAB_TLS_HANDSHAKE_LOCAL_ERROR
+    };
+    lab_network_tls_stats_t before, stats;
+    uint32_t i = 0;
+
+    vLabTlsSessionGetStats(&before);
+    vLabTlsSessionSetCached(true);
+
+    /* A full handshake would have failed as well. */
+    for (i = 0; i < sizeof(failures) / sizeof(failures[0]); i++)
+    {
+        LAB_TEST_CHECK(!bLabTlsSessionHandshakeFailed(failures[i]));
+        LAB_TEST_CHECK(bLabTlsSessionIsCached());
+    }
+
+    vLabTlsSessionGetStats(&stats);
+    LAB_TEST_CHECK_EQUAL(before.failures + 3, stats.failures);
+    LAB_TEST_CHECK_EQUAL(before.forgotten, stats.forgotten);
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_forget(void)
+{
+    lab_network_tls_stats_t before, stats;
+
+    vLabTlsSessionGetStats(&before);
+
+    /* The server refused what was offered. */
+    vLabTlsSessionSetCached(true);
+    LAB_TEST_CHECK(bLabTlsSessionHandshakeFailed(LAB_TLS_HANDSHAKE_ALERT));
+    vLabTlsSessionSetCached(true);
+    LAB_TEST_CHECK(bLabTlsSessionHandshakeFailed(LAB_TLS_HANDSHAKE_REJECTED));
+
+    /* Nothing to forget when no session was offered. */
+    vLabTlsSessionSetCached(false);
+    LAB_TEST_CHECK(!bLabTlsSessionHandshakeFailed(LAB_TLS_HANDSHAKE_ALERT));
+    LAB_TEST_CHECK(!bLabTlsSessionHandshakeFailed(LAB_TLS_HANDSHAKE_REJECTED));
+
+    vLabTlsSessionGetStats(&stats);
+    LAB_TEST_CHECK_EQUAL(before.failures + 4, stats.failures);
+    LAB_TEST_CHECK_EQUAL(before.forgotten + 2, stats.forgotten);
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_stats(void)
+{
+    lab_network_tls_stats_t before, stats;
+
+    vLabTlsSessionGetStats(&before);
+
+    vLabTlsSessionHandshakeDone(false, 2500);
+    vLabTlsSessionHandshakeDone(true, 300);
+    vLabTlsSessionHandshakeDone(true, 500);
+
+    vLabTlsSessionGetStats(&stats);
+    LAB_TEST_CHECK_EQUAL(before.handshakes + 3, stats.handshakes);
+    LAB_TEST_CHECK_EQUAL(before.resumed + 2, stats.resumed);
+    LAB_TEST_CHECK_EQUAL(500, stats.lastHandshakeMs);
+    LAB_TEST_CHECK_EQUAL(2500, stats.lastFullHandshakeMs);
+    LAB_TEST_CHECK_EQUAL(500, stats.lastResumedHandshakeMs);
+    LAB_TEST_CHECK_EQUAL(before.totalFullHandshakeMs + 2500, stats.totalFullHandshakeMs);
+    LAB_TEST_CHECK_EQUAL(before.totalResumedHandshakeMs + 800, stats.totalResumedHandshakeMs);
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Outcome of a reconnection attempt on a flaky network: three in ten
+ * time out or lose the connection, one in a hundred is refused by the server.
+ *
+ * @return  true if the handshake went through
+ */
+static bool _attempt(uint32_t attempt, lab_tls_handshake_failure_t *pFailure)
+{
+    if (attempt % 100 == 99)
+    {
+        *pFailure = LAB_TLS_HANDSHAKE_ALERT;
+        return false;
+    }
+    if (attempt % 10 < 2)
+    {
+        *pFailure = LAB_TLS_HANDSHAKE_TIMED_OUT;
+        return false;
+    }
+    if (attempt % 10 == 2)
+    {
+        *pFailure = LAB_TLS_HANDSHAKE_NETWORK_ERROR;
+        return false;
+    }
+
+    return true;
+}
+
+static void test_flaky_network(void)
+{
+    lab_tls_handshake_failure_t failure = LAB_TLS_HANDSHAKE_LOCAL_ERROR;
+    lab_network_tls_stats_t before, stats;
+    uint32_t attempt = 0, connected = 0, full = 0, fullForgetAll = 0;
+    bool cachedForgetAll = false;
+
+    vLabTlsSessionGetStats(&before);
+    vLabTlsSessionSetCached(false);
+
+    for (attempt = 0; connected < TEST_RECONNECTIONS; attempt++)
+    {
+        if (_attempt(attempt, &failure))
+        {
+            /* The server still knows the session: offering it resumes it. */
+            vLabTlsSessionHandshakeDone(bLabTlsSessionIsCached(), 0);
+            full += bLabTlsSessionIsCached() ? 0 : 1;
+            vLabTlsSessionSetCached(true);
+
+            fullForgetAll += cachedForgetAll ? 0 : 1;
+            cachedForgetAll = true;
+            connected++;
+        }
+        else
+        {
+            if (bLabTlsSessionHandshakeFailed(failure))
+            {
+                vLabTlsSessionSetCached(false);
+            }
+
+            /* As before: any failure dropped the session. */
+            cachedForgetAll = false;
+        }
+    }
+
+    vLabTlsSessionGetStats(&stats);
+    printf("tls session: %u reconnections in %u attempts, %u full handshakes, "
+           "%u when any failure forgets the session\n",
+           connected, attempt, full, fullForgetAll);
+
+    LAB_TEST_CHECK_EQUAL(before.handshakes + TEST_RECONNECTIONS, stats.handshakes);
+    LAB_TEST_CHECK_EQUAL(TEST_RECONNECTIONS - full, stats.resumed - before.resumed);
+
+    /* Only the refused ones, and the first, cost a full handshake. */
+    LAB_TEST_CHECK_EQUAL(1 + stats.forgotten - before.forgotten, full);
+    LAB_TEST_CHECK(full * 5 < fullForgetAll);
+}
+
+/*-----------------------------------------------------------*/
+
+int main(void)
+{
+    LAB_TEST_RUN(test_keep);
+    LAB_TEST_RUN(test_forget);
+    LAB_TEST_RUN(test_stats);
+    LAB_TEST_RUN(test_flaky_network);
+
+    return iLabTestResult();
+}
@@ -0,0 +1,140 @@
+/**
+ * @file test_lab_topics.c
+ * @brief Host tests of the topic names of the device, full and aliased, and
+ * the bytes the aliases save on each QoS1 PUBLISH.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include "lab_test.h"
+
+#include "lab_topics.h"
+
+/* The ID of workshop.c: the MAC address of the device. */
+#define TEST_ID             "0a1b2c3d4e5f"
+
+/* The lab1 button message, and the Last Will and Testament of lab_connection. */
+#define TEST_CLICK          "{\"serialNumber\":\"" TEST_ID "\",\"clickType\":\"SINGLE\"}"
+#define TEST_LWT            "{\"message\": \"disconnected\"}"
+
+/*-----------------------------------------------------------*/
+
+static void _expect(lab_connection_topic_t topic, const char *pExpected)
+{
+    uint16_t length = 0;
+    const char *pName = pcLabTopicsGet(topic, &length);
+
+    LAB_TEST_CHECK(pName != NULL);
+    if (pName != NULL && (length != strlen(pExpected) || strcmp(pName, pExpected) != 0))
+    {
+        printf("topic %u: got %s, %u bytes\n", topic, pName, length);
+        LAB_TEST_CHECK(false);
+    }
+}
+
+/**
+ * @brief Size of a QoS1 PUBLISH: fixed header, remaining length, topic and
+ * packet identifier, payload.
+ */
+static size_t _publishSize(size_t topicLength, size_t payloadLength)
+{
+    size_t remaining = 2 + topicLength + 2 + payloadLength;
+    size_t lengthBytes = remaining < 128 ? 1 : remaining < 16384 ? 2 : 3;
+
+    return 1 + lengthBytes + remaining;
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_full_names(void)
+{
+    LAB_TEST_CHECK_EQUAL(ESP_OK, eLabTopicsInit(TEST_ID, false));
+
+    _expect(LABCONNECTION_TOPIC_DEVICE, "mydevice/" TEST_ID);
+    _expect(LABCONNECTION_TOPIC_LWT, "mydevice/" TEST_ID "/lwt");
+    _expect(LABCONNECTION_TOPIC_METRICS, "mydevice/" TEST_ID "/metrics");
+    _expect(LABCONNECTION_TOPIC_VIBRATION, "mydevice/" TEST_ID "/vibration");
+
+    LAB_TEST_CHECK(pcLabTopicsGet(LABCONNECTION_TOPIC_MAX, NULL) == NULL);
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_aliases(void)
+{
+    LAB_TEST_CHECK_EQUAL(ESP_OK, eLabTopicsInit(TEST_ID, true));
+
+    /* The ID stays in front, where per-device policies look for it. */
+    _expect(LABCONNECTION_TOPIC_DEVICE, TEST_ID "/a/0");
+    _expect(LABCONNECTION_TOPIC_LWT, TEST_ID "/a/1");
+    _expect(LABCONNECTION_TOPIC_METRICS, TEST_ID "/a/2");
+    _expect(LABCONNECTION_TOPIC_VIBRATION, TEST_ID "/a/3");
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_too_long(void)
+{
+    char id[LAB_CONNECTION_TOPIC_MAX_LENGTH] = { 0 };
+
+    /* Fits as an alias, not as the full vibration topic. */
+    memset(id, 'x', LAB_CONNECTION_TOPIC_MAX_LENGTH - sizeof("/a/0"));
+    LAB_TEST_CHECK_EQUAL(ESP_OK, eLabTopicsInit(id, true));
+    LAB_TEST_CHECK_EQUAL(ESP_FAIL, eLabTopicsInit(id, false));
+    LAB_TEST_CHECK(pcLabTopicsGet(LABCONNECTION_TOPIC_VIBRATION, NULL) == NULL);
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_saving(void)
+{
+    static const char * const names[LABCONNECTION_TOPIC_MAX] = { "device", "lwt", "metrics", "vibration" };
+    uint16_t fullLengths[LABCONNECTION_TOPIC_MAX] = { 0 };
+    uint16_t aliasLength = 0;
+    size_t fullSize = 0, aliasSize = 0;
+    uint32_t i = 0;
+
+    LAB_TEST_CHECK_EQUAL(ESP_OK, eLabTopicsInit(TEST_ID, false));
+    for (i = 0; i < LABCONNECTION_TOPIC_MAX; i++)
+    {
+        (void)pcLabTopicsGet(i, &fullLengths[i]);
+    }
+
+    LAB_TEST_CHECK_EQUAL(ESP_OK, eLabTopicsInit(TEST_ID, true));
+    for (i = 0; i < LABCONNECTION_TOPIC_MAX; i++)
+    {
+        (void)pcLabTopicsGet(i, &aliasLength);
+        printf("topics: %s: %u bytes, alias %u bytes, %u saved per publish\n",
+               names[i], fullLengths[i], aliasLength, fullLengths[i] - aliasLength);
+
+        LAB_TEST_CHECK(aliasLength < fullLengths[i]);
+    }
+
+    /* The messages of lab1, whole PUBLISH packets. */
+    (void)pcLabTopicsGet(LABCONNECTION_TOPIC_DEVICE, &aliasLength);
+    fullSize = _publishSize(fullLengths[LABCONNECTION_TOPIC_DEVICE], sizeof(TEST_CLICK) - 1);
+    aliasSize = _publishSize(aliasLength, sizeof(TEST_CLICK) - 1);
+    printf("topics: button message: %zu bytes, %zu with the alias, %.1f%% saved\n",
+           fullSize, aliasSize, 100.0 * (fullSize - aliasSize) / fullSize);
+    LAB_TEST_CHECK(aliasSize < fullSize);
+
+    (void)pcLabTopicsGet(LABCONNECTION_TOPIC_LWT, &aliasLength);
+    fullSize = _publishSize(fullLengths[LABCONNECTION_TOPIC_LWT], sizeof(TEST_LWT) - 1);
+    aliasSize = _publishSize(aliasLength, sizeof(TEST_LWT) - 1);
+    printf("topics: Last Will: %zu bytes, %zu with the alias, %.1f%% saved\n",
+           fullSize, aliasSize, 100.0 * (fullSize - aliasSize) / fullSize);
+    LAB_TEST_CHECK(aliasSize < fullSize);
+}
+
+/*-----------------------------------------------------------*/
+
+int main(void)
+{
+    LAB_TEST_RUN(test_full_names);
+    LAB_TEST_RUN(test_aliases);
+    LAB_TEST_RUN(test_too_long);
+    LAB_TEST_RUN(test_saving);
+
+    return iLabTestResult();
+}
@@ -0,0 +1,231 @@
+/**
+ * @file test_lab_vibration.c
+ * @brief Host tests of the vibration features: synthetic sines of known
+ * amplitude and frequency, then the simulated IMU through the sampling and
+ * vibration tasks, in simulated time.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include <math.h>
+#include <time.h>
+
+#include "lab_test.h"
+#include "lab_test_sim.h"
+
+#include "lab_imu.h"
+#include "lab_vibration.h"
+
+#define TEST_PI             ( 3.14159265358979 )
+
+/* Time between two samples, and the width of a band. */
+#define TEST_PERIOD_US      ( (int64_t)LAB_IMU_DECIMATION * 1000000 / LAB_IMU_ODR_HZ )
+#define TEST_RATE_HZ        ( (double)LAB_IMU_ODR_HZ / LAB_IMU_DECIMATION )
+#define TEST_BAND_HZ        ( TEST_RATE_HZ / 2 / LAB_VIBRATION_BANDS )
+
+/* Values in mg, to the given relative tolerance. */
+#define TEST_CHECK_NEAR(expected, actual, tolerance)                                \
+    LAB_TEST_CHECK(fabs((double)(actual) - (expected)) <= (tolerance) * (expected))
+
+static lab_imu_sample_t _samples[LAB_VIBRATION_WINDOW];
+static int64_t _timeUs = 0;
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Feed whole windows of a sine on Z, 1 g of gravity under it, and a
+ * sine on X when given.
+ */
+static void _feedSines(uint32_t windows, double zHz, double zMg, double xHz, double xMg)
+{
+    uint32_t w = 0, n = 0;
+    double t = 0;
+
+    for (w = 0; w < windows; w++)
+    {
+        for (n = 0; n < LAB_VIBRATION_WINDOW; n++)
+        {
+            _timeUs += TEST_PERIOD_US;
+            t = _timeUs / 1e6;
+            _samples[n].timeUs = _timeUs;
+            _samples[n].accel[0] = (int16_t)lrint(xMg * sin(2 * TEST_PI * xHz * t) * LAB_IMU_ACCEL_LSB_PER_G / 1000);
+            _samples[n].accel[1] = 0;
+            _samples[n].accel[2] = (int16_t)lrint((1000 + zMg * sin(2 * TEST_PI * zHz * t)) * LAB_IMU_ACCEL_LSB_PER_G / 1000);
+        }
+        vLabVibrationAddSamples(_samples, LAB_VIBRATION_WINDOW);
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_sine_in_each_band(void)
+{
+    lab_vibration_features_t features;
+    uint32_t b = 0, other = 0;
+
+    for (b = 0; b < LAB_VIBRATION_BANDS; b++)
+    {
+        /* 100 mg in the middle of the band: 70.7 mg RMS, crest factor of 1.41. */
+        _feedSines(4, (b + 0.5) * TEST_BAND_HZ, 100, 0, 0);
+
+        LAB_TEST_CHECK(bLabVibrationTakeFeatures(&features));
+        LAB_TEST_CHECK_EQUAL(4, features.windows);
+        TEST_CHECK_NEAR(70.7, features.rmsMg[2], 0.05);
+        TEST_CHECK_NEAR(100, features.peakMg[2], 0.05);
+        TEST_CHECK_NEAR(141, features.crestX100[2], 0.05);
+        LAB_TEST_CHECK_EQUAL(0, features.rmsMg[0]);
+        LAB_TEST_CHECK_EQUAL(0, features.rmsMg[1]);
+
+        /* All of it in its band, what the window leaks elsewhere is small. */
+        TEST_CHECK_NEAR(70.7, features.bandMg[b], 0.1);
+        for (other = 0; other < LAB_VIBRATION_BANDS; other++)
+        {
+            if (other != b)
+            {
+                LAB_TEST_CHECK(features.bandMg[other] < 7);
+            }
+        }
+    }
+
+    /* Taken: nothing until the next window. */
+    LAB_TEST_CHECK(!bLabVibrationTakeFeatures(&features));
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_two_axes(void)
+{
+    lab_vibration_features_t features;
+
+    /* A slow sway on X only shows in the magnitude at twice its frequency,
+     * by its square: 200 mg gives 10 mg around 1 g, 7 mg RMS. */
+    _feedSines(4, 3.5 * TEST_BAND_HZ, 50, 5, 200);
+
+    LAB_TEST_CHECK(bLabVibrationTakeFeatures(&features));
+    TEST_CHECK_NEAR(141, features.rmsMg[0], 0.05);
+    TEST_CHECK_NEAR(200, features.peakMg[0], 0.05);
+    TEST_CHECK_NEAR(35.4, features.rmsMg[2], 0.05);
+    TEST_CHECK_NEAR(35.4, features.bandMg[3], 0.1);
+    TEST_CHECK_NEAR(7.1, features.bandMg[0], 0.3);
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_gap_restarts_the_window(void)
+{
+    lab_vibration_features_t features;
+    uint32_t n = 0;
+
+    for (n = 0; n < LAB_VIBRATION_WINDOW; n++)
+    {
+        /* A gap of 10 periods three quarters into the window. */
+        _timeUs += n == LAB_VIBRATION_WINDOW * 3 / 4 ? 10 * TEST_PERIOD_US : TEST_PERIOD_US;
+        _samples[n].timeUs = _timeUs;
+        _samples[n].accel[0] = 0;
+        _samples[n].accel[1] = 0;
+        _samples[n].accel[2] = LAB_IMU_ACCEL_LSB_PER_G;
+    }
+
+    vLabVibrationAddSamples(_samples, LAB_VIBRATION_WINDOW);
+    LAB_TEST_CHECK(!bLabVibrationTakeFeatures(&features));
+
+    /* The window started after the gap. */
+    _feedSines(1, TEST_BAND_HZ, 100, 0, 0);
+    LAB_TEST_CHECK(bLabVibrationTakeFeatures(&features));
+    LAB_TEST_CHECK_EQUAL(1, features.windows);
+
+    /* Restarted by the caller, as the task does when the reader lost samples. */
+    vLabVibrationRestartWindow();
+    LAB_TEST_CHECK(!bLabVibrationTakeFeatures(&features));
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_payload_against_the_raw_stream(void)
+{
+    lab_vibration_features_t features;
+    uint8_t buffer[LAB_VIBRATION_PAYLOAD_MAX_LENGTH];
+    size_t json = 0, cbor = 0, raw = 0;
+
+    vLabVibrationRestartWindow();
+    _feedSines(4, 3.5 * TEST_BAND_HZ, 50, 5, 200);
+    LAB_TEST_CHECK(bLabVibrationTakeFeatures(&features));
+
+    /* The largest values fit the bound. */
+    memset(&features, 0xff, sizeof(features));
+    json = xLabVibrationToPayload(&features, buffer, sizeof(buffer), LABPAYLOAD_JSON);
+    cbor = xLabVibrationToPayload(&features, buffer, sizeof(buffer), LABPAYLOAD_CBOR);
+    LAB_TEST_CHECK(json > 0 && json <= LAB_VIBRATION_PAYLOAD_MAX_LENGTH);
+    LAB_TEST_CHECK(cbor > 0 && cbor < json);
+
+    /* One message a minute instead of the samples of the minute. */
+    raw = 60 * (size_t)TEST_RATE_HZ * sizeof(lab_imu_sample_t);
+    printf("vibration: %zu bytes of samples a minute, %zu bytes of JSON features, %zu of CBOR\n", raw, json, cbor);
+    LAB_TEST_CHECK(raw / json > 1000);
+
+    /* Too small a buffer is an error, not a truncated message. */
+    LAB_TEST_CHECK_EQUAL(0, xLabVibrationToPayload(&features, buffer, cbor - 1, LABPAYLOAD_CBOR));
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_window_benchmark(void)
+{
+    lab_vibration_features_t features;
+    struct timespec start, end;
+    uint32_t i = 0;
+    double us = 0;
+
+    vLabVibrationRestartWindow();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < 1000; i++)
+    {
+        _feedSines(1, 3.5 * TEST_BAND_HZ, 50, 5, 200);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    /* Sine generation included: an upper bound. */
+    us = ((end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3) / 1000;
+    printf("vLabVibrationAddSamples: %.1f us per window of %d samples\n", us, LAB_VIBRATION_WINDOW);
+
+    LAB_TEST_CHECK(bLabVibrationTakeFeatures(&features));
+    LAB_TEST_CHECK_EQUAL(1000, features.windows);
+}
+
+/*-----------------------------------------------------------*/
+
+static void test_simulated_imu(void)
+{
+    lab_vibration_features_t features;
+
+    LAB_TEST_CHECK(!bLabVibrationTakeFeatures(&features));
+    LAB_TEST_CHECK_EQUAL(ESP_OK, eLabImuInit(NULL));
+
+    vLabTestSimRunFor(10000000);
+
+    /* 10 s of the sway on X and the 40 Hz vibration on Z of the simulated IMU. */
+    LAB_TEST_CHECK(bLabVibrationTakeFeatures(&features));
+    LAB_TEST_CHECK(features.windows >= 10000000 / (LAB_VIBRATION_WINDOW * TEST_PERIOD_US) - 1);
+    TEST_CHECK_NEAR(141, features.rmsMg[0], 0.05);
+    LAB_TEST_CHECK_EQUAL(0, features.rmsMg[1]);
+    TEST_CHECK_NEAR(35.4, features.rmsMg[2], 0.05);
+    TEST_CHECK_NEAR(35.4, features.bandMg[(uint32_t)(40 / TEST_BAND_HZ)], 0.1);
+}
+
+/*-----------------------------------------------------------*/
+
+int main(void)
+{
+    /* The vibration task only runs in test_simulated_imu. */
+    LAB_TEST_CHECK_EQUAL(ESP_OK, eLabVibrationInit());
+
+    LAB_TEST_RUN(test_sine_in_each_band);
+    LAB_TEST_RUN(test_two_axes);
+    LAB_TEST_RUN(test_gap_restarts_the_window);
+    LAB_TEST_RUN(test_payload_against_the_raw_stream);
+    LAB_TEST_RUN(test_window_benchmark);
+    LAB_TEST_RUN(test_simulated_imu);
+
+    return iLabTestResult();
+}
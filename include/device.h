@@ -15,20 +15,42 @@
 #define STATUS_LED_ON()
 #define STATUS_LED_OFF()
 
-#define DISPLAY_PRINT(str, x, y)
-#define DISPLAY_WIDTH
-#define DISPLAY_HEIGHT
+#define BUTTON_CLICK            0
+#define BUTTON_HOLD             1
+#define BUTTON_DOUBLE_CLICK     2
+#define BUTTON_TRIPLE_CLICK     3
+#define BUTTON_LONG_PRESS       4
 
-#define BUTTON_CLICK    0
-#define BUTTON_HOLD     1
+/* Devices with DEVICE_HAS_BUTTON_EVENT_DATA attach a device_button_event_t to
+ * their button events: time of the physical press (esp_timer, us) and press
+ * duration of a long press (ms). */
 
-#if defined(DEVICE_ESP32_DEVKITC)
+#if defined(LAB_HOST_BUILD)
+
+    #include "host_device.h"
+
+    #define DEVICE_HAS_MAIN_BUTTON
+    #define BUTTON_MAIN_EVENT_BASE HOST_BUTTON_MAIN_EVENT_BASE
+    #define DEVICE_HAS_RESET_BUTTON
+    #define BUTTON_RESET_EVENT_BASE HOST_BUTTON_RESET_EVENT_BASE
+
+    #define DEVICE_HAS_BUTTON_EVENT_DATA
+    typedef host_button_event_t device_button_event_t;
+
+    #define DEVICE_HAS_ACCELEROMETER
+    #define DEVICE_HAS_BATTERY
+    #define DEVICE_HAS_DISPLAY
+
+#elif defined(DEVICE_ESP32_DEVKITC)
 
     #include "esp32devkitc.h"
 
     #define DEVICE_HAS_MAIN_BUTTON
     #define BUTTON_MAIN_EVENT_BASE ESP32DEVKITC_BUTTON_EVENT_BASE
 
+    #define DEVICE_HAS_BUTTON_EVENT_DATA
+    typedef esp32devkitc_button_event_t device_button_event_t;
+
 #elif defined(DEVICE_M5STICKC)
     
     #include "m5stickc.h"
@@ -46,12 +68,7 @@
     #define STATUS_LED_ON() M5StickCLedSet(M5STICKC_LED_ON)
     #define STATUS_LED_OFF() M5StickCLedSet(M5STICKC_LED_OFF)
 
-    #undef DISPLAY_PRINT
-    #define DISPLAY_PRINT(str, x, y) TFT_print(str, x, y)
-    #undef DISPLAY_WIDTH
-    #define DISPLAY_WIDTH M5STICKC_DISPLAY_WIDTH
-    #undef DISPLAY_HEIGHT
-    #define DISPLAY_HEIGHT M5STICKC_DISPLAY_HEIGHT
+    #define DEVICE_HAS_DISPLAY
 
 #else
 
@@ -60,4 +77,14 @@
 esp_err_t eDeviceInit(void);
 esp_err_t eDeviceRegisterButtonCallback(esp_event_base_t base, void (*callback)(void * handler_arg, esp_event_base_t base, int32_t id, void * event_data) );
 
+#if defined(DEVICE_HAS_ACCELEROMETER)
+/* LAB_IMU_EVENT_BASE events, with a lab_imu_motion_event_t. */
+esp_err_t eDeviceRegisterMotionCallback(void (*callback)(void * handler_arg, esp_event_base_t base, int32_t id, void * event_data) );
+#endif
+
+#if defined(DEVICE_HAS_BATTERY)
+/* LAB_BATTERY_EVENT_BASE events, with a lab_battery_event_t. */
+esp_err_t eDeviceRegisterBatteryCallback(void (*callback)(void * handler_arg, esp_event_base_t base, int32_t id, void * event_data) );
+#endif
+
 #endif /* ifndef _DEVICE_H_ */
\ No newline at end of file
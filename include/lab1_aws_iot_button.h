@@ -8,6 +8,9 @@
 #ifndef _LAB1_AWS_IOT_BUTTON_H_
 #define _LAB1_AWS_IOT_BUTTON_H_
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #include "esp_err.h"
 
 #if defined(LAB_INIT)
@@ -16,6 +19,11 @@
 #endif
 
 esp_err_t eLab1Init(const char *strID);
-esp_err_t eLab1Action( const char * strID, int32_t buttonID );
+esp_err_t eLab1Action( const char * strID, int32_t buttonID, uint32_t durationMs );
+
+/**
+ * @brief   Publish that the device started moving, or stopped after durationMs.
+ */
+esp_err_t eLab1Motion( const char * strID, bool moving, uint32_t durationMs );
 
 #endif /* ifndef _LAB1_AWS_IOT_BUTTON_H_ */
@@ -8,10 +8,56 @@
 #ifndef _LAB2_SHADOW_H_
 #define _LAB2_SHADOW_H_
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #include "esp_err.h"
 
+/**
+ * @brief Period of the simulated AirCon: the temperature moves by a degree.
+ */
+#ifndef LAB2_AIRCON_PERIOD_MS
+    #define LAB2_AIRCON_PERIOD_MS               ( 10000 )
+#endif
+
+/**
+ * @brief Change of the temperature, from the last one reported, that is
+ * reported. Changes of powerOn are reported at once.
+ */
+#ifndef LAB2_REPORT_TEMPERATURE_DEADBAND
+    #define LAB2_REPORT_TEMPERATURE_DEADBAND    ( 2 )
+#endif
+
+/**
+ * @brief Shortest time between two reported states, but for powerOn.
+ */
+#ifndef LAB2_REPORT_MIN_INTERVAL_MS
+    #define LAB2_REPORT_MIN_INTERVAL_MS         ( 30000 )
+#endif
+
+/**
+ * @brief Longest time without a reported state, 0 for none.
+ */
+#ifndef LAB2_REPORT_HEARTBEAT_MS
+    #define LAB2_REPORT_HEARTBEAT_MS            ( 15 * 60 * 1000 )
+#endif
+
+/**
+ * @brief Longest wait for the response to a reported update. Past it the
+ * update is taken as lost: its fields are sent again at the next report.
+ */
+#ifndef LAB2_REPORT_RESPONSE_TIMEOUT_MS
+    #define LAB2_REPORT_RESPONSE_TIMEOUT_MS     ( 30000 )
+#endif
+
 esp_err_t eLab2Init(const char *const strID);
 
+/**
+ * @brief   Report the battery in the Shadow, as reported.battery. Called on the
+ *          battery events only: the monitor already filters out small changes.
+ */
+esp_err_t eLab2ReportBattery(uint32_t socPercent, bool charging, uint32_t millivolts);
+
 #if defined(LAB_INIT)
     #undef LAB_INIT
     #define LAB_INIT(x) eLab2Init(x)
@@ -0,0 +1,221 @@
+/**
+ * @file lab2_shadow_state.h
+ * @brief Lab2: state of the AirCon and its Shadow documents, generated from
+ * one schema table, apart from the MQTT code that sends them.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#ifndef _LAB2_SHADOW_STATE_H_
+#define _LAB2_SHADOW_STATE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#include "lab_json.h"
+#include "lab_payload.h"
+#include "lab_report_policy.h"
+#include "lab2_shadow.h"
+
+/**
+ * @brief Schema of the AirCon state: one row per field, from which the state,
+ * the reported document and its size, the delta keys and the report policy are
+ * generated. A field is added here only.
+ *
+ * X(name, C type, JSON type, min, max, report deadband, reported at once, initial value)
+ *
+ * Desired values out of [min, max] are ignored. The temperature keeps two digits
+ * for the display.
+ */
+#define LAB2_SHADOW_FIELDS(X)                                                               \
+    X(powerOn,     uint8_t, BOOL, 0, 1,  0,                                true,  0)        \
+    X(temperature, uint8_t, INT,  0, 99, LAB2_REPORT_TEMPERATURE_DEADBAND, false, 35)
+
+/* Per JSON type: the reader type, the writer and the largest value written.
+ * Bools are reported as 0 or 1, as the desired states set them: true would
+ * never match a desired 1, and the delta would stay. */
+#define LAB2_SHADOW_TYPE_BOOL_JSON                  LABJSON_TYPE_BOOL
+#define LAB2_SHADOW_TYPE_BOOL_LENGTH                ( 1 )
+#define LAB2_SHADOW_TYPE_BOOL_WRITE(writer, value)  vLabPayloadUint(writer, (value) != 0)
+#define LAB2_SHADOW_TYPE_INT_JSON                   LABJSON_TYPE_INT
+#define LAB2_SHADOW_TYPE_INT_LENGTH                 LAB_PAYLOAD_JSON_INT_LENGTH
+#define LAB2_SHADOW_TYPE_INT_WRITE(writer, value)   vLabPayloadInt(writer, (int32_t)(value))
+
+#define LAB2_SHADOW_FIELD_MEMBER(name, ctype, type, min, max, band, atOnce, initial) \
+    ctype name;
+#define LAB2_SHADOW_FIELD_ENUM(name, ctype, type, min, max, band, atOnce, initial) \
+    LAB2SHADOW_FIELD_##name,
+#define LAB2_SHADOW_FIELD_LENGTH(name, ctype, type, min, max, band, atOnce, initial) \
+    + LAB_PAYLOAD_JSON_KEY_LENGTH(#name) + LAB2_SHADOW_TYPE_##type##_LENGTH
+
+typedef struct {
+    LAB2_SHADOW_FIELDS(LAB2_SHADOW_FIELD_MEMBER)
+} lab2_shadow_state_t;
+
+/**
+ * @brief Fields of the state, also their bit in a set of fields.
+ */
+typedef enum {
+    LAB2_SHADOW_FIELDS(LAB2_SHADOW_FIELD_ENUM)
+    LAB2SHADOW_FIELD_COUNT
+} lab2_shadow_field_t;
+
+#define LAB2_SHADOW_ALL_FIELDS              ( (1UL << LAB2SHADOW_FIELD_COUNT) - 1 )
+
+/**
+ * @brief Client token of the Shadow updates: a timestamp, modded by 1000000 to
+ * keep it within 6 characters. It must be unique at any given time, but may be
+ * reused once the update is completed.
+ */
+#define LAB2_SHADOW_CLIENT_TOKEN_LENGTH     ( 6 )
+
+/**
+ * @brief Largest reported document:
+ * {"state":{"reported":{fields}},"clientToken":"123456"}
+ */
+#define LAB2_SHADOW_REPORTED_JSON_LENGTH                                \
+    ( LAB_PAYLOAD_JSON_MAP_LENGTH( 2 ) +                                \
+      LAB_PAYLOAD_JSON_KEY_LENGTH( "state" ) +                          \
+      LAB_PAYLOAD_JSON_MAP_LENGTH( 1 ) +                                \
+      LAB_PAYLOAD_JSON_KEY_LENGTH( "reported" ) +                       \
+      LAB_PAYLOAD_JSON_MAP_LENGTH( LAB2SHADOW_FIELD_COUNT )             \
+      LAB2_SHADOW_FIELDS(LAB2_SHADOW_FIELD_LENGTH) +                    \
+      LAB_PAYLOAD_JSON_KEY_LENGTH( "clientToken" ) +                    \
+      LAB_PAYLOAD_JSON_STRING_LENGTH( LAB2_SHADOW_CLIENT_TOKEN_LENGTH ) )
+
+/**
+ * @brief Reported updates of the AirCon task, which owns it. Only the fields
+ * that differ from what the Shadow accepted, the dirty ones, are sent: a field
+ * is clean once the update carrying it is accepted.
+ */
+typedef struct {
+    uint32_t sequence;                          /*!< Of the last update sent */
+    bool inFlight;                              /*!< Last update waiting for its response */
+    int64_t sentUs;
+    uint32_t fields;                            /*!< Fields of the last update, a bit by LAB2SHADOW_FIELD_* */
+    int32_t values[LAB2SHADOW_FIELD_COUNT];     /*!< Values of the last update */
+    uint32_t accepted;                          /*!< Fields whose value the Shadow accepted */
+    int32_t acceptedValues[LAB2SHADOW_FIELD_COUNT];
+} lab2_shadow_reported_t;
+
+/**
+ * @brief Copies of the states published by the AirCon task for the other
+ * tasks: a seqlock over two copies. The writer moves the sequence on before
+ * writing each copy, and readers read the copy it does not write. Readers
+ * retry only if the writer moved on while they read: a writer preempted
+ * mid-copy, as the priority 0 AirCon task can be, never holds them up.
+ */
+typedef struct {
+    uint32_t sequence;                          /*!< Its lowest bit is the copy to read */
+    lab2_shadow_state_t reported[2];
+    lab2_shadow_state_t desired[2];
+} lab2_shadow_snapshot_t;
+
+/**
+ * @brief   Set a state to the initial values of the schema.
+ */
+void vLab2ShadowStateInit(lab2_shadow_state_t *pState);
+
+/**
+ * @brief   Copy a state into one value per field, for the report policy.
+ */
+void vLab2ShadowStateGetValues(const lab2_shadow_state_t *pState, int32_t *pValues);
+
+/**
+ * @brief   Fields of the report policy, one per field of the state.
+ */
+const lab_report_field_t * pxLab2ShadowReportFields(void);
+
+/**
+ * @brief   Write the "reported" document of some fields of a state.
+ *
+ * @param   fields a bit per field written, by LAB2SHADOW_FIELD_*
+ * @param   clientToken below 1000000
+ * @return  length of the document, 0 if it did not fit
+ */
+size_t xLab2ShadowWriteReported(const lab2_shadow_state_t *pState,
+                                uint32_t fields,
+                                uint32_t clientToken,
+                                char *pBuffer,
+                                size_t size);
+
+/**
+ * @brief   Read the fields of the state in an object of a Shadow document, as
+ *          "state" of a delta or "state.desired" of a read.
+ *
+ * @param   pValues one value per field
+ * @return  as eLabJsonRead
+ */
+esp_err_t eLab2ShadowReadState(const char *pDocument,
+                               size_t documentLength,
+                               const char *pObjectKey,
+                               lab_json_value_t *pValues);
+
+/**
+ * @brief   Apply the fields read within their range to a desired state.
+ *
+ * @return  a bit per field changed, by LAB2SHADOW_FIELD_*
+ */
+uint32_t ulLab2ShadowApplyDelta(const lab_json_value_t *pDelta, lab2_shadow_state_t *pDesired);
+
+/**
+ * @brief   Forget what the Shadow accepted and the update in flight, at the
+ *          start of a session: everything is dirty.
+ */
+void vLab2ShadowReportedReset(lab2_shadow_reported_t *pReported);
+
+/**
+ * @brief   Fields whose value differs from the one the Shadow accepted.
+ */
+uint32_t ulLab2ShadowReportedDirty(const lab2_shadow_reported_t *pReported, const int32_t *pValues);
+
+/**
+ * @brief   Record the update sent, with the sequence pReported->sequence + 1.
+ */
+void vLab2ShadowReportedSent(lab2_shadow_reported_t *pReported,
+                             uint32_t fields,
+                             const int32_t *pValues,
+                             int64_t nowUs);
+
+/**
+ * @brief   Take in the response to an update: the fields of an accepted update
+ *          are clean, those of a rejected one stay dirty.
+ *
+ * @return  true if it is the response to the update in flight, false if it
+ *          is late
+ */
+bool bLab2ShadowReportedResponse(lab2_shadow_reported_t *pReported, uint32_t sequence, bool accepted);
+
+/**
+ * @brief   Take the update in flight as lost once its response is overdue.
+ *
+ * @return  true if it was just taken as lost
+ */
+bool bLab2ShadowReportedExpired(lab2_shadow_reported_t *pReported, int64_t nowUs);
+
+/**
+ * @brief   Set both copies of a snapshot.
+ */
+void vLab2ShadowSnapshotInit(lab2_shadow_snapshot_t *pSnapshot,
+                             const lab2_shadow_state_t *pReported,
+                             const lab2_shadow_state_t *pDesired);
+
+/**
+ * @brief   Publish the states to a snapshot, from its single writer only.
+ */
+void vLab2ShadowSnapshotPublish(lab2_shadow_snapshot_t *pSnapshot,
+                                const lab2_shadow_state_t *pReported,
+                                const lab2_shadow_state_t *pDesired);
+
+/**
+ * @brief   Read a snapshot, from any task. Never blocks.
+ */
+void vLab2ShadowSnapshotRead(const lab2_shadow_snapshot_t *pSnapshot,
+                             lab2_shadow_state_t *pReported,
+                             lab2_shadow_state_t *pDesired);
+
+#endif /* ifndef _LAB2_SHADOW_STATE_H_ */
@@ -0,0 +1,59 @@
+/**
+ * @file lab_backoff.h
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#ifndef _LAB_BACKOFF_H_
+#define _LAB_BACKOFF_H_
+
+#include <stdint.h>
+
+/**
+ * @brief The first retry after a lost connection is drawn uniformly in
+ * [0, LAB_BACKOFF_FIRST_RETRY_MS], so that a short glitch is recovered
+ * quickly while a fleet dropped by the same broker outage does not come back
+ * in lockstep.
+ */
+#ifndef LAB_BACKOFF_FIRST_RETRY_MS
+    #define LAB_BACKOFF_FIRST_RETRY_MS      ( 1000 )
+#endif
+
+/**
+ * @brief Smallest and largest delay between two later retries.
+ */
+#ifndef LAB_BACKOFF_BASE_MS
+    #define LAB_BACKOFF_BASE_MS             ( 1000 )
+#endif
+#ifndef LAB_BACKOFF_CAP_MS
+    #define LAB_BACKOFF_CAP_MS              ( 120000 )
+#endif
+
+typedef struct {
+    uint32_t firstRetryMs;          /*!< Upper bound of the first delay */
+    uint32_t baseMs;                /*!< Lower bound of later delays */
+    uint32_t capMs;                 /*!< Upper bound of all delays */
+    uint32_t attempt;               /*!< Retries since the last reset */
+    uint32_t previousMs;            /*!< Last delay returned */
+} lab_backoff_t;
+
+/**
+ * @brief   Initialize a backoff with the given bounds. Zero selects the default.
+ */
+void vLabBackoffInit(lab_backoff_t * backoff, uint32_t firstRetryMs, uint32_t baseMs, uint32_t capMs);
+
+/**
+ * @brief   Start over from the first retry, once a connection succeeded.
+ */
+void vLabBackoffReset(lab_backoff_t * backoff);
+
+/**
+ * @brief   Delay before the next retry, using decorrelated jitter:
+ *          delay = min(cap, random(base, previous * 3)).
+ *
+ * @return  delay in milliseconds
+ */
+uint32_t ulLabBackoffNextDelayMs(lab_backoff_t * backoff);
+
+#endif /* ifndef _LAB_BACKOFF_H_ */
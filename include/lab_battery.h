@@ -0,0 +1,141 @@
+/**
+ * @file lab_battery.h
+ * @brief Battery monitor: the battery voltage is filtered, converted to a state
+ * of charge and reported only when it changes by more than a deadband, or when
+ * a heartbeat is due.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#ifndef _LAB_BATTERY_H_
+#define _LAB_BATTERY_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_event.h"
+
+/**
+ * @brief Period at which the battery is read.
+ */
+#ifndef LAB_BATTERY_SAMPLE_MS
+    #define LAB_BATTERY_SAMPLE_MS               ( 10000 )
+#endif
+
+/**
+ * @brief Weight of a new reading in the moving average, 1 / 2^shift. 3 gives a
+ * time constant of about 8 readings.
+ */
+#ifndef LAB_BATTERY_EMA_SHIFT
+    #define LAB_BATTERY_EMA_SHIFT               ( 3 )
+#endif
+
+/**
+ * @brief Change of the state of charge, from the last one reported, that is
+ * reported.
+ */
+#ifndef LAB_BATTERY_DEADBAND_PERCENT
+    #define LAB_BATTERY_DEADBAND_PERCENT        ( 5 )
+#endif
+
+/**
+ * @brief Longest time without a report, 0 for none.
+ */
+#ifndef LAB_BATTERY_HEARTBEAT_MS
+    #define LAB_BATTERY_HEARTBEAT_MS            ( 15 * 60 * 1000 )
+#endif
+
+#define LAB_BATTERY_TASK_STACK_SIZE             ( 2048 )
+#define LAB_BATTERY_TASK_PRIORITY               ( 0 )
+
+/**
+ * Events posted to the event loop given to eLabBatteryInit, with a
+ * lab_battery_event_t.
+ */
+typedef enum {
+    LABBATTERY_EVENT_STATE = 0              /*!< State of charge or charging changed, or heartbeat */
+} lab_battery_event_id_t;
+
+ESP_EVENT_DECLARE_BASE(LAB_BATTERY_EVENT_BASE);
+
+typedef struct {
+    uint16_t millivolts;                    /*!< Filtered battery voltage */
+    uint8_t socPercent;                     /*!< State of charge, 0 to 100 */
+    bool charging;                          /*!< Powered from USB */
+} lab_battery_event_t;
+
+/**
+ * @brief State of the filter and of the last report. Owned by one task.
+ */
+typedef struct {
+    int32_t filteredMvQ4;                   /*!< Moving average of the voltage, 1/16 mV */
+    bool primed;                            /*!< A reading was filtered */
+    bool reported;                          /*!< reportedSoc and reportedCharging are valid */
+    uint8_t reportedSoc;
+    bool reportedCharging;
+    int64_t reportedUs;                     /*!< esp_timer time of the last report */
+} lab_battery_monitor_t;
+
+/**
+ * @brief   Reset the filter; the next reading is reported.
+ */
+void vLabBatteryMonitorInit(lab_battery_monitor_t *pMonitor);
+
+/**
+ * @brief   State of charge of a single cell LiPo at rest, from a discharge curve.
+ *
+ * @return  0 to 100 percent
+ */
+uint32_t ulLabBatterySocPercent(uint32_t millivolts);
+
+/**
+ * @brief   Filter a reading and decide whether it is reported. The state is
+ *          compared with the last one recorded by vLabBatteryMonitorReported:
+ *          until it is recorded, the same change is reported again.
+ *
+ * @param   pMonitor state of the monitor
+ * @param   millivolts battery voltage read
+ * @param   charging whether the battery is charging
+ * @param   nowUs esp_timer time of the reading
+ * @param   pEvent filled with the state to report
+ * @return  true if the state is to be reported
+ */
+bool bLabBatteryMonitorUpdate(lab_battery_monitor_t *pMonitor,
+                              uint32_t millivolts,
+                              bool charging,
+                              int64_t nowUs,
+                              lab_battery_event_t *pEvent);
+
+/**
+ * @brief   Record that a state was reported, once it was posted successfully.
+ *
+ * @param   pEvent the state given by bLabBatteryMonitorUpdate
+ * @param   nowUs esp_timer time of the report
+ */
+void vLabBatteryMonitorReported(lab_battery_monitor_t *pMonitor,
+                                const lab_battery_event_t *pEvent,
+                                int64_t nowUs);
+
+/**
+ * @brief   Get the state last reported by the battery task, for consumers that
+ *          start after its first event.
+ *
+ * @return  false if nothing was reported yet
+ */
+bool bLabBatteryGetState(lab_battery_event_t *pState);
+
+/**
+ * @brief   Start the task that reads the battery every LAB_BATTERY_SAMPLE_MS
+ *          and posts LABBATTERY_EVENT_STATE when the state is to be reported.
+ *
+ * @param   eventLoop where the events are posted
+ * @param   read reads the battery voltage and whether it is charging
+ * @return  ESP_OK success
+ *          ESP_FAIL errors found
+ */
+esp_err_t eLabBatteryInit(esp_event_loop_handle_t eventLoop,
+                          esp_err_t (*read)(uint32_t *pMillivolts, bool *pCharging));
+
+#endif /* ifndef _LAB_BATTERY_H_ */
@@ -13,7 +13,12 @@
  *          DEVICE_ESP32_DEVKITC
  *          DEVICE_M5STICKC
  * 
- * These defines will be used throughout the workshop code. */
+ * These defines will be used throughout the workshop code.
+ *
+ * The host build (see host/CMakeLists.txt) brings its own fake device and
+ * picks the lab with LAB_HOST_LAB. */
+
+#if !defined(LAB_HOST_BUILD)
 
 #define DEVICE_M5STICKC
 
@@ -28,6 +33,8 @@
 
 #define LABCONFIG_LAB0_DO_NOTHING
 
+#endif /* !defined(LAB_HOST_BUILD) */
+
 
 /* If you want to allow WIFI provisioning to be managed by mobile apps.
  * Uncomment following #define.
@@ -35,4 +42,21 @@
 
 // #define LABCONFIG_WIFI_PROVISION_VIA_BLE
 
+/* Resume the previous TLS session when reconnecting to AWS IoT, instead of
+ * running a full handshake every time. Comment out to use the Amazon FreeRTOS
+ * secure sockets for the MQTT connection. */
+
+#define LABCONFIG_TLS_SESSION_RESUMPTION
+
+/* Publish the button events of lab1 in CBOR instead of JSON. Smaller on the
+ * air, but whatever subscribes to the device topic must decode CBOR. */
+
+// #define LABCONFIG_DEVICE_TOPIC_CBOR
+
+/* Only sample the IMU while the device moves, and publish motion events in
+ * lab1. The MPU6886 wakes the sampling up with its wake-on-motion interrupt.
+ * Comment out to sample continuously. */
+
+#define LABCONFIG_IMU_WAKE_ON_MOTION
+
 #endif /* ifndef _LAB_CONFIG_H_ */
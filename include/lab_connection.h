@@ -14,17 +14,102 @@
 #include "aws_demo.h"
 #include "aws_iot_shadow.h"
 
+#include "lab_config.h"
+#include "lab_payload.h"
+#include "lab_event_queue.h"
+#include "lab_reconnect.h"
+#include "lab_topics.h"
+
+/**
+ * @brief Batched publishes: messages published on the same topic within
+ * LAB_CONNECTION_BATCH_WINDOW_MS of the first one are sent as a single JSON
+ * array, up to LAB_CONNECTION_BATCH_PAYLOAD_MAX_LENGTH bytes.
+ */
+#ifndef LAB_CONNECTION_BATCH_WINDOW_MS
+    #define LAB_CONNECTION_BATCH_WINDOW_MS              ( 200 )
+#endif
+#ifndef LAB_CONNECTION_BATCH_PAYLOAD_MAX_LENGTH
+    #define LAB_CONNECTION_BATCH_PAYLOAD_MAX_LENGTH     ( 1024 )
+#endif
+#ifndef LAB_CONNECTION_BATCH_MAX_TOPICS
+    #define LAB_CONNECTION_BATCH_MAX_TOPICS             ( 4 )
+#endif
+#ifndef LAB_CONNECTION_BATCH_TOPIC_MAX_LENGTH
+    #define LAB_CONNECTION_BATCH_TOPIC_MAX_LENGTH       ( 64 )
+#endif
+#ifndef LAB_CONNECTION_BATCH_MAX_CALLBACKS
+    #define LAB_CONNECTION_BATCH_MAX_CALLBACKS          ( 4 )
+#endif
+
+/**
+ * @brief Publish buffer pool: number of buffers, and size of their topic and
+ * payload.
+ */
+#ifndef LAB_CONNECTION_POOL_SIZE
+    #define LAB_CONNECTION_POOL_SIZE                    ( 8 )
+#endif
+#ifndef LAB_CONNECTION_POOL_TOPIC_LENGTH
+    #define LAB_CONNECTION_POOL_TOPIC_LENGTH            ( 64 )
+#endif
+#ifndef LAB_CONNECTION_POOL_PAYLOAD_LENGTH
+    #define LAB_CONNECTION_POOL_PAYLOAD_LENGTH          ( 256 )
+#endif
+
+/**
+ * @brief Encoding of the messages of the device topic, JSON unless
+ * LABCONFIG_DEVICE_TOPIC_CBOR is set in lab_config.h.
+ */
+#ifndef LAB_CONNECTION_TOPIC_DEVICE_ENCODING
+    #if defined(LABCONFIG_DEVICE_TOPIC_CBOR)
+        #define LAB_CONNECTION_TOPIC_DEVICE_ENCODING    LABPAYLOAD_CBOR
+    #else
+        #define LAB_CONNECTION_TOPIC_DEVICE_ENCODING    LABPAYLOAD_JSON
+    #endif
+#endif
+
 /**
  * List of possible events this module can trigger
  */
 typedef enum {
-    LABCONNECTION_NETWORK_CONNECTED = 0,        /*!< Network connected */
+    LABCONNECTION_NETWORK_CONNECTED = 0,        /*!< Network connected, event data is the NULL terminated identifier, none if too long */
     LABCONNECTION_NETWORK_DISCONNECTED,         /*!< Network disconnected */
     LABCONNECTION_MQTT_CONNECTED,               /*!< MQTT connected */
     LABCONNECTION_MQTT_DISCONNECTED,            /*!< MQTT disconnected */
+    LABCONNECTION_RECONNECT_SCHEDULED,          /*!< MQTT reconnection scheduled, event data is lab_connection_stats_t */
+    LABCONNECTION_EVENTS_DROPPED,               /*!< Events were dropped, the ring full or their data too large, event data is the uint32_t count since boot */
     LABCONNECTION_EVENT_MAX
 } lab_connection_event_id_t;
 
+/**
+ * States of the connection manager
+ */
+typedef enum {
+    LABCONNECTION_STATE_IDLE = 0,               /*!< Libraries not initialized yet */
+    LABCONNECTION_STATE_CONNECTING,             /*!< Establishing transport and MQTT session */
+    LABCONNECTION_STATE_CONNECTED,              /*!< MQTT session up */
+    LABCONNECTION_STATE_DISCONNECTED            /*!< MQTT session lost, about to reconnect */
+} lab_connection_state_t;
+
+/**
+ * A buffer of the publish pool. Topic and payload are written in place by the
+ * caller, and stay valid until the MQTT library is done with them.
+ */
+typedef struct {
+    char topic[LAB_CONNECTION_POOL_TOPIC_LENGTH];
+    char payload[LAB_CONNECTION_POOL_PAYLOAD_LENGTH];
+    IotMqttCallbackInfo_t complete;             /*!< Completion callback of the caller, set by lab_connection */
+    AwsIotShadowCallbackInfo_t updateComplete;  /*!< Shadow update completion callback of the caller, set by lab_connection */
+    uint32_t startMs;                           /*!< Submission time, set by lab_connection */
+} lab_publish_buffer_t;
+
+typedef struct {
+    uint32_t size;                              /*!< Buffers in the pool */
+    uint32_t inUse;                             /*!< Buffers currently acquired */
+    uint32_t highWater;                         /*!< Most buffers ever acquired at once */
+    uint32_t acquired;                          /*!< Buffers acquired since boot */
+    uint32_t exhausted;                         /*!< Acquisitions that found the pool empty */
+} lab_publish_pool_stats_t;
+
 typedef struct {
     char * strID;
     bool useShadow;
@@ -32,10 +117,16 @@ typedef struct {
     networkDisconnectedCallback_t networkDisconnectedCallback;
     void (*shadowDeltaCallback)(void *, AwsIotShadowCallbackParam_t *);
     void (*shadowUpdatedCallback)(void *, AwsIotShadowCallbackParam_t *);
+    void (*shadowGetCallback)(void *, AwsIotShadowCallbackParam_t *);  /*!< Shadow document read at the start of each session, or the failure to read it */
+    uint32_t backoffFirstRetryMs;               /*!< Reconnection backoff, 0 for LAB_BACKOFF_FIRST_RETRY_MS */
+    uint32_t backoffBaseMs;                     /*!< Reconnection backoff, 0 for LAB_BACKOFF_BASE_MS */
+    uint32_t backoffCapMs;                      /*!< Reconnection backoff, 0 for LAB_BACKOFF_CAP_MS */
+    bool topicAliases;                          /*!< Publish on the short aliases "<id>/a/<topic>", for brokers mapping them to the full topics */
 } iot_connection_params_t;
 
 typedef struct {
     char * thingName;
+    lab_connection_stats_t stats;               /*!< Connection counters when the session came up */
 } connection_event_params_t;
 
 typedef int (* labRunFunction_t)( bool awsIotMqttMode,
@@ -48,11 +139,110 @@ esp_err_t eLabConnectionInit(iot_connection_params_t * params);
 void vLabConnectionCleanup(void);
 
 esp_err_t eLabConnectionUpdateShadow(AwsIotShadowDocumentInfo_t *updateDocument);
+
+/**
+ * @brief   Version of the Shadow document, from the documents received in this
+ *          session: the Shadow read when it started, the deltas and the updated
+ *          documents. Documents older than it are not passed on.
+ *
+ * @return  the version, 0 until one is known
+ */
+uint32_t ulLabConnectionGetShadowVersion(void);
+
+/**
+ * @brief   Number of the MQTT session, counted from 1, 0 before the first.
+ *          It moves on before the Shadow callbacks of the session are armed
+ *          and its Shadow read, and before LABCONNECTION_MQTT_CONNECTED: what
+ *          the callbacks hand over can be told from what an earlier session
+ *          left behind.
+ */
+uint32_t ulLabConnectionGetSession(void);
+
 esp_err_t eLabConnectionPublish(IotMqttPublishInfo_t *publishInfo, IotMqttCallbackInfo_t *publishComplete);
 
+/**
+ * @brief   Take a buffer from the publish pool. Never blocks.
+ *
+ * @return  the buffer, or NULL if all are in use
+ */
+lab_publish_buffer_t * pxLabConnectionAcquireBuffer(void);
+
+/**
+ * @brief   Give a buffer back to the pool without publishing it.
+ */
+void vLabConnectionReleaseBuffer(lab_publish_buffer_t * pBuffer);
+
+/**
+ * @brief   Publish from a pool buffer. Topic and payload of publishInfo point
+ *          into the buffer.
+ *
+ *          Ownership of the buffer passes to lab_connection, whatever the
+ *          result: it goes back to the pool once the publish completes, is
+ *          queued offline, or fails.
+ */
+esp_err_t eLabConnectionPublishBuffer(lab_publish_buffer_t * pBuffer, IotMqttPublishInfo_t * publishInfo, IotMqttCallbackInfo_t * publishComplete);
+
+/**
+ * @brief   Update the shadow from a document held in a pool buffer. Ownership
+ *          of the buffer passes to lab_connection, as for
+ *          eLabConnectionPublishBuffer.
+ *
+ * @param   updateComplete called once the update is accepted, rejected or
+ *          timed out, if it was sent; may be NULL
+ */
+esp_err_t eLabConnectionUpdateShadowBuffer(lab_publish_buffer_t * pBuffer, AwsIotShadowDocumentInfo_t *updateDocument, const AwsIotShadowCallbackInfo_t *updateComplete);
+
+void vLabConnectionGetPoolStats(lab_publish_pool_stats_t * stats);
+
+/**
+ * @brief   Publish several messages, coalescing them per topic.
+ *
+ *          Each payload must be a JSON value. Messages of a same topic are
+ *          appended to a JSON array, sent with a single QoS1 publish once the
+ *          batch window elapses or the array is full. Topic, QoS and retry
+ *          settings of the messages are otherwise ignored. Payloads are copied.
+ *
+ * @param   publishInfos messages to publish
+ * @param   count number of messages
+ * @param   batchComplete invoked once per coalesced publish the messages were
+ *          added to, when it completes. Not invoked if it was queued offline.
+ * @return  ESP_OK success
+ *          ESP_FAIL at least one message could not be added
+ */
+esp_err_t eLabConnectionPublishBatch(const IotMqttPublishInfo_t *publishInfos, size_t count, const IotMqttCallbackInfo_t *batchComplete);
+
+/**
+ * @brief   Publish all pending batches now, without waiting for their window.
+ */
+esp_err_t eLabConnectionFlushBatches(void);
+
+/**
+ * @brief   Point a publish at one of the device topics. The name stays valid
+ *          for as long as the application runs.
+ *
+ * @return  ESP_OK success
+ *          ESP_FAIL unknown topic, or lab_connection not initialized
+ */
+esp_err_t eLabConnectionSetTopic(IotMqttPublishInfo_t * publishInfo, lab_connection_topic_t topic);
+
+/**
+ * @brief   Name published on for a device topic: its alias in alias mode.
+ *
+ * @return  the name, NULL if unknown
+ */
+const char * pcLabConnectionGetTopic(lab_connection_topic_t topic);
+
+/**
+ * @brief   Encoding of the messages published on a device topic.
+ */
+lab_payload_encoding_t xLabConnectionGetTopicEncoding(lab_connection_topic_t topic);
+
 void vLabConnectionResetWifiNetworks( void );
 
 bool bIsLabConnectionMqttConnected(void);
+lab_connection_state_t eLabConnectionGetState(void);
+void vLabConnectionGetStats(lab_connection_stats_t * stats);
+void vLabConnectionGetEventStats(lab_connection_event_stats_t * stats);
 
 esp_err_t eLabConnectionRegisterCallback(void (*callback)(void * handler_arg, esp_event_base_t base, int32_t id, void * event_data) );
 
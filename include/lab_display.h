@@ -0,0 +1,125 @@
+/**
+ * @file lab_display.h
+ * @brief Display service: a compositor task owns the panel. Other tasks post the
+ * text of widgets to a mailbox that keeps the latest one of each; the compositor
+ * redraws, at most once per frame, only the characters that changed since the
+ * last frame.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#ifndef _LAB_DISPLAY_H_
+#define _LAB_DISPLAY_H_
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/**
+ * @brief Shortest time between two frames.
+ */
+#ifndef LAB_DISPLAY_FRAME_MS
+    #define LAB_DISPLAY_FRAME_MS                ( 100 )
+#endif
+
+/**
+ * @brief Longest widget text, in characters.
+ */
+#define LAB_DISPLAY_TEXT_MAX                    ( 26 )
+
+#define LAB_DISPLAY_TASK_STACK_SIZE             ( 2560 )
+#define LAB_DISPLAY_TASK_PRIORITY               ( 1 )
+
+/**
+ * @brief Text fields of the screen: three header lines, and a footer with the
+ * battery on the left and the lab status on the right.
+ */
+typedef enum {
+    LABDISPLAY_WIDGET_TITLE = 0,
+    LABDISPLAY_WIDGET_SUBTITLE,
+    LABDISPLAY_WIDGET_LAB,
+    LABDISPLAY_WIDGET_BATTERY,
+    LABDISPLAY_WIDGET_STATUS,
+    LABDISPLAY_WIDGET_COUNT
+} lab_display_widget_t;
+
+typedef struct {
+    uint32_t updates;                           /*!< Widget updates received */
+    uint32_t coalesced;                         /*!< Widget updates replaced by a newer one before they were drawn */
+    uint32_t frames;                            /*!< Frames drawn */
+    uint32_t rects;                             /*!< Dirty rectangles drawn */
+    uint32_t chars;                             /*!< Characters drawn */
+    uint32_t maxFrameUs;                        /*!< Longest time spent drawing a frame */
+} lab_display_stats_t;
+
+/**
+ * @brief Panel access used by the compositor, from its task only. Coordinates
+ * in pixels, text in a fixed width font.
+ */
+typedef struct {
+    /** Set up the panel, clear it and give the size of a character cell. */
+    esp_err_t (*init)(uint16_t *pCellWidth, uint16_t *pCellHeight);
+    /** Draw a NULL-terminated string, background included. */
+    void (*drawText)(const char *pText, uint16_t x, uint16_t y);
+    /** Draw a horizontal line across the panel. */
+    void (*drawLine)(uint16_t y);
+    uint16_t width;                             /*!< Panel width */
+    uint16_t height;                            /*!< Panel height */
+} lab_display_backend_t;
+
+/**
+ * @brief   TFT of the M5StickC, set up by M5StickCInit.
+ */
+extern const lab_display_backend_t lab_display_m5stickc_backend;
+
+/**
+ * @brief   In-memory framebuffer the size of the M5StickC TFT, for the host
+ *          build: one line of characters per pixel row. Like
+ *          vLabDisplaySimDump and pcLabDisplaySimRow, only defined on the host
+ *          build and with LAB_DISPLAY_SIMULATED.
+ */
+extern const lab_display_backend_t lab_display_sim_backend;
+
+/**
+ * @brief   Log the rows of the simulated framebuffer that are not blank.
+ */
+void vLabDisplaySimDump(void);
+
+/**
+ * @brief   Characters drawn at a pixel row of the simulated framebuffer, one
+ *          per cell.
+ *
+ * @return  NULL below the panel
+ */
+const char * pcLabDisplaySimRow(uint16_t y);
+
+/**
+ * @brief   Set up the panel and start the compositor task. The M5StickC TFT is
+ *          used, or the simulated framebuffer on the host build and when
+ *          LAB_DISPLAY_SIMULATED is defined.
+ *
+ * @return  ESP_OK success
+ *          ESP_ERR_NOT_SUPPORTED the device has no display
+ *          ESP_FAIL errors found
+ */
+esp_err_t eLabDisplayInit(void);
+
+/**
+ * @brief   Replace the text of a widget, drawn at the next frame. Only the
+ *          latest text of a widget is drawn; callable from any task, never
+ *          waits for the compositor.
+ *
+ * @return  ESP_OK posted
+ *          ESP_ERR_INVALID_STATE no display
+ */
+esp_err_t eLabDisplaySetText(lab_display_widget_t widget, const char *pText);
+
+void vLabDisplayGetStats(lab_display_stats_t *pStats);
+
+/**
+ * @brief   Log the compositor statistics.
+ */
+void vLabDisplayDump(void);
+
+#endif /* ifndef _LAB_DISPLAY_H_ */
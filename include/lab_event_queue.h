@@ -0,0 +1,84 @@
+/**
+ * @file lab_event_queue.h
+ * @brief Events of lab_connection waiting for its dispatcher task, posted
+ * from the MQTT and network callbacks without waiting on the event handlers.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#ifndef _LAB_EVENT_QUEUE_H_
+#define _LAB_EVENT_QUEUE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/**
+ * @brief Events wait in a FIFO: at most LAB_CONNECTION_EVENT_RING_SIZE events
+ * other than the state ones, and at most one per state on top of them. Each
+ * carries at most LAB_CONNECTION_EVENT_DATA_MAX_SIZE bytes of data.
+ */
+#ifndef LAB_CONNECTION_EVENT_RING_SIZE
+    #define LAB_CONNECTION_EVENT_RING_SIZE              ( 8 )
+#endif
+#ifndef LAB_CONNECTION_EVENT_DATA_MAX_SIZE
+    #define LAB_CONNECTION_EVENT_DATA_MAX_SIZE          ( 48 )
+#endif
+
+/**
+ * @brief States whose events replace one another, as connected and
+ * disconnected do.
+ */
+#define LAB_EVENT_QUEUE_STATES                          ( 2 )
+#define LAB_EVENT_QUEUE_NO_STATE                        ( -1 )
+
+typedef struct {
+    int32_t id;
+    size_t size;
+    uint8_t data[LAB_CONNECTION_EVENT_DATA_MAX_SIZE];
+} lab_event_queue_event_t;
+
+typedef struct {
+    uint32_t posted;                            /*!< Events posted since boot */
+    uint32_t coalesced;                         /*!< State events replaced by a newer one before dispatch */
+    uint32_t dropped;                           /*!< Events dropped because the ring was full */
+    uint32_t oversize;                          /*!< Events refused because their data was too large */
+    uint32_t maxPostUs;                         /*!< Longest time a caller spent posting an event */
+} lab_connection_event_stats_t;
+
+/**
+ * @brief   Create the mutex of the queue.
+ *
+ * @return  ESP_OK success
+ *          ESP_FAIL errors found
+ */
+esp_err_t eLabEventQueueInit(void);
+
+/**
+ * @brief   Queue a copy of an event. Never blocks on the dispatcher.
+ *
+ *          An event of a state removes the event of that state still queued,
+ *          if any, and is queued after the events posted before it: handlers
+ *          see the latest state, in the order it was reached.
+ *
+ * @param   state the state the event is of, below LAB_EVENT_QUEUE_STATES, or
+ *          LAB_EVENT_QUEUE_NO_STATE
+ * @return  ESP_OK success
+ *          ESP_ERR_INVALID_SIZE data too large, not queued
+ *          ESP_ERR_NO_MEM queue full, dropped
+ */
+esp_err_t eLabEventQueuePost(int32_t id, int32_t state, const void * data, size_t size);
+
+/**
+ * @brief   Take the oldest queued event.
+ *
+ * @return  true if there was one
+ */
+bool bLabEventQueueTake(lab_event_queue_event_t * event);
+
+void vLabEventQueueGetStats(lab_connection_event_stats_t * stats);
+
+#endif /* ifndef _LAB_EVENT_QUEUE_H_ */
@@ -0,0 +1,233 @@
+/**
+ * @file lab_imu.h
+ * @brief IMU sampling: the accelerometer and gyroscope run at a fixed output
+ * data rate, their hardware FIFO is burst read and the samples are kept in a
+ * ring buffer that any number of consumers read at their own pace.
+ *
+ * With wake-on-motion, sampling stops once the device has been still for
+ * LAB_IMU_MOTION_QUIET_MS and the IMU interrupt starts it again.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#ifndef _LAB_IMU_H_
+#define _LAB_IMU_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_event.h"
+
+#include "lab_config.h"
+
+/**
+ * @brief Output data rate of the IMU, in Hz. The MPU6886 derives it from 1 kHz,
+ * so it should divide 1000.
+ */
+#ifndef LAB_IMU_ODR_HZ
+    #define LAB_IMU_ODR_HZ                  ( 200 )
+#endif
+
+/**
+ * @brief Number of IMU samples averaged into one ring sample. The ring rate is
+ * LAB_IMU_ODR_HZ / LAB_IMU_DECIMATION.
+ */
+#ifndef LAB_IMU_DECIMATION
+    #define LAB_IMU_DECIMATION              ( 1 )
+#endif
+
+/**
+ * @brief Samples kept in the ring, a power of 2. Consumers that fall further
+ * behind lose the oldest samples.
+ */
+#ifndef LAB_IMU_RING_SIZE
+    #define LAB_IMU_RING_SIZE               ( 256 )
+#endif
+
+/**
+ * @brief Period at which the FIFO is drained. The FIFO holds
+ * LAB_IMU_FIFO_FRAMES frames, 365 ms at 200 Hz.
+ */
+#ifndef LAB_IMU_POLL_MS
+    #define LAB_IMU_POLL_MS                 ( 50 )
+#endif
+
+/**
+ * @brief Frames read in a single I2C transaction.
+ */
+#ifndef LAB_IMU_BURST_FRAMES
+    #define LAB_IMU_BURST_FRAMES            ( 32 )
+#endif
+
+/**
+ * @brief Wake-on-motion threshold, 4 to 1020 mg: change of acceleration between
+ * two samples that counts as motion. 0 samples continuously.
+ */
+#ifndef LAB_IMU_MOTION_THRESHOLD_MG
+    #if defined(LABCONFIG_IMU_WAKE_ON_MOTION)
+        #define LAB_IMU_MOTION_THRESHOLD_MG ( 64 )
+    #else
+        #define LAB_IMU_MOTION_THRESHOLD_MG ( 0 )
+    #endif
+#endif
+
+/**
+ * @brief Time without motion after which sampling stops.
+ */
+#ifndef LAB_IMU_MOTION_QUIET_MS
+    #define LAB_IMU_MOTION_QUIET_MS         ( 5000 )
+#endif
+
+#define LAB_IMU_TASK_STACK_SIZE             ( 3072 )
+#define LAB_IMU_TASK_PRIORITY               ( 6 )
+
+/**
+ * @brief A FIFO frame, as the MPU6886 writes it: accelerometer XYZ, temperature
+ * and gyroscope XYZ, big-endian 16 bit values.
+ */
+#define LAB_IMU_FRAME_SIZE                  ( 14 )
+#define LAB_IMU_FIFO_SIZE                   ( 1024 )
+#define LAB_IMU_FIFO_FRAMES                 ( LAB_IMU_FIFO_SIZE / LAB_IMU_FRAME_SIZE )
+
+/**
+ * @brief Scale of the raw values: accelerometer at +-8 g, gyroscope at
+ * +-2000 dps.
+ */
+#define LAB_IMU_ACCEL_LSB_PER_G             ( 4096 )
+#define LAB_IMU_GYRO_LSB_PER_DPS            ( 16.4f )
+#define LAB_IMU_TEMP_CELSIUS(raw)           ( (float)(raw) / 326.8f + 25.0f )
+
+typedef struct {
+    int64_t timeUs;                         /*!< esp_timer time the sample was taken, estimated */
+    int16_t accel[3];                       /*!< Accelerometer XYZ, LAB_IMU_ACCEL_LSB_PER_G */
+    int16_t gyro[3];                        /*!< Gyroscope XYZ, LAB_IMU_GYRO_LSB_PER_DPS */
+    int16_t temp;                           /*!< Raw temperature, see LAB_IMU_TEMP_CELSIUS */
+} lab_imu_sample_t;
+
+/**
+ * @brief Read position of a consumer. Each consumer owns one.
+ */
+typedef struct {
+    uint32_t next;                          /*!< Sequence number of the next sample to read */
+    uint32_t lost;                          /*!< Samples overwritten before they were read */
+} lab_imu_reader_t;
+
+/**
+ * @brief Flags of lab_imu_backend_t fifoCount.
+ */
+#define LAB_IMU_STATUS_OVERFLOW             ( 1 << 0 )  /*!< The FIFO filled up, frames were dropped */
+#define LAB_IMU_STATUS_MOTION               ( 1 << 1 )  /*!< Motion above the threshold was seen */
+
+/**
+ * Events posted to the event loop given to eLabImuInit, with a
+ * lab_imu_motion_event_t.
+ */
+typedef enum {
+    LABIMU_EVENT_MOTION_START = 0,          /*!< The device started moving, sampling resumed */
+    LABIMU_EVENT_MOTION_STOP                /*!< The device was still for LAB_IMU_MOTION_QUIET_MS, sampling stopped */
+} lab_imu_event_t;
+
+ESP_EVENT_DECLARE_BASE(LAB_IMU_EVENT_BASE);
+
+typedef struct {
+    int64_t timeUs;                         /*!< esp_timer time of the first or last motion */
+    uint32_t durationMs;                    /*!< From the first to the last motion, for LABIMU_EVENT_MOTION_STOP */
+} lab_imu_motion_event_t;
+
+typedef struct {
+    uint32_t frames;                        /*!< Frames read from the FIFO */
+    uint32_t samples;                       /*!< Samples written to the ring */
+    uint32_t fifoOverruns;                  /*!< Times the FIFO filled up and was reset */
+    uint32_t readErrors;                    /*!< Failed FIFO accesses */
+    uint32_t maxFifoFrames;                 /*!< Highest FIFO fill level seen */
+    uint32_t wakeups;                       /*!< Times motion resumed the sampling */
+} lab_imu_stats_t;
+
+/**
+ * @brief IMU access used by the sampling task. All functions return ESP_OK on
+ * success.
+ */
+typedef struct {
+    /** Configure the output data rate and the motion threshold (0 for none),
+     *  and start filling the FIFO. Also resumes sampling after sleep. */
+    esp_err_t (*init)(uint32_t odrHz, uint32_t motionThresholdMg);
+    /** Number of bytes in the FIFO, and LAB_IMU_STATUS_ flags since last asked. */
+    esp_err_t (*fifoCount)(uint16_t *pBytes, uint8_t *pStatus);
+    /** Read length bytes, a multiple of LAB_IMU_FRAME_SIZE, from the FIFO. */
+    esp_err_t (*fifoRead)(uint8_t *pBuffer, size_t length);
+    /** Empty the FIFO. */
+    esp_err_t (*fifoReset)(void);
+    /** Stop sampling, leaving the accelerometer in low power with its motion
+     *  interrupt armed, which calls pWakeFromISR. ESP_ERR_INVALID_STATE if
+     *  motion is already pending. */
+    esp_err_t (*sleep)(void (*pWakeFromISR)(void));
+} lab_imu_backend_t;
+
+/**
+ * @brief   MPU6886 of the M5StickC, on the I2C bus set up by M5StickCInit.
+ */
+extern const lab_imu_backend_t lab_imu_mpu6886_backend;
+
+/**
+ * @brief   Simulated IMU: a FIFO filled at the output data rate with a 1 g
+ *          gravity vector and a few sine vibrations, for the host build.
+ *          Like vLabImuSimStall and vLabImuSimMotion, only defined on the host
+ *          build and with LAB_IMU_SIMULATED.
+ */
+extern const lab_imu_backend_t lab_imu_sim_backend;
+
+/**
+ * @brief   Hold the simulated bus for a while, so that the FIFO overflows.
+ */
+void vLabImuSimStall(uint32_t durationMs);
+
+/**
+ * @brief   Start or stop moving the simulated device. Moving raises the motion
+ *          interrupt of the simulated IMU.
+ */
+void vLabImuSimMotion(bool moving);
+
+/**
+ * @brief   Configure the IMU and start the sampling task. The MPU6886 backend
+ *          is used, or the simulated one on the host build and when
+ *          LAB_IMU_SIMULATED is defined.
+ *
+ * @param   eventLoop where motion events are posted, NULL for none
+ * @return  ESP_OK success
+ *          ESP_FAIL errors found
+ */
+esp_err_t eLabImuInit(esp_event_loop_handle_t eventLoop);
+
+/**
+ * @brief   Whether the device is moving, that is whether it is being sampled.
+ *          Always true without wake-on-motion.
+ */
+bool bIsLabImuMoving(void);
+
+/**
+ * @brief   Start reading from the newest sample.
+ */
+void vLabImuReaderInit(lab_imu_reader_t *pReader);
+
+/**
+ * @brief   Copy the samples received since the last read, oldest first. Lock
+ *          free, callable from any task; the sampling task is never blocked.
+ *
+ * @param   pReader read position of the consumer
+ * @param   pSamples where to copy the samples
+ * @param   maxSamples room in pSamples
+ * @return  number of samples copied
+ */
+size_t xLabImuRead(lab_imu_reader_t *pReader, lab_imu_sample_t *pSamples, size_t maxSamples);
+
+void vLabImuGetStats(lab_imu_stats_t *pStats);
+
+/**
+ * @brief   Log the sampling statistics.
+ */
+void vLabImuDump(void);
+
+#endif /* ifndef _LAB_IMU_H_ */
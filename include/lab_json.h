@@ -0,0 +1,78 @@
+/**
+ * @file lab_json.h
+ * @brief Single-pass JSON reader: walks a document once and extracts the
+ * values of a table of keys, without allocating.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#ifndef _LAB_JSON_H_
+#define _LAB_JSON_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/**
+ * @brief Deepest nesting of the values skipped.
+ */
+#ifndef LAB_JSON_MAX_DEPTH
+    #define LAB_JSON_MAX_DEPTH                  ( 16 )
+#endif
+
+/**
+ * @brief Types of the values read.
+ */
+typedef enum {
+    LABJSON_TYPE_INT = 0,                       /*!< Integer that fits an int32_t */
+    LABJSON_TYPE_BOOL                           /*!< true or false, also 0 or 1 */
+} lab_json_type_t;
+
+/**
+ * @brief A key to read, with its length computed at compile time.
+ */
+typedef struct {
+    const char *pKey;
+    size_t keyLength;
+    lab_json_type_t type;
+} lab_json_field_t;
+
+/**
+ * @brief Key of a lab_json_field_t table: LAB_JSON_FIELD("powerOn", LABJSON_TYPE_BOOL)
+ */
+#define LAB_JSON_FIELD(key, valueType)          { key, sizeof(key) - 1, valueType }
+
+/**
+ * @brief Value of a field once read.
+ */
+typedef struct {
+    bool found;                                 /*!< Key present with a value of the right type */
+    int32_t value;                              /*!< Integer, or 0 and 1 for a bool */
+} lab_json_value_t;
+
+/**
+ * @brief   Read the members of an object of the document in one pass. Keys are
+ *          compared as they are written, escapes included; if a key is repeated
+ *          the last value is kept.
+ *
+ * @param   pDocument the JSON document, not NULL-terminated
+ * @param   pObjectKey path of the object whose members are read, keys joined
+ *          by dots, as "state" in a Shadow delta or "state.desired" in a
+ *          Shadow document; NULL for the top-level object itself
+ * @param   pFields the keys to read
+ * @param   pValues one value per field, set by the call
+ * @return  ESP_OK the document was read, whether fields were found or not
+ *          ESP_ERR_NOT_FOUND no object at pObjectKey
+ *          ESP_ERR_INVALID_ARG malformed document
+ */
+esp_err_t eLabJsonRead(const char *pDocument,
+                       size_t documentLength,
+                       const char *pObjectKey,
+                       const lab_json_field_t *pFields,
+                       size_t fieldCount,
+                       lab_json_value_t *pValues);
+
+#endif /* ifndef _LAB_JSON_H_ */
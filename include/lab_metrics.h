@@ -0,0 +1,80 @@
+/**
+ * @file lab_metrics.h
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#ifndef _LAB_METRICS_H_
+#define _LAB_METRICS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Number of latency buckets. Bucket 0 counts operations under 1 ms,
+ * bucket i counts [2^(i-1), 2^i) ms, and the last one everything above.
+ */
+#ifndef LAB_METRICS_BUCKETS
+    #define LAB_METRICS_BUCKETS                 ( 16 )
+#endif
+
+/**
+ * @brief Period at which lab_connection publishes the histograms, 0 to never
+ * publish them.
+ */
+#ifndef LAB_METRICS_PUBLISH_PERIOD_MS
+    #define LAB_METRICS_PUBLISH_PERIOD_MS       ( 60000 )
+#endif
+
+/**
+ * Operations timed from submission to completion
+ */
+typedef enum {
+    LABMETRICS_OP_PUBLISH = 0,                  /*!< QoS1 publish, until PUBACK */
+    LABMETRICS_OP_SHADOW_UPDATE,                /*!< Shadow update, until accepted or rejected */
+    LABMETRICS_OP_CONNECT,                      /*!< Transport and MQTT connection, until CONNACK */
+    LABMETRICS_OP_MAX
+} lab_metrics_op_t;
+
+typedef struct {
+    uint32_t count;                             /*!< Completed operations */
+    uint32_t failures;                          /*!< Of which failed */
+    uint32_t sumMs;                             /*!< Total latency */
+    uint32_t maxMs;                             /*!< Largest latency */
+    uint32_t buckets[LAB_METRICS_BUCKETS];      /*!< Log-scale latency histogram */
+} lab_metrics_histogram_t;
+
+/**
+ * @brief   Timestamp to pass to vLabMetricsRecord when the operation completes.
+ */
+uint32_t ulLabMetricsStart(void);
+
+/**
+ * @brief   Record a completed operation. Lock free, callable from any task.
+ *
+ * @param   op the operation
+ * @param   startMs value of ulLabMetricsStart when the operation was submitted
+ * @param   success false if the operation failed or timed out
+ */
+void vLabMetricsRecord(lab_metrics_op_t op, uint32_t startMs, bool success);
+
+void vLabMetricsGetHistogram(lab_metrics_op_t op, lab_metrics_histogram_t * histogram);
+void vLabMetricsReset(void);
+
+const char * pcLabMetricsOpName(lab_metrics_op_t op);
+
+/**
+ * @brief   Serialize the histogram of an operation as a JSON object.
+ *
+ * @return  length of the document, 0 if it does not fit the buffer
+ */
+size_t xLabMetricsToJson(lab_metrics_op_t op, char * buffer, size_t length);
+
+/**
+ * @brief   Log all histograms.
+ */
+void vLabMetricsDump(void);
+
+#endif /* ifndef _LAB_METRICS_H_ */
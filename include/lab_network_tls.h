@@ -0,0 +1,65 @@
+/**
+ * @file lab_network_tls.h
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#ifndef _LAB_NETWORK_TLS_H_
+#define _LAB_NETWORK_TLS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "platform/iot_network.h"
+#include "types/iot_network_types.h"
+
+#include "lab_tls_session.h"
+
+/**
+ * @brief Also keep the resumable session in NVS so that it survives a reboot.
+ * Off by default: the session secret then only ever lives in RAM.
+ */
+#ifndef LAB_NETWORK_TLS_SESSION_IN_NVS
+    #define LAB_NETWORK_TLS_SESSION_IN_NVS      ( 0 )
+#endif
+
+/**
+ * @brief Timeout of a single socket read. Bounds how long the receive task holds
+ * the TLS context, and how quickly it notices a closed connection.
+ */
+#ifndef LAB_NETWORK_TLS_RECV_TIMEOUT_MS
+    #define LAB_NETWORK_TLS_RECV_TIMEOUT_MS     ( 100 )
+#endif
+
+#define LAB_NETWORK_TLS_RECEIVE_TASK_STACK_SIZE ( 4096 )
+#define LAB_NETWORK_TLS_RECEIVE_TASK_PRIORITY   ( 5 )
+
+/**
+ * @brief   Network interface for the MQTT library: TCP over lwIP and TLS over
+ *          mbedTLS, with session ID / session ticket resumption.
+ *
+ *          Takes the same IotNetworkServerInfo_t and IotNetworkCredentials_t as
+ *          the Amazon FreeRTOS TCP/IP network interface. A NULL root CA selects
+ *          the Amazon root CA, a NULL client certificate or private key selects
+ *          the one of aws_clientcredential_keys.h.
+ */
+extern const IotNetworkInterface_t lab_network_tls_interface;
+
+/**
+ * @brief   Restore the cached session from NVS, if enabled.
+ *
+ * @return  ESP_OK success
+ *          ESP_FAIL errors found
+ */
+esp_err_t eLabNetworkTlsInit(void);
+
+/**
+ * @brief   Drop the cached session, forcing the next handshake to be a full one.
+ */
+void vLabNetworkTlsForgetSession(void);
+
+void vLabNetworkTlsGetStats(lab_network_tls_stats_t * stats);
+
+#endif /* ifndef _LAB_NETWORK_TLS_H_ */
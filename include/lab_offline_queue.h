@@ -0,0 +1,132 @@
+/**
+ * @file lab_offline_queue.h
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#ifndef _LAB_OFFLINE_QUEUE_H_
+#define _LAB_OFFLINE_QUEUE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "iot_mqtt.h"
+
+/**
+ * @brief NVS partition holding the queue. Defaults to the `storage` partition
+ * of partition-table.csv, which is otherwise unused.
+ */
+#ifndef LAB_OFFLINE_QUEUE_PARTITION
+    #define LAB_OFFLINE_QUEUE_PARTITION             "storage"
+#endif
+
+/**
+ * @brief Maximum number of publishes kept while the MQTT connection is down.
+ * When full, the oldest publish is dropped to make room for the new one.
+ */
+#ifndef LAB_OFFLINE_QUEUE_CAPACITY
+    #define LAB_OFFLINE_QUEUE_CAPACITY              ( 32 )
+#endif
+
+/**
+ * @brief Largest topic and payload that can be queued. Bigger publishes are rejected.
+ */
+#ifndef LAB_OFFLINE_QUEUE_TOPIC_MAX_LENGTH
+    #define LAB_OFFLINE_QUEUE_TOPIC_MAX_LENGTH      ( 64 )
+#endif
+#ifndef LAB_OFFLINE_QUEUE_PAYLOAD_MAX_LENGTH
+    #define LAB_OFFLINE_QUEUE_PAYLOAD_MAX_LENGTH    ( 256 )
+#endif
+
+/**
+ * @brief Number of publishes sent per drain batch once MQTT is connected, and
+ * the pause between two batches.
+ */
+#ifndef LAB_OFFLINE_QUEUE_DRAIN_BATCH
+    #define LAB_OFFLINE_QUEUE_DRAIN_BATCH           ( 5 )
+#endif
+#ifndef LAB_OFFLINE_QUEUE_DRAIN_PACE_MS
+    #define LAB_OFFLINE_QUEUE_DRAIN_PACE_MS         ( 500 )
+#endif
+
+/**
+ * A queued publish, as stored in flash.
+ */
+typedef struct {
+    uint8_t qos;                                                /*!< IotMqttQos_t of the publish */
+    uint8_t retain;                                             /*!< Retain flag of the publish */
+    uint16_t topicLength;                                       /*!< Length of topic */
+    uint16_t payloadLength;                                     /*!< Length of payload */
+    char data[LAB_OFFLINE_QUEUE_TOPIC_MAX_LENGTH +
+              LAB_OFFLINE_QUEUE_PAYLOAD_MAX_LENGTH];            /*!< Topic immediately followed by payload, not NULL terminated */
+} lab_offline_queue_entry_t;
+
+/**
+ * Queue counters. Depth and drops survive a reboot, the others count since boot.
+ */
+typedef struct {
+    uint32_t depth;             /*!< Publishes currently queued */
+    uint32_t capacity;          /*!< LAB_OFFLINE_QUEUE_CAPACITY */
+    uint32_t enqueued;          /*!< Publishes queued since boot */
+    uint32_t drained;           /*!< Publishes sent from the queue since boot */
+    uint32_t dropped;           /*!< Oldest publishes evicted because the queue was full */
+    uint32_t rejected;          /*!< Publishes refused because they were too large */
+    uint32_t corrupted;         /*!< Entries that could not be read back, dropped since boot */
+} lab_offline_queue_stats_t;
+
+/**
+ * @brief   Open the queue partition and restore the queue from flash.
+ *
+ * @return  ESP_OK success
+ *          ESP_FAIL errors found
+ */
+esp_err_t eLabOfflineQueueInit(void);
+
+/**
+ * @brief   Queue a copy of a publish. Topic and payload are copied to flash.
+ *
+ * @param   publishInfo publish to queue
+ * @return  ESP_OK success
+ *          ESP_ERR_INVALID_SIZE topic or payload too large
+ *          ESP_FAIL errors found
+ */
+esp_err_t eLabOfflineQueuePush(const IotMqttPublishInfo_t * publishInfo);
+
+/**
+ * @brief   Read the oldest queued publish without removing it.
+ *
+ * @param   entry filled with the oldest publish
+ * @param   sequence set to the sequence number of the oldest publish, to pop
+ *          it with, also when it cannot be read
+ * @return  ESP_OK success
+ *          ESP_ERR_NOT_FOUND queue is empty
+ *          ESP_ERR_INVALID_STATE the oldest entry cannot be read: pop it, it
+ *          will never be read
+ *          ESP_FAIL errors found
+ */
+esp_err_t eLabOfflineQueuePeek(lab_offline_queue_entry_t * entry, uint32_t * sequence);
+
+/**
+ * @brief   Remove the oldest queued publish, once it has been sent or found
+ *          unreadable by eLabOfflineQueuePeek. A push to a full queue may have
+ *          dropped it since it was peeked: then nothing is removed, the
+ *          publishes after it were not sent.
+ *
+ * @param   sequence as given by eLabOfflineQueuePeek
+ * @return  ESP_OK success
+ *          ESP_ERR_NOT_FOUND queue is empty, or the publish is no longer the
+ *          oldest
+ */
+esp_err_t eLabOfflineQueuePop(uint32_t sequence);
+
+/**
+ * @brief   Point a publish info to the topic and payload of a queued entry.
+ */
+void vLabOfflineQueueEntryToPublishInfo(const lab_offline_queue_entry_t * entry, IotMqttPublishInfo_t * publishInfo);
+
+uint32_t ulLabOfflineQueueDepth(void);
+void vLabOfflineQueueGetStats(lab_offline_queue_stats_t * stats);
+
+#endif /* ifndef _LAB_OFFLINE_QUEUE_H_ */
@@ -0,0 +1,114 @@
+/**
+ * @file lab_payload.h
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#ifndef _LAB_PAYLOAD_H_
+#define _LAB_PAYLOAD_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Encodings of the payload writer. Which one a topic uses is chosen in
+ * lab_connection, see xLabConnectionGetTopicEncoding.
+ */
+typedef enum {
+    LABPAYLOAD_JSON = 0,                        /*!< JSON text */
+    LABPAYLOAD_CBOR                             /*!< CBOR, RFC 7049, definite lengths only */
+} lab_payload_encoding_t;
+
+/**
+ * @brief A key or a constant string of a fixed-schema message, stored as its
+ * JSON fragment. The CBOR writer uses the same bytes without the quotes.
+ */
+typedef struct {
+    const char * pJson;
+    size_t jsonLength;
+} lab_payload_fragment_t;
+
+/**
+ * @brief Key fragment: "name":
+ */
+#define LAB_PAYLOAD_KEY(name)                       { "\"" name "\":", sizeof(name) + 2 }
+
+/**
+ * @brief Constant string value fragment: "text"
+ */
+#define LAB_PAYLOAD_TEXT(text)                      { "\"" text "\"", sizeof(text) + 1 }
+
+/**
+ * @brief Largest encoded size of the parts of a message, for sizing buffers at
+ * compile time. Strings are not escaped, so their length is their JSON length
+ * plus the quotes. Name and text lengths exclude the terminating NUL.
+ */
+#define LAB_PAYLOAD_JSON_MAP_LENGTH(fields)         ( 2 + ( (fields) > 0 ? (fields) - 1 : 0 ) )
+#define LAB_PAYLOAD_JSON_ARRAY_LENGTH(items)        LAB_PAYLOAD_JSON_MAP_LENGTH(items)
+#define LAB_PAYLOAD_JSON_KEY_LENGTH(name)           ( sizeof(name) + 2 )
+#define LAB_PAYLOAD_JSON_STRING_LENGTH(maxLength)   ( (maxLength) + 2 )
+#define LAB_PAYLOAD_JSON_UINT_LENGTH                ( 10 )
+#define LAB_PAYLOAD_JSON_INT_LENGTH                 ( 11 )
+#define LAB_PAYLOAD_JSON_BOOL_LENGTH                ( 5 )
+
+#define LAB_PAYLOAD_CBOR_HEADER_LENGTH(value)       ( (value) < 24 ? 1 : (value) < 256 ? 2 : (value) < 65536 ? 3 : 5 )
+#define LAB_PAYLOAD_CBOR_MAP_LENGTH(fields)         LAB_PAYLOAD_CBOR_HEADER_LENGTH(fields)
+#define LAB_PAYLOAD_CBOR_ARRAY_LENGTH(items)        LAB_PAYLOAD_CBOR_HEADER_LENGTH(items)
+#define LAB_PAYLOAD_CBOR_KEY_LENGTH(name)           ( LAB_PAYLOAD_CBOR_HEADER_LENGTH(sizeof(name) - 1) + sizeof(name) - 1 )
+#define LAB_PAYLOAD_CBOR_STRING_LENGTH(maxLength)   ( LAB_PAYLOAD_CBOR_HEADER_LENGTH(maxLength) + (maxLength) )
+#define LAB_PAYLOAD_CBOR_UINT_LENGTH                ( 5 )
+#define LAB_PAYLOAD_CBOR_INT_LENGTH                 ( 5 )
+#define LAB_PAYLOAD_CBOR_BOOL_LENGTH                ( 1 )
+
+#define LAB_PAYLOAD_MAX(a, b)                       ( (a) > (b) ? (a) : (b) )
+
+/**
+ * @brief Writer of one message into a caller buffer. Once the buffer is full
+ * further writes are dropped, and xLabPayloadFinish reports it.
+ */
+typedef struct {
+    uint8_t * pBuffer;
+    size_t size;
+    size_t length;
+    lab_payload_encoding_t encoding;
+    bool needsSeparator;
+    bool overflow;
+} lab_payload_writer_t;
+
+void vLabPayloadInit(lab_payload_writer_t * writer, void * pBuffer, size_t size, lab_payload_encoding_t encoding);
+
+/**
+ * @brief   Open a map. CBOR maps have a definite length: fields is the number
+ *          of key / value pairs that follow.
+ */
+void vLabPayloadBeginMap(lab_payload_writer_t * writer, uint32_t fields);
+void vLabPayloadEndMap(lab_payload_writer_t * writer);
+
+/**
+ * @brief   Open an array of items values, a definite length as for maps.
+ */
+void vLabPayloadBeginArray(lab_payload_writer_t * writer, uint32_t items);
+void vLabPayloadEndArray(lab_payload_writer_t * writer);
+
+void vLabPayloadKey(lab_payload_writer_t * writer, const lab_payload_fragment_t * key);
+
+/**
+ * @brief   Values. Strings are written as they are: they must not need JSON
+ *          escaping, which holds for IDs, enums and the like of fixed schemas.
+ */
+void vLabPayloadText(lab_payload_writer_t * writer, const lab_payload_fragment_t * text);
+void vLabPayloadString(lab_payload_writer_t * writer, const char * pString, size_t length);
+void vLabPayloadUint(lab_payload_writer_t * writer, uint32_t value);
+void vLabPayloadInt(lab_payload_writer_t * writer, int32_t value);
+void vLabPayloadBool(lab_payload_writer_t * writer, bool value);
+
+/**
+ * @brief   Length of the message written.
+ *
+ * @return  length in bytes, 0 if it did not fit the buffer
+ */
+size_t xLabPayloadFinish(lab_payload_writer_t * writer);
+
+#endif /* ifndef _LAB_PAYLOAD_H_ */
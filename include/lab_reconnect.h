@@ -0,0 +1,73 @@
+/**
+ * @file lab_reconnect.h
+ * @brief Bookkeeping of the connection loop of lab_connection: the delays
+ * between MQTT connection attempts and the counters around them.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#ifndef _LAB_RECONNECT_H_
+#define _LAB_RECONNECT_H_
+
+#include <stdint.h>
+
+#include "lab_backoff.h"
+
+typedef struct {
+    uint32_t attempts;                          /*!< MQTT connection attempts since boot */
+    uint32_t connects;                          /*!< MQTT sessions established since boot */
+    uint32_t failures;                          /*!< Failed connection attempts since boot */
+    uint32_t consecutiveFailures;               /*!< Failed connection attempts since the last session */
+    uint32_t lastConnectMs;                     /*!< Duration of the last successful connection attempt */
+    uint32_t lastReconnectMs;                   /*!< Time from losing the last session to the next one being up */
+    uint32_t lastBackoffMs;                     /*!< Last delay before a connection attempt */
+} lab_connection_stats_t;
+
+typedef struct {
+    lab_backoff_t backoff;                      /*!< Delays between attempts, reset once a session is up */
+    lab_connection_stats_t stats;
+    uint64_t attemptStartMs;                    /*!< Start of the attempt in progress */
+    uint64_t disconnectedAtMs;                  /*!< Time the last session was lost, 0 if none was lost yet */
+} lab_reconnect_t;
+
+/**
+ * @brief   Initialize with the given backoff bounds. Zero selects the default.
+ */
+void vLabReconnectInit(lab_reconnect_t * reconnect, uint32_t firstRetryMs, uint32_t baseMs, uint32_t capMs);
+
+/**
+ * @brief   A connection attempt starts.
+ */
+void vLabReconnectAttempt(lab_reconnect_t * reconnect, uint64_t nowMs);
+
+/**
+ * @brief   The MQTT connection of the attempt is established.
+ */
+void vLabReconnectEstablished(lab_reconnect_t * reconnect, uint64_t nowMs);
+
+/**
+ * @brief   The session is up: the next loss starts over with a fast first
+ *          retry.
+ */
+void vLabReconnectConnected(lab_reconnect_t * reconnect, uint64_t nowMs);
+
+/**
+ * @brief   The attempt failed.
+ */
+void vLabReconnectFailed(lab_reconnect_t * reconnect);
+
+/**
+ * @brief   The session is lost.
+ */
+void vLabReconnectLost(lab_reconnect_t * reconnect, uint64_t nowMs);
+
+/**
+ * @brief   Delay before the next attempt, whether the last one failed or its
+ *          session was lost. It grows with consecutive failures.
+ *
+ * @return  delay in milliseconds
+ */
+uint32_t ulLabReconnectNextDelayMs(lab_reconnect_t * reconnect);
+
+#endif /* ifndef _LAB_RECONNECT_H_ */
@@ -0,0 +1,100 @@
+/**
+ * @file lab_report_policy.h
+ * @brief Decides when a reported state is worth sending: per field deadbands,
+ * fields reported at once, a minimum interval between reports and a heartbeat.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#ifndef _LAB_REPORT_POLICY_H_
+#define _LAB_REPORT_POLICY_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Most fields in a state.
+ */
+#ifndef LAB_REPORT_POLICY_MAX_FIELDS
+    #define LAB_REPORT_POLICY_MAX_FIELDS        ( 8 )
+#endif
+
+typedef struct {
+    const char *pName;                          /*!< For the logs */
+    uint32_t deadband;                          /*!< Change from the reported value that is reported, 0 or 1 for any */
+    bool immediate;                             /*!< Report any change at once, regardless of the minimum interval */
+} lab_report_field_t;
+
+/**
+ * @brief Why a state is to be reported.
+ */
+typedef enum {
+    LABREPORT_NONE = 0,                         /*!< Not to be reported */
+    LABREPORT_FIRST,                            /*!< Nothing reported yet */
+    LABREPORT_IMMEDIATE,                        /*!< An immediate field changed */
+    LABREPORT_CHANGE,                           /*!< A field moved out of its deadband */
+    LABREPORT_HEARTBEAT,                        /*!< Nothing reported for the heartbeat interval */
+    LABREPORT_RETRY                             /*!< The last report was not taken */
+} lab_report_reason_t;
+
+typedef struct {
+    uint32_t checks;                            /*!< States checked */
+    uint32_t reports;                           /*!< States reported */
+    uint32_t immediate;                         /*!< Checks answered for an immediate field */
+    uint32_t heartbeats;                        /*!< Checks answered for the heartbeat */
+    uint32_t deferred;                          /*!< Checks that waited for the minimum interval */
+    uint32_t retries;                           /*!< Checks answered for a report not taken */
+} lab_report_policy_stats_t;
+
+/**
+ * @brief A policy and what it last reported. Owned by one task.
+ */
+typedef struct {
+    const lab_report_field_t *pFields;
+    size_t fieldCount;
+    uint32_t minIntervalMs;                     /*!< Shortest time between two reports, but for immediate fields */
+    uint32_t heartbeatMs;                       /*!< Longest time without a report, 0 for none */
+    bool hasReported;
+    bool retry;                                 /*!< Report at the next check */
+    int32_t reported[LAB_REPORT_POLICY_MAX_FIELDS];
+    int64_t reportedUs;                         /*!< esp_timer time of the last report */
+    lab_report_policy_stats_t stats;
+} lab_report_policy_t;
+
+/**
+ * @brief   Set up a policy for a state of fieldCount fields; the first state
+ *          checked is reported.
+ */
+void vLabReportPolicyInit(lab_report_policy_t *pPolicy,
+                          const lab_report_field_t *pFields,
+                          size_t fieldCount,
+                          uint32_t minIntervalMs,
+                          uint32_t heartbeatMs);
+
+/**
+ * @brief   Check whether a state is to be reported.
+ *
+ * @param   pValues the current value of each field
+ * @param   nowUs esp_timer time
+ * @return  LABREPORT_NONE, or why to report it
+ */
+lab_report_reason_t xLabReportPolicyCheck(lab_report_policy_t *pPolicy,
+                                          const int32_t *pValues,
+                                          int64_t nowUs);
+
+/**
+ * @brief   Record that a state was reported, once it was sent successfully.
+ */
+void vLabReportPolicyReported(lab_report_policy_t *pPolicy,
+                              const int32_t *pValues,
+                              int64_t nowUs);
+
+/**
+ * @brief   Report at the next check, whatever the state: the last state
+ *          reported was sent but not taken, rejected or lost.
+ */
+void vLabReportPolicyRetry(lab_report_policy_t *pPolicy);
+
+#endif /* ifndef _LAB_REPORT_POLICY_H_ */
@@ -0,0 +1,32 @@
+/**
+ * @file lab_shadow_version.h
+ * @brief Version of a Shadow document, from the documents received: those
+ * older than the version known are stale.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#ifndef _LAB_SHADOW_VERSION_H_
+#define _LAB_SHADOW_VERSION_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief   Take the version of a Shadow document into account. Called from
+ *          any task: the known version only moves forward.
+ *
+ * @param   pVersion the version known, 0 for none; updated
+ * @param   pObjectKey path of the object holding "version", NULL for the
+ *          top level, as in eLabJsonRead
+ * @return  true if the document is not older than the known version, or has
+ *          none; false if it is stale
+ */
+bool bLabShadowVersionCheck(uint32_t *pVersion,
+                            const char *pDocument,
+                            size_t documentLength,
+                            const char *pObjectKey);
+
+#endif /* ifndef _LAB_SHADOW_VERSION_H_ */
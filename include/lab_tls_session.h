@@ -0,0 +1,73 @@
+/**
+ * @file lab_tls_session.h
+ * @brief Bookkeeping of the resumable TLS session of lab_network_tls: whether
+ * one is cached, when a failed handshake is a reason to drop it, and how long
+ * full and resumed handshakes take.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#ifndef _LAB_TLS_SESSION_H_
+#define _LAB_TLS_SESSION_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief Why a handshake failed, as far as the cached session is concerned.
+ */
+typedef enum {
+    LAB_TLS_HANDSHAKE_TIMED_OUT = 0,    /*!< The server did not answer in time */
+    LAB_TLS_HANDSHAKE_NETWORK_ERROR,    /*!< The connection failed or was closed */
+    LAB_TLS_HANDSHAKE_LOCAL_ERROR,      /*!< Failed on this side, out of memory or alike */
+    LAB_TLS_HANDSHAKE_ALERT,            /*!< The server sent a fatal alert */
+    LAB_TLS_HANDSHAKE_REJECTED          /*!< A handshake message of the server was refused */
+} lab_tls_handshake_failure_t;
+
+typedef struct {
+    uint32_t handshakes;                /*!< Successful handshakes since boot */
+    uint32_t resumed;                   /*!< Of which resumed from the cached session */
+    uint32_t failures;                  /*!< Failed handshakes since boot */
+    uint32_t forgotten;                 /*!< Cached sessions dropped after a failed handshake */
+    uint32_t lastHandshakeMs;           /*!< Duration of the last handshake */
+    uint32_t lastFullHandshakeMs;       /*!< Duration of the last full handshake */
+    uint32_t lastResumedHandshakeMs;    /*!< Duration of the last resumed handshake */
+    uint64_t totalFullHandshakeMs;      /*!< Time spent in full handshakes since boot */
+    uint64_t totalResumedHandshakeMs;   /*!< Time spent in resumed handshakes since boot */
+} lab_network_tls_stats_t;
+
+/**
+ * @brief   Record that a session was cached, from a handshake or from NVS, or
+ *          that the cached one was dropped.
+ */
+void vLabTlsSessionSetCached(bool cached);
+
+/**
+ * @brief   Whether a session is cached, to be offered at the next handshake.
+ */
+bool bLabTlsSessionIsCached(void);
+
+/**
+ * @brief   Record a successful handshake.
+ *
+ * @param   resumed true if it resumed the cached session
+ */
+void vLabTlsSessionHandshakeDone(bool resumed, uint32_t durationMs);
+
+/**
+ * @brief   Record a failed handshake.
+ *
+ *          The cached session is kept through timeouts and network or local
+ *          errors, which a full handshake would have hit as well: dropping it
+ *          would only make the next attempt longer. It is dropped when the
+ *          server answered with an alert or with messages that could not be
+ *          accepted, which a session it no longer knows may cause.
+ *
+ * @return  true if the cached session is to be dropped
+ */
+bool bLabTlsSessionHandshakeFailed(lab_tls_handshake_failure_t failure);
+
+void vLabTlsSessionGetStats(lab_network_tls_stats_t * stats);
+
+#endif /* ifndef _LAB_TLS_SESSION_H_ */
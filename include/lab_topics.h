@@ -0,0 +1,51 @@
+/**
+ * @file lab_topics.h
+ * @brief Topic names of the device, formatted once at init with its ID.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#ifndef _LAB_TOPICS_H_
+#define _LAB_TOPICS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#ifndef LAB_CONNECTION_TOPIC_MAX_LENGTH
+    #define LAB_CONNECTION_TOPIC_MAX_LENGTH             ( 64 )
+#endif
+
+/**
+ * Topics of the device, interned at init
+ */
+typedef enum {
+    LABCONNECTION_TOPIC_DEVICE = 0,             /*!< mydevice/<id>, button events */
+    LABCONNECTION_TOPIC_LWT,                    /*!< mydevice/<id>/lwt, Last Will and Testament */
+    LABCONNECTION_TOPIC_METRICS,                /*!< mydevice/<id>/metrics, latency histograms */
+    LABCONNECTION_TOPIC_VIBRATION,              /*!< mydevice/<id>/vibration, vibration features */
+    LABCONNECTION_TOPIC_MAX
+} lab_connection_topic_t;
+
+/**
+ * @brief   Format the topic names of a device.
+ *
+ * @param   useAliases publish on the short aliases "<id>/a/<topic>" instead
+ *          of the full names. They keep the ID of the device in front, so
+ *          that policies granting a device its own topics still apply.
+ * @return  ESP_OK success
+ *          ESP_FAIL a name does not fit LAB_CONNECTION_TOPIC_MAX_LENGTH
+ */
+esp_err_t eLabTopicsInit(const char * strID, bool useAliases);
+
+/**
+ * @brief   Name published on for a device topic.
+ *
+ * @param[out] pLength length of the name, may be NULL
+ * @return  the name, NULL if unknown or not initialized
+ */
+const char * pcLabTopicsGet(lab_connection_topic_t topic, uint16_t * pLength);
+
+#endif /* ifndef _LAB_TOPICS_H_ */
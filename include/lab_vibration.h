@@ -0,0 +1,110 @@
+/**
+ * @file lab_vibration.h
+ * @brief Vibration features computed on the device from the IMU samples, so
+ * that only a few numbers are published instead of the raw stream.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#ifndef _LAB_VIBRATION_H_
+#define _LAB_VIBRATION_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#include "lab_imu.h"
+#include "lab_payload.h"
+
+/**
+ * @brief Samples per window, a power of 2: it is also the FFT size. 256 samples
+ * are 1.28 s at 200 Hz.
+ */
+#ifndef LAB_VIBRATION_WINDOW
+    #define LAB_VIBRATION_WINDOW                ( 256 )
+#endif
+
+/**
+ * @brief Number of FFT bands. Band b covers [b, b + 1) * rate / (2 * bands)
+ * Hz, rate being the IMU sample rate after decimation.
+ */
+#ifndef LAB_VIBRATION_BANDS
+    #define LAB_VIBRATION_BANDS                 ( 8 )
+#endif
+
+/**
+ * @brief Period at which the features are published, 0 to never publish them.
+ * Each message summarises the windows of the period.
+ */
+#ifndef LAB_VIBRATION_PUBLISH_PERIOD_MS
+    #define LAB_VIBRATION_PUBLISH_PERIOD_MS     ( 60000 )
+#endif
+
+/**
+ * @brief Period at which the IMU ring is read. Must be well under the time the
+ * ring holds, 1.28 s at 200 Hz.
+ */
+#ifndef LAB_VIBRATION_READ_MS
+    #define LAB_VIBRATION_READ_MS               ( 250 )
+#endif
+
+#define LAB_VIBRATION_TASK_STACK_SIZE           ( 3072 )
+#define LAB_VIBRATION_TASK_PRIORITY             ( 2 )
+
+/**
+ * @brief Features of the windows since the last bLabVibrationTakeFeatures.
+ * RMS and peak are of each axis with its mean (gravity) removed; the bands are
+ * the RMS of the acceleration magnitude in each frequency band.
+ */
+typedef struct {
+    uint32_t windows;                           /*!< Windows summarised */
+    uint16_t rmsMg[3];                          /*!< RMS of X, Y, Z, mg */
+    uint16_t peakMg[3];                         /*!< Largest deviation from the mean of X, Y, Z, mg */
+    uint16_t crestX100[3];                      /*!< Crest factor of X, Y, Z, peak / RMS, times 100 */
+    uint16_t bandMg[LAB_VIBRATION_BANDS];       /*!< RMS of each band, mg */
+    uint32_t maxComputeUs;                      /*!< Longest time spent computing a window */
+} lab_vibration_features_t;
+
+/**
+ * @brief Largest encoded features message.
+ */
+#define LAB_VIBRATION_PAYLOAD_MAX_LENGTH        ( 192 )
+
+/**
+ * @brief   Prepare the FFT tables and start the task that reads the IMU ring and
+ *          publishes the features.
+ *
+ * @return  ESP_OK success
+ *          ESP_FAIL errors found
+ */
+esp_err_t eLabVibrationInit(void);
+
+/**
+ * @brief   Add consecutive IMU samples, computing the features of each window
+ *          they complete. Called by the vibration task.
+ */
+void vLabVibrationAddSamples(const lab_imu_sample_t *pSamples, size_t count);
+
+/**
+ * @brief   Drop the samples of the current window, after a gap in the samples.
+ */
+void vLabVibrationRestartWindow(void);
+
+/**
+ * @brief   Get the features of the windows completed since the last call.
+ *
+ * @return  false if no window was completed
+ */
+bool bLabVibrationTakeFeatures(lab_vibration_features_t *pFeatures);
+
+/**
+ * @brief   Encode features as a map of arrays.
+ *
+ * @return  length of the message, 0 if it did not fit
+ */
+size_t xLabVibrationToPayload(const lab_vibration_features_t *pFeatures, void *pBuffer, size_t size, lab_payload_encoding_t encoding);
+
+#endif /* ifndef _LAB_VIBRATION_H_ */
@@ -32,6 +32,7 @@
 #include "device.h"
 #include "lab_config.h"
 #include "lab_connection.h"
+#include "lab_payload.h"
 #include "lab1_aws_iot_button.h"
 
 static const char *TAG = "lab1_aws_iot_button";
@@ -94,23 +95,62 @@ static const char *TAG = "lab1_aws_iot_button";
 #define WILL_MESSAGE_LENGTH                      ( ( size_t ) ( sizeof( WILL_MESSAGE ) - 1 ) )
 
 /**
- * @brief The length of topic filter.
- *
- * For convenience, all topic filters are the same length.
+ * @brief Schema of the PUBLISH messages in this demo, the clickType values of
+ * the AWS IoT button and more:
+ * {"serialNumber":"<ID>","clickType":"SINGLE"|"DOUBLE"|"TRIPLE"|"HOLD"}
+ * {"serialNumber":"<ID>","clickType":"LONG","durationMs":<ms>}
+ * {"serialNumber":"<ID>","motion":"START"}
+ * {"serialNumber":"<ID>","motion":"STOP","durationMs":<ms>}
+ * or the same maps in CBOR.
  */
-#define TOPIC_FORMAT                             IOT_DEMO_MQTT_TOPIC_PREFIX "/%s"
-#define TOPIC_BUFFER_LENGTH                      ( ( uint16_t ) ( sizeof( TOPIC_FORMAT ) + 12 ) )
+#define PUBLISH_KEY_SERIAL_NUMBER                "serialNumber"
+#define PUBLISH_KEY_CLICK_TYPE                   "clickType"
+#define PUBLISH_KEY_DURATION                     "durationMs"
+#define PUBLISH_CLICK_TYPE_SINGLE                "SINGLE"
+#define PUBLISH_CLICK_TYPE_DOUBLE                "DOUBLE"
+#define PUBLISH_CLICK_TYPE_TRIPLE                "TRIPLE"
+#define PUBLISH_CLICK_TYPE_HOLD                  "HOLD"
+#define PUBLISH_CLICK_TYPE_LONG                  "LONG"
+#define PUBLISH_KEY_MOTION                       "motion"
+#define PUBLISH_MOTION_START                     "START"
+#define PUBLISH_MOTION_STOP                      "STOP"
 
 /**
- * @brief Format string of the PUBLISH messages in this demo.
+ * @brief The serial number is the MAC address of the device, in hex.
  */
-#define PUBLISH_PAYLOAD_FORMAT_SINGLE                   "{\"serialNumber\": \"%s\",\"clickType\": \"SINGLE\"}"
-#define PUBLISH_PAYLOAD_FORMAT_HOLD                     "{\"serialNumber\": \"%s\",\"clickType\": \"HOLD\"}"
+#define PUBLISH_SERIAL_NUMBER_MAX_LENGTH         ( 12 )
 
 /**
- * @brief Size of the buffer that holds the PUBLISH messages in this demo.
+ * @brief Size of the longest PUBLISH message in this demo, in either encoding:
+ * all fields, with the longest click type. The motion messages are shorter.
  */
-#define PUBLISH_PAYLOAD_BUFFER_LENGTH            ( sizeof( PUBLISH_PAYLOAD_FORMAT_SINGLE ) + 12 )
+#define PUBLISH_PAYLOAD_JSON_LENGTH                                                 \
+    ( LAB_PAYLOAD_JSON_MAP_LENGTH( 3 ) +                                            \
+      LAB_PAYLOAD_JSON_KEY_LENGTH( PUBLISH_KEY_SERIAL_NUMBER ) +                    \
+      LAB_PAYLOAD_JSON_STRING_LENGTH( PUBLISH_SERIAL_NUMBER_MAX_LENGTH ) +          \
+      LAB_PAYLOAD_JSON_KEY_LENGTH( PUBLISH_KEY_CLICK_TYPE ) +                       \
+      LAB_PAYLOAD_JSON_STRING_LENGTH( sizeof( PUBLISH_CLICK_TYPE_SINGLE ) - 1 ) +   \
+      LAB_PAYLOAD_JSON_KEY_LENGTH( PUBLISH_KEY_DURATION ) +                         \
+      LAB_PAYLOAD_JSON_UINT_LENGTH )
+
+#define PUBLISH_PAYLOAD_CBOR_LENGTH                                                 \
+    ( LAB_PAYLOAD_CBOR_MAP_LENGTH( 3 ) +                                            \
+      LAB_PAYLOAD_CBOR_KEY_LENGTH( PUBLISH_KEY_SERIAL_NUMBER ) +                    \
+      LAB_PAYLOAD_CBOR_STRING_LENGTH( PUBLISH_SERIAL_NUMBER_MAX_LENGTH ) +          \
+      LAB_PAYLOAD_CBOR_KEY_LENGTH( PUBLISH_KEY_CLICK_TYPE ) +                       \
+      LAB_PAYLOAD_CBOR_STRING_LENGTH( sizeof( PUBLISH_CLICK_TYPE_SINGLE ) - 1 ) +   \
+      LAB_PAYLOAD_CBOR_KEY_LENGTH( PUBLISH_KEY_DURATION ) +                         \
+      LAB_PAYLOAD_CBOR_UINT_LENGTH )
+
+#define PUBLISH_PAYLOAD_BUFFER_LENGTH            LAB_PAYLOAD_MAX( PUBLISH_PAYLOAD_JSON_LENGTH, PUBLISH_PAYLOAD_CBOR_LENGTH )
+
+_Static_assert( PUBLISH_PAYLOAD_BUFFER_LENGTH <= LAB_CONNECTION_POOL_PAYLOAD_LENGTH,
+                "The PUBLISH messages do not fit the publish buffers" );
+
+_Static_assert( sizeof( PUBLISH_KEY_MOTION ) <= sizeof( PUBLISH_KEY_CLICK_TYPE ) &&
+                sizeof( PUBLISH_MOTION_START ) <= sizeof( PUBLISH_CLICK_TYPE_SINGLE ) &&
+                sizeof( PUBLISH_MOTION_STOP ) <= sizeof( PUBLISH_CLICK_TYPE_SINGLE ),
+                "The motion messages are longer than PUBLISH_PAYLOAD_BUFFER_LENGTH" );
 
 /**
  * @brief The maximum number of times each PUBLISH in this demo will be retried.
@@ -146,6 +186,39 @@ static const char *TAG = "lab1_aws_iot_button";
 
 /*-----------------------------------------------------------*/
 
+/* Keys and constant values of the PUBLISH messages, preformatted. */
+static const lab_payload_fragment_t _keySerialNumber = LAB_PAYLOAD_KEY( PUBLISH_KEY_SERIAL_NUMBER );
+static const lab_payload_fragment_t _keyClickType = LAB_PAYLOAD_KEY( PUBLISH_KEY_CLICK_TYPE );
+static const lab_payload_fragment_t _keyDuration = LAB_PAYLOAD_KEY( PUBLISH_KEY_DURATION );
+static const lab_payload_fragment_t _clickTypeSingle = LAB_PAYLOAD_TEXT( PUBLISH_CLICK_TYPE_SINGLE );
+static const lab_payload_fragment_t _clickTypeDouble = LAB_PAYLOAD_TEXT( PUBLISH_CLICK_TYPE_DOUBLE );
+static const lab_payload_fragment_t _clickTypeTriple = LAB_PAYLOAD_TEXT( PUBLISH_CLICK_TYPE_TRIPLE );
+static const lab_payload_fragment_t _clickTypeHold = LAB_PAYLOAD_TEXT( PUBLISH_CLICK_TYPE_HOLD );
+static const lab_payload_fragment_t _clickTypeLong = LAB_PAYLOAD_TEXT( PUBLISH_CLICK_TYPE_LONG );
+static const lab_payload_fragment_t _keyMotion = LAB_PAYLOAD_KEY( PUBLISH_KEY_MOTION );
+static const lab_payload_fragment_t _motionStart = LAB_PAYLOAD_TEXT( PUBLISH_MOTION_START );
+static const lab_payload_fragment_t _motionStop = LAB_PAYLOAD_TEXT( PUBLISH_MOTION_STOP );
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief The clickType of a button event, NULL if it is not published.
+ */
+static const lab_payload_fragment_t * _clickType( int32_t buttonID )
+{
+    switch ( buttonID )
+    {
+        case BUTTON_CLICK: return &_clickTypeSingle;
+        case BUTTON_DOUBLE_CLICK: return &_clickTypeDouble;
+        case BUTTON_TRIPLE_CLICK: return &_clickTypeTriple;
+        case BUTTON_HOLD: return &_clickTypeHold;
+        case BUTTON_LONG_PRESS: return &_clickTypeLong;
+        default: return NULL;
+    }
+}
+
+/*-----------------------------------------------------------*/
+
 /**
  * @brief Called by the MQTT library when an operation completes.
  *
@@ -187,13 +260,13 @@ static void _operationCompleteCallback( void * param1,
 /**
  * @brief Transmit message.
  *
- * @param[in] pTopicName The topic name for publishing.
- * @param[in] pPayload The payload for publishing.
+ * @param[in] pBuffer The pool buffer holding the payload. It goes back to the
+ * pool once the PUBLISH completes.
+ * @param[in] payloadLength Length of the payload, which may be binary.
  *
  * @return `EXIT_SUCCESS` if all messages are published; `EXIT_FAILURE` otherwise.
  */
-static int _publishMessage( const char * pTopicName,
-                            const char * pPayload)
+static int _publishMessage( lab_publish_buffer_t * pBuffer, size_t payloadLength )
 {
     int status = EXIT_SUCCESS;
 
@@ -206,14 +279,20 @@ static int _publishMessage( const char * pTopicName,
 
     /* Set the common members of the publish info. */
     publishInfo.qos = IOT_MQTT_QOS_1;
-    publishInfo.topicNameLength = strlen(pTopicName);
-    publishInfo.pPayload = pPayload;
-    publishInfo.payloadLength = strlen(pPayload);
-    publishInfo.pTopicName = pTopicName;
+    publishInfo.pPayload = pBuffer->payload;
+    publishInfo.payloadLength = payloadLength;
     publishInfo.retryMs = PUBLISH_RETRY_MS;
     publishInfo.retryLimit = PUBLISH_RETRY_LIMIT;
 
-    status = eLabConnectionPublish(&publishInfo, &publishComplete);
+    /* The topic of the device, formatted once by lab_connection. */
+    if ( eLabConnectionSetTopic( &publishInfo, LABCONNECTION_TOPIC_DEVICE ) != ESP_OK )
+    {
+        IotLogError( "MQTT payload topic not available." );
+        vLabConnectionReleaseBuffer( pBuffer );
+        return EXIT_FAILURE;
+    }
+
+    status = eLabConnectionPublishBuffer(pBuffer, &publishInfo, &publishComplete);
 
     return status;
 }
@@ -237,57 +316,86 @@ esp_err_t eLab1Init(const char *const strID)
 
 /*-----------------------------------------------------------*/
 
-esp_err_t eLab1Action( const char * strID, int32_t buttonID ) 
+/**
+ * @brief Publish {"serialNumber":<ID>,<key>:<value>[,"durationMs":<ms>]}.
+ */
+static esp_err_t _publishEvent( const char * strID,
+                                const lab_payload_fragment_t * pKey,
+                                const lab_payload_fragment_t * pValue,
+                                bool withDuration,
+                                uint32_t durationMs )
 {
-    esp_err_t res = ESP_FAIL;
+    /* No need to check for the MQTT connection: publishes made while it is
+     * down are queued by lab_connection and sent once it is back. */
+
+    /* Payload buffer. It must outlive this function, as the PUBLISH is
+     * retried until acknowledged. */
+    lab_publish_buffer_t * pBuffer = pxLabConnectionAcquireBuffer();
 
-    if ( bIsLabConnectionMqttConnected() )
+    if ( pBuffer == NULL )
     {
-        ESP_LOGI(TAG, "lab1_action: %d", buttonID);
-        
-        /* Topic and Payload buffers */
-        char pTopic[ TOPIC_BUFFER_LENGTH ] = { 0 };
-        char pPublishPayload[ PUBLISH_PAYLOAD_BUFFER_LENGTH ] = { 0 };
-
-        /* Generate the payload for the PUBLISH. */
-        int status = -1;
-        
-        if ( buttonID == BUTTON_CLICK ) 
-        {
-            status = snprintf( pPublishPayload, PUBLISH_PAYLOAD_BUFFER_LENGTH, PUBLISH_PAYLOAD_FORMAT_SINGLE, strID );
-        }
-        if ( buttonID == BUTTON_HOLD ) 
-        {
-            status = snprintf( pPublishPayload, PUBLISH_PAYLOAD_BUFFER_LENGTH, PUBLISH_PAYLOAD_FORMAT_HOLD, strID );
-        }
-
-        /* Check for errors from snprintf. */
-        if( status < 0 )
-        {
-            IotLogError( "Failed to generate MQTT PUBLISH payload: %d.", (int) status );
-            return ESP_FAIL;
-        }
-        else
-        {
-            /* Generate the topic. */
-            status = snprintf( pTopic, TOPIC_BUFFER_LENGTH, TOPIC_FORMAT, strID );
-
-        }
-        
-        if ( status < 0 ) 
-        {
-            IotLogError( "Failed to generate MQTT payload topic: %d.", (int) status );
-            return ESP_FAIL;
-        }
-        
-        res = _publishMessage( pTopic, pPublishPayload );
+        IotLogError( "No publish buffer available, dropping the event." );
+        return ESP_FAIL;
     }
-    else
+
+    /* Generate the payload for the PUBLISH, in the encoding of its topic. */
+    lab_payload_writer_t writer;
+    size_t payloadLength = 0;
+
+    vLabPayloadInit( &writer, pBuffer->payload, PUBLISH_PAYLOAD_BUFFER_LENGTH,
+                     xLabConnectionGetTopicEncoding( LABCONNECTION_TOPIC_DEVICE ) );
+    vLabPayloadBeginMap( &writer, withDuration ? 3 : 2 );
+    vLabPayloadKey( &writer, &_keySerialNumber );
+    vLabPayloadString( &writer, strID, strlen( strID ) );
+    vLabPayloadKey( &writer, pKey );
+    vLabPayloadText( &writer, pValue );
+
+    if ( withDuration )
+    {
+        vLabPayloadKey( &writer, &_keyDuration );
+        vLabPayloadUint( &writer, durationMs );
+    }
+
+    vLabPayloadEndMap( &writer );
+    payloadLength = xLabPayloadFinish( &writer );
+
+    /* Only an ID longer than expected can overflow the buffer. */
+    if( payloadLength == 0 )
     {
-        ESP_LOGI(TAG, "lab1_action: %d. Skipped due to lack of available MQTT connection", buttonID);
+        IotLogError( "Failed to generate MQTT PUBLISH payload for %s.", strID );
+        vLabConnectionReleaseBuffer( pBuffer );
+        return ESP_FAIL;
     }
+    
+    return _publishMessage( pBuffer, payloadLength );
+}
+
+/*-----------------------------------------------------------*/
+
+esp_err_t eLab1Action( const char * strID, int32_t buttonID, uint32_t durationMs ) 
+{
+    const lab_payload_fragment_t * clickType = _clickType( buttonID );
+
+    if ( clickType == NULL )
+    {
+        IotLogError( "Unknown button event %d.", (int) buttonID );
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG, "lab1_action: %d", buttonID);
+
+    return _publishEvent( strID, &_keyClickType, clickType,
+                          buttonID == BUTTON_LONG_PRESS, durationMs );
+}
+
+/*-----------------------------------------------------------*/
+
+esp_err_t eLab1Motion( const char * strID, bool moving, uint32_t durationMs )
+{
+    ESP_LOGI(TAG, "lab1_motion: %s", moving ? "start" : "stop");
 
-    return res;
+    return _publishEvent( strID, &_keyMotion, moving ? &_motionStart : &_motionStop,
+                          !moving, durationMs );
 }
 
 /*-----------------------------------------------------------*/
@@ -15,6 +15,10 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+
 /* Set up logging for this demo. */
 #include "iot_demo_logging.h"
 
@@ -34,146 +38,134 @@
 #include "aws_demo.h"
 #include "types/iot_network_types.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 
 #include "device.h"
+#include "lab_battery.h"
 #include "lab_config.h"
 #include "lab_connection.h"
+#include "lab_display.h"
+#include "lab_json.h"
+#include "lab_payload.h"
+#include "lab_report_policy.h"
 #include "lab2_shadow.h"
+#include "lab2_shadow_state.h"
 
 static const char *TAG = "lab2_shadow";
 
 /**
- * @brief The timeout for MQTT operations.
+ * @brief The timeout for MQTT operations. The AirCon task waits as long for
+ * the Shadow read at the start of a session before reporting.
  */
 #define SHADOW_UPDATE_TIMEOUT_MS (5000)
 
 /**
- * @brief Format string representing a Shadow document with a "desired" state.
- *
- * Note the client token, which is required for all Shadow updates. The client
- * token must be unique at any given time, but may be reused once the update is
- * completed. For this demo, a timestamp is used for a client token.
+ * @brief Format string of the Shadow document reporting the battery, sent on
+ * its own when the battery monitor reports a change.
  */
-#define SHADOW_DESIRED_JSON     \
+#define SHADOW_BATTERY_JSON     \
     "{"                         \
     "\"state\":{"               \
-    "\"desired\":{"             \
-    "\"powerOn\":%01d,"         \
-    "\"temperature\":%02d"      \
+    "\"reported\":{"            \
+    "\"battery\":{"             \
+    "\"soc\":%3u,"              \
+    "\"charging\":%01d,"        \
+    "\"mV\":%4u"                \
+    "}"                         \
     "}"                         \
     "},"                        \
     "\"clientToken\":\"%06lu\"" \
     "}"
 
 /**
- * @brief The expected size of #SHADOW_DESIRED_JSON.
- *
- * Because all the format specifiers in #SHADOW_DESIRED_JSON include a length,
- * its full size is known at compile-time.
+ * @brief The size of #SHADOW_BATTERY_JSON once formatted, without the NULL
+ * terminator: every format specifier has a fixed width, %01d formats 3 fewer
+ * characters than it takes, %4u and %06lu one more.
  */
-#define EXPECTED_DESIRED_JSON_SIZE (sizeof(SHADOW_DESIRED_JSON) - 3)
+#define EXPECTED_BATTERY_JSON_SIZE (sizeof(SHADOW_BATTERY_JSON) - 1 - 3 + 1 + 1)
 
-/**
- * @brief Format string representing a Shadow document with a "reported" state.
- *
- * Note the client token, which is required for all Shadow updates. The client
- * token must be unique at any given time, but may be reused once the update is
- * completed. For this demo, a timestamp is used for a client token.
- */
-#define SHADOW_REPORTED_JSON    \
-    "{"                         \
-    "\"state\":{"               \
-    "\"reported\":{"            \
-    "\"powerOn\":%01d,"         \
-    "\"temperature\":%2d"       \
-    "}"                         \
-    "},"                        \
-    "\"clientToken\":\"%06lu\"" \
-    "}"
+_Static_assert( LAB2_SHADOW_REPORTED_JSON_LENGTH <= LAB_CONNECTION_POOL_PAYLOAD_LENGTH,
+                "The reported Shadow document does not fit a publish buffer" );
+
+/* Thing name while MQTT is connected, NULL otherwise. */
+static const char *_pThingName = NULL;
+
+/* States of the AirCon, written by its task only. The Shadow callbacks send
+ * it what is desired, and read the snapshot. */
+static lab2_shadow_state_t shadowStateReported;
+static lab2_shadow_state_t shadowStateDesired = { 0 };
+
+/* The states published by the AirCon task for the other tasks. */
+static lab2_shadow_snapshot_t _snapshot;
 
 /**
- * @brief The expected size of #SHADOW_REPORTED_JSON.
- *
- * Because all the format specifiers in #SHADOW_REPORTED_JSON include a length,
- * its full size is known at compile-time.
+ * @brief What is desired, from a Shadow callback to the AirCon task.
  */
-#define EXPECTED_REPORTED_JSON_SIZE (sizeof(SHADOW_REPORTED_JSON) - 3)
-
 typedef struct {
-    uint8_t powerOn;
-    uint8_t temperature;
-} shadowState_t;
-
-shadowState_t shadowStateReported = {
-    .powerOn = 0,
-    .temperature = 35
-};
-shadowState_t shadowStateDesired = {
-    .powerOn = 0,
-    .temperature = 0
-};
+    uint32_t session;                           /*!< MQTT session of the callback, first in all messages to the task */
+    lab_json_value_t values[LAB2SHADOW_FIELD_COUNT];
+    bool sync;                                  /*!< From the Shadow read at the start of the session */
+} shadowDesiredMessage_t;
+
+#define SHADOW_DESIRED_QUEUE_LENGTH     ( 4 )
+
+static QueueHandle_t _desiredQueue = NULL;
+
+static TaskHandle_t xAirConTaskHandle = NULL;
+static void prvAirConTask( void *pvParameters );
+
+/* Notification bits of the AirCon task. It is created once, and parked
+ * between sessions rather than deleted: it never dies halfway through
+ * publishing the snapshot, and two of it never run at once. */
+#define AIRCON_NOTIFY_WAKE              ( 1UL << 0 )
+#define AIRCON_NOTIFY_STOP              ( 1UL << 1 )
+#define AIRCON_NOTIFY_START             ( 1UL << 2 )
+
+/* What the AirCon task reported in this connection, used from its task only. */
+static lab_report_policy_t _reportPolicy;
+
+/* Reported updates of the AirCon task, which owns it. */
+static lab2_shadow_reported_t _reported;
 
 /**
- * @brief The expected size of #SHADOW_REPORTED_JSON.
- *
- * Because all the format specifiers in #SHADOW_REPORTED_JSON include a length,
- * its full size is known at compile-time.
+ * @brief Response to a reported update, from the Shadow callback to the
+ * AirCon task.
  */
-#define EXPECTED_REPORTED_JSON_SIZE (sizeof(SHADOW_REPORTED_JSON) - 3)
+typedef struct {
+    uint32_t session;                           /*!< MQTT session of the callback */
+    uint32_t sequence;
+    bool accepted;
+} shadowResponse_t;
 
-/*-----------------------------------------------------------*/
+#define SHADOW_RESPONSE_QUEUE_LENGTH    ( 2 )
 
-static TaskHandle_t xAirConTaskHandle;
-static void prvAirConTask( void *pvParameters );
+static QueueHandle_t _responseQueue = NULL;
 
 /*-----------------------------------------------------------*/
 
 /**
- * @brief Parses a key in the "state" section of a Shadow delta document.
- *
- * @param[in] pDeltaDocument The Shadow delta document to parse.
- * @param[in] deltaDocumentLength The length of `pDeltaDocument`.
- * @param[in] pDeltaKey The key in the delta document to find. Must be NULL-terminated.
- * @param[out] pDelta Set to the first character in the delta key.
- * @param[out] pDeltaLength The length of the delta key.
- *
- * @return `true` if the given delta key is found; `false` otherwise.
+ * @brief Send what is desired to the AirCon task, which applies it. Never
+ * blocks: called from the MQTT callbacks.
  */
-static bool _getDelta(const char *pDeltaDocument,
-                      size_t deltaDocumentLength,
-                      const char *pDeltaKey,
-                      const char **pDelta,
-                      size_t *pDeltaLength)
+static void _postDesired(const lab_json_value_t *pValues, bool sync)
 {
-    bool stateFound = false, deltaFound = false;
-    const size_t deltaKeyLength = strlen(pDeltaKey);
-    const char *pState = NULL;
-    size_t stateLength = 0;
-
-    /* Find the "state" key in the delta document. */
-    stateFound = IotJsonUtils_FindJsonValue(pDeltaDocument,
-                                            deltaDocumentLength,
-                                            "state",
-                                            5,
-                                            &pState,
-                                            &stateLength);
-
-    if (stateFound == true)
-    {
-        /* Find the delta key within the "state" section. */
-        deltaFound = IotJsonUtils_FindJsonValue(pState,
-                                                stateLength,
-                                                pDeltaKey,
-                                                deltaKeyLength,
-                                                pDelta,
-                                                pDeltaLength);
-    }
-    else
+    shadowDesiredMessage_t message;
+    TaskHandle_t xTask = xAirConTaskHandle;
+
+    message.session = ulLabConnectionGetSession();
+    memcpy(message.values, pValues, sizeof(message.values));
+    message.sync = sync;
+
+    if (xQueueSend(_desiredQueue, &message, 0) != pdTRUE)
     {
-        IotLogWarn("Failed to find \"state\" in Shadow delta document.");
+        ESP_LOGE(TAG, "Desired state dropped, the AirCon task is behind");
+        return;
     }
 
-    return deltaFound;
+    if (xTask != NULL)
+    {
+        xTaskNotify(xTask, AIRCON_NOTIFY_WAKE, eSetBits);
+    }
 }
 
 /*-----------------------------------------------------------*/
@@ -229,54 +221,129 @@ static bool _getUpdatedState(const char *pUpdatedDocument,
 }
 /*-----------------------------------------------------------*/
 
+/**
+ * @brief Completion of a reported update: hand the response to the AirCon task.
+ *
+ * @param[in] pCallbackContext The sequence number of the update.
+ * @param[in] pCallbackParam The result of the update.
+ */
+static void _reportComplete(void *pCallbackContext,
+                            AwsIotShadowCallbackParam_t *pCallbackParam)
+{
+    shadowResponse_t response = {
+        .session = ulLabConnectionGetSession(),
+        .sequence = (uint32_t)(uintptr_t)pCallbackContext,
+        .accepted = pCallbackParam->u.operation.result == AWS_IOT_SHADOW_SUCCESS
+    };
+    TaskHandle_t xTask = xAirConTaskHandle;
+
+    if (xQueueSend(_responseQueue, &response, 0) == pdTRUE && xTask != NULL)
+    {
+        xTaskNotify(xTask, AIRCON_NOTIFY_WAKE, eSetBits);
+    }
+}
+
+/*-----------------------------------------------------------*/
+
 /**
  * @brief Send the Shadow update that will trigger the Shadow callbacks.
  *
  * @param[in] pThingName The Thing Name for Shadows in this demo.
+ * @param[in] pState The state reported.
+ * @param[in] fields The fields of the state sent, a bit by LAB2SHADOW_FIELD_*.
+ * @param[in] sequence Passed to _reportComplete with the response.
  *
  * @return `EXIT_SUCCESS` if all Shadow updates were sent; `EXIT_FAILURE`
  * otherwise.
  */
-static int _reportShadow(const char *const pThingName)
+static int _reportShadow(const char *const pThingName, const lab2_shadow_state_t *pState,
+                         uint32_t fields, uint32_t sequence)
+{
+    AwsIotShadowDocumentInfo_t updateDocument = AWS_IOT_SHADOW_DOCUMENT_INFO_INITIALIZER;
+    AwsIotShadowCallbackInfo_t updateComplete = AWS_IOT_SHADOW_CALLBACK_INFO_INITIALIZER;
+    size_t length = 0;
+
+    /* Each report takes its own buffer, returned once the update completes. */
+    lab_publish_buffer_t *pBuffer = pxLabConnectionAcquireBuffer();
+
+    if (pBuffer == NULL)
+    {
+        ESP_LOGE(TAG, "No publish buffer available for the Shadow update");
+        return EXIT_FAILURE;
+    }
+
+    length = xLab2ShadowWriteReported(pState, fields, (uint32_t)(IotClock_GetTimeMs() % 1000000),
+                                      pBuffer->payload, LAB2_SHADOW_REPORTED_JSON_LENGTH);
+
+    if (length == 0)
+    {
+        ESP_LOGE(TAG, "Failed to generate reported state document for Shadow update");
+        vLabConnectionReleaseBuffer(pBuffer);
+        return EXIT_FAILURE;
+    }
+
+    /* Set the common members of the Shadow update document info. */
+    updateDocument.pThingName = pThingName;
+    updateDocument.thingNameLength = strlen(pThingName);
+    updateDocument.u.update.pUpdateDocument = pBuffer->payload;
+    updateDocument.u.update.updateDocumentLength = length;
+
+    updateComplete.function = _reportComplete;
+    updateComplete.pCallbackContext = (void *)(uintptr_t)sequence;
+
+    ESP_LOGD(TAG, "Reporting %u of %u fields in %u bytes", __builtin_popcount(fields),
+             LAB2SHADOW_FIELD_COUNT, (unsigned)length);
+
+    return eLabConnectionUpdateShadowBuffer(pBuffer, &updateDocument, &updateComplete);
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Send the battery state in its own Shadow update, so that it is only
+ * sent when it changes.
+ *
+ * @return `EXIT_SUCCESS` if the update was sent; `EXIT_FAILURE` otherwise.
+ */
+static int _reportBattery(const char *const pThingName,
+                          uint32_t socPercent,
+                          bool charging,
+                          uint32_t millivolts)
 {
     int status = EXIT_SUCCESS;
 
     AwsIotShadowDocumentInfo_t updateDocument = AWS_IOT_SHADOW_DOCUMENT_INFO_INITIALIZER;
+    lab_publish_buffer_t *pBuffer = pxLabConnectionAcquireBuffer();
+
+    if (pBuffer == NULL)
+    {
+        ESP_LOGE(TAG, "No publish buffer available for the battery Shadow update");
+        return EXIT_FAILURE;
+    }
 
-    static char pUpdateDocument[EXPECTED_REPORTED_JSON_SIZE + 1] = {0};
+    char *pUpdateDocument = pBuffer->payload;
 
-    /* Set the common members of the Shadow update document info. */
     updateDocument.pThingName = pThingName;
     updateDocument.thingNameLength = strlen(pThingName);
     updateDocument.u.update.pUpdateDocument = pUpdateDocument;
-    updateDocument.u.update.updateDocumentLength = EXPECTED_REPORTED_JSON_SIZE;
+    updateDocument.u.update.updateDocumentLength = EXPECTED_BATTERY_JSON_SIZE;
 
-    /* Generate a Shadow reported state document, using a timestamp for the client
-     * token. To keep the client token within 6 characters, it is modded by 1000000.
-     * */
     status = snprintf(pUpdateDocument,
-                      EXPECTED_REPORTED_JSON_SIZE + 1,
-                      SHADOW_REPORTED_JSON,
-                      (int)shadowStateReported.powerOn,
-                      (uint8_t)shadowStateReported.temperature,
+                      EXPECTED_BATTERY_JSON_SIZE + 1,
+                      SHADOW_BATTERY_JSON,
+                      (unsigned)socPercent,
+                      (int)charging,
+                      (unsigned)millivolts,
                       (long unsigned)(IotClock_GetTimeMs() % 1000000));
 
-    /* Check for errors from snprintf. The expected value is the length of
-     * the desired JSON document less the format specifier for the state.
-     * */
-    if (status <= 0)
+    if (status != EXPECTED_BATTERY_JSON_SIZE)
     {
-        ESP_LOGE(TAG, "Failed to generate reported state document for Shadow update: %u vs. %u\n", status, EXPECTED_REPORTED_JSON_SIZE);
-        ESP_LOGE(TAG, "%s\n", pUpdateDocument);
-        status = EXIT_FAILURE;
-        return status;
-    }
-    else
-    {
-        status = eLabConnectionUpdateShadow(&updateDocument);
+        ESP_LOGE(TAG, "Failed to generate the battery document for Shadow update: %d vs. %u", status, EXPECTED_BATTERY_JSON_SIZE);
+        vLabConnectionReleaseBuffer(pBuffer);
+        return EXIT_FAILURE;
     }
 
-    return status;
+    return eLabConnectionUpdateShadowBuffer(pBuffer, &updateDocument, NULL);
 }
 
 /*-----------------------------------------------------------*/
@@ -293,71 +360,61 @@ static int _reportShadow(const char *const pThingName)
 static void _shadowDeltaCallback(void *pCallbackContext,
                                  AwsIotShadowCallbackParam_t *pCallbackParam)
 {
-    bool powerOnDeltaFound = false;
-    bool temperatureDeltaFound = false;
-    const char *pPowerOnDelta = NULL;
-    const char *pTemperatureDelta = NULL;
-    size_t deltaLength = 0;
-    int status = 0;
+    lab_json_value_t delta[LAB2SHADOW_FIELD_COUNT];
+    lab2_shadow_state_t reported;
+    lab2_shadow_state_t desired;
+    esp_err_t res = ESP_FAIL;
 
-    /* Check if there is a different "powerOn" state in the Shadow. */
-    powerOnDeltaFound = _getDelta(pCallbackParam->u.callback.pDocument,
-                           pCallbackParam->u.callback.documentLength,
-                           "powerOn",
-                           &pPowerOnDelta,
-                           &deltaLength);
-    
-    if (powerOnDeltaFound == true)
-    {
-        uint8_t newPowerOn = (uint8_t)atoi(pPowerOnDelta);
-        IotLogInfo("Shadow delta: powerOn: %u vs. %u", newPowerOn, shadowStateDesired.powerOn);
-        if (newPowerOn != shadowStateReported.powerOn)
-        {
-            IotLogInfo("%.*s changing powerOn state from %u to %u.",
-                       pCallbackParam->thingNameLength,
-                       pCallbackParam->pThingName,
-                       shadowStateReported.powerOn, newPowerOn);
+    res = eLab2ShadowReadState(pCallbackParam->u.callback.pDocument,
+                               pCallbackParam->u.callback.documentLength,
+                               "state",
+                               delta);
 
-            shadowStateDesired.powerOn = newPowerOn;
-            shadowStateReported.powerOn = newPowerOn;
-        }
+    if (res != ESP_OK)
+    {
+        IotLogWarn("Failed to read \"state\" in Shadow delta document: %s", esp_err_to_name(res));
+        return;
     }
 
-    /* Check if there is a different "temperature" state in the Shadow. */
-    temperatureDeltaFound = _getDelta(pCallbackParam->u.callback.pDocument,
-                                      pCallbackParam->u.callback.documentLength,
-                                      "temperature",
-                                      &pTemperatureDelta,
-                                      &deltaLength);
+    vLab2ShadowSnapshotRead(&_snapshot, &reported, &desired);
 
-    if (temperatureDeltaFound == true)
-    {
-        uint8_t newTemperature = (uint8_t)atoi(pTemperatureDelta);
-        IotLogInfo("Shadow delta: temperature: %u vs. %u", newTemperature, shadowStateDesired.temperature);
-        /* Change the current state based on the value in the delta document. */
-        if (newTemperature != shadowStateDesired.temperature)
-        {            
-            IotLogInfo("%.*s changing temperature state from %u to %u.",
-                       pCallbackParam->thingNameLength,
-                       pCallbackParam->pThingName,
-                       shadowStateDesired.temperature, newTemperature);
+    IotLogInfo("%.*s Shadow delta, reported powerOn %u temperature %u",
+               pCallbackParam->thingNameLength, pCallbackParam->pThingName,
+               reported.powerOn, reported.temperature);
 
-            shadowStateDesired.temperature = newTemperature;
-        }
-    }
+    /* The AirCon task alone writes the state and reports it. */
+    _postDesired(delta, false);
+}
 
-    if (powerOnDeltaFound == true)
-    {
-        IotLogInfo("Shadow delta: change of Power State requires updating shadow");
+/*-----------------------------------------------------------*/
 
-        status = _reportShadow(pCallbackParam->pThingName);
+/**
+ * @brief Shadow read at the start of a session: apply what is desired, so that
+ * the state converges within a round trip instead of at the next delta.
+ *
+ * @param[in] pCallbackContext Not used.
+ * @param[in] pCallbackParam The Shadow document, or the failure to read it.
+ */
+static void _shadowGetCallback(void *pCallbackContext,
+                               AwsIotShadowCallbackParam_t *pCallbackParam)
+{
+    lab_json_value_t desired[LAB2SHADOW_FIELD_COUNT];
 
-        if (status != EXIT_SUCCESS)
-        {
-            IotLogError("Shadow delta: report new shadow failed\n");
-        }
+    if (pCallbackParam->u.operation.result == AWS_IOT_SHADOW_SUCCESS &&
+        eLab2ShadowReadState(pCallbackParam->u.operation.get.pDocument,
+                             pCallbackParam->u.operation.get.documentLength,
+                             "state.desired",
+                             desired) == ESP_OK)
+    {
+        IotLogInfo("Shadow version %u read", ulLabConnectionGetShadowVersion());
+    }
+    else
+    {
+        /* Nothing desired: the AirCon task reports what it has. */
+        memset(desired, 0, sizeof(desired));
     }
 
+    _postDesired(desired, true);
 }
 
 /*-----------------------------------------------------------*/
@@ -421,61 +478,283 @@ static void _shadowUpdatedCallback(void *pCallbackContext,
 
 /*-----------------------------------------------------------*/
 
-static void prvAirConTask( void * pvParameters )
+/**
+ * @brief Simulate the AirCon for a period: the temperature moves by a degree
+ * towards the target, or warms up while it is off.
+ */
+static void _stepAirCon(void)
 {
     // Used for the screen.
     char pAirConStr[11] = {0};
-    char * pThingName = (char *)pvParameters;
+    int status = 0;
+
+    if (shadowStateReported.powerOn == 1)
+    {
+        shadowStateReported.temperature--;
+        if (shadowStateReported.temperature < shadowStateDesired.temperature)
+        {
+            shadowStateReported.temperature = shadowStateDesired.temperature;
+        }
+
+        ESP_LOGI(TAG, "prvAirConTask: AirCon is ON => Temp (%u) needs to decrease to target (%u)",
+                shadowStateReported.temperature,
+                shadowStateDesired.temperature);
+
+        status = snprintf(pAirConStr, 11, " ON %02u", shadowStateReported.temperature);
+    }
+    else
+    {
+        shadowStateReported.temperature++;
+        if (shadowStateReported.temperature > 40)
+        {
+            shadowStateReported.temperature = 40;
+        }
+
+        ESP_LOGI(TAG, "prvAirConTask: AirCon is OFF => Temp (%u) increases", shadowStateReported.temperature);
+
+        status = snprintf(pAirConStr, 11, "OFF %02u", shadowStateReported.temperature);
+    }
+
+    if (status >= 0)
+    {
+        eLabDisplaySetText(LABDISPLAY_WIDGET_STATUS, pAirConStr);
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Receive the next message of a session: those an earlier session left
+ * are dropped, those of a later one are left for it. The AirCon task runs at
+ * the lowest priority: the next session may be up and have read the Shadow
+ * before it is done with the previous one.
+ *
+ * @param[out] pMessage a message of the queue, starting with its session
+ * @return  true if a message of the session was received
+ */
+static bool _receiveOfSession(QueueHandle_t xQueue, void *pMessage, uint32_t session)
+{
+    uint32_t messageSession = 0;
+
+    while (xQueuePeek(xQueue, pMessage, 0) == pdTRUE)
+    {
+        memcpy(&messageSession, pMessage, sizeof(messageSession));
+
+        if ((int32_t)(messageSession - session) > 0)
+        {
+            return false;
+        }
+
+        (void)xQueueReceive(xQueue, pMessage, 0);
+
+        if (messageSession == session)
+        {
+            return true;
+        }
+
+        ESP_LOGD(TAG, "prvAirConTask: Message of session %u dropped in session %u", messageSession, session);
+    }
+
+    return false;
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Take in the responses to the reported updates: the fields of an
+ * accepted update are clean, those of a rejected or lost one stay dirty and
+ * are reported again at the next step.
+ */
+static void _receiveResponses(lab2_shadow_reported_t *pReported, int64_t nowUs, uint32_t session)
+{
+    shadowResponse_t response;
+
+    while (_receiveOfSession(_responseQueue, &response, session))
+    {
+        if (bLab2ShadowReportedResponse(pReported, response.sequence, response.accepted) &&
+            !response.accepted)
+        {
+            ESP_LOGW(TAG, "prvAirConTask: Update %u rejected, reported again", response.sequence);
+            vLabReportPolicyRetry(&_reportPolicy);
+        }
+    }
+
+    if (bLab2ShadowReportedExpired(pReported, nowUs))
+    {
+        ESP_LOGW(TAG, "prvAirConTask: No response to update %u, reported again", pReported->sequence);
+        vLabReportPolicyRetry(&_reportPolicy);
+    }
+}
+
+/*-----------------------------------------------------------*/
 
-    ESP_LOGI(TAG, "prvAirConTask: Starting the AirCon task for: %s", pThingName);
+/**
+ * @brief Apply what the Shadow callbacks sent: the AirCon switches at once,
+ * the temperature follows in _stepAirCon.
+ *
+ * @param[out] pSynced Set once the Shadow read at the start of the session is in.
+ * @return  true if something was received
+ */
+static bool _receiveDesired(bool *pSynced, uint32_t session)
+{
+    shadowDesiredMessage_t message;
+    bool received = false;
+
+    while (_receiveOfSession(_desiredQueue, &message, session))
+    {
+        ulLab2ShadowApplyDelta(message.values, &shadowStateDesired);
+
+        if (message.values[LAB2SHADOW_FIELD_powerOn].found == true)
+        {
+            shadowStateReported.powerOn = shadowStateDesired.powerOn;
+        }
+
+        *pSynced |= message.sync;
+        received = true;
+    }
+
+    return received;
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Run the AirCon for a session, until it is stopped.
+ *
+ * @return  the notification bits it stopped on, a start of the next session
+ *          among them
+ */
+static uint32_t _runAirCon(const char *pThingName, uint32_t session)
+{
+    TickType_t xNextStep = xTaskGetTickCount();
+    TickType_t xNow = 0;
+    lab_report_reason_t reason = LABREPORT_NONE;
+    int32_t values[LAB2SHADOW_FIELD_COUNT] = {0};
+    lab2_shadow_state_t state;
+    uint32_t fields = 0;
+    int64_t nowUs = 0;
+    int64_t startUs = esp_timer_get_time();
+    bool synced = false;
+    bool changed = false;
+    uint32_t notified = 0;
+
+    ESP_LOGI(TAG, "prvAirConTask: Starting the AirCon for: %s, session %u", pThingName, session);
+
+    /* The Shadow may have changed while disconnected: report it all anew. */
+    vLabReportPolicyInit(&_reportPolicy, pxLab2ShadowReportFields(), LAB2SHADOW_FIELD_COUNT,
+                         LAB2_REPORT_MIN_INTERVAL_MS, LAB2_REPORT_HEARTBEAT_MS);
+    vLab2ShadowReportedReset(&_reported);
 
     for(;;)
-    {        
-        int status = EXIT_SUCCESS;
+    {
+        changed = _receiveDesired(&synced, session);
+        xNow = xTaskGetTickCount();
 
-        if (shadowStateReported.powerOn == 1)
+        /* Woken up early by a delta or a response, or the period is over. */
+        if ((int32_t)(xNow - xNextStep) >= 0)
         {
-            shadowStateReported.temperature--;
-            if (shadowStateReported.temperature < shadowStateDesired.temperature)
-            {
-                shadowStateReported.temperature = shadowStateDesired.temperature;
-            }
+            _stepAirCon();
+            xNextStep += pdMS_TO_TICKS( LAB2_AIRCON_PERIOD_MS );
+            changed = true;
+        }
+
+        if (changed)
+        {
+            vLab2ShadowSnapshotPublish(&_snapshot, &shadowStateReported, &shadowStateDesired);
+        }
 
-            ESP_LOGI(TAG, "prvAirConTask: AirCon is ON => Temp (%u) needs to decrease to target (%u)",
-                    shadowStateReported.temperature,
-                    shadowStateDesired.temperature);
+        nowUs = esp_timer_get_time();
+        _receiveResponses(&_reported, nowUs, session);
 
-            status = snprintf(pAirConStr, 11, " ON %02u", shadowStateReported.temperature);
+        /* One update at a time, so that its response tells what is clean;
+         * the first once the Shadow read tells what is desired. */
+        if (!_reported.inFlight &&
+            (synced ||
+             nowUs - startUs >= SHADOW_UPDATE_TIMEOUT_MS * 1000LL))
+        {
+            /* What is checked is what is sent. */
+            state = shadowStateReported;
+            vLab2ShadowStateGetValues(&state, values);
+
+            reason = xLabReportPolicyCheck(&_reportPolicy, values, nowUs);
         }
         else
         {
-            shadowStateReported.temperature++;
-            if (shadowStateReported.temperature > 40)
+            reason = LABREPORT_NONE;
+        }
+
+        if (reason != LABREPORT_NONE)
+        {
+            fields = ulLab2ShadowReportedDirty(&_reported, values);
+
+            /* The heartbeat refreshes the whole state. */
+            if (reason == LABREPORT_HEARTBEAT)
             {
-                shadowStateReported.temperature = 40;
+                fields = LAB2_SHADOW_ALL_FIELDS;
             }
 
-            ESP_LOGI(TAG, "prvAirConTask: AirCon is OFF => Temp (%u) increases", shadowStateReported.temperature);
+            if (fields == 0)
+            {
+                /* Back to what the Shadow accepted: nothing to send. */
+                vLabReportPolicyReported(&_reportPolicy, values, nowUs);
+                ESP_LOGD(TAG, "prvAirConTask: Nothing dirty (%d), not reported", reason);
+            }
+            else if (_reportShadow(pThingName, &state, fields, _reported.sequence + 1) == EXIT_SUCCESS)
+            {
+                vLab2ShadowReportedSent(&_reported, fields, values, nowUs);
 
-            status = snprintf(pAirConStr, 11, "OFF %02u", shadowStateReported.temperature);
+                vLabReportPolicyReported(&_reportPolicy, values, nowUs);
+                ESP_LOGD(TAG, "prvAirConTask: Reported (%d), %u of %u states", reason,
+                         _reportPolicy.stats.reports, _reportPolicy.stats.checks);
+            }
+            else
+            {
+                /* Checked again at the next step. */
+                ESP_LOGE(TAG, "prvAirConTask: Failed to report the shadow.");
+            }
         }
 
-        if (status >= 0)
+        xNow = xTaskGetTickCount();
+        xTaskNotifyWait(0, UINT32_MAX, &notified,
+                        (int32_t)(xNextStep - xNow) > 0 ? xNextStep - xNow : 0);
+
+        if (notified & AIRCON_NOTIFY_STOP)
         {
-            DISPLAY_PRINT(pAirConStr, DISPLAY_WIDTH - 6 * 9, DISPLAY_HEIGHT - 13);
+            break;
         }
-        
-        /* Report Shadow. */
-        status = _reportShadow(pThingName);
-        if (status != EXIT_SUCCESS)
+    }
+
+    ESP_LOGI(TAG, "prvAirConTask: Reported %u of %u AirCon states (%u for powerOn, %u heartbeats, %u deferred, %u retries)",
+             _reportPolicy.stats.reports, _reportPolicy.stats.checks,
+             _reportPolicy.stats.immediate, _reportPolicy.stats.heartbeats,
+             _reportPolicy.stats.deferred, _reportPolicy.stats.retries);
+
+    return notified;
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvAirConTask( void * pvParameters )
+{
+    const char * pThingName = NULL;
+    uint32_t notified = 0;
+
+    (void)pvParameters;
+
+    for(;;)
+    {
+        /* Parked until a session starts: wake ups are of no use until then,
+         * what they bring stays queued for the session. */
+        while (!(notified & AIRCON_NOTIFY_START))
         {
-            ESP_LOGE(TAG, "prvAirConTask: Failed to report the shadow.");
+            xTaskNotifyWait(0, UINT32_MAX, &notified, portMAX_DELAY);
         }
 
-        vTaskDelay( pdMS_TO_TICKS( 10000 ) );
+        /* Already disconnected again otherwise. What the session left
+         * queued is dropped as it is received. */
+        pThingName = _pThingName;
+        notified = pThingName != NULL ? _runAirCon(pThingName, ulLabConnectionGetSession()) : 0;
     }
-
-    vTaskDelete( NULL );
 }
 
 /*-----------------------------------------------------------*/
@@ -494,28 +773,79 @@ void prvLab2ConnectionEventHandler(void * handler_arg, esp_event_base_t base, in
         char * thingName = ((connection_event_params_t *)event_data)->thingName;
         ESP_LOGI(TAG, "LABCONNECTION_MQTT_CONNECTED: %s (%i)", thingName, strlen(thingName));
 
-        /* Create the AirCon task */
-        xTaskCreate( prvAirConTask,			    /* The function that implements the task. */
-                    "AirCon",    				/* The text name assigned to the task - for debug only as it is not used by the kernel. */
-                    2048,		                /* The size of the stack to allocate to the task. */
-                    thingName,                  /* The parameter passed to the task. */
-                    0,				            /* The priority assigned to the task. */
-                    &xAirConTaskHandle );	    /* The task handle is used to obtain the name of the task. */
+        _pThingName = thingName;
+
+        #if defined(DEVICE_HAS_BATTERY)
+        {
+            /* Changes while disconnected were not reported. */
+            lab_battery_event_t battery;
+
+            if (bLabBatteryGetState(&battery) &&
+                _reportBattery(thingName, battery.socPercent, battery.charging, battery.millivolts) != EXIT_SUCCESS)
+            {
+                ESP_LOGE(TAG, "LABCONNECTION_MQTT_CONNECTED: Failed to report the battery");
+            }
+        }
+        #endif
+
+        /* Start the AirCon task on this session. */
+        xTaskNotify(xAirConTaskHandle, AIRCON_NOTIFY_START, eSetBits);
     }
     else if (id == LABCONNECTION_MQTT_DISCONNECTED)
     {
-        vTaskDelete( xAirConTaskHandle );
+        _pThingName = NULL;
+
+        xTaskNotify(xAirConTaskHandle, AIRCON_NOTIFY_STOP, eSetBits);
     }
 }
 
 /*-----------------------------------------------------------*/
 
+esp_err_t eLab2ReportBattery(uint32_t socPercent, bool charging, uint32_t millivolts)
+{
+    const char *pThingName = _pThingName;
+
+    /* Sent once connected otherwise. */
+    if (pThingName == NULL)
+    {
+        return ESP_OK;
+    }
+
+    return _reportBattery(pThingName, socPercent, charging, millivolts) == EXIT_SUCCESS ? ESP_OK : ESP_FAIL;
+}
+
+/*-----------------------------------------------------------*/
+
 esp_err_t eLab2Init(const char *const strID)
 {
     esp_err_t res = ESP_FAIL;
 
     ESP_LOGI(TAG, "eLab2Init: Init");
 
+    vLab2ShadowStateInit(&shadowStateReported);
+    vLab2ShadowSnapshotInit(&_snapshot, &shadowStateReported, &shadowStateDesired);
+
+    _responseQueue = xQueueCreate(SHADOW_RESPONSE_QUEUE_LENGTH, sizeof(shadowResponse_t));
+    _desiredQueue = xQueueCreate(SHADOW_DESIRED_QUEUE_LENGTH, sizeof(shadowDesiredMessage_t));
+
+    if (_responseQueue == NULL || _desiredQueue == NULL)
+    {
+        ESP_LOGE(TAG, "eLab2Init: Failed to create the queues");
+        return ESP_ERR_NO_MEM;
+    }
+
+    /* Create the AirCon task, parked until MQTT is connected. */
+    if (xTaskCreate( prvAirConTask,			    /* The function that implements the task. */
+                    "AirCon",    				/* The text name assigned to the task - for debug only as it is not used by the kernel. */
+                    2048,		                /* The size of the stack to allocate to the task. */
+                    NULL,                       /* The parameter passed to the task. */
+                    0,				            /* The priority assigned to the task. */
+                    &xAirConTaskHandle ) != pdPASS)	/* The task handle is used to obtain the name of the task. */
+    {
+        ESP_LOGE(TAG, "eLab2Init: Failed to create the AirCon task");
+        return ESP_ERR_NO_MEM;
+    }
+
     static iot_connection_params_t connectionParams;
 
     connectionParams.strID = (char *)strID;
@@ -524,6 +854,7 @@ esp_err_t eLab2Init(const char *const strID)
     connectionParams.networkDisconnectedCallback = NULL;
     connectionParams.shadowDeltaCallback = _shadowDeltaCallback;
     connectionParams.shadowUpdatedCallback = _shadowUpdatedCallback;
+    connectionParams.shadowGetCallback = _shadowGetCallback;
 
     res = eLabConnectionInit(&connectionParams);
     if (res == ESP_OK)
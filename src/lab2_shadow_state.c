@@ -0,0 +1,312 @@
+/**
+ * @file lab2_shadow_state.c
+ * @brief Lab2: state of the AirCon and its Shadow documents.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "lab2_shadow_state.h"
+
+static const char *TAG = "lab2_shadow_state";
+
+#define LAB2_SHADOW_FIELD_INITIAL(name, ctype, type, min, max, band, atOnce, initial) \
+    .name = initial,
+#define LAB2_SHADOW_FIELD_DELTA(name, ctype, type, min, max, band, atOnce, initial) \
+    [LAB2SHADOW_FIELD_##name] = LAB_JSON_FIELD(#name, LAB2_SHADOW_TYPE_##type##_JSON),
+#define LAB2_SHADOW_FIELD_POLICY(name, ctype, type, min, max, band, atOnce, initial) \
+    [LAB2SHADOW_FIELD_##name] = { .pName = #name, .deadband = band, .immediate = atOnce },
+
+static const lab2_shadow_state_t _initialState = {
+    LAB2_SHADOW_FIELDS(LAB2_SHADOW_FIELD_INITIAL)
+};
+
+static const lab_report_field_t _reportPolicyFields[LAB2SHADOW_FIELD_COUNT] = {
+    LAB2_SHADOW_FIELDS(LAB2_SHADOW_FIELD_POLICY)
+};
+
+/**
+ * @brief Keys of the state in a Shadow document.
+ */
+static const lab_json_field_t _deltaFields[LAB2SHADOW_FIELD_COUNT] = {
+    LAB2_SHADOW_FIELDS(LAB2_SHADOW_FIELD_DELTA)
+};
+
+static const lab_payload_fragment_t _keyState = LAB_PAYLOAD_KEY( "state" );
+static const lab_payload_fragment_t _keyReported = LAB_PAYLOAD_KEY( "reported" );
+static const lab_payload_fragment_t _keyClientToken = LAB_PAYLOAD_KEY( "clientToken" );
+
+/*-----------------------------------------------------------*/
+
+void vLab2ShadowStateInit(lab2_shadow_state_t *pState)
+{
+    *pState = _initialState;
+}
+
+/*-----------------------------------------------------------*/
+
+void vLab2ShadowStateGetValues(const lab2_shadow_state_t *pState, int32_t *pValues)
+{
+    #define LAB2_SHADOW_FIELD_GET(name, ctype, type, min, max, band, atOnce, initial) \
+        pValues[LAB2SHADOW_FIELD_##name] = (int32_t)pState->name;
+
+    LAB2_SHADOW_FIELDS(LAB2_SHADOW_FIELD_GET)
+
+    #undef LAB2_SHADOW_FIELD_GET
+}
+
+/*-----------------------------------------------------------*/
+
+const lab_report_field_t * pxLab2ShadowReportFields(void)
+{
+    return _reportPolicyFields;
+}
+
+/*-----------------------------------------------------------*/
+
+size_t xLab2ShadowWriteReported(const lab2_shadow_state_t *pState,
+                                uint32_t fields,
+                                uint32_t clientToken,
+                                char *pBuffer,
+                                size_t size)
+{
+    lab_payload_writer_t writer;
+    char token[LAB2_SHADOW_CLIENT_TOKEN_LENGTH + 1];
+
+    snprintf(token, sizeof(token), "%06lu", (long unsigned)(clientToken % 1000000));
+
+    vLabPayloadInit(&writer, pBuffer, size, LABPAYLOAD_JSON);
+    vLabPayloadBeginMap(&writer, 2);
+    vLabPayloadKey(&writer, &_keyState);
+    vLabPayloadBeginMap(&writer, 1);
+    vLabPayloadKey(&writer, &_keyReported);
+    vLabPayloadBeginMap(&writer, __builtin_popcount(fields & LAB2_SHADOW_ALL_FIELDS));
+
+    #define LAB2_SHADOW_FIELD_WRITE(name, ctype, type, min, max, band, atOnce, initial) \
+        if (fields & (1UL << LAB2SHADOW_FIELD_##name))                                  \
+        {                                                                               \
+            static const lab_payload_fragment_t key = LAB_PAYLOAD_KEY(#name);           \
+            vLabPayloadKey(&writer, &key);                                              \
+            LAB2_SHADOW_TYPE_##type##_WRITE(&writer, pState->name);                     \
+        }
+
+    LAB2_SHADOW_FIELDS(LAB2_SHADOW_FIELD_WRITE)
+
+    #undef LAB2_SHADOW_FIELD_WRITE
+
+    vLabPayloadEndMap(&writer);
+    vLabPayloadEndMap(&writer);
+    vLabPayloadKey(&writer, &_keyClientToken);
+    vLabPayloadString(&writer, token, LAB2_SHADOW_CLIENT_TOKEN_LENGTH);
+    vLabPayloadEndMap(&writer);
+
+    return xLabPayloadFinish(&writer);
+}
+
+/*-----------------------------------------------------------*/
+
+esp_err_t eLab2ShadowReadState(const char *pDocument,
+                               size_t documentLength,
+                               const char *pObjectKey,
+                               lab_json_value_t *pValues)
+{
+    /* All the keys in one pass over the document. */
+    return eLabJsonRead(pDocument, documentLength, pObjectKey,
+                        _deltaFields, LAB2SHADOW_FIELD_COUNT, pValues);
+}
+
+/*-----------------------------------------------------------*/
+
+uint32_t ulLab2ShadowApplyDelta(const lab_json_value_t *pDelta, lab2_shadow_state_t *pDesired)
+{
+    uint32_t changed = 0;
+
+    #define LAB2_SHADOW_FIELD_APPLY(name, ctype, type, min, max, band, atOnce, initial) \
+        if (pDelta[LAB2SHADOW_FIELD_##name].found)                                      \
+        {                                                                               \
+            int32_t value = pDelta[LAB2SHADOW_FIELD_##name].value;                      \
+                                                                                        \
+            if (value < (min) || value > (max))                                         \
+            {                                                                           \
+                ESP_LOGW(TAG, "Shadow delta: " #name " %d out of range", (int)value);   \
+            }                                                                           \
+            else if ((ctype)value != pDesired->name)                                    \
+            {                                                                           \
+                ESP_LOGI(TAG, "Shadow delta: " #name " from %d to %d",                  \
+                         (int)pDesired->name, (int)value);                              \
+                pDesired->name = (ctype)value;                                          \
+                changed |= 1UL << LAB2SHADOW_FIELD_##name;                              \
+            }                                                                           \
+        }
+
+    LAB2_SHADOW_FIELDS(LAB2_SHADOW_FIELD_APPLY)
+
+    #undef LAB2_SHADOW_FIELD_APPLY
+
+    return changed;
+}
+
+/*-----------------------------------------------------------*/
+
+void vLab2ShadowReportedReset(lab2_shadow_reported_t *pReported)
+{
+    pReported->inFlight = false;
+    pReported->accepted = 0;
+}
+
+/*-----------------------------------------------------------*/
+
+uint32_t ulLab2ShadowReportedDirty(const lab2_shadow_reported_t *pReported, const int32_t *pValues)
+{
+    uint32_t dirty = 0;
+    uint32_t i = 0;
+
+    for (i = 0; i < LAB2SHADOW_FIELD_COUNT; i++)
+    {
+        if (!(pReported->accepted & (1UL << i)) || pReported->acceptedValues[i] != pValues[i])
+        {
+            dirty |= 1UL << i;
+        }
+    }
+
+    return dirty;
+}
+
+/*-----------------------------------------------------------*/
+
+void vLab2ShadowReportedSent(lab2_shadow_reported_t *pReported,
+                             uint32_t fields,
+                             const int32_t *pValues,
+                             int64_t nowUs)
+{
+    pReported->sequence++;
+    pReported->inFlight = true;
+    pReported->sentUs = nowUs;
+    pReported->fields = fields;
+    memcpy(pReported->values, pValues, sizeof(pReported->values));
+}
+
+/*-----------------------------------------------------------*/
+
+bool bLab2ShadowReportedResponse(lab2_shadow_reported_t *pReported, uint32_t sequence, bool accepted)
+{
+    uint32_t i = 0;
+
+    /* Late responses of updates taken as lost are of no use. */
+    if (!pReported->inFlight || sequence != pReported->sequence)
+    {
+        return false;
+    }
+
+    pReported->inFlight = false;
+
+    if (!accepted)
+    {
+        return true;
+    }
+
+    for (i = 0; i < LAB2SHADOW_FIELD_COUNT; i++)
+    {
+        if (pReported->fields & (1UL << i))
+        {
+            pReported->acceptedValues[i] = pReported->values[i];
+        }
+    }
+
+    pReported->accepted |= pReported->fields;
+
+    return true;
+}
+
+/*-----------------------------------------------------------*/
+
+bool bLab2ShadowReportedExpired(lab2_shadow_reported_t *pReported, int64_t nowUs)
+{
+    if (pReported->inFlight && nowUs - pReported->sentUs > LAB2_REPORT_RESPONSE_TIMEOUT_MS * 1000LL)
+    {
+        pReported->inFlight = false;
+        return true;
+    }
+
+    return false;
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Copy a state field by field, with atomic accesses: the snapshot is
+ * read while it is written.
+ */
+static void _copyState(lab2_shadow_state_t *pTo, const lab2_shadow_state_t *pFrom, bool toSnapshot)
+{
+    #define LAB2_SHADOW_FIELD_COPY(name, ctype, type, min, max, band, atOnce, initial)     \
+        if (toSnapshot)                                                                 \
+        {                                                                               \
+            __atomic_store_n(&pTo->name, pFrom->name, __ATOMIC_RELAXED);                \
+        }                                                                               \
+        else                                                                            \
+        {                                                                               \
+            pTo->name = __atomic_load_n(&pFrom->name, __ATOMIC_RELAXED);                \
+        }
+
+    LAB2_SHADOW_FIELDS(LAB2_SHADOW_FIELD_COPY)
+
+    #undef LAB2_SHADOW_FIELD_COPY
+}
+
+/*-----------------------------------------------------------*/
+
+void vLab2ShadowSnapshotInit(lab2_shadow_snapshot_t *pSnapshot,
+                             const lab2_shadow_state_t *pReported,
+                             const lab2_shadow_state_t *pDesired)
+{
+    pSnapshot->sequence = 0;
+    pSnapshot->reported[0] = *pReported;
+    pSnapshot->reported[1] = *pReported;
+    pSnapshot->desired[0] = *pDesired;
+    pSnapshot->desired[1] = *pDesired;
+}
+
+/*-----------------------------------------------------------*/
+
+void vLab2ShadowSnapshotPublish(lab2_shadow_snapshot_t *pSnapshot,
+                                const lab2_shadow_state_t *pReported,
+                                const lab2_shadow_state_t *pDesired)
+{
+    uint32_t sequence = __atomic_load_n(&pSnapshot->sequence, __ATOMIC_RELAXED);
+    uint32_t i = 0;
+
+    for (i = 1; i <= 2; i++)
+    {
+        /* Readers move to the other copy before this one is written. */
+        __atomic_store_n(&pSnapshot->sequence, sequence + i, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+
+        _copyState(&pSnapshot->reported[(sequence + i + 1) & 1], pReported, true);
+        _copyState(&pSnapshot->desired[(sequence + i + 1) & 1], pDesired, true);
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+void vLab2ShadowSnapshotRead(const lab2_shadow_snapshot_t *pSnapshot,
+                             lab2_shadow_state_t *pReported,
+                             lab2_shadow_state_t *pDesired)
+{
+    uint32_t sequence = 0;
+
+    do
+    {
+        sequence = __atomic_load_n(&pSnapshot->sequence, __ATOMIC_ACQUIRE);
+
+        _copyState(pReported, &pSnapshot->reported[sequence & 1], false);
+        _copyState(pDesired, &pSnapshot->desired[sequence & 1], false);
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (__atomic_load_n(&pSnapshot->sequence, __ATOMIC_RELAXED) != sequence);
+}
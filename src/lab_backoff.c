@@ -0,0 +1,79 @@
+/**
+ * @file lab_backoff.c
+ * @brief Exponential backoff with decorrelated jitter for reconnections.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include <stddef.h>
+
+#include "esp_system.h"
+
+#include "lab_backoff.h"
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Uniform random number in [min, max].
+ */
+static uint32_t prvRandomBetween(uint32_t min, uint32_t max)
+{
+    if (max <= min)
+    {
+        return min;
+    }
+
+    return min + (uint32_t)(esp_random() % ((uint64_t)max - min + 1));
+}
+
+/*-----------------------------------------------------------*/
+
+void vLabBackoffInit(lab_backoff_t * backoff, uint32_t firstRetryMs, uint32_t baseMs, uint32_t capMs)
+{
+    backoff->firstRetryMs = firstRetryMs != 0 ? firstRetryMs : LAB_BACKOFF_FIRST_RETRY_MS;
+    backoff->baseMs = baseMs != 0 ? baseMs : LAB_BACKOFF_BASE_MS;
+    backoff->capMs = capMs != 0 ? capMs : LAB_BACKOFF_CAP_MS;
+
+    vLabBackoffReset(backoff);
+}
+
+/*-----------------------------------------------------------*/
+
+void vLabBackoffReset(lab_backoff_t * backoff)
+{
+    backoff->attempt = 0;
+    backoff->previousMs = 0;
+}
+
+/*-----------------------------------------------------------*/
+
+uint32_t ulLabBackoffNextDelayMs(lab_backoff_t * backoff)
+{
+    uint32_t delayMs = 0;
+
+    if (backoff->attempt == 0)
+    {
+        /* Fast, but still spread, first retry. */
+        delayMs = prvRandomBetween(0, backoff->firstRetryMs);
+    }
+    else
+    {
+        uint32_t previousMs = backoff->previousMs < backoff->baseMs ? backoff->baseMs : backoff->previousMs;
+        uint64_t upperMs = (uint64_t)previousMs * 3;
+
+        delayMs = prvRandomBetween(backoff->baseMs, upperMs > backoff->capMs ? backoff->capMs : (uint32_t)upperMs);
+    }
+
+    if (delayMs > backoff->capMs)
+    {
+        delayMs = backoff->capMs;
+    }
+
+    backoff->attempt++;
+    backoff->previousMs = delayMs;
+
+    return delayMs;
+}
+
+/*-----------------------------------------------------------*/
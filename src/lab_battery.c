@@ -0,0 +1,267 @@
+/**
+ * @file lab_battery.c
+ * @brief Battery monitor task, moving average and state of charge curve.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include <stddef.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "lab_battery.h"
+
+static const char *TAG = "lab_battery";
+
+#if LAB_BATTERY_EMA_SHIFT < 0 || LAB_BATTERY_EMA_SHIFT > 8
+    #error "LAB_BATTERY_EMA_SHIFT must be 0 to 8"
+#endif
+
+#define LAB_BATTERY_Q                   ( 4 )
+
+ESP_EVENT_DEFINE_BASE(LAB_BATTERY_EVENT_BASE);
+
+/**
+ * @brief Open circuit voltage of a LiPo cell against its state of charge,
+ * ascending. Linear in between, flat outside.
+ */
+static const struct {
+    uint16_t millivolts;
+    uint8_t percent;
+} _socCurve[] = {
+    { 3300,   0 },
+    { 3450,   5 },
+    { 3550,  10 },
+    { 3650,  20 },
+    { 3700,  30 },
+    { 3750,  40 },
+    { 3790,  50 },
+    { 3830,  60 },
+    { 3880,  70 },
+    { 3950,  80 },
+    { 4050,  90 },
+    { 4150, 100 }
+};
+
+#define LAB_BATTERY_CURVE_POINTS        ( sizeof(_socCurve) / sizeof(_socCurve[0]) )
+
+static esp_event_loop_handle_t _eventLoop = NULL;
+static esp_err_t (*_read)(uint32_t *pMillivolts, bool *pCharging) = NULL;
+static TaskHandle_t _batteryTaskHandle = NULL;
+
+/* Last reported state, packed so that it is read and written atomically:
+ * millivolts, socPercent << 16, charging << 24, and valid << 25. */
+static uint32_t _state = 0;
+
+#define LAB_BATTERY_STATE_CHARGING      ( 1UL << 24 )
+#define LAB_BATTERY_STATE_VALID         ( 1UL << 25 )
+
+/*-----------------------------------------------------------*/
+
+uint32_t ulLabBatterySocPercent(uint32_t millivolts)
+{
+    uint32_t i = 0;
+    uint32_t spanMv = 0, spanPercent = 0;
+
+    if (millivolts <= _socCurve[0].millivolts)
+    {
+        return _socCurve[0].percent;
+    }
+
+    for (i = 1; i < LAB_BATTERY_CURVE_POINTS; i++)
+    {
+        if (millivolts < _socCurve[i].millivolts)
+        {
+            spanMv = _socCurve[i].millivolts - _socCurve[i - 1].millivolts;
+            spanPercent = _socCurve[i].percent - _socCurve[i - 1].percent;
+
+            return _socCurve[i - 1].percent +
+                   ((millivolts - _socCurve[i - 1].millivolts) * spanPercent + spanMv / 2) / spanMv;
+        }
+    }
+
+    return _socCurve[LAB_BATTERY_CURVE_POINTS - 1].percent;
+}
+
+/*-----------------------------------------------------------*/
+
+void vLabBatteryMonitorInit(lab_battery_monitor_t *pMonitor)
+{
+    pMonitor->filteredMvQ4 = 0;
+    pMonitor->primed = false;
+    pMonitor->reported = false;
+    pMonitor->reportedSoc = 0;
+    pMonitor->reportedCharging = false;
+    pMonitor->reportedUs = 0;
+}
+
+/*-----------------------------------------------------------*/
+
+bool bLabBatteryMonitorUpdate(lab_battery_monitor_t *pMonitor,
+                              uint32_t millivolts,
+                              bool charging,
+                              int64_t nowUs,
+                              lab_battery_event_t *pEvent)
+{
+    int32_t sampleQ4 = (int32_t)millivolts << LAB_BATTERY_Q;
+    uint32_t filteredMv = 0, soc = 0, change = 0;
+    bool report = false;
+
+    /* The first reading seeds the average, instead of ramping up from 0. */
+    if (!pMonitor->primed)
+    {
+        pMonitor->filteredMvQ4 = sampleQ4;
+        pMonitor->primed = true;
+    }
+    else
+    {
+        pMonitor->filteredMvQ4 += (sampleQ4 - pMonitor->filteredMvQ4) / (1 << LAB_BATTERY_EMA_SHIFT);
+    }
+
+    filteredMv = (uint32_t)((pMonitor->filteredMvQ4 + (1 << (LAB_BATTERY_Q - 1))) >> LAB_BATTERY_Q);
+    soc = ulLabBatterySocPercent(filteredMv);
+
+    if (!pMonitor->reported || charging != pMonitor->reportedCharging)
+    {
+        report = true;
+    }
+    else
+    {
+        change = soc > pMonitor->reportedSoc ? soc - pMonitor->reportedSoc : pMonitor->reportedSoc - soc;
+
+        /* Empty and full are worth a report even within the deadband. */
+        report = change >= LAB_BATTERY_DEADBAND_PERCENT ||
+                 (change > 0 && (soc == 0 || soc == 100));
+
+        #if LAB_BATTERY_HEARTBEAT_MS > 0
+            report |= nowUs - pMonitor->reportedUs >= (int64_t)LAB_BATTERY_HEARTBEAT_MS * 1000;
+        #endif
+    }
+
+    if (report)
+    {
+        pEvent->millivolts = (uint16_t)filteredMv;
+        pEvent->socPercent = (uint8_t)soc;
+        pEvent->charging = charging;
+    }
+
+    return report;
+}
+
+/*-----------------------------------------------------------*/
+
+void vLabBatteryMonitorReported(lab_battery_monitor_t *pMonitor,
+                                const lab_battery_event_t *pEvent,
+                                int64_t nowUs)
+{
+    pMonitor->reported = true;
+    pMonitor->reportedSoc = pEvent->socPercent;
+    pMonitor->reportedCharging = pEvent->charging;
+    pMonitor->reportedUs = nowUs;
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvBatteryTask( void *pvParameters )
+{
+    lab_battery_monitor_t monitor;
+    lab_battery_event_t event;
+    uint32_t millivolts = 0;
+    bool charging = false;
+    int64_t nowUs = 0;
+
+    vLabBatteryMonitorInit(&monitor);
+
+    for( ;; )
+    {
+        nowUs = esp_timer_get_time();
+
+        if (_read(&millivolts, &charging) != ESP_OK)
+        {
+            ESP_LOGW(TAG, "prvBatteryTask: Failed to read the battery");
+        }
+        else if (bLabBatteryMonitorUpdate(&monitor, millivolts, charging, nowUs, &event))
+        {
+            ESP_LOGD(TAG, "prvBatteryTask: %u mV, %u%%%s", event.millivolts, event.socPercent,
+                     event.charging ? ", charging" : "");
+
+            __atomic_store_n(&_state,
+                             event.millivolts | ((uint32_t)event.socPercent << 16) |
+                             (event.charging ? LAB_BATTERY_STATE_CHARGING : 0) | LAB_BATTERY_STATE_VALID,
+                             __ATOMIC_RELAXED);
+
+            if (esp_event_post_to(_eventLoop, LAB_BATTERY_EVENT_BASE, LABBATTERY_EVENT_STATE,
+                                  &event, sizeof(event), 0) != ESP_OK)
+            {
+                /* Not recorded: reported again at the next reading. */
+                ESP_LOGW(TAG, "prvBatteryTask: Battery event dropped");
+            }
+            else
+            {
+                vLabBatteryMonitorReported(&monitor, &event, nowUs);
+            }
+        }
+
+        vTaskDelay( pdMS_TO_TICKS( LAB_BATTERY_SAMPLE_MS ) );
+    }
+
+    vTaskDelete( NULL );
+}
+
+/*-----------------------------------------------------------*/
+
+bool bLabBatteryGetState(lab_battery_event_t *pState)
+{
+    uint32_t state = __atomic_load_n(&_state, __ATOMIC_RELAXED);
+
+    if ((state & LAB_BATTERY_STATE_VALID) == 0)
+    {
+        return false;
+    }
+
+    pState->millivolts = (uint16_t)state;
+    pState->socPercent = (uint8_t)(state >> 16);
+    pState->charging = (state & LAB_BATTERY_STATE_CHARGING) != 0;
+
+    return true;
+}
+
+/*-----------------------------------------------------------*/
+
+esp_err_t eLabBatteryInit(esp_event_loop_handle_t eventLoop,
+                          esp_err_t (*read)(uint32_t *pMillivolts, bool *pCharging))
+{
+    if (_batteryTaskHandle != NULL)
+    {
+        return ESP_OK;
+    }
+
+    if (eventLoop == NULL || read == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    _eventLoop = eventLoop;
+    _read = read;
+
+    if (xTaskCreate( prvBatteryTask,
+                     "BatteryTask",
+                     LAB_BATTERY_TASK_STACK_SIZE,
+                     NULL,
+                     LAB_BATTERY_TASK_PRIORITY,
+                     &_batteryTaskHandle ) != pdPASS)
+    {
+        ESP_LOGE(TAG, "eLabBatteryInit: Failed to create the battery task");
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG, "eLabBatteryInit: Every %u ms, deadband %u%% ... OK",
+             LAB_BATTERY_SAMPLE_MS, LAB_BATTERY_DEADBAND_PERCENT);
+
+    return ESP_OK;
+}
@@ -22,6 +22,10 @@
 #include "platform/iot_clock.h"
 #include "platform/iot_threads.h"
 
+/* FreeRTOS includes. */
+#include "FreeRTOS.h"
+#include "timers.h"
+
 /* MQTT include. */
 #include "iot_mqtt.h"
 
@@ -34,6 +38,7 @@
 #include "aws_demo.h"
 #include "types/iot_network_types.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 
 #include "iot_wifi.h"
 #include "iot_ble_config.h"
@@ -43,6 +48,16 @@
 #include "device.h"
 #include "lab_config.h"
 #include "lab_connection.h"
+#include "lab_offline_queue.h"
+#include "lab_reconnect.h"
+#include "lab_metrics.h"
+#include "lab_shadow_version.h"
+#include "lab_event_queue.h"
+#include "lab_topics.h"
+
+#if defined(LABCONFIG_TLS_SESSION_RESUMPTION)
+    #include "lab_network_tls.h"
+#endif
 
 /*-----------------------------------------------------------*/
 
@@ -50,8 +65,6 @@ static const char *TAG = "lab_connection";
 
 /*-----------------------------------------------------------*/
 
-#define IOT_MQTT_TOPIC_PREFIX "mydevice"
-
 /**
  * @brief The timeout for MQTT operations.
  */
@@ -80,20 +93,15 @@ static const char *TAG = "lab_connection";
 #define KEEP_ALIVE_SECONDS (60)
 
 /**
- * @brief The Last Will and Testament topic name.
- *
- * The MQTT server will publish a message to this topic name if this client is
- * unexpectedly disconnected.
- */
-#define LWT_TOPIC_NAME_FORMAT IOT_MQTT_TOPIC_PREFIX "/%s/lwt"
-
-/**
- * @brief The length of #LWT_TOPIC_NAME.
+ * @brief Retry settings of coalesced publishes, as in lab1.
  */
-#define LWT_TOPIC_NAME_MAX_LENGTH ((uint16_t)(sizeof(LWT_TOPIC_NAME_FORMAT) - 1 + 12))
+#define LAB_CONNECTION_BATCH_RETRY_MS (1000)
+#define LAB_CONNECTION_BATCH_RETRY_LIMIT (10)
 
 /**
- * @brief The message to publish to #LWT_TOPIC_NAME.
+ * @brief The message to publish to the Last Will and Testament topic.
+ *
+ * The MQTT server will publish it if this client is unexpectedly disconnected.
  */
 #define LWT_MESSAGE "{\"message\": \"disconnected\"}"
 
@@ -104,6 +112,14 @@ static const char *TAG = "lab_connection";
 
 /*-----------------------------------------------------------*/
 
+/* Encoding of the messages of each topic, in the order of lab_connection_topic_t. */
+static const lab_payload_encoding_t _topicEncodings[LABCONNECTION_TOPIC_MAX] = {
+    LAB_CONNECTION_TOPIC_DEVICE_ENCODING,
+    LABPAYLOAD_JSON,
+    LABPAYLOAD_JSON,
+    LAB_CONNECTION_TOPIC_DEVICE_ENCODING
+};
+
 /* Semaphore for connection readiness */
 static IotSemaphore_t connectionReadySem;
 
@@ -113,17 +129,132 @@ static IotSemaphore_t cleanUpReadySem;
 /* Semaphore for shadow delta management */ 
 // static IotSemaphore_t shadowDeltaSem;
 
+/* Semaphore signaling the offline queue drain task that MQTT is connected */
+static IotSemaphore_t offlineDrainSem;
+
+/* Publish buffer pool and batched publishes, created by eLabConnectionInit. */
+static IotMutex_t _poolMutex;
+static bool _poolReady = false;
+static IotMutex_t _batchMutex;
+static bool _batchReady = false;
+
+/* Posted by the batch window timers: the timer service task must not wait on
+ * the network or the flash, the flush task does. */
+static IotSemaphore_t _batchFlushSem;
+static void prvBatchFlushTask( void * pArgument );
+
 /* Handle of the MQTT connection used in this demo. */
 static IotMqttConnection_t _mqttConnection = IOT_MQTT_CONNECTION_INITIALIZER;
 
 static iot_connection_params_t *_pConnectionParams = NULL;
 
-static bool mqttConnectionEstablished = false;
+/* State of the connection manager. Only lab_run and the MQTT disconnect
+ * callback change it. */
+static volatile lab_connection_state_t _connectionState = LABCONNECTION_STATE_IDLE;
+
+/* Delays between connection attempts and the counters around them, used
+ * from lab_run only. */
+static lab_reconnect_t _reconnect;
+
+/* Shadow callbacks are armed on every new MQTT session. Keep them around. */
+static AwsIotShadowCallbackInfo_t _deltaCallback = AWS_IOT_SHADOW_CALLBACK_INFO_INITIALIZER;
+static AwsIotShadowCallbackInfo_t _updatedCallback = AWS_IOT_SHADOW_CALLBACK_INFO_INITIALIZER;
+
+/* Shadow version known in this session, 0 for none. Written from the MQTT
+ * callbacks and at the start of a session, read from any task. */
+static uint32_t _shadowVersion = 0;
+
+/* Number of the MQTT session, counted from 1. Moved on before the session
+ * arms its callbacks, read from any task. */
+static uint32_t _session = 0;
 
 ESP_EVENT_DEFINE_BASE(LAB_CONNECTION_EVENT_BASE);
 esp_event_loop_handle_t lab_connection_event_loop;
 
 char prvThingName[128] = { 0 }; 
+/*-----------------------------------------------------------*/
+
+/* The event data fits a queued event. */
+_Static_assert( sizeof( connection_event_params_t ) <= LAB_CONNECTION_EVENT_DATA_MAX_SIZE,
+                "connection_event_params_t does not fit LAB_CONNECTION_EVENT_DATA_MAX_SIZE" );
+_Static_assert( sizeof( lab_connection_stats_t ) <= LAB_CONNECTION_EVENT_DATA_MAX_SIZE,
+                "lab_connection_stats_t does not fit LAB_CONNECTION_EVENT_DATA_MAX_SIZE" );
+
+/* Wakes the dispatcher task up once events are queued. */
+static IotSemaphore_t _eventSem;
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Hand an event over to the dispatcher task. Never blocks on the event
+ * handlers, so the MQTT and network callback threads are never held up.
+ */
+static void _postEvent(int32_t id, const void * data, size_t size)
+{
+    int32_t state = LAB_EVENT_QUEUE_NO_STATE;
+
+    /* Handlers see the latest network and MQTT states. */
+    if (id == LABCONNECTION_NETWORK_CONNECTED || id == LABCONNECTION_NETWORK_DISCONNECTED)
+    {
+        state = 0;
+    }
+    else if (id == LABCONNECTION_MQTT_CONNECTED || id == LABCONNECTION_MQTT_DISCONNECTED)
+    {
+        state = 1;
+    }
+
+    if (eLabEventQueuePost(id, state, data, size) == ESP_ERR_INVALID_SIZE)
+    {
+        ESP_LOGE(TAG, "_postEvent: Event %i dropped, %u bytes of data", id, (unsigned)size);
+        return;
+    }
+
+    IotSemaphore_Post(&_eventSem);
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Feed the event loop. Only this task waits on slow handlers.
+ */
+static void prvEventDispatchTask( void * pArgument )
+{
+    static lab_event_queue_event_t event;
+    lab_connection_event_stats_t stats;
+    uint32_t reportedDrops = 0;
+    uint32_t dropped = 0;
+
+    for(;;)
+    {
+        IotSemaphore_Wait(&_eventSem);
+
+        while (bLabEventQueueTake(&event))
+        {
+            esp_event_post_to(lab_connection_event_loop,
+                              LAB_CONNECTION_EVENT_BASE,
+                              event.id,
+                              event.size > 0 ? event.data : NULL,
+                              event.size,
+                              portMAX_DELAY);
+        }
+
+        vLabEventQueueGetStats(&stats);
+        dropped = stats.dropped + stats.oversize;
+
+        if (dropped != reportedDrops)
+        {
+            ESP_LOGW(TAG, "prvEventDispatchTask: %u events dropped since boot", dropped);
+            reportedDrops = dropped;
+
+            esp_event_post_to(lab_connection_event_loop,
+                              LAB_CONNECTION_EVENT_BASE,
+                              LABCONNECTION_EVENTS_DROPPED,
+                              &dropped,
+                              sizeof(uint32_t),
+                              portMAX_DELAY);
+        }
+    }
+}
 
 /*-----------------------------------------------------------*/
 
@@ -133,30 +264,36 @@ void vNetworkConnectedCallback( bool awsIotMqttMode,
                                 void * pNetworkCredentialInfo,
                                 const IotNetworkInterface_t * pNetworkInterface )
 {
-    esp_event_post_to(lab_connection_event_loop, 
-                    LAB_CONNECTION_EVENT_BASE, 
-                    LABCONNECTION_NETWORK_CONNECTED, 
-                    (void *)pIdentifier, 
-                    pIdentifier == NULL ? 0 : strlen(pIdentifier), 
-                    portMAX_DELAY);    
+    size_t size = pIdentifier == NULL ? 0 : strlen(pIdentifier) + 1;
+
+    /* The network state matters more than the identifier. */
+    if (size > LAB_CONNECTION_EVENT_DATA_MAX_SIZE)
+    {
+        size = 0;
+    }
+
+    _postEvent(LABCONNECTION_NETWORK_CONNECTED,
+               size > 0 ? pIdentifier : NULL,
+               size);
 }
 
 void vNetworkDisconnectedCallback( const IotNetworkInterface_t * pNetworkInterface )
 {
-    esp_event_post_to(lab_connection_event_loop, 
-                    LAB_CONNECTION_EVENT_BASE, 
-                    LABCONNECTION_NETWORK_DISCONNECTED, 
-                    NULL, 0, 
-                    portMAX_DELAY);    
+    _postEvent(LABCONNECTION_NETWORK_DISCONNECTED, NULL, 0);
 }
 
 void vMQTTDisconnectedCallback( void * pCallbackContext, IotMqttCallbackParam_t * pIotMqttCallbackParam )
 {
-    esp_event_post_to(lab_connection_event_loop, 
-                    LAB_CONNECTION_EVENT_BASE, 
-                    LABCONNECTION_MQTT_DISCONNECTED, 
-                    NULL, 0, 
-                    portMAX_DELAY);    
+    /* lab_run tears the session down itself, nothing to signal then. */
+    if (pIotMqttCallbackParam->u.disconnectReason == IOT_MQTT_DISCONNECT_CALLED)
+    {
+        return;
+    }
+
+    /* Publishes made from now on go to the offline queue. */
+    _connectionState = LABCONNECTION_STATE_DISCONNECTED;
+
+    _postEvent(LABCONNECTION_MQTT_DISCONNECTED, NULL, 0);
 }
 
 void prvLabConnectionEventHandler(void * handler_arg, esp_event_base_t base, int32_t id, void * event_data)
@@ -175,12 +312,28 @@ void prvLabConnectionEventHandler(void * handler_arg, esp_event_base_t base, int
     {
         char * thingName = ((connection_event_params_t *)event_data)->thingName;
         ESP_LOGI(TAG, "LABCONNECTION_MQTT_CONNECTED: %s (%i)", thingName, strlen(thingName));
+
+        /* Flush what was published while offline. */
+        if (ulLabOfflineQueueDepth() > 0)
+        {
+            IotSemaphore_Post(&offlineDrainSem);
+        }
     }
     else if (id == LABCONNECTION_MQTT_DISCONNECTED)
     {
         ESP_LOGI(TAG, "LABCONNECTION_MQTT_DISCONNECTED");
         vLabConnectionCleanup();
     }
+    else if (id == LABCONNECTION_RECONNECT_SCHEDULED)
+    {
+        lab_connection_stats_t * stats = (lab_connection_stats_t *)event_data;
+        ESP_LOGI(TAG, "LABCONNECTION_RECONNECT_SCHEDULED: in %u ms, %u attempts, %u failures (%u in a row)",
+                 stats->lastBackoffMs, stats->attempts, stats->failures, stats->consecutiveFailures);
+    }
+    else if (id == LABCONNECTION_EVENTS_DROPPED)
+    {
+        ESP_LOGW(TAG, "LABCONNECTION_EVENTS_DROPPED: %u", *(uint32_t *)event_data);
+    }
 }
 
 /*-----------------------------------------------------------*/
@@ -241,12 +394,106 @@ static int _initializeLibraries(void)
 /*-----------------------------------------------------------*/
 
 /**
- * @brief Clean up the the MQTT library and the Shadow library.
+ * @brief Check a Shadow document against the version known in this session,
+ * see bLabShadowVersionCheck.
+ */
+static bool _checkShadowVersion(const char *pDocument, size_t documentLength, const char *pObjectKey)
+{
+    return bLabShadowVersionCheck(&_shadowVersion, pDocument, documentLength, pObjectKey);
+}
+
+/*-----------------------------------------------------------*/
+
+static void _shadowDelta(void *pCallbackContext, AwsIotShadowCallbackParam_t *pCallbackParam)
+{
+    if (_checkShadowVersion(pCallbackParam->u.callback.pDocument,
+                            pCallbackParam->u.callback.documentLength,
+                            NULL))
+    {
+        _pConnectionParams->shadowDeltaCallback(pCallbackContext, pCallbackParam);
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void _shadowUpdated(void *pCallbackContext, AwsIotShadowCallbackParam_t *pCallbackParam)
+{
+    if (_checkShadowVersion(pCallbackParam->u.callback.pDocument,
+                            pCallbackParam->u.callback.documentLength,
+                            "current"))
+    {
+        _pConnectionParams->shadowUpdatedCallback(pCallbackContext, pCallbackParam);
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void _shadowGetComplete(void *pCallbackContext, AwsIotShadowCallbackParam_t *pCallbackParam)
+{
+    bool success = pCallbackParam->u.operation.result == AWS_IOT_SHADOW_SUCCESS;
+
+    if (success && !_checkShadowVersion(pCallbackParam->u.operation.get.pDocument,
+                                        pCallbackParam->u.operation.get.documentLength,
+                                        NULL))
+    {
+        return;
+    }
+
+    if (!success)
+    {
+        /* Rejected when the Thing has no Shadow yet. */
+        ESP_LOGW(TAG, "Failed to read the Shadow, error %s.",
+                 AwsIotShadow_strerror(pCallbackParam->u.operation.result));
+    }
+
+    if (_pConnectionParams->shadowGetCallback != NULL)
+    {
+        _pConnectionParams->shadowGetCallback(pCallbackContext, pCallbackParam);
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Read the Shadow at the start of a session, so that its state is
+ * known within a round trip instead of at the next delta.
+ *
+ * @return `EXIT_SUCCESS` if the read was sent; `EXIT_FAILURE` otherwise.
  */
-static void _cleanup(void)
+static int _getShadow(const char *pThingName)
+{
+    AwsIotShadowDocumentInfo_t getDocument = AWS_IOT_SHADOW_DOCUMENT_INFO_INITIALIZER;
+    AwsIotShadowCallbackInfo_t getCallback = AWS_IOT_SHADOW_CALLBACK_INFO_INITIALIZER;
+    AwsIotShadowError_t getStatus = AWS_IOT_SHADOW_STATUS_PENDING;
+
+    getDocument.pThingName = pThingName;
+    getDocument.thingNameLength = strlen(pThingName);
+
+    getCallback.function = _shadowGetComplete;
+
+    getStatus = AwsIotShadow_Get(_mqttConnection, &getDocument, 0, &getCallback, NULL);
+
+    if (getStatus != AWS_IOT_SHADOW_STATUS_PENDING)
+    {
+        IotLogError("Failed to read the Shadow, error %s.", AwsIotShadow_strerror(getStatus));
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/*-----------------------------------------------------------*/
+
+uint32_t ulLabConnectionGetShadowVersion(void)
+{
+    return __atomic_load_n(&_shadowVersion, __ATOMIC_RELAXED);
+}
+
+/*-----------------------------------------------------------*/
+
+uint32_t ulLabConnectionGetSession(void)
 {
-    AwsIotShadow_Cleanup();
-    IotMqtt_Cleanup();
+    return __atomic_load_n(&_session, __ATOMIC_RELAXED);
 }
 
 /*-----------------------------------------------------------*/
@@ -263,13 +510,11 @@ static int _setShadowCallbacks(const char *pThingName)
 {
     int status = EXIT_SUCCESS;
     AwsIotShadowError_t callbackStatus = AWS_IOT_SHADOW_STATUS_PENDING;
-    AwsIotShadowCallbackInfo_t deltaCallback = AWS_IOT_SHADOW_CALLBACK_INFO_INITIALIZER;
-    AwsIotShadowCallbackInfo_t updatedCallback = AWS_IOT_SHADOW_CALLBACK_INFO_INITIALIZER;
 
     /* Set the functions for callbacks. */
-    // deltaCallback.pCallbackContext = &shadowDeltaSem;
-    deltaCallback.function = _pConnectionParams->shadowDeltaCallback;
-    updatedCallback.function = _pConnectionParams->shadowUpdatedCallback;
+    // _deltaCallback.pCallbackContext = &shadowDeltaSem;
+    _deltaCallback.function = _shadowDelta;
+    _updatedCallback.function = _shadowUpdated;
 
     if (_pConnectionParams->shadowDeltaCallback != NULL)
     {
@@ -279,7 +524,7 @@ static int _setShadowCallbacks(const char *pThingName)
                                                     pThingName,
                                                     strlen(pThingName),
                                                     0,
-                                                    &deltaCallback);
+                                                    &_deltaCallback);
 
         if (callbackStatus != AWS_IOT_SHADOW_SUCCESS)
         {
@@ -302,7 +547,7 @@ static int _setShadowCallbacks(const char *pThingName)
                                                          pThingName,
                                                          strlen(pThingName),
                                                          0,
-                                                         &updatedCallback);
+                                                         &_updatedCallback);
         if (callbackStatus != AWS_IOT_SHADOW_SUCCESS)
         {
             IotLogError("Failed to set shadow callback, error %s.",
@@ -320,6 +565,31 @@ static int _setShadowCallbacks(const char *pThingName)
 
 /*-----------------------------------------------------------*/
 
+/**
+ * @brief Forget the Shadow callbacks of an MQTT session that is going away.
+ *
+ * The Shadow library only subscribes to the delta and updated topics when a
+ * callback is first set, so the callbacks must be cleared for them to be
+ * subscribed again on the next session. The session is usually already lost at
+ * this point, so failing to unsubscribe is expected and ignored.
+ *
+ * @param[in] pThingName The Thing Name for Shadows in this demo.
+ */
+static void _clearShadowCallbacks(const char *pThingName)
+{
+    if (_pConnectionParams->shadowDeltaCallback != NULL)
+    {
+        AwsIotShadow_SetDeltaCallback(_mqttConnection, pThingName, strlen(pThingName), 0, NULL);
+    }
+
+    if (_pConnectionParams->shadowUpdatedCallback != NULL)
+    {
+        AwsIotShadow_SetUpdatedCallback(_mqttConnection, pThingName, strlen(pThingName), 0, NULL);
+    }
+}
+
+/*-----------------------------------------------------------*/
+
 /**
  * @brief Establish a new connection to the MQTT server.
  *
@@ -349,7 +619,6 @@ static int _establishMqttConnection(const char *pIdentifier,
         .function = vMQTTDisconnectedCallback
     };
     char pClientIdentifierBuffer[CLIENT_IDENTIFIER_MAX_LENGTH] = {0};
-    char pLwtBuffer[LWT_TOPIC_NAME_MAX_LENGTH] = {0};
 
     /* Set the members of the network info not set by the initializer. This
      * struct provided information on the transport layer to the MQTT connection. */
@@ -357,6 +626,12 @@ static int _establishMqttConnection(const char *pIdentifier,
     networkInfo.u.setup.pNetworkServerInfo = pNetworkServerInfo;
     networkInfo.u.setup.pNetworkCredentialInfo = pNetworkCredentialInfo;
     networkInfo.pNetworkInterface = pNetworkInterface;
+
+    #if defined(LABCONFIG_TLS_SESSION_RESUMPTION)
+        /* Same server info and credentials, but a transport that resumes the
+         * previous TLS session instead of running a full handshake. */
+        networkInfo.pNetworkInterface = &lab_network_tls_interface;
+    #endif
     networkInfo.disconnectCallback = disconnectInfo;
 
     #if (IOT_MQTT_ENABLE_SERIALIZER_OVERRIDES == 1) && defined(IOT_DEMO_MQTT_SERIALIZER)
@@ -369,29 +644,16 @@ static int _establishMqttConnection(const char *pIdentifier,
     connectInfo.keepAliveSeconds = KEEP_ALIVE_SECONDS;
     connectInfo.pWillInfo = &lwtInfo;
 
-    status = snprintf(pLwtBuffer,
-                        LWT_TOPIC_NAME_MAX_LENGTH,
-                        LWT_TOPIC_NAME_FORMAT,
-                        _pConnectionParams->strID);
-
-    /* Check for errors from snprintf. */
-    if (status < 0)
+    /* Set the members of the Last Will and Testament (LWT) message info. The
+     * MQTT server will publish the LWT message if this client disconnects
+     * unexpectedly. */
+    if (eLabConnectionSetTopic(&lwtInfo, LABCONNECTION_TOPIC_LWT) != ESP_OK)
     {
-        ESP_LOGE(TAG, "Failed to generate the LWT topic name.");
+        ESP_LOGE(TAG, "The LWT topic name is not available.");
         return EXIT_FAILURE;
     }
-    else
-    {
-        status = EXIT_SUCCESS;
-
-        /* Set the members of the Last Will and Testament (LWT) message info. The
-         * MQTT server will publish the LWT message if this client disconnects
-         * unexpectedly. */
-        lwtInfo.pTopicName = pLwtBuffer;
-        lwtInfo.topicNameLength = strlen(pLwtBuffer);
-        lwtInfo.pPayload = LWT_MESSAGE;
-        lwtInfo.payloadLength = LWT_MESSAGE_LENGTH;
-    }
+    lwtInfo.pPayload = LWT_MESSAGE;
+    lwtInfo.payloadLength = LWT_MESSAGE_LENGTH;
 
     if (_pConnectionParams->useShadow == true && pIdentifier == NULL)
     {
@@ -523,7 +785,13 @@ void vLabConnectionResetWifiNetworks( void )
 /*-----------------------------------------------------------*/
 
 /**
- * @brief The function that runs the MQTT demo, called by the demo runner.
+ * @brief The connection manager, called by the demo runner once the network is up.
+ *
+ * The MQTT and Shadow libraries are initialized on the first call only. After
+ * that, this function loops forever: it establishes the transport and MQTT
+ * session, re-arms the Shadow callbacks, waits for the session to be lost and
+ * immediately starts over. Only a failed connection attempt is followed by a
+ * delay.
  *
  * @param[in] awsIotMqttMode Specify if this demo is running with the AWS IoT
  * MQTT server. Set this to `false` if using another MQTT server.
@@ -534,7 +802,8 @@ void vLabConnectionResetWifiNetworks( void )
  * establishing the MQTT connection.
  * @param[in] pNetworkInterface The network interface to use for this demo.
  *
- * @return `EXIT_SUCCESS` if the demo completes successfully; `EXIT_FAILURE` otherwise.
+ * @return `EXIT_FAILURE` if the libraries could not be initialized. Does not
+ * return otherwise.
  */
 
 int lab_run(bool awsIotMqttMode,
@@ -544,77 +813,100 @@ int lab_run(bool awsIotMqttMode,
             const IotNetworkInterface_t *pNetworkInterface)
 {
     static connection_event_params_t connectionEventParams;
+    static bool librariesInitialized = false;
 
-    for(;;)
-    {        
-        /* Return value of this function and the exit status of this program. */
-        int status = EXIT_SUCCESS;
-
-        /* Flags for tracking which cleanup functions must be called. */
-        bool librariesInitialized = false;
-        
-        mqttConnectionEstablished = false;
+    /* The first parameter of this demo function is not used. Shadows are specific
+    * to AWS IoT, so this value is hardcoded to true whenever needed. */
+    (void)awsIotMqttMode;
 
-        /* The first parameter of this demo function is not used. Shadows are specific
-        * to AWS IoT, so this value is hardcoded to true whenever needed. */
-        (void)awsIotMqttMode;
+    ESP_LOGI(TAG, "lab_run: Start");
 
+    /* Initialize the libraries required for this demo, once. */
+    if (librariesInitialized == false)
+    {
         _getSavedWifiNetworks();
 
-        ESP_LOGI(TAG, "lab_run: Start");
+        if (_initializeLibraries() != EXIT_SUCCESS)
+        {
+            ESP_LOGE(TAG, "lab_run: Failed to initialize the libraries");
+            return EXIT_FAILURE;
+        }
 
-        /* Initialize the libraries required for this demo. */
-        status = _initializeLibraries();
+        librariesInitialized = true;
+        ESP_LOGI(TAG, "lab_run: Libraries initialized");
+    }
 
-        if (status == EXIT_SUCCESS)
-        {
-            /* Mark the libraries as initialized. */
-            librariesInitialized = true;
+    for(;;)
+    {
+        int status = EXIT_SUCCESS;
 
-            ESP_LOGI(TAG, "lab_run: Libraries initialized");
+        /* Flag for tracking whether the MQTT session must be torn down. */
+        bool sessionEstablished = false;
 
-            /* Establish a new MQTT connection. */
-            status = _establishMqttConnection(pIdentifier,
-                                            pNetworkServerInfo,
-                                            pNetworkCredentialInfo,
-                                            pNetworkInterface);
-        }
-        else
-        {
-            ESP_LOGE(TAG, "lab_run: Failed to initialize the libraries: %i", status);
-            return status;
-        }
+        uint64_t attemptStartMs = IotClock_GetTimeMs();
+        uint32_t delayMs = 0;
+
+        _connectionState = LABCONNECTION_STATE_CONNECTING;
+        vLabReconnectAttempt(&_reconnect, attemptStartMs);
+
+        /* Establish a new MQTT connection, transport included. */
+        status = _establishMqttConnection(pIdentifier,
+                                          pNetworkServerInfo,
+                                          pNetworkCredentialInfo,
+                                          pNetworkInterface);
 
         if (status == EXIT_SUCCESS)
         {
-            /* Mark the MQTT connection as established. */
-            mqttConnectionEstablished = true;
+            sessionEstablished = true;
+            vLabReconnectEstablished(&_reconnect, IotClock_GetTimeMs());
+            vLabMetricsRecord(LABMETRICS_OP_CONNECT, (uint32_t)attemptStartMs, true);
 
             ESP_LOGI(TAG, "lab_run: MQTT Connection established");
 
-            /* Set the Shadow callbacks for this demo. */
+            /* Versions start over with the session: the Shadow may have
+             * been deleted and created again. */
+            __atomic_store_n(&_shadowVersion, 0, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&_session, 1, __ATOMIC_RELAXED);
+
+            /* Re-arm the Shadow callbacks on this session. */
             status = _setShadowCallbacks(prvThingName);
+
+            /* Then read the Shadow, whose deltas may have been missed. The
+             * session is of use without it: the deltas still come. */
+            if (status == EXIT_SUCCESS && _pConnectionParams->useShadow)
+            {
+                (void)_getShadow(prvThingName);
+            }
         }
         else
         {
             ESP_LOGE(TAG, "lab_run: Failed to initialize the MQTT Connection: %i", status);
+            vLabMetricsRecord(LABMETRICS_OP_CONNECT, (uint32_t)attemptStartMs, false);
         }
 
         if (status == EXIT_SUCCESS)
         {
+            /* Discard a clean up signal left over from a previous session. */
+            while (IotSemaphore_TryWait(&cleanUpReadySem) == true)
+            {
+            }
 
-            connectionEventParams.thingName = prvThingName;
+            _connectionState = LABCONNECTION_STATE_CONNECTED;
 
-            if (ESP_OK != esp_event_post_to(lab_connection_event_loop, 
-                                        LAB_CONNECTION_EVENT_BASE, 
-                                        LABCONNECTION_MQTT_CONNECTED, 
-                                        &connectionEventParams,
-                                        sizeof(connection_event_params_t),
-                                        portMAX_DELAY))
+            /* The next session loss starts over with a fast first retry. */
+            vLabReconnectConnected(&_reconnect, IotClock_GetTimeMs());
+            if (_reconnect.disconnectedAtMs != 0)
             {
-                ESP_LOGE(TAG, "lab_run: failed to post to event");
+                ESP_LOGI(TAG, "lab_run: Reconnected in %u ms", _reconnect.stats.lastReconnectMs);
             }
 
+            connectionEventParams.thingName = prvThingName;
+            connectionEventParams.stats = _reconnect.stats;
+
+            _postEvent(LABCONNECTION_MQTT_CONNECTED,
+                       &connectionEventParams,
+                       sizeof(connection_event_params_t));
+
             // Connection is ready
             IotSemaphore_Post(&connectionReadySem);
             // Shadow can be used
@@ -625,36 +917,181 @@ int lab_run(bool awsIotMqttMode,
             IotSemaphore_Wait(&cleanUpReadySem);
 
             ESP_LOGI(TAG, "lab_run: Received connection clean up signal.");
-            
-            // Cleanup connection cleanup semaphore
-            IotSemaphore_Destroy(&cleanUpReadySem);
-            // Cleanup shadow delta semaphore
-            // IotSemaphore_Destroy(&shadowDeltaSem);        
+
+            vLabReconnectLost(&_reconnect, IotClock_GetTimeMs());
         }
 
-        /* Disconnect the MQTT connection if it was established. */
-        if (mqttConnectionEstablished == true)
+        _connectionState = LABCONNECTION_STATE_DISCONNECTED;
+
+        /* Tear down the MQTT session only. The libraries stay initialized. */
+        if (sessionEstablished == true)
         {
+            _clearShadowCallbacks(prvThingName);
             IotMqtt_Disconnect(_mqttConnection, 0);
-            mqttConnectionEstablished = false;
+            _mqttConnection = IOT_MQTT_CONNECTION_INITIALIZER;
         }
 
-        /* Clean up libraries if they were initialized. */
-        if (librariesInitialized == true)
+        if (status != EXIT_SUCCESS)
         {
-            ESP_LOGI(TAG, "lab_run: Cleaning up");
-            _cleanup();
+            vLabReconnectFailed(&_reconnect);
         }
 
-        ESP_LOGI(TAG, "lab_run: End, looping in 10secs");
-        vTaskDelay( pdMS_TO_TICKS( 10000 ) );
+        /* Wait before the next attempt, whether this one failed or the session
+         * was lost. The delay grows with consecutive failures. */
+        delayMs = ulLabReconnectNextDelayMs(&_reconnect);
 
-        return status;
+        ESP_LOGI(TAG, "lab_run: Reconnecting in %u ms (attempt %u)", delayMs, _reconnect.backoff.attempt);
+
+        _postEvent(LABCONNECTION_RECONNECT_SCHEDULED,
+                   &_reconnect.stats,
+                   sizeof(lab_connection_stats_t));
+
+        vTaskDelay( pdMS_TO_TICKS( delayMs ) );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Sends the publishes queued while offline, oldest first.
+ *
+ * Publishes are sent in batches of LAB_OFFLINE_QUEUE_DRAIN_BATCH, waiting
+ * LAB_OFFLINE_QUEUE_DRAIN_PACE_MS between batches so that a long backlog does
+ * not starve live traffic. An entry is only removed from the queue once it has
+ * been sent (and acknowledged for QoS1), so a disconnect while draining loses
+ * nothing: the drain resumes on the next LABCONNECTION_MQTT_CONNECTED.
+ */
+static void prvOfflineDrainTask( void * pArgument )
+{
+    static lab_offline_queue_entry_t entry;
+    IotMqttPublishInfo_t publishInfo = IOT_MQTT_PUBLISH_INFO_INITIALIZER;
+    IotMqttError_t publishStatus = IOT_MQTT_SUCCESS;
+    esp_err_t peekStatus = ESP_OK;
+    lab_offline_queue_stats_t stats;
+    uint32_t publishStart = 0;
+    uint32_t sequence = 0;
+
+    for(;;)
+    {
+        IotSemaphore_Wait(&offlineDrainSem);
+
+        ESP_LOGI(TAG, "prvOfflineDrainTask: Draining %u queued publishes", ulLabOfflineQueueDepth());
+
+        while (bIsLabConnectionMqttConnected() && ulLabOfflineQueueDepth() > 0)
+        {
+            uint32_t sent = 0;
+
+            for (sent = 0; sent < LAB_OFFLINE_QUEUE_DRAIN_BATCH; sent++)
+            {
+                peekStatus = eLabOfflineQueuePeek(&entry, &sequence);
+
+                /* Otherwise every drain would stop at the same entry. */
+                if (peekStatus == ESP_ERR_INVALID_STATE)
+                {
+                    eLabOfflineQueuePop(sequence);
+                    continue;
+                }
+
+                if (peekStatus != ESP_OK)
+                {
+                    break;
+                }
+
+                vLabOfflineQueueEntryToPublishInfo(&entry, &publishInfo);
+                publishInfo.retryMs = 0;
+                publishInfo.retryLimit = 0;
+
+                publishStart = ulLabMetricsStart();
+                publishStatus = IotMqtt_TimedPublish(_mqttConnection, &publishInfo, 0, MQTT_TIMEOUT_MS);
+                vLabMetricsRecord(LABMETRICS_OP_PUBLISH, publishStart, publishStatus == IOT_MQTT_SUCCESS);
+
+                if (publishStatus != IOT_MQTT_SUCCESS)
+                {
+                    ESP_LOGE(TAG, "prvOfflineDrainTask: Publish failed: %s", IotMqtt_strerror(publishStatus));
+                    break;
+                }
+
+                /* Only the entry sent: pushes while it was sent may have
+                 * dropped it from a full queue. */
+                eLabOfflineQueuePop(sequence);
+            }
+
+            if (sent < LAB_OFFLINE_QUEUE_DRAIN_BATCH)
+            {
+                break;
+            }
+
+            vTaskDelay( pdMS_TO_TICKS( LAB_OFFLINE_QUEUE_DRAIN_PACE_MS ) );
+        }
+
+        vLabOfflineQueueGetStats(&stats);
+        ESP_LOGI(TAG, "prvOfflineDrainTask: Done. depth %u, drained %u, dropped %u, corrupted %u",
+                 stats.depth, stats.drained, stats.dropped, stats.corrupted);
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+#if LAB_METRICS_PUBLISH_PERIOD_MS > 0
+
+/* All the histograms of a period go out in one batch. */
+_Static_assert( LABMETRICS_OP_MAX * ( LAB_CONNECTION_POOL_PAYLOAD_LENGTH + 1 ) + 1 <= LAB_CONNECTION_BATCH_PAYLOAD_MAX_LENGTH,
+                "The metrics of a period do not fit LAB_CONNECTION_BATCH_PAYLOAD_MAX_LENGTH" );
+
+/**
+ * @brief Publish the latency histograms every LAB_METRICS_PUBLISH_PERIOD_MS
+ * on the metrics topic of the device, batched into a single QoS1 publish of a
+ * JSON array, one object per operation, once the batch window closes. Nothing
+ * is published while MQTT is down.
+ */
+static void prvMetricsTask( void * pArgument )
+{
+    static char payloads[LABMETRICS_OP_MAX][LAB_CONNECTION_POOL_PAYLOAD_LENGTH];
+    IotMqttPublishInfo_t publishInfos[LABMETRICS_OP_MAX];
+    size_t count = 0;
+    uint32_t op = 0;
+
+    for(;;)
+    {
+        vTaskDelay( pdMS_TO_TICKS( LAB_METRICS_PUBLISH_PERIOD_MS ) );
+
+        if (!bIsLabConnectionMqttConnected())
+        {
+            continue;
+        }
+
+        for (op = 0, count = 0; op < LABMETRICS_OP_MAX; op++)
+        {
+            publishInfos[count] = (IotMqttPublishInfo_t)IOT_MQTT_PUBLISH_INFO_INITIALIZER;
+            publishInfos[count].pPayload = payloads[op];
+            publishInfos[count].payloadLength = xLabMetricsToJson(op, payloads[op], sizeof(payloads[op]));
+
+            if (eLabConnectionSetTopic(&publishInfos[count], LABCONNECTION_TOPIC_METRICS) != ESP_OK ||
+                publishInfos[count].payloadLength == 0)
+            {
+                ESP_LOGE(TAG, "prvMetricsTask: %s does not fit a publish buffer", pcLabMetricsOpName(op));
+                continue;
+            }
+
+            count++;
+        }
+
+        if (count > 0 && eLabConnectionPublishBatch(publishInfos, count, NULL) != ESP_OK)
+        {
+            ESP_LOGE(TAG, "prvMetricsTask: Failed to batch the metrics");
+        }
     }
 }
 
+#endif
+
 /*-----------------------------------------------------------*/
 
+/**
+ * @brief Runs the connection manager. runDemoTask only returns when the network
+ * or the libraries could not be brought up: MQTT link flaps are handled inside
+ * lab_run without returning.
+ */
 void vLabConnectionTask( void * pArgument )
 {
     for(;;)
@@ -674,6 +1111,16 @@ esp_err_t eLabConnectionInit(iot_connection_params_t * pConnectionParams)
 
     _pConnectionParams = pConnectionParams;
 
+    if ( eLabTopicsInit(_pConnectionParams->strID, _pConnectionParams->topicAliases) != ESP_OK )
+    {
+        return ESP_FAIL;
+    }
+
+    vLabReconnectInit(&_reconnect,
+                      _pConnectionParams->backoffFirstRetryMs,
+                      _pConnectionParams->backoffBaseMs,
+                      _pConnectionParams->backoffCapMs);
+
     static demoContext_t mqttDemoContext =
     {
         .networkTypes = AWSIOT_NETWORK_TYPE_WIFI,
@@ -713,6 +1160,19 @@ esp_err_t eLabConnectionInit(iot_connection_params_t * pConnectionParams)
         ESP_LOGE(TAG, "Error creating event loop: %s", esp_err_to_name(res));
     }
 
+    // Events are posted to the loop by a dispatcher, never by the callbacks
+    if ( res == ESP_OK && ( eLabEventQueueInit() != ESP_OK || !IotSemaphore_Create(&_eventSem, 0, 1) ) )
+    {
+        ESP_LOGE(TAG, "Failed to create event dispatcher mutex or semaphore!");
+        res = ESP_FAIL;
+    }
+
+    if ( res == ESP_OK && !Iot_CreateDetachedThread(prvEventDispatchTask, NULL, tskIDLE_PRIORITY + 6, configMINIMAL_STACK_SIZE * 4) )
+    {
+        ESP_LOGE(TAG, "Failed to create event dispatcher thread!");
+        res = ESP_FAIL;
+    }
+
     // Create semaphore for connection readiness
     if (res == ESP_OK && !IotSemaphore_Create(&connectionReadySem, 0, 1))
     {
@@ -727,16 +1187,89 @@ esp_err_t eLabConnectionInit(iot_connection_params_t * pConnectionParams)
         res = ESP_FAIL;
     }
 
-    // Create semaphore for shadow delta
-    // if ( res == ESP_OK && !IotSemaphore_Create(&shadowDeltaSem, 0, 1))
-    // {
-    //     ESP_LOGE(TAG, "Failed to create shadow delta semaphore!");
-    //     res = ESP_FAIL;
-    // }
-
-    if ( res == ESP_OK )
+    // Create semaphore for the offline queue drain
+    if ( res == ESP_OK && !IotSemaphore_Create(&offlineDrainSem, 0, 1))
     {
-        ESP_LOGI(TAG, "Creating IoT Thread");
+        ESP_LOGE(TAG, "Failed to create offline drain semaphore!");
+        res = ESP_FAIL;
+    }
+
+    #if defined(LABCONFIG_TLS_SESSION_RESUMPTION)
+        // Without it, every reconnection runs a full handshake
+        if ( res == ESP_OK && eLabNetworkTlsInit() != ESP_OK )
+        {
+            ESP_LOGE(TAG, "Failed to init the TLS session cache!");
+            res = ESP_FAIL;
+        }
+    #endif
+
+    // Create mutex for the publish buffer pool
+    if ( res == ESP_OK && !_poolReady )
+    {
+        _poolReady = IotMutex_Create(&_poolMutex, false);
+        if ( !_poolReady )
+        {
+            ESP_LOGE(TAG, "Failed to create publish pool mutex!");
+            res = ESP_FAIL;
+        }
+    }
+
+    // Create mutex for batched publishes, and the task flushing them
+    if ( res == ESP_OK && !IotSemaphore_Create(&_batchFlushSem, 0, 1) )
+    {
+        ESP_LOGE(TAG, "Failed to create batch flush semaphore!");
+        res = ESP_FAIL;
+    }
+
+    if ( res == ESP_OK )
+    {
+        _batchReady = IotMutex_Create(&_batchMutex, false);
+        if ( !_batchReady )
+        {
+            ESP_LOGE(TAG, "Failed to create batch mutex!");
+            res = ESP_FAIL;
+        }
+    }
+
+    if ( res == ESP_OK && !Iot_CreateDetachedThread(prvBatchFlushTask, NULL, tskIDLE_PRIORITY + 4, configMINIMAL_STACK_SIZE * 4) )
+    {
+        ESP_LOGE(TAG, "Failed to create batch flush thread!");
+        res = ESP_FAIL;
+    }
+
+    // The offline queue is best effort: publishing still works without it
+    if ( res == ESP_OK && eLabOfflineQueueInit() != ESP_OK )
+    {
+        ESP_LOGE(TAG, "Failed to init the offline queue, offline publishes will be lost!");
+    }
+
+    #if LAB_METRICS_PUBLISH_PERIOD_MS > 0
+        if ( res == ESP_OK && !Iot_CreateDetachedThread(prvMetricsTask, NULL, tskIDLE_PRIORITY + 1, configMINIMAL_STACK_SIZE * 4) )
+        {
+            ESP_LOGE(TAG, "Failed to create metrics thread!");
+            res = ESP_FAIL;
+        }
+    #endif
+
+    if ( res == ESP_OK )
+    {
+        if ( !Iot_CreateDetachedThread(prvOfflineDrainTask, NULL, tskIDLE_PRIORITY + 4, configMINIMAL_STACK_SIZE * 4) )
+        {
+            ESP_LOGE(TAG, "Failed to create offline drain thread!");
+            res = ESP_FAIL;
+        }
+    }
+
+    // Create semaphore for shadow delta
+    // if ( res == ESP_OK && !IotSemaphore_Create(&shadowDeltaSem, 0, 1))
+    // {
+    //     ESP_LOGE(TAG, "Failed to create shadow delta semaphore!");
+    //     res = ESP_FAIL;
+    // }
+
+    if ( res == ESP_OK )
+    {
+        ESP_LOGI(TAG, "Creating IoT Thread");
         if ( Iot_CreateDetachedThread(vLabConnectionTask, &mqttDemoContext, tskIDLE_PRIORITY + 5, configMINIMAL_STACK_SIZE * 8) )
         {
             res = ESP_OK;
@@ -753,19 +1286,152 @@ esp_err_t eLabConnectionInit(iot_connection_params_t * pConnectionParams)
 
 /*-----------------------------------------------------------*/
 
-// Shadow update completion callback.
+/*-----------------------------------------------------------*/
+/*----                Publish buffer pool                ----*/
+/*-----------------------------------------------------------*/
+
+static lab_publish_buffer_t _bufferPool[LAB_CONNECTION_POOL_SIZE];
+static bool _bufferInUse[LAB_CONNECTION_POOL_SIZE];
+static lab_publish_pool_stats_t _poolStats = { .size = LAB_CONNECTION_POOL_SIZE };
+
+/*-----------------------------------------------------------*/
+
+lab_publish_buffer_t * pxLabConnectionAcquireBuffer(void)
+{
+    lab_publish_buffer_t * pBuffer = NULL;
+    uint32_t i = 0;
+
+    if (!_poolReady)
+    {
+        return NULL;
+    }
+
+    IotMutex_Lock(&_poolMutex);
+
+    for (i = 0; i < LAB_CONNECTION_POOL_SIZE; i++)
+    {
+        if (!_bufferInUse[i])
+        {
+            _bufferInUse[i] = true;
+            pBuffer = &_bufferPool[i];
+            pBuffer->complete.function = NULL;
+            pBuffer->complete.pCallbackContext = NULL;
+            pBuffer->updateComplete.function = NULL;
+            pBuffer->updateComplete.pCallbackContext = NULL;
+            break;
+        }
+    }
+
+    if (pBuffer != NULL)
+    {
+        _poolStats.acquired++;
+        _poolStats.inUse++;
+        if (_poolStats.inUse > _poolStats.highWater)
+        {
+            _poolStats.highWater = _poolStats.inUse;
+        }
+    }
+    else
+    {
+        _poolStats.exhausted++;
+    }
+
+    IotMutex_Unlock(&_poolMutex);
+
+    return pBuffer;
+}
+
+/*-----------------------------------------------------------*/
+
+void vLabConnectionReleaseBuffer(lab_publish_buffer_t * pBuffer)
+{
+    uint32_t i = 0;
+
+    if (pBuffer == NULL || pBuffer < _bufferPool || pBuffer >= _bufferPool + LAB_CONNECTION_POOL_SIZE)
+    {
+        return;
+    }
+
+    i = (uint32_t)(pBuffer - _bufferPool);
+
+    IotMutex_Lock(&_poolMutex);
+
+    if (_bufferInUse[i])
+    {
+        _bufferInUse[i] = false;
+        _poolStats.inUse--;
+    }
+
+    IotMutex_Unlock(&_poolMutex);
+}
+
+/*-----------------------------------------------------------*/
+
+void vLabConnectionGetPoolStats(lab_publish_pool_stats_t * stats)
+{
+    IotMutex_Lock(&_poolMutex);
+    *stats = _poolStats;
+    IotMutex_Unlock(&_poolMutex);
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Completion of a publish made from a pool buffer: the MQTT library is
+ * done with the buffer once the PUBACK is in, or the retries are exhausted.
+ */
+static void _bufferPublishComplete(void * pCallbackContext, IotMqttCallbackParam_t * pCallbackParam)
+{
+    lab_publish_buffer_t * pBuffer = (lab_publish_buffer_t *)pCallbackContext;
+
+    vLabMetricsRecord(LABMETRICS_OP_PUBLISH, pBuffer->startMs,
+                      pCallbackParam->u.operation.result == IOT_MQTT_SUCCESS);
+
+    if (pBuffer->complete.function != NULL)
+    {
+        pBuffer->complete.function(pBuffer->complete.pCallbackContext, pCallbackParam);
+    }
+
+    vLabConnectionReleaseBuffer(pBuffer);
+}
+
+/*-----------------------------------------------------------*/
+
+// Shadow update completion callback. The context is the pool buffer holding
+// the document, if any.
 void _updateComplete( void * pCallbackContext,
                       AwsIotShadowCallbackParam_t * pCallbackParam )
 {
+    lab_publish_buffer_t * pBuffer = (lab_publish_buffer_t *)pCallbackContext;
+
     ESP_LOGI(TAG, "_updateComplete");
+
+    if (pBuffer != NULL)
+    {
+        vLabMetricsRecord(LABMETRICS_OP_SHADOW_UPDATE, pBuffer->startMs,
+                          pCallbackParam->u.operation.result == AWS_IOT_SHADOW_SUCCESS);
+
+        if (pBuffer->updateComplete.function != NULL)
+        {
+            pBuffer->updateComplete.function(pBuffer->updateComplete.pCallbackContext, pCallbackParam);
+        }
+
+        vLabConnectionReleaseBuffer(pBuffer);
+    }
 }
 
-esp_err_t eLabConnectionUpdateShadow(AwsIotShadowDocumentInfo_t *updateDocument)
+static int _updateShadow(AwsIotShadowDocumentInfo_t *updateDocument, lab_publish_buffer_t * pBuffer)
 {
     int status = EXIT_SUCCESS;
     AwsIotShadowError_t updateStatus = AWS_IOT_SHADOW_STATUS_PENDING;    
     AwsIotShadowCallbackInfo_t updateCallback = AWS_IOT_SHADOW_CALLBACK_INFO_INITIALIZER;
     updateCallback.function = _updateComplete;
+    updateCallback.pCallbackContext = pBuffer;
+
+    if (pBuffer != NULL)
+    {
+        pBuffer->startMs = ulLabMetricsStart();
+    }
 
     updateStatus = AwsIotShadow_Update(_mqttConnection, updateDocument, AWS_IOT_SHADOW_FLAG_KEEP_SUBSCRIPTIONS,
                                         &updateCallback, NULL);
@@ -784,22 +1450,72 @@ esp_err_t eLabConnectionUpdateShadow(AwsIotShadowDocumentInfo_t *updateDocument)
     return status;
 }
 
+esp_err_t eLabConnectionUpdateShadow(AwsIotShadowDocumentInfo_t *updateDocument)
+{
+    return _updateShadow(updateDocument, NULL);
+}
+
+esp_err_t eLabConnectionUpdateShadowBuffer(lab_publish_buffer_t * pBuffer, AwsIotShadowDocumentInfo_t *updateDocument, const AwsIotShadowCallbackInfo_t *updateComplete)
+{
+    int status = EXIT_SUCCESS;
+
+    if (updateComplete != NULL)
+    {
+        pBuffer->updateComplete = *updateComplete;
+    }
+
+    status = _updateShadow(updateDocument, pBuffer);
+
+    if (status != EXIT_SUCCESS)
+    {
+        vLabConnectionReleaseBuffer(pBuffer);
+    }
+
+    return status;
+}
+
 /*-----------------------------------------------------------*/
 
-esp_err_t eLabConnectionPublish(IotMqttPublishInfo_t * publishInfo, IotMqttCallbackInfo_t * publishComplete)
+/**
+ * @brief Publish, or queue the publish if MQTT is not connected.
+ *
+ * @param[out] pQueued Set to true if the publish was queued. The completion
+ * callback is not invoked for queued publishes.
+ *
+ * @return `EXIT_SUCCESS` if the publish was sent or queued; `EXIT_FAILURE` otherwise.
+ */
+static int _publish(IotMqttPublishInfo_t * publishInfo, IotMqttCallbackInfo_t * publishComplete, bool * pQueued)
 {
     int status = EXIT_SUCCESS;
     IotMqttError_t publishStatus = IOT_MQTT_STATUS_PENDING;
 
-    if (NULL != _mqttConnection)
+    *pQueued = false;
+
+    if (!bIsLabConnectionMqttConnected())
+    {
+        /* Keep it for later, it is sent once MQTT is connected again. */
+        if (eLabOfflineQueuePush(publishInfo) == ESP_OK)
+        {
+            *pQueued = true;
+            ESP_LOGI(TAG, "MQTT Publish: Offline, queued (%u queued)", ulLabOfflineQueueDepth());
+        }
+        else
+        {
+            ESP_LOGE(TAG, "MQTT Publish: Offline, failed to queue the publish.");
+            status = EXIT_FAILURE;
+        }
+    }
+    else if (NULL != _mqttConnection)
     {
         /* PUBLISH a message. This is an asynchronous function that notifies of
          * completion through a callback. */
-        ESP_LOGI(TAG, "MQTT Publish: %s: %s", (char *)publishInfo->pTopicName, (char *)publishInfo->pPayload);
+        ESP_LOGD(TAG, "MQTT Publish: %.*s: %.*s",
+                 publishInfo->topicNameLength, publishInfo->pTopicName,
+                 (int)publishInfo->payloadLength, (const char *)publishInfo->pPayload);
 
         publishStatus = IotMqtt_Publish(_mqttConnection, publishInfo, 0, publishComplete, NULL);
 
-        if (publishStatus != IOT_MQTT_STATUS_PENDING)
+        if (publishStatus != IOT_MQTT_STATUS_PENDING && publishStatus != IOT_MQTT_SUCCESS)
         {
             ESP_LOGE(TAG, "MQTT Publish returned error %s.", IotMqtt_strerror(publishStatus));
             status = EXIT_FAILURE;
@@ -810,9 +1526,508 @@ esp_err_t eLabConnectionPublish(IotMqttPublishInfo_t * publishInfo, IotMqttCallb
         ESP_LOGE(TAG, "MQTT Publish: MQTT Connection is (NULL) not available.");
         status = EXIT_FAILURE;
     }
-        
+
     return status;
 }
+
+/*-----------------------------------------------------------*/
+
+esp_err_t eLabConnectionPublish(IotMqttPublishInfo_t * publishInfo, IotMqttCallbackInfo_t * publishComplete)
+{
+    bool queued = false;
+
+    /* The completion callback is not invoked for queued publishes. */
+    return _publish(publishInfo, publishComplete, &queued);
+}
+
+/*-----------------------------------------------------------*/
+
+esp_err_t eLabConnectionPublishBuffer(lab_publish_buffer_t * pBuffer, IotMqttPublishInfo_t * publishInfo, IotMqttCallbackInfo_t * publishComplete)
+{
+    IotMqttCallbackInfo_t bufferComplete = IOT_MQTT_CALLBACK_INFO_INITIALIZER;
+    bool queued = false;
+    int status = EXIT_SUCCESS;
+
+    if (publishComplete != NULL)
+    {
+        pBuffer->complete = *publishComplete;
+    }
+
+    /* QoS0 publishes do not complete: the buffer is released right away. */
+    if (publishInfo->qos == IOT_MQTT_QOS_0)
+    {
+        status = _publish(publishInfo, NULL, &queued);
+        vLabConnectionReleaseBuffer(pBuffer);
+        return status;
+    }
+
+    bufferComplete.function = _bufferPublishComplete;
+    bufferComplete.pCallbackContext = pBuffer;
+    pBuffer->startMs = ulLabMetricsStart();
+
+    status = _publish(publishInfo, &bufferComplete, &queued);
+
+    /* The offline queue keeps its own copy and never calls back. */
+    if (status != EXIT_SUCCESS || queued)
+    {
+        vLabConnectionReleaseBuffer(pBuffer);
+    }
+
+    return status;
+}
+
+/*-----------------------------------------------------------*/
+/*----                 Batched publishes                 ----*/
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief A coalesced payload: a JSON array of the messages published on a topic
+ * during a window, and the callbacks to invoke once it is sent.
+ */
+typedef struct {
+    char payload[LAB_CONNECTION_BATCH_PAYLOAD_MAX_LENGTH];
+    size_t payloadLength;
+    uint32_t messages;
+    IotMqttCallbackInfo_t callbacks[LAB_CONNECTION_BATCH_MAX_CALLBACKS];
+    uint32_t callbackCount;
+    bool inFlight;
+    bool failed;                    /*!< Not sent: the callers are yet to be told */
+    uint32_t startMs;
+} _batchBuffer_t;
+
+/**
+ * @brief A topic being batched. One buffer accumulates while the other may
+ * still be waiting for its PUBACK.
+ */
+typedef struct {
+    char topic[LAB_CONNECTION_BATCH_TOPIC_MAX_LENGTH];
+    uint16_t topicLength;
+    _batchBuffer_t buffers[2];
+    _batchBuffer_t * pOpen;
+    TimerHandle_t windowTimer;
+    bool windowExpired;             /*!< Set by the timer, flushed by prvBatchFlushTask */
+} _batchTopic_t;
+
+static _batchTopic_t _batchTopics[LAB_CONNECTION_BATCH_MAX_TOPICS];
+
+/*-----------------------------------------------------------*/
+
+static void _batchRelease(_batchBuffer_t * pBuffer)
+{
+    IotMutex_Lock(&_batchMutex);
+    pBuffer->inFlight = false;
+    IotMutex_Unlock(&_batchMutex);
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief The single MQTT completion callback of a coalesced publish. Forwards
+ * the result to every caller that contributed to it.
+ */
+static void _batchPublishComplete(void * pCallbackContext, IotMqttCallbackParam_t * pCallbackParam)
+{
+    _batchBuffer_t * pBuffer = (_batchBuffer_t *)pCallbackContext;
+    uint32_t i = 0;
+
+    vLabMetricsRecord(LABMETRICS_OP_PUBLISH, pBuffer->startMs,
+                      pCallbackParam->u.operation.result == IOT_MQTT_SUCCESS);
+
+    for (i = 0; i < pBuffer->callbackCount; i++)
+    {
+        pBuffer->callbacks[i].function(pBuffer->callbacks[i].pCallbackContext, pCallbackParam);
+    }
+
+    _batchRelease(pBuffer);
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Close the open buffer of a topic and publish it. Called with
+ * _batchMutex held: a buffer that could not be sent is marked as failed, and
+ * its callers are told by _batchCompleteFailed once the mutex is released.
+ */
+static esp_err_t _batchFlushLocked(_batchTopic_t * pTopic)
+{
+    _batchBuffer_t * pBuffer = pTopic->pOpen;
+    IotMqttPublishInfo_t publishInfo = IOT_MQTT_PUBLISH_INFO_INITIALIZER;
+    IotMqttCallbackInfo_t publishComplete = IOT_MQTT_CALLBACK_INFO_INITIALIZER;
+    bool queued = false;
+
+    if (pBuffer == NULL)
+    {
+        return ESP_OK;
+    }
+
+    pTopic->pOpen = NULL;
+    xTimerStop(pTopic->windowTimer, 0);
+
+    if (pBuffer->messages == 0)
+    {
+        return ESP_OK;
+    }
+
+    pBuffer->payload[pBuffer->payloadLength++] = ']';
+    pBuffer->inFlight = true;
+
+    publishInfo.qos = IOT_MQTT_QOS_1;
+    publishInfo.pTopicName = pTopic->topic;
+    publishInfo.topicNameLength = pTopic->topicLength;
+    publishInfo.pPayload = pBuffer->payload;
+    publishInfo.payloadLength = pBuffer->payloadLength;
+    publishInfo.retryMs = LAB_CONNECTION_BATCH_RETRY_MS;
+    publishInfo.retryLimit = LAB_CONNECTION_BATCH_RETRY_LIMIT;
+
+    publishComplete.function = _batchPublishComplete;
+    publishComplete.pCallbackContext = pBuffer;
+    pBuffer->startMs = ulLabMetricsStart();
+
+    ESP_LOGD(TAG, "Batch Publish: %.*s: %u messages, %u bytes",
+             pTopic->topicLength, pTopic->topic, pBuffer->messages, pBuffer->payloadLength);
+
+    if (_publish(&publishInfo, &publishComplete, &queued) != EXIT_SUCCESS)
+    {
+        /* Kept in flight until the callers know, as the MQTT library will not
+         * tell them. */
+        pBuffer->failed = true;
+        return ESP_FAIL;
+    }
+
+    /* The offline queue keeps its own copy and never calls back. */
+    if (queued)
+    {
+        pBuffer->inFlight = false;
+    }
+
+    return ESP_OK;
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Tell the callers of the buffers that could not be sent. Called
+ * without _batchMutex held, so that a callback may publish again.
+ */
+static void _batchCompleteFailed(void)
+{
+    IotMqttCallbackParam_t failedParam = { 0 };
+    _batchBuffer_t * pFailed = NULL;
+    uint32_t i = 0;
+    uint32_t j = 0;
+
+    failedParam.u.operation.type = IOT_MQTT_PUBLISH_TO_SERVER;
+    failedParam.u.operation.result = IOT_MQTT_SEND_ERROR;
+
+    do
+    {
+        pFailed = NULL;
+
+        IotMutex_Lock(&_batchMutex);
+
+        for (i = 0; i < LAB_CONNECTION_BATCH_MAX_TOPICS && pFailed == NULL; i++)
+        {
+            for (j = 0; j < 2 && pFailed == NULL; j++)
+            {
+                if (_batchTopics[i].buffers[j].failed)
+                {
+                    pFailed = &_batchTopics[i].buffers[j];
+                    pFailed->failed = false;
+                }
+            }
+        }
+
+        IotMutex_Unlock(&_batchMutex);
+
+        if (pFailed != NULL)
+        {
+            /* Still in flight: nobody else touches it. */
+            for (i = 0; i < pFailed->callbackCount; i++)
+            {
+                pFailed->callbacks[i].function(pFailed->callbacks[i].pCallbackContext, &failedParam);
+            }
+
+            _batchRelease(pFailed);
+        }
+    } while (pFailed != NULL);
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Runs on the timer service task: hands the flush over to
+ * prvBatchFlushTask, as publishing may wait on the network or the flash.
+ */
+static void _batchWindowExpired(TimerHandle_t xTimer)
+{
+    _batchTopic_t * pTopic = (_batchTopic_t *)pvTimerGetTimerID(xTimer);
+
+    __atomic_store_n(&pTopic->windowExpired, true, __ATOMIC_RELEASE);
+    IotSemaphore_Post(&_batchFlushSem);
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Flushes the batches whose window expired.
+ */
+static void prvBatchFlushTask( void * pArgument )
+{
+    uint32_t i = 0;
+
+    for(;;)
+    {
+        IotSemaphore_Wait(&_batchFlushSem);
+
+        IotMutex_Lock(&_batchMutex);
+
+        for (i = 0; i < LAB_CONNECTION_BATCH_MAX_TOPICS; i++)
+        {
+            if (__atomic_exchange_n(&_batchTopics[i].windowExpired, false, __ATOMIC_ACQUIRE))
+            {
+                _batchFlushLocked(&_batchTopics[i]);
+            }
+        }
+
+        IotMutex_Unlock(&_batchMutex);
+
+        _batchCompleteFailed();
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Find the slot of a topic, claiming a free one if needed. Called with
+ * _batchMutex held.
+ */
+static _batchTopic_t * _batchFindTopic(const char * pTopicName, uint16_t topicNameLength)
+{
+    _batchTopic_t * pFree = NULL;
+    uint32_t i = 0;
+
+    for (i = 0; i < LAB_CONNECTION_BATCH_MAX_TOPICS; i++)
+    {
+        _batchTopic_t * pTopic = &_batchTopics[i];
+
+        if (pTopic->topicLength == topicNameLength && memcmp(pTopic->topic, pTopicName, topicNameLength) == 0)
+        {
+            return pTopic;
+        }
+        if (pFree == NULL && pTopic->topicLength == 0)
+        {
+            pFree = pTopic;
+        }
+    }
+
+    if (pFree != NULL && topicNameLength <= LAB_CONNECTION_BATCH_TOPIC_MAX_LENGTH)
+    {
+        pFree->windowTimer = xTimerCreate("batch",
+                                          pdMS_TO_TICKS(LAB_CONNECTION_BATCH_WINDOW_MS),
+                                          pdFALSE,
+                                          pFree,
+                                          _batchWindowExpired);
+        if (pFree->windowTimer == NULL)
+        {
+            return NULL;
+        }
+
+        memcpy(pFree->topic, pTopicName, topicNameLength);
+        pFree->topicLength = topicNameLength;
+        return pFree;
+    }
+
+    return NULL;
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Start accumulating in a buffer that is not waiting for a PUBACK.
+ * Called with _batchMutex held.
+ */
+static _batchBuffer_t * _batchOpen(_batchTopic_t * pTopic)
+{
+    uint32_t i = 0;
+
+    if (pTopic->pOpen != NULL)
+    {
+        return pTopic->pOpen;
+    }
+
+    for (i = 0; i < 2; i++)
+    {
+        _batchBuffer_t * pBuffer = &pTopic->buffers[i];
+
+        if (!pBuffer->inFlight)
+        {
+            pBuffer->payload[0] = '[';
+            pBuffer->payloadLength = 1;
+            pBuffer->messages = 0;
+            pBuffer->callbackCount = 0;
+            pTopic->pOpen = pBuffer;
+
+            /* The window starts with the first message. */
+            __atomic_store_n(&pTopic->windowExpired, false, __ATOMIC_RELAXED);
+            xTimerReset(pTopic->windowTimer, 0);
+            return pBuffer;
+        }
+    }
+
+    return NULL;
+}
+
+/*-----------------------------------------------------------*/
+
+static bool _batchAddCallback(_batchBuffer_t * pBuffer, const IotMqttCallbackInfo_t * pCallback)
+{
+    uint32_t i = 0;
+
+    if (pCallback == NULL || pCallback->function == NULL)
+    {
+        return true;
+    }
+
+    for (i = 0; i < pBuffer->callbackCount; i++)
+    {
+        if (pBuffer->callbacks[i].function == pCallback->function &&
+            pBuffer->callbacks[i].pCallbackContext == pCallback->pCallbackContext)
+        {
+            return true;
+        }
+    }
+
+    if (pBuffer->callbackCount == LAB_CONNECTION_BATCH_MAX_CALLBACKS)
+    {
+        return false;
+    }
+
+    pBuffer->callbacks[pBuffer->callbackCount++] = *pCallback;
+    return true;
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Append one message to the batch of its topic. Called with
+ * _batchMutex held.
+ */
+static esp_err_t _batchAppendLocked(const IotMqttPublishInfo_t * pPublishInfo, const IotMqttCallbackInfo_t * pBatchComplete)
+{
+    _batchTopic_t * pTopic = NULL;
+    _batchBuffer_t * pBuffer = NULL;
+    size_t needed = 0;
+
+    /* '[' + message + ']' must fit an empty buffer. */
+    if (pPublishInfo->payloadLength + 2 > LAB_CONNECTION_BATCH_PAYLOAD_MAX_LENGTH)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    pTopic = _batchFindTopic(pPublishInfo->pTopicName, pPublishInfo->topicNameLength);
+    if (pTopic == NULL)
+    {
+        ESP_LOGE(TAG, "Batch Publish: No room for topic %.*s", pPublishInfo->topicNameLength, pPublishInfo->pTopicName);
+        return ESP_ERR_NO_MEM;
+    }
+
+    pBuffer = _batchOpen(pTopic);
+
+    if (pBuffer != NULL)
+    {
+        /* Separator, message and closing bracket. */
+        needed = (pBuffer->messages > 0 ? 1 : 0) + pPublishInfo->payloadLength + 1;
+
+        if (pBuffer->payloadLength + needed > LAB_CONNECTION_BATCH_PAYLOAD_MAX_LENGTH ||
+            !_batchAddCallback(pBuffer, pBatchComplete))
+        {
+            /* Size window reached: send what is there and start over. */
+            _batchFlushLocked(pTopic);
+            pBuffer = _batchOpen(pTopic);
+
+            if (pBuffer != NULL)
+            {
+                _batchAddCallback(pBuffer, pBatchComplete);
+            }
+        }
+    }
+
+    if (pBuffer == NULL)
+    {
+        ESP_LOGE(TAG, "Batch Publish: Both buffers of %.*s waiting for PUBACK", pTopic->topicLength, pTopic->topic);
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (pBuffer->messages > 0)
+    {
+        pBuffer->payload[pBuffer->payloadLength++] = ',';
+    }
+
+    memcpy(pBuffer->payload + pBuffer->payloadLength, pPublishInfo->pPayload, pPublishInfo->payloadLength);
+    pBuffer->payloadLength += pPublishInfo->payloadLength;
+    pBuffer->messages++;
+
+    return ESP_OK;
+}
+
+/*-----------------------------------------------------------*/
+
+esp_err_t eLabConnectionPublishBatch(const IotMqttPublishInfo_t * publishInfos, size_t count, const IotMqttCallbackInfo_t * batchComplete)
+{
+    esp_err_t res = ESP_OK;
+    size_t i = 0;
+
+    if (!_batchReady || publishInfos == NULL)
+    {
+        return ESP_FAIL;
+    }
+
+    IotMutex_Lock(&_batchMutex);
+
+    for (i = 0; i < count; i++)
+    {
+        if (_batchAppendLocked(&publishInfos[i], batchComplete) != ESP_OK)
+        {
+            res = ESP_FAIL;
+        }
+    }
+
+    IotMutex_Unlock(&_batchMutex);
+
+    _batchCompleteFailed();
+
+    return res;
+}
+
+/*-----------------------------------------------------------*/
+
+esp_err_t eLabConnectionFlushBatches(void)
+{
+    esp_err_t res = ESP_OK;
+    uint32_t i = 0;
+
+    if (!_batchReady)
+    {
+        return ESP_FAIL;
+    }
+
+    IotMutex_Lock(&_batchMutex);
+
+    for (i = 0; i < LAB_CONNECTION_BATCH_MAX_TOPICS; i++)
+    {
+        if (_batchTopics[i].topicLength != 0 && _batchFlushLocked(&_batchTopics[i]) != ESP_OK)
+        {
+            res = ESP_FAIL;
+        }
+    }
+
+    IotMutex_Unlock(&_batchMutex);
+
+    _batchCompleteFailed();
+
+    return res;
+}
+
 /*-----------------------------------------------------------*/
 
 void vLabConnectionCleanup(void)
@@ -823,7 +2038,55 @@ void vLabConnectionCleanup(void)
 
 bool bIsLabConnectionMqttConnected(void)
 {
-    return mqttConnectionEstablished;
+    return _connectionState == LABCONNECTION_STATE_CONNECTED;
+}
+
+lab_connection_state_t eLabConnectionGetState(void)
+{
+    return _connectionState;
+}
+
+void vLabConnectionGetStats(lab_connection_stats_t * stats)
+{
+    *stats = _reconnect.stats;
+}
+
+esp_err_t eLabConnectionSetTopic(IotMqttPublishInfo_t * publishInfo, lab_connection_topic_t topic)
+{
+    uint16_t length = 0;
+    const char * pName = pcLabTopicsGet(topic, &length);
+
+    if (pName == NULL)
+    {
+        return ESP_FAIL;
+    }
+
+    publishInfo->pTopicName = pName;
+    publishInfo->topicNameLength = length;
+
+    return ESP_OK;
+}
+
+const char * pcLabConnectionGetTopic(lab_connection_topic_t topic)
+{
+    return pcLabTopicsGet(topic, NULL);
+}
+
+lab_payload_encoding_t xLabConnectionGetTopicEncoding(lab_connection_topic_t topic)
+{
+    if (topic >= LABCONNECTION_TOPIC_MAX)
+    {
+        return LABPAYLOAD_JSON;
+    }
+
+    return _topicEncodings[topic];
+}
+
+/*-----------------------------------------------------------*/
+
+void vLabConnectionGetEventStats(lab_connection_event_stats_t * stats)
+{
+    vLabEventQueueGetStats(stats);
 }
 
 /*-----------------------------------------------------------*/
@@ -0,0 +1,365 @@
+/**
+ * @file lab_display.c
+ * @brief Display compositor task and widget layout.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+/* The config header is always included first. */
+#include "iot_config.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "platform/iot_threads.h"
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "lab_config.h"
+#include "lab_display.h"
+
+static const char *TAG = "lab_display";
+
+#if defined(LAB_HOST_BUILD) || defined(LAB_DISPLAY_SIMULATED)
+    #define LAB_DISPLAY_BACKEND         lab_display_sim_backend
+#elif defined(DEVICE_M5STICKC)
+    #define LAB_DISPLAY_BACKEND         lab_display_m5stickc_backend
+#endif
+
+/**
+ * @brief Footer: a line above the battery and status widgets.
+ */
+#define LAB_DISPLAY_FOOTER_HEIGHT       ( 13 )
+#define LAB_DISPLAY_FOOTER_LINE_GAP     ( 3 )
+
+typedef enum {
+    _ALIGN_LEFT = 0,
+    _ALIGN_CENTER,
+    _ALIGN_RIGHT
+} _align_t;
+
+/**
+ * @brief Where a widget goes. A y below 0 is from the bottom of the panel;
+ * 0 columns is the whole width.
+ */
+typedef struct {
+    int16_t y;
+    uint8_t columns;
+    _align_t align;
+} _layout_t;
+
+static const _layout_t _layout[LABDISPLAY_WIDGET_COUNT] = {
+    [LABDISPLAY_WIDGET_TITLE]    = { 2, 0, _ALIGN_CENTER },
+    [LABDISPLAY_WIDGET_SUBTITLE] = { 16, 0, _ALIGN_CENTER },
+    [LABDISPLAY_WIDGET_LAB]      = { 44, 0, _ALIGN_CENTER },
+    [LABDISPLAY_WIDGET_BATTERY]  = { -LAB_DISPLAY_FOOTER_HEIGHT, 8, _ALIGN_LEFT },
+    [LABDISPLAY_WIDGET_STATUS]   = { -LAB_DISPLAY_FOOTER_HEIGHT, 9, _ALIGN_RIGHT }
+};
+
+/**
+ * @brief A widget on the panel: its cells, what they show and what they will
+ * show at the next frame, both padded with spaces to the widget width.
+ */
+typedef struct {
+    uint16_t x;
+    uint16_t y;
+    uint8_t columns;
+    char drawn[LAB_DISPLAY_TEXT_MAX + 1];
+    char next[LAB_DISPLAY_TEXT_MAX + 1];
+} _widget_t;
+
+static const lab_display_backend_t * _backend = NULL;
+static TaskHandle_t _displayTaskHandle = NULL;
+
+/* Latest text of each widget not drawn yet, and which widgets have one. */
+static IotMutex_t _mailboxMutex;
+static char _mailbox[LABDISPLAY_WIDGET_COUNT][LAB_DISPLAY_TEXT_MAX + 1];
+static uint32_t _pending = 0;
+
+static _widget_t _widgets[LABDISPLAY_WIDGET_COUNT];
+static uint16_t _cellWidth = 0;
+static lab_display_stats_t _stats = { 0 };
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Place the widgets on a panel with cells of the given size.
+ */
+static void _layoutWidgets(uint16_t cellWidth)
+{
+    uint32_t panelColumns = _backend->width / cellWidth;
+    uint32_t i = 0;
+
+    for (i = 0; i < LABDISPLAY_WIDGET_COUNT; i++)
+    {
+        _widget_t *pWidget = &_widgets[i];
+        uint32_t columns = _layout[i].columns ? _layout[i].columns : panelColumns;
+
+        if (columns > panelColumns) columns = panelColumns;
+        if (columns > LAB_DISPLAY_TEXT_MAX) columns = LAB_DISPLAY_TEXT_MAX;
+
+        pWidget->columns = (uint8_t)columns;
+        pWidget->y = (uint16_t)(_layout[i].y >= 0 ? _layout[i].y : _backend->height + _layout[i].y);
+
+        switch (_layout[i].align)
+        {
+            case _ALIGN_LEFT: pWidget->x = 1; break;
+            case _ALIGN_RIGHT: pWidget->x = (uint16_t)(_backend->width - columns * cellWidth - 1); break;
+            default: pWidget->x = (uint16_t)((_backend->width - columns * cellWidth) / 2); break;
+        }
+
+        /* The panel starts blank. */
+        memset(pWidget->drawn, ' ', columns);
+        pWidget->drawn[columns] = '\0';
+        memcpy(pWidget->next, pWidget->drawn, columns + 1);
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Lay out the text of a widget, for the next frame.
+ */
+static void _apply(uint32_t widget, const char *pText)
+{
+    _widget_t *pWidget = &_widgets[widget];
+    size_t length = strlen(pText);
+    size_t offset = 0;
+
+    if (length > pWidget->columns)
+    {
+        length = pWidget->columns;
+    }
+
+    switch (_layout[widget].align)
+    {
+        case _ALIGN_LEFT: offset = 0; break;
+        case _ALIGN_RIGHT: offset = pWidget->columns - length; break;
+        default: offset = (pWidget->columns - length) / 2; break;
+    }
+
+    memset(pWidget->next, ' ', pWidget->columns);
+    memcpy(pWidget->next + offset, pText, length);
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Take the texts posted since the last frame.
+ */
+static void _applyPending(void)
+{
+    uint32_t i = 0;
+
+    IotMutex_Lock(&_mailboxMutex);
+
+    for (i = 0; i < LABDISPLAY_WIDGET_COUNT; i++)
+    {
+        if (_pending & (1UL << i))
+        {
+            _apply(i, _mailbox[i]);
+        }
+    }
+    _pending = 0;
+
+    IotMutex_Unlock(&_mailboxMutex);
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Draw the characters that changed since the last frame: per widget,
+ * the span from the first to the last changed cell.
+ */
+static void _drawFrame(void)
+{
+    char span[LAB_DISPLAY_TEXT_MAX + 1];
+    int64_t startUs = esp_timer_get_time();
+    uint32_t frameUs = 0;
+    uint32_t i = 0, first = 0, last = 0;
+    bool dirty = false;
+
+    for (i = 0; i < LABDISPLAY_WIDGET_COUNT; i++)
+    {
+        _widget_t *pWidget = &_widgets[i];
+
+        for (first = 0; first < pWidget->columns && pWidget->next[first] == pWidget->drawn[first]; first++);
+
+        if (first == pWidget->columns)
+        {
+            continue;
+        }
+
+        for (last = pWidget->columns - 1; pWidget->next[last] == pWidget->drawn[last]; last--);
+
+        memcpy(span, pWidget->next + first, last - first + 1);
+        span[last - first + 1] = '\0';
+        _backend->drawText(span, (uint16_t)(pWidget->x + first * _cellWidth), pWidget->y);
+        memcpy(pWidget->drawn + first, span, last - first + 1);
+
+        __atomic_fetch_add(&_stats.rects, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&_stats.chars, last - first + 1, __ATOMIC_RELAXED);
+        dirty = true;
+    }
+
+    if (dirty)
+    {
+        __atomic_fetch_add(&_stats.frames, 1, __ATOMIC_RELAXED);
+        frameUs = (uint32_t)(esp_timer_get_time() - startUs);
+        if (frameUs > _stats.maxFrameUs)
+        {
+            __atomic_store_n(&_stats.maxFrameUs, frameUs, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Sleeps until a widget changes, gathers the updates of the rest of the
+ * frame time and draws the latest text of each widget.
+ */
+static void prvDisplayTask( void *pvParameters )
+{
+    TickType_t xLastFrame = xTaskGetTickCount() - pdMS_TO_TICKS( LAB_DISPLAY_FRAME_MS );
+    TickType_t xElapsed = 0;
+
+    for( ;; )
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        /* Not more than one frame per LAB_DISPLAY_FRAME_MS. */
+        xElapsed = xTaskGetTickCount() - xLastFrame;
+        if (xElapsed < pdMS_TO_TICKS( LAB_DISPLAY_FRAME_MS ))
+        {
+            vTaskDelay( pdMS_TO_TICKS( LAB_DISPLAY_FRAME_MS ) - xElapsed );
+        }
+
+        _applyPending();
+        _drawFrame();
+        xLastFrame = xTaskGetTickCount();
+    }
+
+    vTaskDelete( NULL );
+}
+
+/*-----------------------------------------------------------*/
+
+esp_err_t eLabDisplayInit(void)
+{
+    esp_err_t res = ESP_FAIL;
+    uint16_t cellWidth = 0, cellHeight = 0;
+
+    if (_displayTaskHandle != NULL)
+    {
+        return ESP_OK;
+    }
+
+    #if defined(LAB_DISPLAY_BACKEND)
+        _backend = &LAB_DISPLAY_BACKEND;
+    #else
+        return ESP_ERR_NOT_SUPPORTED;
+    #endif
+
+    res = _backend->init(&cellWidth, &cellHeight);
+    ESP_LOGI(TAG, "eLabDisplayInit: %ux%u panel, %ux%u cells ... %s",
+             _backend->width, _backend->height, cellWidth, cellHeight, res == ESP_OK ? "OK" : "NOK");
+    if (res != ESP_OK) return res;
+
+    if (cellWidth == 0 || cellWidth > _backend->width)
+    {
+        return ESP_FAIL;
+    }
+
+    _cellWidth = cellWidth;
+    _layoutWidgets(cellWidth);
+    _backend->drawLine(_backend->height - LAB_DISPLAY_FOOTER_HEIGHT - LAB_DISPLAY_FOOTER_LINE_GAP);
+
+    if (!IotMutex_Create(&_mailboxMutex, false))
+    {
+        ESP_LOGE(TAG, "eLabDisplayInit: Failed to create the mailbox mutex");
+        return ESP_FAIL;
+    }
+
+    if (xTaskCreate( prvDisplayTask,
+                     "DisplayTask",
+                     LAB_DISPLAY_TASK_STACK_SIZE,
+                     NULL,
+                     LAB_DISPLAY_TASK_PRIORITY,
+                     &_displayTaskHandle ) != pdPASS)
+    {
+        ESP_LOGE(TAG, "eLabDisplayInit: Failed to create the compositor task");
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+/*-----------------------------------------------------------*/
+
+esp_err_t eLabDisplaySetText(lab_display_widget_t widget, const char *pText)
+{
+    TaskHandle_t xDisplayTask = _displayTaskHandle;
+    bool coalesced = false;
+
+    if (xDisplayTask == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if ((uint32_t)widget >= LABDISPLAY_WIDGET_COUNT || pText == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    IotMutex_Lock(&_mailboxMutex);
+
+    strncpy(_mailbox[widget], pText, LAB_DISPLAY_TEXT_MAX);
+    _mailbox[widget][LAB_DISPLAY_TEXT_MAX] = '\0';
+    coalesced = (_pending & (1UL << widget)) != 0;
+    _pending |= 1UL << widget;
+
+    IotMutex_Unlock(&_mailboxMutex);
+
+    __atomic_fetch_add(&_stats.updates, 1, __ATOMIC_RELAXED);
+    if (coalesced)
+    {
+        /* The text it replaced was never drawn, the compositor is awake. */
+        __atomic_fetch_add(&_stats.coalesced, 1, __ATOMIC_RELAXED);
+    }
+    else
+    {
+        xTaskNotifyGive(xDisplayTask);
+    }
+
+    return ESP_OK;
+}
+
+/*-----------------------------------------------------------*/
+
+void vLabDisplayGetStats(lab_display_stats_t *pStats)
+{
+    pStats->updates = __atomic_load_n(&_stats.updates, __ATOMIC_RELAXED);
+    pStats->coalesced = __atomic_load_n(&_stats.coalesced, __ATOMIC_RELAXED);
+    pStats->frames = __atomic_load_n(&_stats.frames, __ATOMIC_RELAXED);
+    pStats->rects = __atomic_load_n(&_stats.rects, __ATOMIC_RELAXED);
+    pStats->chars = __atomic_load_n(&_stats.chars, __ATOMIC_RELAXED);
+    pStats->maxFrameUs = __atomic_load_n(&_stats.maxFrameUs, __ATOMIC_RELAXED);
+}
+
+/*-----------------------------------------------------------*/
+
+void vLabDisplayDump(void)
+{
+    lab_display_stats_t stats;
+
+    vLabDisplayGetStats(&stats);
+
+    ESP_LOGI(TAG, "Display: %u updates, %u coalesced, %u frames, %u rectangles, %u characters, %u us per frame at most",
+             stats.updates, stats.coalesced, stats.frames, stats.rects, stats.chars, stats.maxFrameUs);
+}
@@ -0,0 +1,66 @@
+/**
+ * @file lab_display_m5stickc.c
+ * @brief M5StickC backend of the display compositor: the ST7735S TFT through
+ * the TFT library of the M5StickC component.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include "lab_config.h"
+
+#if defined(DEVICE_M5STICKC)
+
+#include "m5stickc.h"
+
+#include "lab_display.h"
+
+/*-----------------------------------------------------------*/
+
+static esp_err_t prvInit(uint16_t *pCellWidth, uint16_t *pCellHeight)
+{
+    TFT_FONT_ROTATE = 0;
+    TFT_TEXT_WRAP = 0;
+    TFT_FONT_TRANSPARENT = 0;
+    /* The compositor redraws single characters: they need fixed cells. */
+    TFT_FONT_FORCEFIXED = 1;
+    TFT_GRAY_SCALE = 0;
+    TFT_setGammaCurve(DEFAULT_GAMMA_CURVE);
+    TFT_setRotation(LANDSCAPE_FLIP);
+    TFT_setFont(DEFAULT_FONT, NULL);
+    TFT_resetclipwin();
+    TFT_fillScreen(TFT_BLACK);
+    TFT_FONT_BACKGROUND = TFT_BLACK;
+    TFT_FONT_FOREGROUND = TFT_ORANGE;
+
+    *pCellWidth = (uint16_t)TFT_getStringWidth((char *)"0");
+    *pCellHeight = (uint16_t)TFT_getfontheight();
+
+    return M5StickCDisplayOn();
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvDrawText(const char *pText, uint16_t x, uint16_t y)
+{
+    TFT_print((char *)pText, x, y);
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvDrawLine(uint16_t y)
+{
+    TFT_drawLine(0, y, M5STICKC_DISPLAY_WIDTH, y, TFT_ORANGE);
+}
+
+/*-----------------------------------------------------------*/
+
+const lab_display_backend_t lab_display_m5stickc_backend = {
+    .init = prvInit,
+    .drawText = prvDrawText,
+    .drawLine = prvDrawLine,
+    .width = M5STICKC_DISPLAY_WIDTH,
+    .height = M5STICKC_DISPLAY_HEIGHT
+};
+
+#endif /* defined(DEVICE_M5STICKC) */
@@ -0,0 +1,117 @@
+/**
+ * @file lab_display_sim.c
+ * @brief Simulated backend of the display compositor: an in-memory framebuffer
+ * the size of the M5StickC TFT, with one line of characters per pixel row.
+ *
+ * Only built with the backend it stands in for: on the host build, or on the
+ * device with LAB_DISPLAY_SIMULATED. The firmware globs every source of src/.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "lab_display.h"
+
+#if defined(LAB_HOST_BUILD) || defined(LAB_DISPLAY_SIMULATED)
+
+static const char *TAG = "lab_display_sim";
+
+#define LAB_DISPLAY_SIM_WIDTH           ( 160 )
+#define LAB_DISPLAY_SIM_HEIGHT          ( 80 )
+#define LAB_DISPLAY_SIM_CELL_WIDTH      ( 6 )
+#define LAB_DISPLAY_SIM_CELL_HEIGHT     ( 8 )
+#define LAB_DISPLAY_SIM_COLUMNS         ( LAB_DISPLAY_SIM_WIDTH / LAB_DISPLAY_SIM_CELL_WIDTH )
+
+/**
+ * @brief Text starting at each pixel row, by character cell.
+ */
+static char _framebuffer[LAB_DISPLAY_SIM_HEIGHT][LAB_DISPLAY_SIM_COLUMNS + 1];
+
+/*-----------------------------------------------------------*/
+
+static esp_err_t prvInit(uint16_t *pCellWidth, uint16_t *pCellHeight)
+{
+    uint32_t y = 0;
+
+    for (y = 0; y < LAB_DISPLAY_SIM_HEIGHT; y++)
+    {
+        memset(_framebuffer[y], ' ', LAB_DISPLAY_SIM_COLUMNS);
+        _framebuffer[y][LAB_DISPLAY_SIM_COLUMNS] = '\0';
+    }
+
+    *pCellWidth = LAB_DISPLAY_SIM_CELL_WIDTH;
+    *pCellHeight = LAB_DISPLAY_SIM_CELL_HEIGHT;
+
+    return ESP_OK;
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvDrawText(const char *pText, uint16_t x, uint16_t y)
+{
+    uint32_t column = x / LAB_DISPLAY_SIM_CELL_WIDTH;
+    size_t length = strlen(pText);
+
+    if (y >= LAB_DISPLAY_SIM_HEIGHT || column >= LAB_DISPLAY_SIM_COLUMNS)
+    {
+        return;
+    }
+
+    if (length > LAB_DISPLAY_SIM_COLUMNS - column)
+    {
+        length = LAB_DISPLAY_SIM_COLUMNS - column;
+    }
+
+    memcpy(&_framebuffer[y][column], pText, length);
+
+    ESP_LOGD(TAG, "Dirty rectangle %ux%u at %u,%u: \"%s\"",
+             (unsigned)(length * LAB_DISPLAY_SIM_CELL_WIDTH), LAB_DISPLAY_SIM_CELL_HEIGHT, x, y, pText);
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvDrawLine(uint16_t y)
+{
+    if (y < LAB_DISPLAY_SIM_HEIGHT)
+    {
+        memset(_framebuffer[y], '-', LAB_DISPLAY_SIM_COLUMNS);
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+void vLabDisplaySimDump(void)
+{
+    uint32_t y = 0;
+
+    for (y = 0; y < LAB_DISPLAY_SIM_HEIGHT; y++)
+    {
+        if (strspn(_framebuffer[y], " ") != LAB_DISPLAY_SIM_COLUMNS)
+        {
+            ESP_LOGI(TAG, "%2u |%s|", y, _framebuffer[y]);
+        }
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+const char * pcLabDisplaySimRow(uint16_t y)
+{
+    return y < LAB_DISPLAY_SIM_HEIGHT ? _framebuffer[y] : NULL;
+}
+
+/*-----------------------------------------------------------*/
+
+const lab_display_backend_t lab_display_sim_backend = {
+    .init = prvInit,
+    .drawText = prvDrawText,
+    .drawLine = prvDrawLine,
+    .width = LAB_DISPLAY_SIM_WIDTH,
+    .height = LAB_DISPLAY_SIM_HEIGHT
+};
+
+#endif /* if defined(LAB_HOST_BUILD) || defined(LAB_DISPLAY_SIMULATED) */
@@ -0,0 +1,186 @@
+/**
+ * @file lab_event_queue.c
+ * @brief Events of lab_connection waiting for its dispatcher task.
+ *
+ * One FIFO holds all events, so handlers see them in the order they were
+ * posted. A state event takes the place of the one of its state still
+ * queued: it is moved to the tail rather than written over it, which would
+ * hand it out before the events posted in between.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+/* The config header is always included first. */
+#include "iot_config.h"
+
+/* Standard includes. */
+#include <string.h>
+
+/* Platform layer includes. */
+#include "platform/iot_threads.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "lab_event_queue.h"
+
+/*-----------------------------------------------------------*/
+
+static const char *TAG = "lab_event_queue";
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Room for a full ring of other events and one event per state.
+ */
+#define EVENT_QUEUE_SIZE    ( LAB_CONNECTION_EVENT_RING_SIZE + LAB_EVENT_QUEUE_STATES )
+
+typedef struct {
+    lab_event_queue_event_t event;
+    int32_t state;
+} _queuedEvent_t;
+
+static _queuedEvent_t _events[EVENT_QUEUE_SIZE];
+static uint32_t _head = 0;
+static uint32_t _count = 0;
+
+/* Events queued other than the state ones. */
+static uint32_t _otherCount = 0;
+
+static lab_connection_event_stats_t _stats = { 0 };
+static IotMutex_t _mutex;
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Remove the queued event at a position from the head, keeping the
+ * order of the others.
+ */
+static void _remove(uint32_t position)
+{
+    for (; position + 1 < _count; position++)
+    {
+        _events[(_head + position) % EVENT_QUEUE_SIZE] = _events[(_head + position + 1) % EVENT_QUEUE_SIZE];
+    }
+
+    _count--;
+}
+
+/*-----------------------------------------------------------*/
+
+esp_err_t eLabEventQueueInit(void)
+{
+    if (!IotMutex_Create(&_mutex, false))
+    {
+        ESP_LOGE(TAG, "eLabEventQueueInit: Failed to create mutex");
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+/*-----------------------------------------------------------*/
+
+esp_err_t eLabEventQueuePost(int32_t id, int32_t state, const void * data, size_t size)
+{
+    int64_t startUs = esp_timer_get_time();
+    _queuedEvent_t * pQueued = NULL;
+    esp_err_t res = ESP_OK;
+    uint32_t elapsedUs = 0;
+    uint32_t i = 0;
+
+    IotMutex_Lock(&_mutex);
+
+    _stats.posted++;
+
+    /* Not cut: its handlers would read past the end of what is left. */
+    if (size > LAB_CONNECTION_EVENT_DATA_MAX_SIZE)
+    {
+        _stats.oversize++;
+        res = ESP_ERR_INVALID_SIZE;
+    }
+    else if (state != LAB_EVENT_QUEUE_NO_STATE)
+    {
+        for (i = 0; i < _count; i++)
+        {
+            if (_events[(_head + i) % EVENT_QUEUE_SIZE].state == state)
+            {
+                _remove(i);
+                _stats.coalesced++;
+                break;
+            }
+        }
+    }
+    else if (_otherCount < LAB_CONNECTION_EVENT_RING_SIZE)
+    {
+        _otherCount++;
+    }
+    else
+    {
+        _stats.dropped++;
+        res = ESP_ERR_NO_MEM;
+    }
+
+    if (res == ESP_OK)
+    {
+        pQueued = &_events[(_head + _count) % EVENT_QUEUE_SIZE];
+        _count++;
+
+        pQueued->state = state;
+        pQueued->event.id = id;
+        pQueued->event.size = size;
+        if (size > 0)
+        {
+            memcpy(pQueued->event.data, data, size);
+        }
+    }
+
+    elapsedUs = (uint32_t)(esp_timer_get_time() - startUs);
+    if (elapsedUs > _stats.maxPostUs)
+    {
+        _stats.maxPostUs = elapsedUs;
+    }
+
+    IotMutex_Unlock(&_mutex);
+
+    return res;
+}
+
+/*-----------------------------------------------------------*/
+
+bool bLabEventQueueTake(lab_event_queue_event_t * event)
+{
+    bool found = false;
+
+    IotMutex_Lock(&_mutex);
+
+    if (_count > 0)
+    {
+        *event = _events[_head].event;
+
+        if (_events[_head].state == LAB_EVENT_QUEUE_NO_STATE)
+        {
+            _otherCount--;
+        }
+
+        _head = (_head + 1) % EVENT_QUEUE_SIZE;
+        _count--;
+        found = true;
+    }
+
+    IotMutex_Unlock(&_mutex);
+
+    return found;
+}
+
+/*-----------------------------------------------------------*/
+
+void vLabEventQueueGetStats(lab_connection_event_stats_t * stats)
+{
+    IotMutex_Lock(&_mutex);
+    *stats = _stats;
+    IotMutex_Unlock(&_mutex);
+}
+
+/*-----------------------------------------------------------*/
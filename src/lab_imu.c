@@ -0,0 +1,442 @@
+/**
+ * @file lab_imu.c
+ * @brief IMU sampling task and sample ring.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "lab_imu.h"
+
+static const char *TAG = "lab_imu";
+
+#if (LAB_IMU_RING_SIZE & (LAB_IMU_RING_SIZE - 1)) != 0
+    #error "LAB_IMU_RING_SIZE must be a power of 2"
+#endif
+
+#if LAB_IMU_DECIMATION < 1
+    #error "LAB_IMU_DECIMATION must be at least 1"
+#endif
+
+#if LAB_IMU_POLL_MS * LAB_IMU_ODR_HZ >= LAB_IMU_FIFO_FRAMES * 1000
+    #error "LAB_IMU_POLL_MS is too long, the FIFO would overflow between two polls"
+#endif
+
+#if LAB_IMU_MOTION_THRESHOLD_MG > 1020
+    #error "LAB_IMU_MOTION_THRESHOLD_MG is at most 1020 mg"
+#endif
+
+#define LAB_IMU_RING_MASK               ( LAB_IMU_RING_SIZE - 1 )
+#define LAB_IMU_SAMPLE_PERIOD_US        ( 1000000 / LAB_IMU_ODR_HZ )
+
+#if defined(LAB_HOST_BUILD) || defined(LAB_IMU_SIMULATED)
+    #define LAB_IMU_BACKEND             lab_imu_sim_backend
+#else
+    #define LAB_IMU_BACKEND             lab_imu_mpu6886_backend
+#endif
+
+/**
+ * @brief Samples being averaged into the next ring sample.
+ */
+typedef struct {
+    int32_t accel[3];
+    int32_t gyro[3];
+    int32_t temp;
+    uint32_t count;
+} _decimator_t;
+
+/*-----------------------------------------------------------*/
+
+ESP_EVENT_DEFINE_BASE(LAB_IMU_EVENT_BASE);
+
+static const lab_imu_backend_t * _backend = NULL;
+static TaskHandle_t _imuTaskHandle = NULL;
+static esp_event_loop_handle_t _eventLoop = NULL;
+static bool _moving = true;
+
+/* Written by the sampling task only. _head is the sequence number of the next
+ * sample, samples [_head - LAB_IMU_RING_SIZE, _head) are in the ring. */
+static lab_imu_sample_t _ring[LAB_IMU_RING_SIZE];
+static uint32_t _head = 0;
+
+static _decimator_t _decimator;
+static uint8_t _burst[LAB_IMU_BURST_FRAMES * LAB_IMU_FRAME_SIZE];
+static lab_imu_stats_t _stats;
+
+/*-----------------------------------------------------------*/
+
+static int16_t _be16(const uint8_t *p)
+{
+    return (int16_t)(((uint16_t)p[0] << 8) | p[1]);
+}
+
+/*-----------------------------------------------------------*/
+
+static void _push(const lab_imu_sample_t *pSample)
+{
+    uint32_t head = _head;
+
+    _ring[head & LAB_IMU_RING_MASK] = *pSample;
+    __atomic_store_n(&_head, head + 1, __ATOMIC_RELEASE);
+
+    __atomic_fetch_add(&_stats.samples, 1, __ATOMIC_RELAXED);
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Add one FIFO frame to the decimator, pushing a sample once
+ * LAB_IMU_DECIMATION frames were added.
+ */
+static void _addFrame(const uint8_t *pFrame, int64_t timeUs)
+{
+    lab_imu_sample_t sample;
+    uint32_t i = 0;
+
+    for (i = 0; i < 3; i++)
+    {
+        _decimator.accel[i] += _be16(pFrame + 2 * i);
+        _decimator.gyro[i] += _be16(pFrame + 8 + 2 * i);
+    }
+    _decimator.temp += _be16(pFrame + 6);
+
+    if (++_decimator.count < LAB_IMU_DECIMATION)
+    {
+        return;
+    }
+
+    /* The average of the frames, stamped with the time of the last one. */
+    sample.timeUs = timeUs;
+    for (i = 0; i < 3; i++)
+    {
+        sample.accel[i] = (int16_t)(_decimator.accel[i] / LAB_IMU_DECIMATION);
+        sample.gyro[i] = (int16_t)(_decimator.gyro[i] / LAB_IMU_DECIMATION);
+    }
+    sample.temp = (int16_t)(_decimator.temp / LAB_IMU_DECIMATION);
+
+    memset(&_decimator, 0, sizeof(_decimator));
+    _push(&sample);
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Read everything the FIFO holds, in bursts of LAB_IMU_BURST_FRAMES.
+ *
+ * @return true if the IMU saw motion since the last call
+ */
+static bool _drainFifo(void)
+{
+    uint16_t bytes = 0;
+    uint8_t status = 0;
+    uint32_t frames = 0, burst = 0, i = 0;
+    int64_t nowUs = 0;
+
+    if (_backend->fifoCount(&bytes, &status) != ESP_OK)
+    {
+        __atomic_fetch_add(&_stats.readErrors, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+
+    if (status & LAB_IMU_STATUS_OVERFLOW)
+    {
+        /* Frames were lost, the time base is gone: start over. */
+        __atomic_fetch_add(&_stats.fifoOverruns, 1, __ATOMIC_RELAXED);
+        memset(&_decimator, 0, sizeof(_decimator));
+        if (_backend->fifoReset() != ESP_OK)
+        {
+            __atomic_fetch_add(&_stats.readErrors, 1, __ATOMIC_RELAXED);
+        }
+        ESP_LOGW(TAG, "FIFO overrun, reset");
+        return (status & LAB_IMU_STATUS_MOTION) != 0;
+    }
+
+    frames = bytes / LAB_IMU_FRAME_SIZE;
+    if (frames > _stats.maxFifoFrames)
+    {
+        __atomic_store_n(&_stats.maxFifoFrames, frames, __ATOMIC_RELAXED);
+    }
+
+    /* The newest frame was taken about now, the others one period apart. */
+    nowUs = esp_timer_get_time();
+
+    while (frames > 0)
+    {
+        burst = frames < LAB_IMU_BURST_FRAMES ? frames : LAB_IMU_BURST_FRAMES;
+
+        if (_backend->fifoRead(_burst, burst * LAB_IMU_FRAME_SIZE) != ESP_OK)
+        {
+            __atomic_fetch_add(&_stats.readErrors, 1, __ATOMIC_RELAXED);
+            break;
+        }
+
+        for (i = 0; i < burst; i++)
+        {
+            _addFrame(_burst + i * LAB_IMU_FRAME_SIZE,
+                      nowUs - (int64_t)(frames - 1 - i) * LAB_IMU_SAMPLE_PERIOD_US);
+        }
+
+        frames -= burst;
+        __atomic_fetch_add(&_stats.frames, burst, __ATOMIC_RELAXED);
+    }
+
+    return (status & LAB_IMU_STATUS_MOTION) != 0;
+}
+
+/*-----------------------------------------------------------*/
+
+#if LAB_IMU_MOTION_THRESHOLD_MG > 0
+
+/**
+ * @brief Motion interrupt, from the backend. Without a yield request the task
+ * runs at the next tick at the latest, which is plenty for a wake up.
+ */
+static void _wakeFromISR(void)
+{
+    vTaskNotifyGiveFromISR(_imuTaskHandle, NULL);
+}
+
+/*-----------------------------------------------------------*/
+
+static void _postMotion(lab_imu_event_t id, int64_t timeUs, uint32_t durationMs)
+{
+    lab_imu_motion_event_t event = {
+        .timeUs = timeUs,
+        .durationMs = durationMs
+    };
+
+    if (_eventLoop != NULL && esp_event_post_to(_eventLoop, LAB_IMU_EVENT_BASE, id, &event, sizeof(event), 0) != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Motion event %d dropped", id);
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Put the IMU to sleep and block until it reports motion, then resume
+ * sampling.
+ *
+ * @return false if the IMU could not be put to sleep: sampling goes on, there
+ * was no motion
+ */
+static bool _sleepUntilMotion(void)
+{
+    esp_err_t res = ESP_FAIL;
+
+    /* A wake up left over from before is not motion. */
+    ulTaskNotifyTake(pdTRUE, 0);
+
+    res = _backend->sleep(_wakeFromISR);
+    if (res == ESP_OK)
+    {
+        __atomic_store_n(&_moving, false, __ATOMIC_RELAXED);
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+    else if (res != ESP_ERR_INVALID_STATE)
+    {
+        __atomic_fetch_add(&_stats.readErrors, 1, __ATOMIC_RELAXED);
+    }
+
+    memset(&_decimator, 0, sizeof(_decimator));
+
+    while (_backend->init(LAB_IMU_ODR_HZ, LAB_IMU_MOTION_THRESHOLD_MG) != ESP_OK)
+    {
+        __atomic_fetch_add(&_stats.readErrors, 1, __ATOMIC_RELAXED);
+        vTaskDelay( pdMS_TO_TICKS( LAB_IMU_POLL_MS ) );
+    }
+
+    __atomic_store_n(&_moving, true, __ATOMIC_RELAXED);
+
+    return res == ESP_OK || res == ESP_ERR_INVALID_STATE;
+}
+
+#endif
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Drains the FIFO every LAB_IMU_POLL_MS. With wake-on-motion, it starts
+ * asleep and goes back to sleep after LAB_IMU_MOTION_QUIET_MS without motion.
+ */
+static void prvImuTask( void *pvParameters )
+{
+    TickType_t xLastWakeTime = 0;
+    #if LAB_IMU_MOTION_THRESHOLD_MG > 0
+        int64_t firstMotionUs = 0, lastMotionUs = 0;
+        bool woken = false;
+    #endif
+
+    for( ;; )
+    {
+        #if LAB_IMU_MOTION_THRESHOLD_MG > 0
+            woken = _sleepUntilMotion();
+            firstMotionUs = lastMotionUs = esp_timer_get_time();
+
+            if (woken)
+            {
+                __atomic_fetch_add(&_stats.wakeups, 1, __ATOMIC_RELAXED);
+                _postMotion(LABIMU_EVENT_MOTION_START, firstMotionUs, 0);
+            }
+        #endif
+
+        xLastWakeTime = xTaskGetTickCount();
+
+        for( ;; )
+        {
+            vTaskDelayUntil( &xLastWakeTime, pdMS_TO_TICKS( LAB_IMU_POLL_MS ) );
+
+            #if LAB_IMU_MOTION_THRESHOLD_MG > 0
+                if (_drainFifo())
+                {
+                    lastMotionUs = esp_timer_get_time();
+                }
+                else if (esp_timer_get_time() - lastMotionUs >= (int64_t)LAB_IMU_MOTION_QUIET_MS * 1000)
+                {
+                    break;
+                }
+            #else
+                _drainFifo();
+            #endif
+        }
+
+        #if LAB_IMU_MOTION_THRESHOLD_MG > 0
+            if (woken)
+            {
+                _postMotion(LABIMU_EVENT_MOTION_STOP, lastMotionUs, (uint32_t)((lastMotionUs - firstMotionUs) / 1000));
+            }
+        #endif
+    }
+
+    vTaskDelete( NULL );
+}
+
+/*-----------------------------------------------------------*/
+
+esp_err_t eLabImuInit(esp_event_loop_handle_t eventLoop)
+{
+    esp_err_t res = ESP_FAIL;
+
+    if (_imuTaskHandle != NULL)
+    {
+        return ESP_OK;
+    }
+
+    _backend = &LAB_IMU_BACKEND;
+    _eventLoop = eventLoop;
+
+    res = _backend->init(LAB_IMU_ODR_HZ, LAB_IMU_MOTION_THRESHOLD_MG);
+    ESP_LOGI(TAG, "eLabImuInit: IMU at %u Hz, decimation %u, wake-on-motion at %u mg ... %s",
+             LAB_IMU_ODR_HZ, LAB_IMU_DECIMATION, LAB_IMU_MOTION_THRESHOLD_MG, res == ESP_OK ? "OK" : "NOK");
+    if (res != ESP_OK) return res;
+
+    if (xTaskCreate( prvImuTask,
+                     "ImuTask",
+                     LAB_IMU_TASK_STACK_SIZE,
+                     NULL,
+                     LAB_IMU_TASK_PRIORITY,
+                     &_imuTaskHandle ) != pdPASS)
+    {
+        ESP_LOGE(TAG, "eLabImuInit: Failed to create the sampling task");
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+/*-----------------------------------------------------------*/
+
+bool bIsLabImuMoving(void)
+{
+    return __atomic_load_n(&_moving, __ATOMIC_RELAXED);
+}
+
+/*-----------------------------------------------------------*/
+
+void vLabImuReaderInit(lab_imu_reader_t *pReader)
+{
+    pReader->next = __atomic_load_n(&_head, __ATOMIC_ACQUIRE);
+    pReader->lost = 0;
+}
+
+/*-----------------------------------------------------------*/
+
+size_t xLabImuRead(lab_imu_reader_t *pReader, lab_imu_sample_t *pSamples, size_t maxSamples)
+{
+    uint32_t head = __atomic_load_n(&_head, __ATOMIC_ACQUIRE);
+    uint32_t available = 0, oldest = 0, i = 0;
+    size_t count = 0;
+
+    /* Fell behind by more than the ring: skip to the oldest sample still in it. */
+    if (head - pReader->next > LAB_IMU_RING_SIZE)
+    {
+        pReader->lost += head - pReader->next - LAB_IMU_RING_SIZE;
+        pReader->next = head - LAB_IMU_RING_SIZE;
+    }
+
+    available = head - pReader->next;
+    count = available < maxSamples ? available : maxSamples;
+
+    for (i = 0; i < count; i++)
+    {
+        pSamples[i] = _ring[(pReader->next + i) & LAB_IMU_RING_MASK];
+    }
+
+    /* The sampling task does not wait for readers: whatever it overwrote while
+     * we were copying, the slot of sample _head included, is dropped. */
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    head = __atomic_load_n(&_head, __ATOMIC_RELAXED);
+    oldest = head - LAB_IMU_RING_SIZE + 1;
+
+    if ((int32_t)(oldest - pReader->next) > 0)
+    {
+        uint32_t overwritten = oldest - pReader->next;
+
+        if (overwritten > count)
+        {
+            overwritten = count;
+        }
+        memmove(pSamples, pSamples + overwritten, (count - overwritten) * sizeof(lab_imu_sample_t));
+        pReader->lost += overwritten;
+        pReader->next += overwritten;
+        count -= overwritten;
+    }
+
+    pReader->next += count;
+
+    return count;
+}
+
+/*-----------------------------------------------------------*/
+
+void vLabImuGetStats(lab_imu_stats_t *pStats)
+{
+    pStats->frames = __atomic_load_n(&_stats.frames, __ATOMIC_RELAXED);
+    pStats->samples = __atomic_load_n(&_stats.samples, __ATOMIC_RELAXED);
+    pStats->fifoOverruns = __atomic_load_n(&_stats.fifoOverruns, __ATOMIC_RELAXED);
+    pStats->readErrors = __atomic_load_n(&_stats.readErrors, __ATOMIC_RELAXED);
+    pStats->maxFifoFrames = __atomic_load_n(&_stats.maxFifoFrames, __ATOMIC_RELAXED);
+    pStats->wakeups = __atomic_load_n(&_stats.wakeups, __ATOMIC_RELAXED);
+}
+
+/*-----------------------------------------------------------*/
+
+void vLabImuDump(void)
+{
+    lab_imu_stats_t stats;
+
+    vLabImuGetStats(&stats);
+
+    ESP_LOGI(TAG, "IMU: %u frames, %u samples, %u FIFO overruns, %u read errors, max FIFO fill %u/%u frames",
+             stats.frames, stats.samples, stats.fifoOverruns, stats.readErrors,
+             stats.maxFifoFrames, LAB_IMU_FIFO_FRAMES);
+    ESP_LOGI(TAG, "IMU: %s, %u wake ups on motion", bIsLabImuMoving() ? "moving" : "still", stats.wakeups);
+}
@@ -0,0 +1,338 @@
+/**
+ * @file lab_imu_mpu6886.c
+ * @brief MPU6886 backend of the IMU sampling: FIFO access over I2C.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "driver/gpio.h"
+#include "driver/i2c.h"
+
+#include "lab_imu.h"
+
+/**
+ * @brief I2C bus of the MPU6886, installed by M5StickCInit, shared with the
+ * AXP192 power management.
+ */
+#ifndef LAB_IMU_I2C_PORT
+    #define LAB_IMU_I2C_PORT                ( I2C_NUM_0 )
+#endif
+#ifndef LAB_IMU_I2C_TIMEOUT_MS
+    #define LAB_IMU_I2C_TIMEOUT_MS          ( 20 )
+#endif
+
+/**
+ * @brief GPIO the INT pin of the MPU6886 is wired to on the M5StickC.
+ */
+#ifndef LAB_IMU_INT_GPIO
+    #define LAB_IMU_INT_GPIO                ( GPIO_NUM_35 )
+#endif
+
+/**
+ * @brief Accelerometer rate while asleep, at which motion is looked for.
+ */
+#ifndef LAB_IMU_SLEEP_ODR_HZ
+    #define LAB_IMU_SLEEP_ODR_HZ            ( 50 )
+#endif
+
+#define MPU6886_ADDRESS                     ( 0x68 )
+
+#define MPU6886_SMPLRT_DIV                  ( 0x19 )
+#define MPU6886_CONFIG                      ( 0x1A )
+#define MPU6886_GYRO_CONFIG                 ( 0x1B )
+#define MPU6886_ACCEL_CONFIG                ( 0x1C )
+#define MPU6886_ACCEL_CONFIG2               ( 0x1D )
+#define MPU6886_ACCEL_WOM_X_THR             ( 0x20 )
+#define MPU6886_ACCEL_WOM_Y_THR             ( 0x21 )
+#define MPU6886_ACCEL_WOM_Z_THR             ( 0x22 )
+#define MPU6886_FIFO_EN                     ( 0x23 )
+#define MPU6886_INT_PIN_CFG                 ( 0x37 )
+#define MPU6886_INT_ENABLE                  ( 0x38 )
+#define MPU6886_INT_STATUS                  ( 0x3A )
+#define MPU6886_ACCEL_INTEL_CTRL            ( 0x69 )
+#define MPU6886_USER_CTRL                   ( 0x6A )
+#define MPU6886_PWR_MGMT_1                  ( 0x6B )
+#define MPU6886_PWR_MGMT_2                  ( 0x6C )
+#define MPU6886_FIFO_COUNTH                 ( 0x72 )
+#define MPU6886_FIFO_R_W                    ( 0x74 )
+
+#define MPU6886_CONFIG_FIFO_MODE_KEEP       ( 0x40 )    /* Full FIFO drops new frames, keeping the stream aligned */
+#define MPU6886_CONFIG_DLPF_176HZ           ( 0x01 )    /* Gyro DLPF, also selects the 1 kHz internal rate */
+#define MPU6886_GYRO_FS_2000DPS             ( 0x18 )
+#define MPU6886_ACCEL_FS_8G                 ( 0x10 )
+#define MPU6886_ACCEL_DLPF_218HZ            ( 0x00 )
+#define MPU6886_FIFO_EN_GYRO_ACCEL          ( 0x18 )
+#define MPU6886_INT_STATUS_FIFO_OFLOW       ( 0x10 )
+#define MPU6886_INT_STATUS_WOM              ( 0xE0 )    /* WOM_X, WOM_Y and WOM_Z */
+#define MPU6886_INT_ENABLE_WOM              ( 0xE0 )
+#define MPU6886_INT_PIN_CFG_LATCH           ( 0x20 )    /* Held high until INT_STATUS is read */
+#define MPU6886_ACCEL_INTEL_WOM             ( 0xC2 )    /* Enabled, compare to previous sample, output limit */
+#define MPU6886_WOM_MG_PER_LSB              ( 4 )
+#define MPU6886_PWR_MGMT_2_GYRO_STANDBY     ( 0x07 )
+#define MPU6886_USER_CTRL_FIFO_EN           ( 0x40 )
+#define MPU6886_USER_CTRL_FIFO_RST          ( 0x04 )
+#define MPU6886_PWR_MGMT_1_CLKSEL_AUTO      ( 0x01 )
+#define MPU6886_PWR_MGMT_1_CYCLE            ( 0x20 )
+
+#define MPU6886_INTERNAL_RATE_HZ            ( 1000 )
+
+static void (*_pWakeFromISR)(void) = NULL;
+static bool _interruptInstalled = false;
+
+/*-----------------------------------------------------------*/
+
+static esp_err_t prvWrite(uint8_t reg, uint8_t value)
+{
+    esp_err_t res = ESP_FAIL;
+    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+
+    i2c_master_start(cmd);
+    i2c_master_write_byte(cmd, (MPU6886_ADDRESS << 1) | I2C_MASTER_WRITE, true);
+    i2c_master_write_byte(cmd, reg, true);
+    i2c_master_write_byte(cmd, value, true);
+    i2c_master_stop(cmd);
+
+    res = i2c_master_cmd_begin(LAB_IMU_I2C_PORT, cmd, pdMS_TO_TICKS(LAB_IMU_I2C_TIMEOUT_MS));
+    i2c_cmd_link_delete(cmd);
+
+    return res;
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Read consecutive bytes in a single transaction. On FIFO_R_W the
+ * address does not increment, so this is also the FIFO burst read.
+ */
+static esp_err_t prvRead(uint8_t reg, uint8_t *pBuffer, size_t length)
+{
+    esp_err_t res = ESP_FAIL;
+    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+
+    i2c_master_start(cmd);
+    i2c_master_write_byte(cmd, (MPU6886_ADDRESS << 1) | I2C_MASTER_WRITE, true);
+    i2c_master_write_byte(cmd, reg, true);
+    i2c_master_start(cmd);
+    i2c_master_write_byte(cmd, (MPU6886_ADDRESS << 1) | I2C_MASTER_READ, true);
+    i2c_master_read(cmd, pBuffer, length, I2C_MASTER_LAST_NACK);
+    i2c_master_stop(cmd);
+
+    res = i2c_master_cmd_begin(LAB_IMU_I2C_PORT, cmd, pdMS_TO_TICKS(LAB_IMU_I2C_TIMEOUT_MS));
+    i2c_cmd_link_delete(cmd);
+
+    return res;
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvInterruptHandler(void *pArgument)
+{
+    /* Edges only come while asleep, a second one before waking is harmless. */
+    if (_pWakeFromISR != NULL)
+    {
+        _pWakeFromISR();
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Route the INT pin to prvInterruptHandler, left disabled until sleep.
+ */
+static esp_err_t prvInstallInterrupt(void)
+{
+    esp_err_t res = ESP_OK;
+    gpio_config_t config = {
+        .pin_bit_mask = 1ULL << LAB_IMU_INT_GPIO,
+        .mode = GPIO_MODE_INPUT,
+        .pull_up_en = GPIO_PULLUP_DISABLE,
+        .pull_down_en = GPIO_PULLDOWN_DISABLE,
+        .intr_type = GPIO_INTR_POSEDGE
+    };
+
+    if (_interruptInstalled)
+    {
+        return ESP_OK;
+    }
+
+    res = gpio_config(&config);
+
+    if (res == ESP_OK)
+    {
+        /* The board support may have installed the service for its buttons. */
+        res = gpio_install_isr_service(0);
+        if (res == ESP_ERR_INVALID_STATE)
+        {
+            res = ESP_OK;
+        }
+    }
+
+    if (res == ESP_OK)
+    {
+        res = gpio_isr_handler_add(LAB_IMU_INT_GPIO, prvInterruptHandler, NULL);
+    }
+
+    if (res == ESP_OK)
+    {
+        gpio_intr_disable(LAB_IMU_INT_GPIO);
+        _interruptInstalled = true;
+    }
+
+    return res;
+}
+
+/*-----------------------------------------------------------*/
+
+static esp_err_t prvFifoReset(void)
+{
+    return prvWrite(MPU6886_USER_CTRL, MPU6886_USER_CTRL_FIFO_EN | MPU6886_USER_CTRL_FIFO_RST);
+}
+
+/*-----------------------------------------------------------*/
+
+static esp_err_t prvInit(uint32_t odrHz, uint32_t motionThresholdMg)
+{
+    esp_err_t res = ESP_OK;
+    uint8_t status = 0;
+    uint8_t threshold = (uint8_t)(motionThresholdMg / MPU6886_WOM_MG_PER_LSB);
+
+    if (odrHz == 0 || odrHz > MPU6886_INTERNAL_RATE_HZ)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    /* Resuming from sleep: no more wake ups. */
+    _pWakeFromISR = NULL;
+    if (_interruptInstalled)
+    {
+        gpio_intr_disable(LAB_IMU_INT_GPIO);
+    }
+
+    res |= prvWrite(MPU6886_PWR_MGMT_1, MPU6886_PWR_MGMT_1_CLKSEL_AUTO);
+    res |= prvWrite(MPU6886_PWR_MGMT_2, 0);
+    vTaskDelay(pdMS_TO_TICKS(10));
+
+    res |= prvWrite(MPU6886_USER_CTRL, 0);
+    res |= prvWrite(MPU6886_FIFO_EN, 0);
+    res |= prvWrite(MPU6886_CONFIG, MPU6886_CONFIG_FIFO_MODE_KEEP | MPU6886_CONFIG_DLPF_176HZ);
+    res |= prvWrite(MPU6886_SMPLRT_DIV, (uint8_t)(MPU6886_INTERNAL_RATE_HZ / odrHz - 1));
+    res |= prvWrite(MPU6886_GYRO_CONFIG, MPU6886_GYRO_FS_2000DPS);
+    res |= prvWrite(MPU6886_ACCEL_CONFIG, MPU6886_ACCEL_FS_8G);
+    res |= prvWrite(MPU6886_ACCEL_CONFIG2, MPU6886_ACCEL_DLPF_218HZ);
+
+    /* Wake-on-motion stays on while sampling: its flags tell when the device
+     * stops moving. */
+    if (threshold > 0)
+    {
+        res |= prvWrite(MPU6886_ACCEL_WOM_X_THR, threshold);
+        res |= prvWrite(MPU6886_ACCEL_WOM_Y_THR, threshold);
+        res |= prvWrite(MPU6886_ACCEL_WOM_Z_THR, threshold);
+        res |= prvWrite(MPU6886_INT_PIN_CFG, MPU6886_INT_PIN_CFG_LATCH);
+        res |= prvWrite(MPU6886_ACCEL_INTEL_CTRL, MPU6886_ACCEL_INTEL_WOM);
+        res |= prvWrite(MPU6886_INT_ENABLE, MPU6886_INT_ENABLE_WOM);
+        res |= prvInstallInterrupt();
+    }
+    else
+    {
+        res |= prvWrite(MPU6886_INT_ENABLE, 0);
+        res |= prvWrite(MPU6886_ACCEL_INTEL_CTRL, 0);
+    }
+
+    /* Start from an empty FIFO and a clear overflow flag. */
+    res |= prvFifoReset();
+    res |= prvRead(MPU6886_INT_STATUS, &status, 1);
+    res |= prvWrite(MPU6886_FIFO_EN, MPU6886_FIFO_EN_GYRO_ACCEL);
+
+    return res == ESP_OK ? ESP_OK : ESP_FAIL;
+}
+
+/*-----------------------------------------------------------*/
+
+static esp_err_t prvFifoCount(uint16_t *pBytes, uint8_t *pStatus)
+{
+    esp_err_t res = ESP_FAIL;
+    uint8_t count[2] = { 0 };
+    uint8_t status = 0;
+
+    /* INT_STATUS is cleared by reading it. */
+    res = prvRead(MPU6886_INT_STATUS, &status, 1);
+    if (res == ESP_OK)
+    {
+        res = prvRead(MPU6886_FIFO_COUNTH, count, sizeof(count));
+    }
+
+    if (res == ESP_OK)
+    {
+        *pBytes = ((uint16_t)(count[0] & 0x1F) << 8) | count[1];
+        *pStatus = ((status & MPU6886_INT_STATUS_FIFO_OFLOW) ? LAB_IMU_STATUS_OVERFLOW : 0) |
+                   ((status & MPU6886_INT_STATUS_WOM) ? LAB_IMU_STATUS_MOTION : 0);
+    }
+
+    return res;
+}
+
+/*-----------------------------------------------------------*/
+
+static esp_err_t prvFifoRead(uint8_t *pBuffer, size_t length)
+{
+    return prvRead(MPU6886_FIFO_R_W, pBuffer, length);
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Gyroscope off, FIFO off, accelerometer in duty cycled low power mode:
+ * only the wake-on-motion logic runs.
+ */
+static esp_err_t prvSleep(void (*pWakeFromISR)(void))
+{
+    esp_err_t res = ESP_OK;
+    uint8_t status = 0;
+
+    if (!_interruptInstalled)
+    {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    res |= prvWrite(MPU6886_FIFO_EN, 0);
+    res |= prvWrite(MPU6886_USER_CTRL, 0);
+    res |= prvWrite(MPU6886_PWR_MGMT_2, MPU6886_PWR_MGMT_2_GYRO_STANDBY);
+    res |= prvWrite(MPU6886_SMPLRT_DIV, (uint8_t)(MPU6886_INTERNAL_RATE_HZ / LAB_IMU_SLEEP_ODR_HZ - 1));
+    res |= prvWrite(MPU6886_PWR_MGMT_1, MPU6886_PWR_MGMT_1_CYCLE | MPU6886_PWR_MGMT_1_CLKSEL_AUTO);
+
+    /* Reading the status releases the latched INT pin, so the next motion is
+     * a rising edge. */
+    res |= prvRead(MPU6886_INT_STATUS, &status, 1);
+    if (res != ESP_OK)
+    {
+        return ESP_FAIL;
+    }
+
+    _pWakeFromISR = pWakeFromISR;
+    gpio_intr_enable(LAB_IMU_INT_GPIO);
+
+    /* Motion between the status read and the interrupt enable left the pin
+     * high, and its edge is gone. */
+    if (gpio_get_level(LAB_IMU_INT_GPIO) != 0)
+    {
+        gpio_intr_disable(LAB_IMU_INT_GPIO);
+        _pWakeFromISR = NULL;
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    return ESP_OK;
+}
+
+/*-----------------------------------------------------------*/
+
+const lab_imu_backend_t lab_imu_mpu6886_backend = {
+    .init = prvInit,
+    .fifoCount = prvFifoCount,
+    .fifoRead = prvFifoRead,
+    .fifoReset = prvFifoReset,
+    .sleep = prvSleep
+};
@@ -0,0 +1,245 @@
+/**
+ * @file lab_imu_sim.c
+ * @brief Simulated backend of the IMU sampling. The FIFO fills at the output
+ * data rate as the real one would, including its overflow behaviour, with
+ * frames in the MPU6886 layout. Its motion interrupt is raised by
+ * vLabImuSimMotion.
+ *
+ * Only built with the backend it stands in for: on the host build, or on the
+ * device with LAB_IMU_SIMULATED. The firmware globs every source of src/.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include <math.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "esp_timer.h"
+
+#include "lab_imu.h"
+
+#if defined(LAB_HOST_BUILD) || defined(LAB_IMU_SIMULATED)
+
+#define LAB_IMU_SIM_PI                      ( 3.14159265f )
+
+/**
+ * @brief Simulated signal: gravity on Z and, while moving, a 5 Hz sway on X and
+ * a 40 Hz vibration on Z, in g, and a slow rotation around Z, in dps.
+ */
+#define LAB_IMU_SIM_SWAY_HZ                 ( 5.0f )
+#define LAB_IMU_SIM_SWAY_G                  ( 0.2f )
+#define LAB_IMU_SIM_VIBRATION_HZ            ( 40.0f )
+#define LAB_IMU_SIM_VIBRATION_G             ( 0.05f )
+#define LAB_IMU_SIM_ROTATION_DPS            ( 10.0f )
+#define LAB_IMU_SIM_TEMP_RAW                ( 1634 )    /* 30 C */
+
+static uint32_t _odrHz = 0;
+static int64_t _lastUs = 0;                 /* Time the last frame was produced */
+static uint32_t _produced = 0;              /* Frames produced since init, lost ones included */
+static uint32_t _next = 0;                  /* Index of the oldest frame in the FIFO */
+static uint32_t _pending = 0;               /* Frames in the FIFO */
+static bool _overflow = false;
+static int64_t _stallUntilUs = 0;
+static uint32_t _thresholdMg = 0;
+static volatile bool _moving = true;
+static bool _asleep = false;
+static void (*_pWakeFromISR)(void) = NULL;
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Produce the frames due since the last call. A full FIFO drops them,
+ * as the MPU6886 in FIFO_MODE 1.
+ */
+static void _advance(void)
+{
+    int64_t nowUs = esp_timer_get_time();
+    uint32_t due = (uint32_t)((nowUs - _lastUs) * _odrHz / 1000000);
+
+    if (due == 0)
+    {
+        return;
+    }
+
+    /* Nothing is sampled while asleep. */
+    if (_asleep)
+    {
+        _lastUs += (int64_t)due * 1000000 / _odrHz;
+        return;
+    }
+
+    _lastUs += (int64_t)due * 1000000 / _odrHz;
+    _produced += due;
+    _pending += due;
+
+    if (_pending > LAB_IMU_FIFO_FRAMES)
+    {
+        _pending = LAB_IMU_FIFO_FRAMES;
+        _overflow = true;
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void _putBe16(uint8_t *p, float value)
+{
+    int16_t raw = (int16_t)lrintf(value);
+
+    p[0] = (uint8_t)((uint16_t)raw >> 8);
+    p[1] = (uint8_t)raw;
+}
+
+/*-----------------------------------------------------------*/
+
+static void _frame(uint32_t index, uint8_t *pFrame)
+{
+    float t = (float)index / _odrHz;
+    float amplitude = _moving ? 1.0f : 0.0f;
+    float sway = amplitude * LAB_IMU_SIM_SWAY_G * sinf(2 * LAB_IMU_SIM_PI * LAB_IMU_SIM_SWAY_HZ * t);
+    float vibration = amplitude * LAB_IMU_SIM_VIBRATION_G * sinf(2 * LAB_IMU_SIM_PI * LAB_IMU_SIM_VIBRATION_HZ * t);
+
+    _putBe16(pFrame + 0, sway * LAB_IMU_ACCEL_LSB_PER_G);
+    _putBe16(pFrame + 2, 0);
+    _putBe16(pFrame + 4, (1.0f + vibration) * LAB_IMU_ACCEL_LSB_PER_G);
+    _putBe16(pFrame + 6, LAB_IMU_SIM_TEMP_RAW);
+    _putBe16(pFrame + 8, 0);
+    _putBe16(pFrame + 10, 0);
+    _putBe16(pFrame + 12, amplitude * LAB_IMU_SIM_ROTATION_DPS * LAB_IMU_GYRO_LSB_PER_DPS);
+}
+
+/*-----------------------------------------------------------*/
+
+static esp_err_t prvFifoReset(void)
+{
+    _advance();
+    _pending = 0;
+    _next = _produced;
+    _overflow = false;
+
+    return ESP_OK;
+}
+
+/*-----------------------------------------------------------*/
+
+static esp_err_t prvInit(uint32_t odrHz, uint32_t motionThresholdMg)
+{
+    if (odrHz == 0 || odrHz > 1000)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    _odrHz = odrHz;
+    _thresholdMg = motionThresholdMg;
+    _pWakeFromISR = NULL;
+    _asleep = false;
+    _lastUs = esp_timer_get_time();
+    _produced = 0;
+
+    return prvFifoReset();
+}
+
+/*-----------------------------------------------------------*/
+
+static esp_err_t prvFifoCount(uint16_t *pBytes, uint8_t *pStatus)
+{
+    int64_t stallUs = _stallUntilUs - esp_timer_get_time();
+
+    /* A stalled bus, for the overrun handling. */
+    if (stallUs > 0)
+    {
+        vTaskDelay(pdMS_TO_TICKS(stallUs / 1000) + 1);
+    }
+
+    _advance();
+
+    *pBytes = (uint16_t)(_pending * LAB_IMU_FRAME_SIZE);
+    *pStatus = (_overflow ? LAB_IMU_STATUS_OVERFLOW : 0) |
+               ((_thresholdMg > 0 && _moving) ? LAB_IMU_STATUS_MOTION : 0);
+    _overflow = false;
+
+    return ESP_OK;
+}
+
+/*-----------------------------------------------------------*/
+
+static esp_err_t prvFifoRead(uint8_t *pBuffer, size_t length)
+{
+    uint32_t frames = length / LAB_IMU_FRAME_SIZE;
+    uint32_t i = 0;
+
+    if (frames > _pending)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    for (i = 0; i < frames; i++)
+    {
+        _frame(_next + i, pBuffer + i * LAB_IMU_FRAME_SIZE);
+    }
+
+    _next += frames;
+    _pending -= frames;
+
+    return ESP_OK;
+}
+
+/*-----------------------------------------------------------*/
+
+static esp_err_t prvSleep(void (*pWakeFromISR)(void))
+{
+    if (_thresholdMg == 0)
+    {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    if (_moving)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    _advance();
+    _pending = 0;
+    _next = _produced;
+    _asleep = true;
+    _pWakeFromISR = pWakeFromISR;
+
+    return ESP_OK;
+}
+
+/*-----------------------------------------------------------*/
+
+void vLabImuSimStall(uint32_t durationMs)
+{
+    _stallUntilUs = esp_timer_get_time() + (int64_t)durationMs * 1000;
+}
+
+/*-----------------------------------------------------------*/
+
+void vLabImuSimMotion(bool moving)
+{
+    void (*pWakeFromISR)(void) = _pWakeFromISR;
+
+    _moving = moving;
+
+    /* The interrupt line: fires once, until the next sleep. */
+    if (moving && pWakeFromISR != NULL)
+    {
+        _pWakeFromISR = NULL;
+        pWakeFromISR();
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+const lab_imu_backend_t lab_imu_sim_backend = {
+    .init = prvInit,
+    .fifoCount = prvFifoCount,
+    .fifoRead = prvFifoRead,
+    .fifoReset = prvFifoReset,
+    .sleep = prvSleep
+};
+
+#endif /* if defined(LAB_HOST_BUILD) || defined(LAB_IMU_SIMULATED) */
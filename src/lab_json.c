@@ -0,0 +1,420 @@
+/**
+ * @file lab_json.c
+ * @brief Single-pass JSON reader. It reads what it is asked for and skips the
+ * rest: it is not a validator, nested values are only checked for balance.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "lab_json.h"
+
+static const char *TAG = "lab_json";
+
+typedef struct {
+    const char *p;
+    const char *pEnd;
+} _reader_t;
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Skip white space; false at the end of the document.
+ */
+static bool _skipSpace(_reader_t *pReader)
+{
+    while (pReader->p < pReader->pEnd &&
+           (*pReader->p == ' ' || *pReader->p == '\t' || *pReader->p == '\r' || *pReader->p == '\n'))
+    {
+        pReader->p++;
+    }
+
+    return pReader->p < pReader->pEnd;
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Read a string, escapes left as they are.
+ */
+static bool _readString(_reader_t *pReader, const char **ppString, size_t *pLength)
+{
+    const char *pStart = NULL;
+
+    if (*pReader->p != '"')
+    {
+        return false;
+    }
+
+    pStart = ++pReader->p;
+
+    for (;;)
+    {
+        const char *pQuote = memchr(pReader->p, '"', (size_t)(pReader->pEnd - pReader->p));
+        const char *pEscape = pQuote;
+
+        if (pQuote == NULL)
+        {
+            return false;
+        }
+
+        /* The quote is escaped after an odd number of backslashes. */
+        while (pEscape > pStart && pEscape[-1] == '\\')
+        {
+            pEscape--;
+        }
+
+        pReader->p = pQuote + 1;
+
+        if (((pQuote - pEscape) & 1) == 0)
+        {
+            *ppString = pStart;
+            *pLength = (size_t)(pQuote - pStart);
+            return true;
+        }
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static inline bool _isDelimiter(char c)
+{
+    switch (c)
+    {
+        case ',': case ':': case ']': case '}': case '[': case '{': case '"':
+        case ' ': case '\t': case '\r': case '\n':
+            return true;
+        default:
+            return false;
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Read a number, true, false or null, up to the next delimiter.
+ */
+static bool _readScalar(_reader_t *pReader, const char **ppToken, size_t *pLength)
+{
+    const char *pStart = pReader->p;
+
+    while (pReader->p < pReader->pEnd && !_isDelimiter(*pReader->p))
+    {
+        pReader->p++;
+    }
+
+    *ppToken = pStart;
+    *pLength = (size_t)(pReader->p - pStart);
+
+    return *pLength > 0;
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Skip a value of any type.
+ */
+static bool _skipValue(_reader_t *pReader)
+{
+    const char *pToken = NULL;
+    size_t length = 0;
+    uint32_t depth = 0;
+
+    do
+    {
+        if (!_skipSpace(pReader))
+        {
+            return false;
+        }
+
+        switch (*pReader->p)
+        {
+            case '"':
+                if (!_readString(pReader, &pToken, &length))
+                {
+                    return false;
+                }
+                break;
+
+            case '{':
+            case '[':
+                if (++depth > LAB_JSON_MAX_DEPTH)
+                {
+                    return false;
+                }
+                pReader->p++;
+                break;
+
+            case '}':
+            case ']':
+                if (depth == 0)
+                {
+                    return false;
+                }
+                depth--;
+                pReader->p++;
+                break;
+
+            case ',':
+            case ':':
+                if (depth == 0)
+                {
+                    return false;
+                }
+                pReader->p++;
+                break;
+
+            default:
+                if (!_readScalar(pReader, &pToken, &length))
+                {
+                    return false;
+                }
+                break;
+        }
+    } while (depth > 0);
+
+    return true;
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Move to the value of the next member of an object whose '{' was read.
+ *
+ * @return  1 at a value, 0 at the end of the object, -1 malformed
+ */
+static int _nextMember(_reader_t *pReader, bool *pFirst, const char **ppKey, size_t *pKeyLength)
+{
+    if (!_skipSpace(pReader))
+    {
+        return -1;
+    }
+
+    if (*pReader->p == '}')
+    {
+        pReader->p++;
+        return 0;
+    }
+
+    if (!*pFirst)
+    {
+        if (*pReader->p != ',')
+        {
+            return -1;
+        }
+
+        pReader->p++;
+
+        if (!_skipSpace(pReader))
+        {
+            return -1;
+        }
+    }
+
+    if (!_readString(pReader, ppKey, pKeyLength) ||
+        !_skipSpace(pReader) ||
+        *pReader->p != ':')
+    {
+        return -1;
+    }
+
+    pReader->p++;
+    *pFirst = false;
+
+    return _skipSpace(pReader) ? 1 : -1;
+}
+
+/*-----------------------------------------------------------*/
+
+static bool _parseInt(const char *pToken, size_t length, int32_t *pValue)
+{
+    bool negative = pToken[0] == '-';
+    int64_t value = 0;
+    size_t i = negative ? 1 : 0;
+
+    if (i == length)
+    {
+        return false;
+    }
+
+    for (; i < length; i++)
+    {
+        if (pToken[i] < '0' || pToken[i] > '9')
+        {
+            return false;
+        }
+
+        value = value * 10 + (pToken[i] - '0');
+
+        if (value > (int64_t)INT32_MAX + 1)
+        {
+            return false;
+        }
+    }
+
+    value = negative ? -value : value;
+
+    if (value > INT32_MAX)
+    {
+        return false;
+    }
+
+    *pValue = (int32_t)value;
+
+    return true;
+}
+
+/*-----------------------------------------------------------*/
+
+static bool _parseBool(const char *pToken, size_t length, int32_t *pValue)
+{
+    if ((length == 4 && memcmp(pToken, "true", 4) == 0) ||
+        (length == 1 && pToken[0] == '1'))
+    {
+        *pValue = 1;
+        return true;
+    }
+
+    if ((length == 5 && memcmp(pToken, "false", 5) == 0) ||
+        (length == 1 && pToken[0] == '0'))
+    {
+        *pValue = 0;
+        return true;
+    }
+
+    return false;
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Read the members of an object whose '{' was read.
+ */
+static bool _readObject(_reader_t *pReader,
+                        const lab_json_field_t *pFields,
+                        size_t fieldCount,
+                        lab_json_value_t *pValues)
+{
+    const char *pKey = NULL;
+    const char *pToken = NULL;
+    size_t keyLength = 0;
+    size_t length = 0;
+    size_t i = 0;
+    bool first = true;
+    int res = 0;
+
+    while ((res = _nextMember(pReader, &first, &pKey, &keyLength)) > 0)
+    {
+        for (i = 0; i < fieldCount; i++)
+        {
+            if (pFields[i].keyLength == keyLength && memcmp(pFields[i].pKey, pKey, keyLength) == 0)
+            {
+                break;
+            }
+        }
+
+        /* Strings, objects and arrays are of no type read. */
+        if (i == fieldCount || *pReader->p == '"' || *pReader->p == '{' || *pReader->p == '[')
+        {
+            if (i < fieldCount)
+            {
+                pValues[i].found = false;
+                ESP_LOGW(TAG, "%s: not a scalar", pFields[i].pKey);
+            }
+
+            if (!_skipValue(pReader))
+            {
+                return false;
+            }
+
+            continue;
+        }
+
+        if (!_readScalar(pReader, &pToken, &length))
+        {
+            return false;
+        }
+
+        pValues[i].found = pFields[i].type == LABJSON_TYPE_BOOL ?
+                           _parseBool(pToken, length, &pValues[i].value) :
+                           _parseInt(pToken, length, &pValues[i].value);
+
+        if (!pValues[i].found)
+        {
+            ESP_LOGW(TAG, "%s: unexpected value %.*s", pFields[i].pKey, (int)length, pToken);
+        }
+    }
+
+    return res == 0;
+}
+
+/*-----------------------------------------------------------*/
+
+esp_err_t eLabJsonRead(const char *pDocument,
+                       size_t documentLength,
+                       const char *pObjectKey,
+                       const lab_json_field_t *pFields,
+                       size_t fieldCount,
+                       lab_json_value_t *pValues)
+{
+    _reader_t reader = { .p = pDocument, .pEnd = pDocument + documentLength };
+    const char *pPath = pObjectKey;
+    const char *pDot = NULL;
+    const char *pKey = NULL;
+    size_t segmentLength = 0;
+    size_t keyLength = 0;
+    bool first = true;
+    int res = 1;
+
+    memset(pValues, 0, fieldCount * sizeof(pValues[0]));
+
+    if (!_skipSpace(&reader) || *reader.p != '{')
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    reader.p++;
+
+    /* Down the path one object at a time; the rest of each is of no use. */
+    while (pPath != NULL && res > 0)
+    {
+        pDot = strchr(pPath, '.');
+        segmentLength = pDot != NULL ? (size_t)(pDot - pPath) : strlen(pPath);
+        first = true;
+
+        while ((res = _nextMember(&reader, &first, &pKey, &keyLength)) > 0)
+        {
+            if (keyLength == segmentLength && memcmp(pKey, pPath, keyLength) == 0 && *reader.p == '{')
+            {
+                reader.p++;
+                break;
+            }
+
+            if (!_skipValue(&reader))
+            {
+                res = -1;
+                break;
+            }
+        }
+
+        pPath = pDot != NULL ? pDot + 1 : NULL;
+    }
+
+    if (res > 0 && !_readObject(&reader, pFields, fieldCount, pValues))
+    {
+        res = -1;
+    }
+
+    if (res < 0)
+    {
+        /* Nothing read from a malformed document is used. */
+        memset(pValues, 0, fieldCount * sizeof(pValues[0]));
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    return res > 0 ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
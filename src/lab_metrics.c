@@ -0,0 +1,182 @@
+/**
+ * @file lab_metrics.c
+ * @brief Latency histograms of MQTT and Shadow operations.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "platform/iot_clock.h"
+#include "esp_log.h"
+
+#include "lab_metrics.h"
+
+static const char *TAG = "lab_metrics";
+
+/* Updated with atomic increments only: recording never blocks the MQTT
+ * callback threads. A snapshot may be off by the operations recorded while
+ * it is taken. */
+static lab_metrics_histogram_t _histograms[LABMETRICS_OP_MAX];
+
+static const char * const _opNames[LABMETRICS_OP_MAX] = {
+    "publish",
+    "shadowUpdate",
+    "connect"
+};
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Bucket of a latency: 0 below 1 ms, then one bucket per power of two.
+ */
+static uint32_t prvBucket(uint32_t elapsedMs)
+{
+    uint32_t bucket = 0;
+
+    if (elapsedMs != 0)
+    {
+        bucket = 32 - __builtin_clz(elapsedMs);
+    }
+
+    return bucket < LAB_METRICS_BUCKETS ? bucket : LAB_METRICS_BUCKETS - 1;
+}
+
+/*-----------------------------------------------------------*/
+
+uint32_t ulLabMetricsStart(void)
+{
+    return (uint32_t)IotClock_GetTimeMs();
+}
+
+/*-----------------------------------------------------------*/
+
+void vLabMetricsRecord(lab_metrics_op_t op, uint32_t startMs, bool success)
+{
+    lab_metrics_histogram_t * histogram = NULL;
+    uint32_t elapsedMs = (uint32_t)IotClock_GetTimeMs() - startMs;
+    uint32_t maxMs = 0;
+
+    if (op >= LABMETRICS_OP_MAX)
+    {
+        return;
+    }
+
+    histogram = &_histograms[op];
+
+    __atomic_fetch_add(&histogram->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->sumMs, elapsedMs, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->buckets[prvBucket(elapsedMs)], 1, __ATOMIC_RELAXED);
+
+    if (!success)
+    {
+        __atomic_fetch_add(&histogram->failures, 1, __ATOMIC_RELAXED);
+    }
+
+    maxMs = __atomic_load_n(&histogram->maxMs, __ATOMIC_RELAXED);
+    while (elapsedMs > maxMs &&
+           !__atomic_compare_exchange_n(&histogram->maxMs, &maxMs, elapsedMs, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+void vLabMetricsGetHistogram(lab_metrics_op_t op, lab_metrics_histogram_t * histogram)
+{
+    uint32_t i = 0;
+
+    memset(histogram, 0, sizeof(lab_metrics_histogram_t));
+
+    if (op >= LABMETRICS_OP_MAX)
+    {
+        return;
+    }
+
+    histogram->count = __atomic_load_n(&_histograms[op].count, __ATOMIC_RELAXED);
+    histogram->failures = __atomic_load_n(&_histograms[op].failures, __ATOMIC_RELAXED);
+    histogram->sumMs = __atomic_load_n(&_histograms[op].sumMs, __ATOMIC_RELAXED);
+    histogram->maxMs = __atomic_load_n(&_histograms[op].maxMs, __ATOMIC_RELAXED);
+
+    for (i = 0; i < LAB_METRICS_BUCKETS; i++)
+    {
+        histogram->buckets[i] = __atomic_load_n(&_histograms[op].buckets[i], __ATOMIC_RELAXED);
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+void vLabMetricsReset(void)
+{
+    memset(_histograms, 0, sizeof(_histograms));
+}
+
+/*-----------------------------------------------------------*/
+
+const char * pcLabMetricsOpName(lab_metrics_op_t op)
+{
+    return op < LABMETRICS_OP_MAX ? _opNames[op] : "unknown";
+}
+
+/*-----------------------------------------------------------*/
+
+size_t xLabMetricsToJson(lab_metrics_op_t op, char * buffer, size_t length)
+{
+    lab_metrics_histogram_t histogram;
+    size_t used = 0;
+    int written = 0;
+    uint32_t i = 0;
+
+    vLabMetricsGetHistogram(op, &histogram);
+
+    written = snprintf(buffer, length, "{\"op\":\"%s\",\"n\":%u,\"fail\":%u,\"sum\":%u,\"max\":%u,\"b\":[",
+                       pcLabMetricsOpName(op), histogram.count, histogram.failures, histogram.sumMs, histogram.maxMs);
+
+    for (i = 0; written > 0 && (size_t)written < length - used && i < LAB_METRICS_BUCKETS; i++)
+    {
+        used += written;
+        written = snprintf(buffer + used, length - used, i == 0 ? "%u" : ",%u", histogram.buckets[i]);
+    }
+
+    if (written > 0 && (size_t)written < length - used)
+    {
+        used += written;
+        written = snprintf(buffer + used, length - used, "]}");
+    }
+
+    if (written <= 0 || (size_t)written >= length - used)
+    {
+        return 0;
+    }
+
+    return used + written;
+}
+
+/*-----------------------------------------------------------*/
+
+void vLabMetricsDump(void)
+{
+    lab_metrics_histogram_t histogram;
+    uint32_t op = 0;
+    uint32_t i = 0;
+
+    for (op = 0; op < LABMETRICS_OP_MAX; op++)
+    {
+        vLabMetricsGetHistogram(op, &histogram);
+
+        ESP_LOGI(TAG, "%s: %u done, %u failed, avg %u ms, max %u ms",
+                 pcLabMetricsOpName(op), histogram.count, histogram.failures,
+                 histogram.count ? histogram.sumMs / histogram.count : 0, histogram.maxMs);
+
+        for (i = 0; i < LAB_METRICS_BUCKETS; i++)
+        {
+            if (histogram.buckets[i] != 0)
+            {
+                ESP_LOGI(TAG, "    %s%u ms: %u", i == LAB_METRICS_BUCKETS - 1 ? ">= " : "< ",
+                         i == LAB_METRICS_BUCKETS - 1 ? 1u << (i - 1) : 1u << i, histogram.buckets[i]);
+            }
+        }
+    }
+}
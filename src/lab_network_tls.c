@@ -0,0 +1,853 @@
+/**
+ * @file lab_network_tls.c
+ * @brief MQTT network interface over lwIP and mbedTLS with TLS session resumption.
+ *
+ * A full TLS handshake costs seconds of CPU on a single core ESP32, most of it
+ * in the asymmetric crypto. After the first handshake, the negotiated session
+ * (session ID and, when the server issues one, session ticket) is cached so
+ * that reconnections only run the abbreviated handshake.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+/* The config header is always included first. */
+#include "iot_config.h"
+
+/* Standard includes. */
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* FreeRTOS includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+/* Platform layer includes. */
+#include "platform/iot_clock.h"
+#include "platform/iot_threads.h"
+
+#include "lwip/sockets.h"
+#include "lwip/netdb.h"
+
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/net_sockets.h"
+#include "mbedtls/ssl.h"
+
+#include "esp_log.h"
+#include "nvs.h"
+
+#include "aws_clientcredential_keys.h"
+#include "iot_default_root_certificates.h"
+
+#include "lab_network_tls.h"
+#include "lab_tls_session.h"
+
+/*-----------------------------------------------------------*/
+
+static const char *TAG = "lab_network_tls";
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Give up on a handshake that takes longer than this.
+ */
+#define TLS_HANDSHAKE_TIMEOUT_MS    ( 20000 )
+
+/**
+ * @brief Timeout of a single socket write.
+ */
+#define TLS_SEND_TIMEOUT_MS         ( 5000 )
+
+#define TLS_SESSION_NVS_NAMESPACE   "lab_tls"
+#define TLS_SESSION_NVS_KEY         "session"
+#define TLS_SESSION_NVS_VERSION     ( 1 )
+
+/**
+ * @brief Largest session ticket kept in NVS.
+ */
+#define TLS_SESSION_TICKET_MAX_LENGTH   ( 512 )
+
+/*-----------------------------------------------------------*/
+
+typedef struct {
+    int socket;
+    mbedtls_ssl_context ssl;
+    mbedtls_ssl_config config;
+    mbedtls_x509_crt rootCa;
+    mbedtls_x509_crt clientCert;
+    mbedtls_pk_context privateKey;
+    const char * pAlpnProtos[2];
+
+    /* mbedTLS contexts are not thread safe: the receive task and the MQTT
+     * send path share the same one. */
+    IotMutex_t sslMutex;
+
+    volatile bool closing;
+    volatile bool destroyPending;
+    IotNetworkReceiveCallback_t receiveCallback;
+    void * pReceiveContext;
+    TaskHandle_t receiveTask;
+    IotSemaphore_t receiveTaskDone;
+} _labTlsConnection_t;
+
+#if LAB_NETWORK_TLS_SESSION_IN_NVS == 1
+    /**
+     * @brief The parts of a session needed to resume it. The server certificate
+     * is not needed by the abbreviated handshake and is not kept.
+     */
+    typedef struct {
+        uint32_t version;
+        int32_t ciphersuite;
+        int32_t compression;
+        uint32_t idLength;
+        unsigned char id[32];
+        unsigned char master[48];
+        uint32_t ticketLifetime;
+        uint32_t ticketLength;
+        unsigned char ticket[TLS_SESSION_TICKET_MAX_LENGTH];
+    } _savedSession_t;
+#endif
+
+/*-----------------------------------------------------------*/
+
+static mbedtls_entropy_context _entropy;
+static mbedtls_ctr_drbg_context _ctrDrbg;
+static bool _rngReady = false;
+
+/* The resumable session, from the last successful handshake, valid while
+ * lab_tls_session tells one is cached. */
+static mbedtls_ssl_session _session;
+
+/*-----------------------------------------------------------*/
+
+static IotNetworkError_t prvCreate(void * pConnectionInfo, void * pCredentialInfo, void ** pConnection);
+static IotNetworkError_t prvClose(void * pConnection);
+static size_t prvSend(void * pConnection, const uint8_t * pMessage, size_t messageLength);
+static size_t prvReceive(void * pConnection, uint8_t * pBuffer, size_t bytesRequested);
+static IotNetworkError_t prvSetReceiveCallback(void * pConnection, IotNetworkReceiveCallback_t receiveCallback, void * pContext);
+static IotNetworkError_t prvDestroy(void * pConnection);
+
+const IotNetworkInterface_t lab_network_tls_interface = {
+    .create = prvCreate,
+    .close = prvClose,
+    .send = prvSend,
+    .receive = prvReceive,
+    .setReceiveCallback = prvSetReceiveCallback,
+    .destroy = prvDestroy
+};
+
+/*-----------------------------------------------------------*/
+
+static int prvBioSend(void * pContext, const unsigned char * pBuffer, size_t length)
+{
+    int ret = send(*(int *)pContext, pBuffer, length, 0);
+
+    if (ret < 0)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+        {
+            return MBEDTLS_ERR_SSL_WANT_WRITE;
+        }
+        return MBEDTLS_ERR_NET_SEND_FAILED;
+    }
+
+    return ret;
+}
+
+/*-----------------------------------------------------------*/
+
+static int prvBioRecv(void * pContext, unsigned char * pBuffer, size_t length)
+{
+    int ret = recv(*(int *)pContext, pBuffer, length, 0);
+
+    if (ret < 0)
+    {
+        /* SO_RCVTIMEO expired: let the caller decide whether to wait more. */
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+        {
+            return MBEDTLS_ERR_SSL_WANT_READ;
+        }
+        return MBEDTLS_ERR_NET_RECV_FAILED;
+    }
+
+    return ret;
+}
+
+/*-----------------------------------------------------------*/
+
+static bool prvSetupRng(void)
+{
+    if (_rngReady)
+    {
+        return true;
+    }
+
+    mbedtls_entropy_init(&_entropy);
+    mbedtls_ctr_drbg_init(&_ctrDrbg);
+
+    if (mbedtls_ctr_drbg_seed(&_ctrDrbg, mbedtls_entropy_func, &_entropy, (const unsigned char *)TAG, strlen(TAG)) != 0)
+    {
+        ESP_LOGE(TAG, "prvSetupRng: Failed to seed the DRBG");
+        mbedtls_ctr_drbg_free(&_ctrDrbg);
+        mbedtls_entropy_free(&_entropy);
+        return false;
+    }
+
+    _rngReady = true;
+    return true;
+}
+
+/*-----------------------------------------------------------*/
+
+#if LAB_NETWORK_TLS_SESSION_IN_NVS == 1
+
+static void prvSaveSession(void)
+{
+    static _savedSession_t saved;
+    nvs_handle handle;
+
+    if (_session.ticket_len > TLS_SESSION_TICKET_MAX_LENGTH || _session.id_len > sizeof(saved.id))
+    {
+        return;
+    }
+
+    memset(&saved, 0, sizeof(saved));
+    saved.version = TLS_SESSION_NVS_VERSION;
+    saved.ciphersuite = _session.ciphersuite;
+    saved.compression = _session.compression;
+    saved.idLength = _session.id_len;
+    memcpy(saved.id, _session.id, _session.id_len);
+    memcpy(saved.master, _session.master, sizeof(saved.master));
+    saved.ticketLifetime = _session.ticket_lifetime;
+    saved.ticketLength = _session.ticket_len;
+    if (_session.ticket != NULL)
+    {
+        memcpy(saved.ticket, _session.ticket, _session.ticket_len);
+    }
+
+    if (nvs_open(TLS_SESSION_NVS_NAMESPACE, NVS_READWRITE, &handle) == ESP_OK)
+    {
+        if (nvs_set_blob(handle, TLS_SESSION_NVS_KEY, &saved, sizeof(saved)) == ESP_OK)
+        {
+            nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvLoadSession(void)
+{
+    static _savedSession_t saved;
+    size_t length = sizeof(saved);
+    nvs_handle handle;
+
+    if (nvs_open(TLS_SESSION_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK)
+    {
+        return;
+    }
+
+    if (nvs_get_blob(handle, TLS_SESSION_NVS_KEY, &saved, &length) == ESP_OK &&
+        length == sizeof(saved) &&
+        saved.version == TLS_SESSION_NVS_VERSION &&
+        saved.idLength <= sizeof(saved.id) &&
+        saved.ticketLength <= TLS_SESSION_TICKET_MAX_LENGTH)
+    {
+        mbedtls_ssl_session_init(&_session);
+        _session.ciphersuite = saved.ciphersuite;
+        _session.compression = saved.compression;
+        _session.id_len = saved.idLength;
+        memcpy(_session.id, saved.id, saved.idLength);
+        memcpy(_session.master, saved.master, sizeof(saved.master));
+        _session.ticket_lifetime = saved.ticketLifetime;
+
+        if (saved.ticketLength > 0)
+        {
+            _session.ticket = malloc(saved.ticketLength);
+            if (_session.ticket != NULL)
+            {
+                memcpy(_session.ticket, saved.ticket, saved.ticketLength);
+                _session.ticket_len = saved.ticketLength;
+            }
+        }
+
+        vLabTlsSessionSetCached(true);
+        ESP_LOGI(TAG, "prvLoadSession: Restored TLS session from NVS");
+    }
+
+    nvs_close(handle);
+}
+
+static void prvEraseSession(void)
+{
+    nvs_handle handle;
+
+    if (nvs_open(TLS_SESSION_NVS_NAMESPACE, NVS_READWRITE, &handle) == ESP_OK)
+    {
+        nvs_erase_key(handle, TLS_SESSION_NVS_KEY);
+        nvs_commit(handle);
+        nvs_close(handle);
+    }
+}
+
+#else
+
+    #define prvSaveSession()
+    #define prvLoadSession()
+    #define prvEraseSession()
+
+#endif /* LAB_NETWORK_TLS_SESSION_IN_NVS == 1 */
+
+/*-----------------------------------------------------------*/
+
+static void prvFreeConnection(_labTlsConnection_t * pTlsConnection)
+{
+    if (pTlsConnection->socket >= 0)
+    {
+        close(pTlsConnection->socket);
+    }
+
+    mbedtls_ssl_free(&pTlsConnection->ssl);
+    mbedtls_ssl_config_free(&pTlsConnection->config);
+    mbedtls_x509_crt_free(&pTlsConnection->rootCa);
+    mbedtls_x509_crt_free(&pTlsConnection->clientCert);
+    mbedtls_pk_free(&pTlsConnection->privateKey);
+
+    if (pTlsConnection->receiveTask != NULL)
+    {
+        IotSemaphore_Destroy(&pTlsConnection->receiveTaskDone);
+    }
+
+    IotMutex_Destroy(&pTlsConnection->sslMutex);
+    free(pTlsConnection);
+}
+
+/*-----------------------------------------------------------*/
+
+static int prvConnectSocket(const IotNetworkServerInfo_t * pServerInfo)
+{
+    struct addrinfo hints = { 0 };
+    struct addrinfo * pAddresses = NULL;
+    char port[6] = { 0 };
+    int sock = -1;
+
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(port, sizeof(port), "%u", pServerInfo->port);
+
+    if (getaddrinfo(pServerInfo->pHostName, port, &hints, &pAddresses) != 0 || pAddresses == NULL)
+    {
+        ESP_LOGE(TAG, "prvConnectSocket: Failed to resolve %s", pServerInfo->pHostName);
+        return -1;
+    }
+
+    sock = socket(pAddresses->ai_family, pAddresses->ai_socktype, pAddresses->ai_protocol);
+
+    if (sock >= 0 && connect(sock, pAddresses->ai_addr, pAddresses->ai_addrlen) != 0)
+    {
+        ESP_LOGE(TAG, "prvConnectSocket: Failed to connect to %s:%s", pServerInfo->pHostName, port);
+        close(sock);
+        sock = -1;
+    }
+
+    freeaddrinfo(pAddresses);
+
+    if (sock >= 0)
+    {
+        struct timeval timeout = {
+            .tv_sec = LAB_NETWORK_TLS_RECV_TIMEOUT_MS / 1000,
+            .tv_usec = (LAB_NETWORK_TLS_RECV_TIMEOUT_MS % 1000) * 1000
+        };
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        timeout.tv_sec = TLS_SEND_TIMEOUT_MS / 1000;
+        timeout.tv_usec = (TLS_SEND_TIMEOUT_MS % 1000) * 1000;
+        setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    }
+
+    return sock;
+}
+
+/*-----------------------------------------------------------*/
+
+static int prvSetupTls(_labTlsConnection_t * pTlsConnection,
+                       const IotNetworkServerInfo_t * pServerInfo,
+                       const IotNetworkCredentials_t * pCredentials)
+{
+    int ret = 0;
+
+    /* Defaults to the Amazon root CA and to the workshop credentials. */
+    const char * pRootCa = tlsATS1_ROOT_CERTIFICATE_PEM;
+    size_t rootCaSize = tlsATS1_ROOT_CERTIFICATE_LENGTH;
+    const char * pClientCert = keyCLIENT_CERTIFICATE_PEM;
+    size_t clientCertSize = sizeof(keyCLIENT_CERTIFICATE_PEM);
+    const char * pPrivateKey = keyCLIENT_PRIVATE_KEY_PEM;
+    size_t privateKeySize = sizeof(keyCLIENT_PRIVATE_KEY_PEM);
+
+    if (pCredentials != NULL && pCredentials->pRootCa != NULL)
+    {
+        pRootCa = pCredentials->pRootCa;
+        rootCaSize = pCredentials->rootCaSize;
+    }
+    if (pCredentials != NULL && pCredentials->pClientCert != NULL)
+    {
+        pClientCert = pCredentials->pClientCert;
+        clientCertSize = pCredentials->clientCertSize;
+    }
+    if (pCredentials != NULL && pCredentials->pPrivateKey != NULL)
+    {
+        pPrivateKey = pCredentials->pPrivateKey;
+        privateKeySize = pCredentials->privateKeySize;
+    }
+
+    ret = mbedtls_x509_crt_parse(&pTlsConnection->rootCa, (const unsigned char *)pRootCa, rootCaSize);
+    if (ret == 0)
+    {
+        ret = mbedtls_x509_crt_parse(&pTlsConnection->clientCert, (const unsigned char *)pClientCert, clientCertSize);
+    }
+    if (ret == 0)
+    {
+        ret = mbedtls_pk_parse_key(&pTlsConnection->privateKey, (const unsigned char *)pPrivateKey, privateKeySize, NULL, 0);
+    }
+    if (ret != 0)
+    {
+        ESP_LOGE(TAG, "prvSetupTls: Failed to parse credentials: -0x%x", -ret);
+        return ret;
+    }
+
+    ret = mbedtls_ssl_config_defaults(&pTlsConnection->config,
+                                      MBEDTLS_SSL_IS_CLIENT,
+                                      MBEDTLS_SSL_TRANSPORT_STREAM,
+                                      MBEDTLS_SSL_PRESET_DEFAULT);
+    if (ret != 0)
+    {
+        return ret;
+    }
+
+    mbedtls_ssl_conf_authmode(&pTlsConnection->config, MBEDTLS_SSL_VERIFY_REQUIRED);
+    mbedtls_ssl_conf_ca_chain(&pTlsConnection->config, &pTlsConnection->rootCa, NULL);
+    mbedtls_ssl_conf_rng(&pTlsConnection->config, mbedtls_ctr_drbg_random, &_ctrDrbg);
+    mbedtls_ssl_conf_session_tickets(&pTlsConnection->config, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+
+    ret = mbedtls_ssl_conf_own_cert(&pTlsConnection->config, &pTlsConnection->clientCert, &pTlsConnection->privateKey);
+
+    if (ret == 0 && pCredentials != NULL && pCredentials->pAlpnProtos != NULL)
+    {
+        pTlsConnection->pAlpnProtos[0] = pCredentials->pAlpnProtos;
+        pTlsConnection->pAlpnProtos[1] = NULL;
+        ret = mbedtls_ssl_conf_alpn_protocols(&pTlsConnection->config, pTlsConnection->pAlpnProtos);
+    }
+
+    if (ret == 0)
+    {
+        ret = mbedtls_ssl_setup(&pTlsConnection->ssl, &pTlsConnection->config);
+    }
+
+    if (ret == 0 && (pCredentials == NULL || pCredentials->disableSni == false))
+    {
+        ret = mbedtls_ssl_set_hostname(&pTlsConnection->ssl, pServerInfo->pHostName);
+    }
+
+    if (ret == 0)
+    {
+        mbedtls_ssl_set_bio(&pTlsConnection->ssl, &pTlsConnection->socket, prvBioSend, prvBioRecv, NULL);
+
+        /* Offer the cached session. The server falls back to a full handshake
+         * if it no longer knows it. */
+        if (bLabTlsSessionIsCached())
+        {
+            ret = mbedtls_ssl_set_session(&pTlsConnection->ssl, &_session);
+        }
+    }
+
+    return ret;
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Tell why a handshake failed, from the mbedTLS error.
+ */
+static lab_tls_handshake_failure_t prvHandshakeFailure(int ret)
+{
+    switch (ret)
+    {
+        case MBEDTLS_ERR_SSL_WANT_READ:
+        case MBEDTLS_ERR_SSL_WANT_WRITE:
+        case MBEDTLS_ERR_SSL_TIMEOUT:
+            return LAB_TLS_HANDSHAKE_TIMED_OUT;
+
+        case MBEDTLS_ERR_NET_SEND_FAILED:
+        case MBEDTLS_ERR_NET_RECV_FAILED:
+        case MBEDTLS_ERR_SSL_CONN_EOF:
+            return LAB_TLS_HANDSHAKE_NETWORK_ERROR;
+
+        case MBEDTLS_ERR_SSL_FATAL_ALERT_MESSAGE:
+            return LAB_TLS_HANDSHAKE_ALERT;
+
+        /* What a server answering a session it no longer knows, or resuming
+         * it with other secrets, would cause. */
+        case MBEDTLS_ERR_SSL_BAD_HS_SERVER_HELLO:
+        case MBEDTLS_ERR_SSL_BAD_HS_CHANGE_CIPHER_SPEC:
+        case MBEDTLS_ERR_SSL_BAD_HS_FINISHED:
+        case MBEDTLS_ERR_SSL_BAD_HS_NEW_SESSION_TICKET:
+        case MBEDTLS_ERR_SSL_INVALID_MAC:
+        case MBEDTLS_ERR_SSL_UNEXPECTED_MESSAGE:
+            return LAB_TLS_HANDSHAKE_REJECTED;
+
+        default:
+            return LAB_TLS_HANDSHAKE_LOCAL_ERROR;
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static int prvHandshake(_labTlsConnection_t * pTlsConnection)
+{
+    int ret = 0;
+    uint64_t startMs = IotClock_GetTimeMs();
+    uint32_t durationMs = 0;
+    bool resumed = false;
+    lab_network_tls_stats_t stats;
+
+    do
+    {
+        ret = mbedtls_ssl_handshake(&pTlsConnection->ssl);
+    } while ((ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) &&
+             (IotClock_GetTimeMs() - startMs) < TLS_HANDSHAKE_TIMEOUT_MS);
+
+    durationMs = (uint32_t)(IotClock_GetTimeMs() - startMs);
+
+    if (ret != 0)
+    {
+        ESP_LOGE(TAG, "prvHandshake: Failed after %u ms: -0x%x", durationMs, -ret);
+
+        /* Do not keep offering a session the server may have refused. */
+        if (bLabTlsSessionHandshakeFailed(prvHandshakeFailure(ret)))
+        {
+            ESP_LOGW(TAG, "prvHandshake: Forgetting the cached session");
+            vLabNetworkTlsForgetSession();
+        }
+        return ret;
+    }
+
+    /* A resumed session keeps the master secret of the cached one. */
+    resumed = bLabTlsSessionIsCached() &&
+              memcmp(pTlsConnection->ssl.session->master, _session.master, sizeof(_session.master)) == 0;
+
+    vLabTlsSessionHandshakeDone(resumed, durationMs);
+    vLabTlsSessionGetStats(&stats);
+
+    ESP_LOGI(TAG, "prvHandshake: %s handshake in %u ms (%u of %u resumed, %llu ms full vs %llu ms resumed on average)",
+             resumed ? "Resumed" : "Full", durationMs, stats.resumed, stats.handshakes,
+             stats.handshakes > stats.resumed ? stats.totalFullHandshakeMs / (stats.handshakes - stats.resumed) : 0ULL,
+             stats.resumed > 0 ? stats.totalResumedHandshakeMs / stats.resumed : 0ULL);
+
+    /* Cache the session for the next connection. The server may have issued a
+     * new ticket even when resuming. */
+    mbedtls_ssl_session_free(&_session);
+    mbedtls_ssl_session_init(&_session);
+    vLabTlsSessionSetCached(mbedtls_ssl_get_session(&pTlsConnection->ssl, &_session) == 0);
+
+    if (bLabTlsSessionIsCached())
+    {
+        prvSaveSession();
+    }
+
+    return 0;
+}
+
+/*-----------------------------------------------------------*/
+
+static IotNetworkError_t prvCreate(void * pConnectionInfo, void * pCredentialInfo, void ** pConnection)
+{
+    const IotNetworkServerInfo_t * pServerInfo = (const IotNetworkServerInfo_t *)pConnectionInfo;
+    const IotNetworkCredentials_t * pCredentials = (const IotNetworkCredentials_t *)pCredentialInfo;
+    _labTlsConnection_t * pTlsConnection = NULL;
+
+    if (pServerInfo == NULL || pConnection == NULL)
+    {
+        return IOT_NETWORK_BAD_PARAMETER;
+    }
+
+    if (!prvSetupRng())
+    {
+        return IOT_NETWORK_SYSTEM_ERROR;
+    }
+
+    pTlsConnection = calloc(1, sizeof(_labTlsConnection_t));
+    if (pTlsConnection == NULL)
+    {
+        return IOT_NETWORK_NO_MEMORY;
+    }
+
+    pTlsConnection->socket = -1;
+    mbedtls_ssl_init(&pTlsConnection->ssl);
+    mbedtls_ssl_config_init(&pTlsConnection->config);
+    mbedtls_x509_crt_init(&pTlsConnection->rootCa);
+    mbedtls_x509_crt_init(&pTlsConnection->clientCert);
+    mbedtls_pk_init(&pTlsConnection->privateKey);
+
+    if (!IotMutex_Create(&pTlsConnection->sslMutex, false))
+    {
+        mbedtls_ssl_free(&pTlsConnection->ssl);
+        mbedtls_ssl_config_free(&pTlsConnection->config);
+        free(pTlsConnection);
+        return IOT_NETWORK_NO_MEMORY;
+    }
+
+    pTlsConnection->socket = prvConnectSocket(pServerInfo);
+
+    if (pTlsConnection->socket < 0 ||
+        prvSetupTls(pTlsConnection, pServerInfo, pCredentials) != 0 ||
+        prvHandshake(pTlsConnection) != 0)
+    {
+        prvFreeConnection(pTlsConnection);
+        return IOT_NETWORK_FAILURE;
+    }
+
+    *pConnection = pTlsConnection;
+
+    return IOT_NETWORK_SUCCESS;
+}
+
+/*-----------------------------------------------------------*/
+
+static IotNetworkError_t prvClose(void * pConnection)
+{
+    _labTlsConnection_t * pTlsConnection = (_labTlsConnection_t *)pConnection;
+
+    if (pTlsConnection->closing)
+    {
+        return IOT_NETWORK_SUCCESS;
+    }
+
+    pTlsConnection->closing = true;
+
+    IotMutex_Lock(&pTlsConnection->sslMutex);
+    mbedtls_ssl_close_notify(&pTlsConnection->ssl);
+    IotMutex_Unlock(&pTlsConnection->sslMutex);
+
+    /* Wakes up the receive task. */
+    shutdown(pTlsConnection->socket, SHUT_RDWR);
+
+    return IOT_NETWORK_SUCCESS;
+}
+
+/*-----------------------------------------------------------*/
+
+static size_t prvSend(void * pConnection, const uint8_t * pMessage, size_t messageLength)
+{
+    _labTlsConnection_t * pTlsConnection = (_labTlsConnection_t *)pConnection;
+    size_t sent = 0;
+    int ret = 0;
+
+    IotMutex_Lock(&pTlsConnection->sslMutex);
+
+    while (sent < messageLength && !pTlsConnection->closing)
+    {
+        ret = mbedtls_ssl_write(&pTlsConnection->ssl, pMessage + sent, messageLength - sent);
+
+        if (ret > 0)
+        {
+            sent += (size_t)ret;
+        }
+        else if (ret != MBEDTLS_ERR_SSL_WANT_WRITE && ret != MBEDTLS_ERR_SSL_WANT_READ)
+        {
+            ESP_LOGE(TAG, "prvSend: Failed: -0x%x", -ret);
+            break;
+        }
+    }
+
+    IotMutex_Unlock(&pTlsConnection->sslMutex);
+
+    return sent;
+}
+
+/*-----------------------------------------------------------*/
+
+static size_t prvReceive(void * pConnection, uint8_t * pBuffer, size_t bytesRequested)
+{
+    _labTlsConnection_t * pTlsConnection = (_labTlsConnection_t *)pConnection;
+    size_t received = 0;
+    int ret = 0;
+
+    /* The lock is taken per read so that a send is never held up for longer
+     * than LAB_NETWORK_TLS_RECV_TIMEOUT_MS. */
+    while (received < bytesRequested && !pTlsConnection->closing)
+    {
+        IotMutex_Lock(&pTlsConnection->sslMutex);
+        ret = mbedtls_ssl_read(&pTlsConnection->ssl, pBuffer + received, bytesRequested - received);
+        IotMutex_Unlock(&pTlsConnection->sslMutex);
+
+        if (ret > 0)
+        {
+            received += (size_t)ret;
+        }
+        else if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE)
+        {
+            /* Connection closed by the peer, or failed. */
+            break;
+        }
+    }
+
+    return received;
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Calls the MQTT receive callback whenever data is available.
+ */
+static void prvReceiveTask(void * pArgument)
+{
+    _labTlsConnection_t * pTlsConnection = (_labTlsConnection_t *)pArgument;
+    fd_set readSet;
+    struct timeval timeout;
+    size_t pending = 0;
+
+    while (!pTlsConnection->closing)
+    {
+        /* Data may already be decrypted and waiting in mbedTLS. */
+        IotMutex_Lock(&pTlsConnection->sslMutex);
+        pending = mbedtls_ssl_get_bytes_avail(&pTlsConnection->ssl);
+        IotMutex_Unlock(&pTlsConnection->sslMutex);
+
+        if (pending == 0)
+        {
+            FD_ZERO(&readSet);
+            FD_SET(pTlsConnection->socket, &readSet);
+            timeout.tv_sec = LAB_NETWORK_TLS_RECV_TIMEOUT_MS / 1000;
+            timeout.tv_usec = (LAB_NETWORK_TLS_RECV_TIMEOUT_MS % 1000) * 1000;
+
+            int ready = select(pTlsConnection->socket + 1, &readSet, NULL, NULL, &timeout);
+
+            if (ready < 0)
+            {
+                break;
+            }
+            if (ready == 0)
+            {
+                continue;
+            }
+        }
+
+        pTlsConnection->receiveCallback(pTlsConnection, pTlsConnection->pReceiveContext);
+
+        if (pTlsConnection->destroyPending)
+        {
+            break;
+        }
+    }
+
+    if (pTlsConnection->destroyPending)
+    {
+        /* Destroyed from within the receive callback: clean up on its behalf. */
+        prvFreeConnection(pTlsConnection);
+    }
+    else
+    {
+        IotSemaphore_Post(&pTlsConnection->receiveTaskDone);
+    }
+
+    vTaskDelete(NULL);
+}
+
+/*-----------------------------------------------------------*/
+
+static IotNetworkError_t prvSetReceiveCallback(void * pConnection, IotNetworkReceiveCallback_t receiveCallback, void * pContext)
+{
+    _labTlsConnection_t * pTlsConnection = (_labTlsConnection_t *)pConnection;
+
+    if (pTlsConnection == NULL || receiveCallback == NULL || pTlsConnection->receiveTask != NULL)
+    {
+        return IOT_NETWORK_BAD_PARAMETER;
+    }
+
+    pTlsConnection->receiveCallback = receiveCallback;
+    pTlsConnection->pReceiveContext = pContext;
+
+    if (!IotSemaphore_Create(&pTlsConnection->receiveTaskDone, 0, 1))
+    {
+        return IOT_NETWORK_NO_MEMORY;
+    }
+
+    if (xTaskCreate(prvReceiveTask,
+                    "TlsRecv",
+                    LAB_NETWORK_TLS_RECEIVE_TASK_STACK_SIZE,
+                    pTlsConnection,
+                    LAB_NETWORK_TLS_RECEIVE_TASK_PRIORITY,
+                    &pTlsConnection->receiveTask) != pdPASS)
+    {
+        IotSemaphore_Destroy(&pTlsConnection->receiveTaskDone);
+        pTlsConnection->receiveTask = NULL;
+        return IOT_NETWORK_NO_MEMORY;
+    }
+
+    return IOT_NETWORK_SUCCESS;
+}
+
+/*-----------------------------------------------------------*/
+
+static IotNetworkError_t prvDestroy(void * pConnection)
+{
+    _labTlsConnection_t * pTlsConnection = (_labTlsConnection_t *)pConnection;
+
+    pTlsConnection->closing = true;
+
+    if (pTlsConnection->receiveTask != NULL)
+    {
+        if (pTlsConnection->receiveTask == xTaskGetCurrentTaskHandle())
+        {
+            pTlsConnection->destroyPending = true;
+            return IOT_NETWORK_SUCCESS;
+        }
+
+        shutdown(pTlsConnection->socket, SHUT_RDWR);
+        IotSemaphore_Wait(&pTlsConnection->receiveTaskDone);
+    }
+
+    prvFreeConnection(pTlsConnection);
+
+    return IOT_NETWORK_SUCCESS;
+}
+
+/*-----------------------------------------------------------*/
+
+esp_err_t eLabNetworkTlsInit(void)
+{
+    if (!bLabTlsSessionIsCached())
+    {
+        mbedtls_ssl_session_init(&_session);
+        prvLoadSession();
+    }
+
+    return prvSetupRng() ? ESP_OK : ESP_FAIL;
+}
+
+/*-----------------------------------------------------------*/
+
+void vLabNetworkTlsForgetSession(void)
+{
+    if (bLabTlsSessionIsCached())
+    {
+        mbedtls_ssl_session_free(&_session);
+        mbedtls_ssl_session_init(&_session);
+        vLabTlsSessionSetCached(false);
+        prvEraseSession();
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+void vLabNetworkTlsGetStats(lab_network_tls_stats_t * stats)
+{
+    vLabTlsSessionGetStats(stats);
+}
+
+/*-----------------------------------------------------------*/
@@ -0,0 +1,356 @@
+/**
+ * @file lab_offline_queue.c
+ * @brief Bounded store-and-forward queue for publishes made while MQTT is down.
+ *
+ * Publishes are kept in the `storage` NVS partition so they survive a reboot.
+ * Each entry lives in its own blob, keyed by its slot in a ring of
+ * LAB_OFFLINE_QUEUE_CAPACITY slots. The head (oldest) and tail (next free)
+ * sequence numbers are stored next to them.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+/* The config header is always included first. */
+#include "iot_config.h"
+
+/* Standard includes. */
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Platform layer includes. */
+#include "platform/iot_threads.h"
+
+#include "esp_log.h"
+#include "nvs.h"
+#include "nvs_flash.h"
+
+#include "lab_offline_queue.h"
+
+/*-----------------------------------------------------------*/
+
+static const char *TAG = "lab_offline_queue";
+
+/*-----------------------------------------------------------*/
+
+#define OFFLINE_QUEUE_NAMESPACE         "offline_q"
+#define OFFLINE_QUEUE_KEY_HEAD          "head"
+#define OFFLINE_QUEUE_KEY_TAIL          "tail"
+#define OFFLINE_QUEUE_KEY_DROPPED       "dropped"
+
+/**
+ * @brief Entry keys are "m" followed by the slot number.
+ */
+#define OFFLINE_QUEUE_KEY_ENTRY_FORMAT  "m%u"
+#define OFFLINE_QUEUE_KEY_MAX_LENGTH    ( 16 )
+
+/**
+ * @brief Only the header and the used part of the topic and payload are written.
+ */
+#define OFFLINE_QUEUE_ENTRY_HEADER_SIZE ( offsetof(lab_offline_queue_entry_t, data) )
+
+/*-----------------------------------------------------------*/
+
+static nvs_handle xQueueHandle;
+static IotMutex_t xQueueMutex;
+static bool bQueueReady = false;
+
+/* Sequence numbers of the oldest entry and of the next entry to write. */
+static uint32_t ulHead = 0;
+static uint32_t ulTail = 0;
+
+static lab_offline_queue_stats_t xStats = {
+    .capacity = LAB_OFFLINE_QUEUE_CAPACITY
+};
+
+/* The oldest entry could not be read: its pop counts it as corrupted. */
+static bool bHeadCorrupted = false;
+
+/* Scratch entry used by eLabOfflineQueuePush, protected by xQueueMutex. */
+static lab_offline_queue_entry_t xPushEntry;
+
+/*-----------------------------------------------------------*/
+
+static void prvEntryKey(uint32_t sequence, char * key)
+{
+    snprintf(key, OFFLINE_QUEUE_KEY_MAX_LENGTH, OFFLINE_QUEUE_KEY_ENTRY_FORMAT,
+             (unsigned)(sequence % LAB_OFFLINE_QUEUE_CAPACITY));
+}
+
+/*-----------------------------------------------------------*/
+
+static esp_err_t prvSaveIndexes(void)
+{
+    esp_err_t res = nvs_set_u32(xQueueHandle, OFFLINE_QUEUE_KEY_HEAD, ulHead);
+
+    if (res == ESP_OK)
+    {
+        res = nvs_set_u32(xQueueHandle, OFFLINE_QUEUE_KEY_TAIL, ulTail);
+    }
+    if (res == ESP_OK)
+    {
+        res = nvs_set_u32(xQueueHandle, OFFLINE_QUEUE_KEY_DROPPED, xStats.dropped);
+    }
+    if (res == ESP_OK)
+    {
+        res = nvs_commit(xQueueHandle);
+    }
+
+    return res;
+}
+
+/*-----------------------------------------------------------*/
+
+esp_err_t eLabOfflineQueueInit(void)
+{
+    esp_err_t res = ESP_OK;
+
+    if (bQueueReady)
+    {
+        return ESP_OK;
+    }
+
+    res = nvs_flash_init_partition(LAB_OFFLINE_QUEUE_PARTITION);
+    if ((res == ESP_ERR_NVS_NO_FREE_PAGES) || (res == ESP_ERR_NVS_NEW_VERSION_FOUND))
+    {
+        ESP_LOGW(TAG, "eLabOfflineQueueInit: Erasing partition %s", LAB_OFFLINE_QUEUE_PARTITION);
+        res = nvs_flash_erase_partition(LAB_OFFLINE_QUEUE_PARTITION);
+        if (res == ESP_OK)
+        {
+            res = nvs_flash_init_partition(LAB_OFFLINE_QUEUE_PARTITION);
+        }
+    }
+
+    if (res == ESP_OK)
+    {
+        res = nvs_open_from_partition(LAB_OFFLINE_QUEUE_PARTITION, OFFLINE_QUEUE_NAMESPACE, NVS_READWRITE, &xQueueHandle);
+    }
+
+    if (res != ESP_OK)
+    {
+        ESP_LOGE(TAG, "eLabOfflineQueueInit: Failed to open partition %s: %s", LAB_OFFLINE_QUEUE_PARTITION, esp_err_to_name(res));
+        return ESP_FAIL;
+    }
+
+    /* Missing keys simply mean an empty queue. */
+    nvs_get_u32(xQueueHandle, OFFLINE_QUEUE_KEY_HEAD, &ulHead);
+    nvs_get_u32(xQueueHandle, OFFLINE_QUEUE_KEY_TAIL, &ulTail);
+    nvs_get_u32(xQueueHandle, OFFLINE_QUEUE_KEY_DROPPED, &xStats.dropped);
+
+    if ((uint32_t)(ulTail - ulHead) > LAB_OFFLINE_QUEUE_CAPACITY)
+    {
+        ESP_LOGW(TAG, "eLabOfflineQueueInit: Inconsistent indexes (%u, %u), resetting", ulHead, ulTail);
+        ulHead = ulTail = 0;
+        prvSaveIndexes();
+    }
+
+    if (!IotMutex_Create(&xQueueMutex, false))
+    {
+        ESP_LOGE(TAG, "eLabOfflineQueueInit: Failed to create mutex");
+        nvs_close(xQueueHandle);
+        return ESP_FAIL;
+    }
+
+    xStats.depth = ulTail - ulHead;
+    bQueueReady = true;
+
+    ESP_LOGI(TAG, "eLabOfflineQueueInit: %u queued, %u dropped", xStats.depth, xStats.dropped);
+
+    return ESP_OK;
+}
+
+/*-----------------------------------------------------------*/
+
+esp_err_t eLabOfflineQueuePush(const IotMqttPublishInfo_t * publishInfo)
+{
+    esp_err_t res = ESP_OK;
+    char key[OFFLINE_QUEUE_KEY_MAX_LENGTH] = { 0 };
+
+    if (!bQueueReady || publishInfo == NULL)
+    {
+        return ESP_FAIL;
+    }
+
+    if (publishInfo->topicNameLength > LAB_OFFLINE_QUEUE_TOPIC_MAX_LENGTH ||
+        publishInfo->payloadLength > LAB_OFFLINE_QUEUE_PAYLOAD_MAX_LENGTH)
+    {
+        IotMutex_Lock(&xQueueMutex);
+        xStats.rejected++;
+        IotMutex_Unlock(&xQueueMutex);
+
+        ESP_LOGE(TAG, "eLabOfflineQueuePush: Publish too large (%u, %u)", publishInfo->topicNameLength, (unsigned)publishInfo->payloadLength);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    IotMutex_Lock(&xQueueMutex);
+
+    /* Make room by dropping the oldest publish. */
+    if ((ulTail - ulHead) >= LAB_OFFLINE_QUEUE_CAPACITY)
+    {
+        ulHead++;
+        bHeadCorrupted = false;
+        xStats.dropped++;
+        ESP_LOGW(TAG, "eLabOfflineQueuePush: Queue full, dropped oldest (%u dropped)", xStats.dropped);
+    }
+
+    /* Topic and payload are packed right after the header. */
+    xPushEntry.qos = (uint8_t)publishInfo->qos;
+    xPushEntry.retain = publishInfo->retain ? 1 : 0;
+    xPushEntry.topicLength = publishInfo->topicNameLength;
+    xPushEntry.payloadLength = (uint16_t)publishInfo->payloadLength;
+    memcpy(xPushEntry.data, publishInfo->pTopicName, publishInfo->topicNameLength);
+    memcpy(xPushEntry.data + publishInfo->topicNameLength, publishInfo->pPayload, publishInfo->payloadLength);
+
+    prvEntryKey(ulTail, key);
+    res = nvs_set_blob(xQueueHandle, key, &xPushEntry,
+                       OFFLINE_QUEUE_ENTRY_HEADER_SIZE + publishInfo->topicNameLength + publishInfo->payloadLength);
+
+    if (res == ESP_OK)
+    {
+        ulTail++;
+        res = prvSaveIndexes();
+    }
+
+    if (res == ESP_OK)
+    {
+        xStats.enqueued++;
+        xStats.depth = ulTail - ulHead;
+    }
+    else
+    {
+        ESP_LOGE(TAG, "eLabOfflineQueuePush: Failed to write %s: %s", key, esp_err_to_name(res));
+        res = ESP_FAIL;
+    }
+
+    IotMutex_Unlock(&xQueueMutex);
+
+    return res;
+}
+
+/*-----------------------------------------------------------*/
+
+esp_err_t eLabOfflineQueuePeek(lab_offline_queue_entry_t * entry, uint32_t * sequence)
+{
+    esp_err_t res = ESP_OK;
+    char key[OFFLINE_QUEUE_KEY_MAX_LENGTH] = { 0 };
+    size_t length = sizeof(lab_offline_queue_entry_t);
+
+    if (!bQueueReady || entry == NULL || sequence == NULL)
+    {
+        return ESP_FAIL;
+    }
+
+    IotMutex_Lock(&xQueueMutex);
+
+    if (ulTail == ulHead)
+    {
+        res = ESP_ERR_NOT_FOUND;
+    }
+    else
+    {
+        *sequence = ulHead;
+        prvEntryKey(ulHead, key);
+        res = nvs_get_blob(xQueueHandle, key, entry, &length);
+
+        if (res == ESP_OK &&
+            (length < OFFLINE_QUEUE_ENTRY_HEADER_SIZE ||
+             entry->topicLength > LAB_OFFLINE_QUEUE_TOPIC_MAX_LENGTH ||
+             entry->payloadLength > LAB_OFFLINE_QUEUE_PAYLOAD_MAX_LENGTH ||
+             length != OFFLINE_QUEUE_ENTRY_HEADER_SIZE + entry->topicLength + entry->payloadLength))
+        {
+            res = ESP_ERR_INVALID_SIZE;
+        }
+
+        /* Reading it again would fail again: it has to be popped. */
+        if (res != ESP_OK)
+        {
+            ESP_LOGE(TAG, "eLabOfflineQueuePeek: Cannot read entry %s: %s", key, esp_err_to_name(res));
+            bHeadCorrupted = true;
+            res = ESP_ERR_INVALID_STATE;
+        }
+    }
+
+    IotMutex_Unlock(&xQueueMutex);
+
+    return res;
+}
+
+/*-----------------------------------------------------------*/
+
+esp_err_t eLabOfflineQueuePop(uint32_t sequence)
+{
+    esp_err_t res = ESP_OK;
+    char key[OFFLINE_QUEUE_KEY_MAX_LENGTH] = { 0 };
+
+    if (!bQueueReady)
+    {
+        return ESP_FAIL;
+    }
+
+    IotMutex_Lock(&xQueueMutex);
+
+    /* Evicted since it was peeked: the new head was never sent. */
+    if (ulTail == ulHead || sequence != ulHead)
+    {
+        res = ESP_ERR_NOT_FOUND;
+    }
+    else
+    {
+        prvEntryKey(ulHead, key);
+        nvs_erase_key(xQueueHandle, key);
+        ulHead++;
+        res = prvSaveIndexes();
+
+        if (bHeadCorrupted)
+        {
+            xStats.corrupted++;
+            bHeadCorrupted = false;
+        }
+        else
+        {
+            xStats.drained++;
+        }
+        xStats.depth = ulTail - ulHead;
+    }
+
+    IotMutex_Unlock(&xQueueMutex);
+
+    return res;
+}
+
+/*-----------------------------------------------------------*/
+
+void vLabOfflineQueueEntryToPublishInfo(const lab_offline_queue_entry_t * entry, IotMqttPublishInfo_t * publishInfo)
+{
+    publishInfo->qos = (IotMqttQos_t)entry->qos;
+    publishInfo->retain = (entry->retain != 0);
+    publishInfo->pTopicName = entry->data;
+    publishInfo->topicNameLength = entry->topicLength;
+    publishInfo->pPayload = entry->data + entry->topicLength;
+    publishInfo->payloadLength = entry->payloadLength;
+}
+
+/*-----------------------------------------------------------*/
+
+uint32_t ulLabOfflineQueueDepth(void)
+{
+    return bQueueReady ? (ulTail - ulHead) : 0;
+}
+
+/*-----------------------------------------------------------*/
+
+void vLabOfflineQueueGetStats(lab_offline_queue_stats_t * stats)
+{
+    if (!bQueueReady)
+    {
+        *stats = xStats;
+        return;
+    }
+
+    IotMutex_Lock(&xQueueMutex);
+    *stats = xStats;
+    IotMutex_Unlock(&xQueueMutex);
+}
+
+/*-----------------------------------------------------------*/
@@ -0,0 +1,338 @@
+/**
+ * @file lab_payload.c
+ * @brief Writer of fixed-schema messages, in JSON or in CBOR. Keys and constant
+ * strings are precomputed fragments, numbers are converted without going
+ * through a format string.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include <string.h>
+
+#include "lab_payload.h"
+
+/**
+ * @brief CBOR major types, already shifted.
+ */
+#define CBOR_UINT           ( 0x00 )
+#define CBOR_NEGATIVE_INT   ( 0x20 )
+#define CBOR_TEXT           ( 0x60 )
+#define CBOR_ARRAY          ( 0x80 )
+#define CBOR_MAP            ( 0xA0 )
+#define CBOR_FALSE          ( 0xF4 )
+#define CBOR_TRUE           ( 0xF5 )
+
+/*-----------------------------------------------------------*/
+
+static void prvWrite(lab_payload_writer_t * writer, const void * pData, size_t length)
+{
+    if (writer->overflow || length > writer->size - writer->length)
+    {
+        writer->overflow = true;
+        return;
+    }
+
+    memcpy(writer->pBuffer + writer->length, pData, length);
+    writer->length += length;
+}
+
+static void prvWriteByte(lab_payload_writer_t * writer, uint8_t byte)
+{
+    prvWrite(writer, &byte, 1);
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief CBOR initial byte and argument, in the shortest form.
+ */
+static void prvCborHeader(lab_payload_writer_t * writer, uint8_t majorType, uint32_t value)
+{
+    uint8_t header[5];
+    size_t length = 0;
+
+    if (value < 24)
+    {
+        header[length++] = majorType | (uint8_t)value;
+    }
+    else if (value < 0x100)
+    {
+        header[length++] = majorType | 24;
+        header[length++] = (uint8_t)value;
+    }
+    else if (value < 0x10000)
+    {
+        header[length++] = majorType | 25;
+        header[length++] = (uint8_t)(value >> 8);
+        header[length++] = (uint8_t)value;
+    }
+    else
+    {
+        header[length++] = majorType | 26;
+        header[length++] = (uint8_t)(value >> 24);
+        header[length++] = (uint8_t)(value >> 16);
+        header[length++] = (uint8_t)(value >> 8);
+        header[length++] = (uint8_t)value;
+    }
+
+    prvWrite(writer, header, length);
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Decimal digits of a value, written from the end of a local buffer.
+ */
+static void prvJsonDigits(lab_payload_writer_t * writer, uint32_t value, bool negative)
+{
+    char digits[LAB_PAYLOAD_JSON_INT_LENGTH];
+    size_t start = sizeof(digits);
+
+    do
+    {
+        digits[--start] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+
+    if (negative)
+    {
+        digits[--start] = '-';
+    }
+
+    prvWrite(writer, &digits[start], sizeof(digits) - start);
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Called before every value: in an array, a value that follows another
+ * one needs a comma. In a map a value follows its key, which cleared the flag.
+ */
+static void prvBeginValue(lab_payload_writer_t * writer)
+{
+    if (writer->encoding == LABPAYLOAD_JSON && writer->needsSeparator)
+    {
+        prvWriteByte(writer, ',');
+    }
+}
+
+/**
+ * @brief Called after every value: a value ends a field, the next key needs a
+ * comma.
+ */
+static void prvValue(lab_payload_writer_t * writer)
+{
+    writer->needsSeparator = true;
+}
+
+/*-----------------------------------------------------------*/
+
+void vLabPayloadInit(lab_payload_writer_t * writer, void * pBuffer, size_t size, lab_payload_encoding_t encoding)
+{
+    writer->pBuffer = (uint8_t *)pBuffer;
+    writer->size = size;
+    writer->length = 0;
+    writer->encoding = encoding;
+    writer->needsSeparator = false;
+    writer->overflow = false;
+}
+
+/*-----------------------------------------------------------*/
+
+void vLabPayloadBeginMap(lab_payload_writer_t * writer, uint32_t fields)
+{
+    prvBeginValue(writer);
+
+    if (writer->encoding == LABPAYLOAD_CBOR)
+    {
+        prvCborHeader(writer, CBOR_MAP, fields);
+    }
+    else
+    {
+        prvWriteByte(writer, '{');
+    }
+
+    writer->needsSeparator = false;
+}
+
+/*-----------------------------------------------------------*/
+
+void vLabPayloadEndMap(lab_payload_writer_t * writer)
+{
+    if (writer->encoding == LABPAYLOAD_JSON)
+    {
+        prvWriteByte(writer, '}');
+    }
+
+    prvValue(writer);
+}
+
+/*-----------------------------------------------------------*/
+
+void vLabPayloadBeginArray(lab_payload_writer_t * writer, uint32_t items)
+{
+    prvBeginValue(writer);
+
+    if (writer->encoding == LABPAYLOAD_CBOR)
+    {
+        prvCborHeader(writer, CBOR_ARRAY, items);
+    }
+    else
+    {
+        prvWriteByte(writer, '[');
+    }
+
+    writer->needsSeparator = false;
+}
+
+/*-----------------------------------------------------------*/
+
+void vLabPayloadEndArray(lab_payload_writer_t * writer)
+{
+    if (writer->encoding == LABPAYLOAD_JSON)
+    {
+        prvWriteByte(writer, ']');
+    }
+
+    prvValue(writer);
+}
+
+/*-----------------------------------------------------------*/
+
+void vLabPayloadKey(lab_payload_writer_t * writer, const lab_payload_fragment_t * key)
+{
+    if (writer->encoding == LABPAYLOAD_CBOR)
+    {
+        /* "name": without the quotes and the colon. */
+        prvCborHeader(writer, CBOR_TEXT, (uint32_t)(key->jsonLength - 3));
+        prvWrite(writer, key->pJson + 1, key->jsonLength - 3);
+    }
+    else
+    {
+        if (writer->needsSeparator)
+        {
+            prvWriteByte(writer, ',');
+        }
+        prvWrite(writer, key->pJson, key->jsonLength);
+    }
+
+    writer->needsSeparator = false;
+}
+
+/*-----------------------------------------------------------*/
+
+void vLabPayloadText(lab_payload_writer_t * writer, const lab_payload_fragment_t * text)
+{
+    prvBeginValue(writer);
+
+    if (writer->encoding == LABPAYLOAD_CBOR)
+    {
+        /* "text" without the quotes. */
+        prvCborHeader(writer, CBOR_TEXT, (uint32_t)(text->jsonLength - 2));
+        prvWrite(writer, text->pJson + 1, text->jsonLength - 2);
+    }
+    else
+    {
+        prvWrite(writer, text->pJson, text->jsonLength);
+    }
+
+    prvValue(writer);
+}
+
+/*-----------------------------------------------------------*/
+
+void vLabPayloadString(lab_payload_writer_t * writer, const char * pString, size_t length)
+{
+    prvBeginValue(writer);
+
+    if (writer->encoding == LABPAYLOAD_CBOR)
+    {
+        prvCborHeader(writer, CBOR_TEXT, (uint32_t)length);
+        prvWrite(writer, pString, length);
+    }
+    else
+    {
+        prvWriteByte(writer, '"');
+        prvWrite(writer, pString, length);
+        prvWriteByte(writer, '"');
+    }
+
+    prvValue(writer);
+}
+
+/*-----------------------------------------------------------*/
+
+void vLabPayloadUint(lab_payload_writer_t * writer, uint32_t value)
+{
+    prvBeginValue(writer);
+
+    if (writer->encoding == LABPAYLOAD_CBOR)
+    {
+        prvCborHeader(writer, CBOR_UINT, value);
+    }
+    else
+    {
+        prvJsonDigits(writer, value, false);
+    }
+
+    prvValue(writer);
+}
+
+/*-----------------------------------------------------------*/
+
+void vLabPayloadInt(lab_payload_writer_t * writer, int32_t value)
+{
+    /* Magnitude computed unsigned, INT32_MIN has no positive counterpart. */
+    uint32_t magnitude = (value < 0) ? (uint32_t)0 - (uint32_t)value : (uint32_t)value;
+
+    prvBeginValue(writer);
+
+    if (writer->encoding == LABPAYLOAD_CBOR)
+    {
+        if (value < 0)
+        {
+            /* CBOR negative integers encode -1 - n. */
+            prvCborHeader(writer, CBOR_NEGATIVE_INT, magnitude - 1);
+        }
+        else
+        {
+            prvCborHeader(writer, CBOR_UINT, magnitude);
+        }
+    }
+    else
+    {
+        prvJsonDigits(writer, magnitude, value < 0);
+    }
+
+    prvValue(writer);
+}
+
+/*-----------------------------------------------------------*/
+
+void vLabPayloadBool(lab_payload_writer_t * writer, bool value)
+{
+    prvBeginValue(writer);
+
+    if (writer->encoding == LABPAYLOAD_CBOR)
+    {
+        prvWriteByte(writer, value ? CBOR_TRUE : CBOR_FALSE);
+    }
+    else if (value)
+    {
+        prvWrite(writer, "true", 4);
+    }
+    else
+    {
+        prvWrite(writer, "false", 5);
+    }
+
+    prvValue(writer);
+}
+
+/*-----------------------------------------------------------*/
+
+size_t xLabPayloadFinish(lab_payload_writer_t * writer)
+{
+    return writer->overflow ? 0 : writer->length;
+}
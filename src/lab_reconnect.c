@@ -0,0 +1,75 @@
+/**
+ * @file lab_reconnect.c
+ * @brief Bookkeeping of the connection loop of lab_connection, used from its
+ * task only.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include <string.h>
+
+#include "lab_reconnect.h"
+
+/*-----------------------------------------------------------*/
+
+void vLabReconnectInit(lab_reconnect_t * reconnect, uint32_t firstRetryMs, uint32_t baseMs, uint32_t capMs)
+{
+    memset(reconnect, 0, sizeof(lab_reconnect_t));
+    vLabBackoffInit(&reconnect->backoff, firstRetryMs, baseMs, capMs);
+}
+
+/*-----------------------------------------------------------*/
+
+void vLabReconnectAttempt(lab_reconnect_t * reconnect, uint64_t nowMs)
+{
+    reconnect->attemptStartMs = nowMs;
+    reconnect->stats.attempts++;
+}
+
+/*-----------------------------------------------------------*/
+
+void vLabReconnectEstablished(lab_reconnect_t * reconnect, uint64_t nowMs)
+{
+    reconnect->stats.lastConnectMs = (uint32_t)(nowMs - reconnect->attemptStartMs);
+}
+
+/*-----------------------------------------------------------*/
+
+void vLabReconnectConnected(lab_reconnect_t * reconnect, uint64_t nowMs)
+{
+    vLabBackoffReset(&reconnect->backoff);
+    reconnect->stats.consecutiveFailures = 0;
+    reconnect->stats.connects++;
+
+    if (reconnect->disconnectedAtMs != 0)
+    {
+        reconnect->stats.lastReconnectMs = (uint32_t)(nowMs - reconnect->disconnectedAtMs);
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+void vLabReconnectFailed(lab_reconnect_t * reconnect)
+{
+    reconnect->stats.failures++;
+    reconnect->stats.consecutiveFailures++;
+}
+
+/*-----------------------------------------------------------*/
+
+void vLabReconnectLost(lab_reconnect_t * reconnect, uint64_t nowMs)
+{
+    reconnect->disconnectedAtMs = nowMs;
+}
+
+/*-----------------------------------------------------------*/
+
+uint32_t ulLabReconnectNextDelayMs(lab_reconnect_t * reconnect)
+{
+    reconnect->stats.lastBackoffMs = ulLabBackoffNextDelayMs(&reconnect->backoff);
+
+    return reconnect->stats.lastBackoffMs;
+}
+
+/*-----------------------------------------------------------*/
@@ -0,0 +1,123 @@
+/**
+ * @file lab_report_policy.c
+ * @brief Report-on-change policy for reported states.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "lab_report_policy.h"
+
+static const char *TAG = "lab_report_policy";
+
+/*-----------------------------------------------------------*/
+
+void vLabReportPolicyInit(lab_report_policy_t *pPolicy,
+                          const lab_report_field_t *pFields,
+                          size_t fieldCount,
+                          uint32_t minIntervalMs,
+                          uint32_t heartbeatMs)
+{
+    memset(pPolicy, 0, sizeof(*pPolicy));
+
+    if (fieldCount > LAB_REPORT_POLICY_MAX_FIELDS)
+    {
+        ESP_LOGE(TAG, "vLabReportPolicyInit: %u fields, only %u are checked",
+                 (unsigned)fieldCount, LAB_REPORT_POLICY_MAX_FIELDS);
+        fieldCount = LAB_REPORT_POLICY_MAX_FIELDS;
+    }
+
+    pPolicy->pFields = pFields;
+    pPolicy->fieldCount = fieldCount;
+    pPolicy->minIntervalMs = minIntervalMs;
+    pPolicy->heartbeatMs = heartbeatMs;
+}
+
+/*-----------------------------------------------------------*/
+
+lab_report_reason_t xLabReportPolicyCheck(lab_report_policy_t *pPolicy,
+                                          const int32_t *pValues,
+                                          int64_t nowUs)
+{
+    int64_t elapsedMs = (nowUs - pPolicy->reportedUs) / 1000;
+    bool changed = false;
+    uint32_t change = 0;
+    size_t i = 0;
+
+    pPolicy->stats.checks++;
+
+    if (!pPolicy->hasReported)
+    {
+        return LABREPORT_FIRST;
+    }
+
+    if (pPolicy->retry)
+    {
+        pPolicy->stats.retries++;
+        return LABREPORT_RETRY;
+    }
+
+    for (i = 0; i < pPolicy->fieldCount; i++)
+    {
+        if (pValues[i] == pPolicy->reported[i])
+        {
+            continue;
+        }
+
+        if (pPolicy->pFields[i].immediate)
+        {
+            ESP_LOGD(TAG, "%s changed from %d to %d", pPolicy->pFields[i].pName,
+                     (int)pPolicy->reported[i], (int)pValues[i]);
+            pPolicy->stats.immediate++;
+            return LABREPORT_IMMEDIATE;
+        }
+
+        change = pValues[i] > pPolicy->reported[i] ?
+                 (uint32_t)pValues[i] - (uint32_t)pPolicy->reported[i] :
+                 (uint32_t)pPolicy->reported[i] - (uint32_t)pValues[i];
+
+        changed |= change >= pPolicy->pFields[i].deadband;
+    }
+
+    if (changed)
+    {
+        if (elapsedMs >= pPolicy->minIntervalMs)
+        {
+            return LABREPORT_CHANGE;
+        }
+
+        pPolicy->stats.deferred++;
+    }
+
+    if (pPolicy->heartbeatMs > 0 && elapsedMs >= pPolicy->heartbeatMs)
+    {
+        pPolicy->stats.heartbeats++;
+        return LABREPORT_HEARTBEAT;
+    }
+
+    return LABREPORT_NONE;
+}
+
+/*-----------------------------------------------------------*/
+
+void vLabReportPolicyReported(lab_report_policy_t *pPolicy,
+                              const int32_t *pValues,
+                              int64_t nowUs)
+{
+    memcpy(pPolicy->reported, pValues, pPolicy->fieldCount * sizeof(pValues[0]));
+    pPolicy->hasReported = true;
+    pPolicy->retry = false;
+    pPolicy->reportedUs = nowUs;
+    pPolicy->stats.reports++;
+}
+
+/*-----------------------------------------------------------*/
+
+void vLabReportPolicyRetry(lab_report_policy_t *pPolicy)
+{
+    pPolicy->retry = true;
+}
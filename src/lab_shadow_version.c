@@ -0,0 +1,49 @@
+/**
+ * @file lab_shadow_version.c
+ * @brief Version of a Shadow document.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include "esp_log.h"
+
+#include "lab_json.h"
+#include "lab_shadow_version.h"
+
+static const char *TAG = "lab_shadow_version";
+
+static const lab_json_field_t _versionField[1] = {
+    LAB_JSON_FIELD("version", LABJSON_TYPE_INT)
+};
+
+/*-----------------------------------------------------------*/
+
+bool bLabShadowVersionCheck(uint32_t *pVersion,
+                            const char *pDocument,
+                            size_t documentLength,
+                            const char *pObjectKey)
+{
+    lab_json_value_t version;
+    uint32_t known = __atomic_load_n(pVersion, __ATOMIC_RELAXED);
+
+    if (eLabJsonRead(pDocument, documentLength, pObjectKey, _versionField, 1, &version) != ESP_OK ||
+        !version.found || version.value <= 0)
+    {
+        return true;
+    }
+
+    /* Documents are taken in from more than one task: a newer version
+     * stored in between is never replaced by an older one. */
+    do
+    {
+        if ((uint32_t)version.value < known)
+        {
+            ESP_LOGW(TAG, "Shadow document version %d older than %u, dropped", (int)version.value, known);
+            return false;
+        }
+    } while (!__atomic_compare_exchange_n(pVersion, &known, (uint32_t)version.value, false,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    return true;
+}
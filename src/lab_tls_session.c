@@ -0,0 +1,90 @@
+/**
+ * @file lab_tls_session.c
+ * @brief Bookkeeping of the resumable TLS session of lab_network_tls. The
+ * session itself stays with mbedTLS in lab_network_tls.c; handshakes run one
+ * at a time, from the task connecting to MQTT.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include "lab_tls_session.h"
+
+/*-----------------------------------------------------------*/
+
+static bool _cached = false;
+
+static lab_network_tls_stats_t _stats = { 0 };
+
+/*-----------------------------------------------------------*/
+
+void vLabTlsSessionSetCached(bool cached)
+{
+    _cached = cached;
+}
+
+/*-----------------------------------------------------------*/
+
+bool bLabTlsSessionIsCached(void)
+{
+    return _cached;
+}
+
+/*-----------------------------------------------------------*/
+
+void vLabTlsSessionHandshakeDone(bool resumed, uint32_t durationMs)
+{
+    _stats.handshakes++;
+    _stats.lastHandshakeMs = durationMs;
+
+    if (resumed)
+    {
+        _stats.resumed++;
+        _stats.lastResumedHandshakeMs = durationMs;
+        _stats.totalResumedHandshakeMs += durationMs;
+    }
+    else
+    {
+        _stats.lastFullHandshakeMs = durationMs;
+        _stats.totalFullHandshakeMs += durationMs;
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+bool bLabTlsSessionHandshakeFailed(lab_tls_handshake_failure_t failure)
+{
+    bool forget = false;
+
+    _stats.failures++;
+
+    switch (failure)
+    {
+        case LAB_TLS_HANDSHAKE_ALERT:
+        case LAB_TLS_HANDSHAKE_REJECTED:
+            forget = _cached;
+            break;
+
+        case LAB_TLS_HANDSHAKE_TIMED_OUT:
+        case LAB_TLS_HANDSHAKE_NETWORK_ERROR:
+        case LAB_TLS_HANDSHAKE_LOCAL_ERROR:
+        default:
+            break;
+    }
+
+    if (forget)
+    {
+        _stats.forgotten++;
+    }
+
+    return forget;
+}
+
+/*-----------------------------------------------------------*/
+
+void vLabTlsSessionGetStats(lab_network_tls_stats_t * stats)
+{
+    *stats = _stats;
+}
+
+/*-----------------------------------------------------------*/
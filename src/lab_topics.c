@@ -0,0 +1,93 @@
+/**
+ * @file lab_topics.c
+ * @brief Topic names of the device, formatted once at init so that publishes
+ * only point at them.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "lab_topics.h"
+
+/*-----------------------------------------------------------*/
+
+static const char *TAG = "lab_topics";
+
+/*-----------------------------------------------------------*/
+
+#define IOT_MQTT_TOPIC_PREFIX "mydevice"
+
+/**
+ * @brief Short topic names published on in alias mode, one per
+ * lab_connection_topic_t, formatted with the ID of the device. The broker
+ * maps them back to the full topics.
+ */
+#define TOPIC_ALIAS_FORMAT "%s/a/%u"
+
+/* Full topic names of the device, formatted with its ID, in the order of
+ * lab_connection_topic_t. */
+static const char * const _topicFormats[LABCONNECTION_TOPIC_MAX] = {
+    IOT_MQTT_TOPIC_PREFIX "/%s",
+    IOT_MQTT_TOPIC_PREFIX "/%s/lwt",
+    IOT_MQTT_TOPIC_PREFIX "/%s/metrics",
+    IOT_MQTT_TOPIC_PREFIX "/%s/vibration"
+};
+
+/* Topic names published on, formatted once at init. */
+static char _topicNames[LABCONNECTION_TOPIC_MAX][LAB_CONNECTION_TOPIC_MAX_LENGTH];
+static uint16_t _topicNameLengths[LABCONNECTION_TOPIC_MAX] = { 0 };
+
+/*-----------------------------------------------------------*/
+
+esp_err_t eLabTopicsInit(const char * strID, bool useAliases)
+{
+    int length = 0;
+    uint32_t i = 0;
+
+    for (i = 0; i < LABCONNECTION_TOPIC_MAX; i++)
+    {
+        if (useAliases)
+        {
+            length = snprintf(_topicNames[i], LAB_CONNECTION_TOPIC_MAX_LENGTH, TOPIC_ALIAS_FORMAT, strID, i);
+        }
+        else
+        {
+            length = snprintf(_topicNames[i], LAB_CONNECTION_TOPIC_MAX_LENGTH, _topicFormats[i], strID);
+        }
+
+        if (length < 0 || length >= LAB_CONNECTION_TOPIC_MAX_LENGTH)
+        {
+            ESP_LOGE(TAG, "Failed to generate topic %u for %s", i, strID);
+            memset(_topicNameLengths, 0, sizeof(_topicNameLengths));
+            return ESP_FAIL;
+        }
+
+        _topicNameLengths[i] = (uint16_t)length;
+    }
+
+    return ESP_OK;
+}
+
+/*-----------------------------------------------------------*/
+
+const char * pcLabTopicsGet(lab_connection_topic_t topic, uint16_t * pLength)
+{
+    if (topic >= LABCONNECTION_TOPIC_MAX || _topicNameLengths[topic] == 0)
+    {
+        return NULL;
+    }
+
+    if (pLength != NULL)
+    {
+        *pLength = _topicNameLengths[topic];
+    }
+
+    return _topicNames[topic];
+}
+
+/*-----------------------------------------------------------*/
@@ -0,0 +1,573 @@
+/**
+ * @file lab_vibration.c
+ * @brief Windowed RMS, peak, crest factor and FFT band energies of the IMU
+ * samples. Everything is computed in fixed point: a Q15 radix-2 FFT, scaled
+ * by 2 at each stage, over a block-scaled input.
+ *
+ * (C) 2019 - Timothee Cruse <timothee.cruse@gmail.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "lab_connection.h"
+#include "lab_vibration.h"
+
+static const char *TAG = "lab_vibration";
+
+#if (LAB_VIBRATION_WINDOW & (LAB_VIBRATION_WINDOW - 1)) != 0 || LAB_VIBRATION_WINDOW < 16
+    #error "LAB_VIBRATION_WINDOW must be a power of 2, at least 16"
+#endif
+
+#if (LAB_VIBRATION_WINDOW / 2) % LAB_VIBRATION_BANDS != 0
+    #error "LAB_VIBRATION_BANDS must divide LAB_VIBRATION_WINDOW / 2"
+#endif
+
+#define LAB_VIBRATION_BAND_BINS         ( LAB_VIBRATION_WINDOW / 2 / LAB_VIBRATION_BANDS )
+#define LAB_VIBRATION_PI                ( 3.14159265f )
+
+/**
+ * @brief The FFT input is scaled up to just under this, which keeps every
+ * butterfly within 16 bits.
+ */
+#define LAB_VIBRATION_FFT_HEADROOM      ( 16384 )
+
+#define LAB_VIBRATION_MG(lsb)           ( (uint32_t)(lsb) * 1000 / LAB_IMU_ACCEL_LSB_PER_G )
+
+/**
+ * @brief Time between two samples beyond which they are not consecutive: the
+ * IMU slept in between. A few sample periods, for the timestamp jitter.
+ */
+#define LAB_VIBRATION_MAX_GAP_US        ( 4 * 1000000LL * LAB_IMU_DECIMATION / LAB_IMU_ODR_HZ )
+
+#define PAYLOAD_KEY_WINDOWS             "windows"
+#define PAYLOAD_KEY_RMS                 "rmsMg"
+#define PAYLOAD_KEY_PEAK                "peakMg"
+#define PAYLOAD_KEY_CREST               "crest"
+#define PAYLOAD_KEY_BANDS               "bandsMg"
+
+#define PAYLOAD_JSON_U16_LENGTH         ( 5 )
+#define PAYLOAD_JSON_U16_ARRAY_LENGTH(n)    ( LAB_PAYLOAD_JSON_ARRAY_LENGTH(n) + (n) * PAYLOAD_JSON_U16_LENGTH )
+#define PAYLOAD_CBOR_U16_ARRAY_LENGTH(n)    ( LAB_PAYLOAD_CBOR_ARRAY_LENGTH(n) + (n) * 3 )
+
+#define PAYLOAD_JSON_LENGTH                                                     \
+    ( LAB_PAYLOAD_JSON_MAP_LENGTH(5) +                                          \
+      LAB_PAYLOAD_JSON_KEY_LENGTH(PAYLOAD_KEY_WINDOWS) + LAB_PAYLOAD_JSON_UINT_LENGTH + \
+      LAB_PAYLOAD_JSON_KEY_LENGTH(PAYLOAD_KEY_RMS) + PAYLOAD_JSON_U16_ARRAY_LENGTH(3) + \
+      LAB_PAYLOAD_JSON_KEY_LENGTH(PAYLOAD_KEY_PEAK) + PAYLOAD_JSON_U16_ARRAY_LENGTH(3) + \
+      LAB_PAYLOAD_JSON_KEY_LENGTH(PAYLOAD_KEY_CREST) + PAYLOAD_JSON_U16_ARRAY_LENGTH(3) + \
+      LAB_PAYLOAD_JSON_KEY_LENGTH(PAYLOAD_KEY_BANDS) + PAYLOAD_JSON_U16_ARRAY_LENGTH(LAB_VIBRATION_BANDS) )
+
+#define PAYLOAD_CBOR_LENGTH                                                     \
+    ( LAB_PAYLOAD_CBOR_MAP_LENGTH(5) +                                          \
+      LAB_PAYLOAD_CBOR_KEY_LENGTH(PAYLOAD_KEY_WINDOWS) + LAB_PAYLOAD_CBOR_UINT_LENGTH + \
+      LAB_PAYLOAD_CBOR_KEY_LENGTH(PAYLOAD_KEY_RMS) + PAYLOAD_CBOR_U16_ARRAY_LENGTH(3) + \
+      LAB_PAYLOAD_CBOR_KEY_LENGTH(PAYLOAD_KEY_PEAK) + PAYLOAD_CBOR_U16_ARRAY_LENGTH(3) + \
+      LAB_PAYLOAD_CBOR_KEY_LENGTH(PAYLOAD_KEY_CREST) + PAYLOAD_CBOR_U16_ARRAY_LENGTH(3) + \
+      LAB_PAYLOAD_CBOR_KEY_LENGTH(PAYLOAD_KEY_BANDS) + PAYLOAD_CBOR_U16_ARRAY_LENGTH(LAB_VIBRATION_BANDS) )
+
+_Static_assert(LAB_PAYLOAD_MAX(PAYLOAD_JSON_LENGTH, PAYLOAD_CBOR_LENGTH) <= LAB_VIBRATION_PAYLOAD_MAX_LENGTH,
+               "LAB_VIBRATION_PAYLOAD_MAX_LENGTH is too small for LAB_VIBRATION_BANDS");
+_Static_assert(LAB_VIBRATION_PAYLOAD_MAX_LENGTH <= LAB_CONNECTION_POOL_PAYLOAD_LENGTH,
+               "The features do not fit a publish buffer");
+
+/**
+ * @brief Sums of the window being filled.
+ */
+typedef struct {
+    uint32_t count;
+    int32_t sum[3];
+    uint64_t sumSquares[3];
+    int16_t min[3];
+    int16_t max[3];
+} _window_t;
+
+/**
+ * @brief Sums of the windows since the features were last taken, in raw units.
+ */
+typedef struct {
+    uint32_t windows;
+    uint64_t meanSquares[3];
+    uint32_t peak[3];
+    uint64_t bandMeanSquares[LAB_VIBRATION_BANDS];
+    uint32_t maxComputeUs;
+} _aggregate_t;
+
+/*-----------------------------------------------------------*/
+
+static const lab_payload_fragment_t _keyWindows = LAB_PAYLOAD_KEY( PAYLOAD_KEY_WINDOWS );
+static const lab_payload_fragment_t _keyRms = LAB_PAYLOAD_KEY( PAYLOAD_KEY_RMS );
+static const lab_payload_fragment_t _keyPeak = LAB_PAYLOAD_KEY( PAYLOAD_KEY_PEAK );
+static const lab_payload_fragment_t _keyCrest = LAB_PAYLOAD_KEY( PAYLOAD_KEY_CREST );
+static const lab_payload_fragment_t _keyBands = LAB_PAYLOAD_KEY( PAYLOAD_KEY_BANDS );
+
+/* Q15 twiddles, cos and sin of 2 pi k / N for k < N / 2, and Hann window. */
+static int16_t _cos[LAB_VIBRATION_WINDOW / 2];
+static int16_t _sin[LAB_VIBRATION_WINDOW / 2];
+static int16_t _hann[LAB_VIBRATION_WINDOW];
+
+/* Acceleration magnitude of the window, and the FFT work area. */
+static uint16_t _magnitude[LAB_VIBRATION_WINDOW];
+static int16_t _re[LAB_VIBRATION_WINDOW];
+static int16_t _im[LAB_VIBRATION_WINDOW];
+
+static _window_t _window;
+static _aggregate_t _aggregate;
+static int64_t _lastTimeUs = 0;
+
+static TaskHandle_t _vibrationTaskHandle = NULL;
+
+/*-----------------------------------------------------------*/
+
+static uint32_t _isqrt(uint64_t value)
+{
+    uint64_t root = 0;
+    uint64_t bit = (uint64_t)1 << 62;
+
+    while (bit > value)
+    {
+        bit >>= 2;
+    }
+
+    while (bit != 0)
+    {
+        if (value >= root + bit)
+        {
+            value -= root + bit;
+            root = (root >> 1) + bit;
+        }
+        else
+        {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+
+    return (uint32_t)root;
+}
+
+/*-----------------------------------------------------------*/
+
+static int16_t _q15(float value)
+{
+    int32_t q = (int32_t)lrintf(value * 32768.0f);
+
+    return (int16_t)(q > 32767 ? 32767 : q);
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief In-place radix-2 FFT of _re / _im, input in bit-reversed order.
+ * Each stage halves the values: the output is the DFT divided by N.
+ */
+static void _fft(void)
+{
+    uint32_t size = 0, half = 0, step = 0, start = 0, k = 0, i = 0, j = 0;
+    int32_t wr = 0, wi = 0, tr = 0, ti = 0, ur = 0, ui = 0;
+
+    for (size = 2; size <= LAB_VIBRATION_WINDOW; size <<= 1)
+    {
+        half = size / 2;
+        step = LAB_VIBRATION_WINDOW / size;
+
+        for (start = 0; start < LAB_VIBRATION_WINDOW; start += size)
+        {
+            for (k = 0; k < half; k++)
+            {
+                i = start + k;
+                j = i + half;
+
+                /* t = x[j] * exp(-2 pi i k / size) */
+                wr = _cos[k * step];
+                wi = -_sin[k * step];
+                tr = (wr * _re[j] - wi * _im[j]) >> 15;
+                ti = (wr * _im[j] + wi * _re[j]) >> 15;
+                ur = _re[i];
+                ui = _im[i];
+
+                _re[i] = (int16_t)((ur + tr) >> 1);
+                _im[i] = (int16_t)((ui + ti) >> 1);
+                _re[j] = (int16_t)((ur - tr) >> 1);
+                _im[j] = (int16_t)((ui - ti) >> 1);
+            }
+        }
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static uint32_t _bitReverse(uint32_t index)
+{
+    uint32_t reversed = 0;
+    uint32_t bit = 0;
+
+    for (bit = 1; bit < LAB_VIBRATION_WINDOW; bit <<= 1)
+    {
+        reversed = (reversed << 1) | (index & 1);
+        index >>= 1;
+    }
+
+    return reversed;
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Band energies of the magnitude of the window, added to the aggregate.
+ */
+static void _addBands(void)
+{
+    uint32_t sum = 0, n = 0, b = 0, k = 0;
+    int32_t mean = 0, value = 0, maxAbs = 0;
+    int32_t shift = 0;
+    uint64_t energy = 0;
+
+    for (n = 0; n < LAB_VIBRATION_WINDOW; n++)
+    {
+        sum += _magnitude[n];
+    }
+    mean = (int32_t)(sum / LAB_VIBRATION_WINDOW);
+
+    /* Gravity removed and Hann window applied: the magnitude can be above
+     * 16 bits, look for the block scale first. */
+    for (n = 0; n < LAB_VIBRATION_WINDOW; n++)
+    {
+        value = (((int32_t)_magnitude[n] - mean) * _hann[n]) >> 15;
+        if (value < 0) value = -value;
+        if (value > maxAbs) maxAbs = value;
+    }
+
+    /* Block floating point: use all the bits the FFT can take. */
+    while (maxAbs >= LAB_VIBRATION_FFT_HEADROOM)
+    {
+        maxAbs >>= 1;
+        shift--;
+    }
+    while (maxAbs != 0 && (maxAbs << 1) < LAB_VIBRATION_FFT_HEADROOM)
+    {
+        maxAbs <<= 1;
+        shift++;
+    }
+
+    /* Input in bit-reversed order. */
+    for (n = 0; n < LAB_VIBRATION_WINDOW; n++)
+    {
+        value = (((int32_t)_magnitude[n] - mean) * _hann[n]) >> 15;
+        value = shift >= 0 ? value * (1 << shift) : value >> -shift;
+        _re[_bitReverse(n)] = (int16_t)value;
+        _im[n] = 0;
+    }
+
+    _fft();
+
+    /* Parseval: the mean square of a band is twice the sum of its |X / N|^2,
+     * times 8 / 3 for the power the Hann window took, and the input scale. */
+    for (b = 0; b < LAB_VIBRATION_BANDS; b++)
+    {
+        energy = 0;
+        for (k = b * LAB_VIBRATION_BAND_BINS; k < (b + 1) * LAB_VIBRATION_BAND_BINS; k++)
+        {
+            if (k == 0)
+            {
+                continue;
+            }
+            energy += (uint64_t)((int32_t)_re[k] * _re[k]) + (uint64_t)((int32_t)_im[k] * _im[k]);
+        }
+        energy = (energy * 16) / 3;
+        _aggregate.bandMeanSquares[b] += shift >= 0 ? energy >> (2 * shift) : energy << (-2 * shift);
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void _closeWindow(void)
+{
+    int64_t startUs = esp_timer_get_time();
+    uint32_t axis = 0, computeUs = 0;
+    int32_t mean = 0, peak = 0;
+    int64_t meanSquare = 0;
+
+    for (axis = 0; axis < 3; axis++)
+    {
+        /* (N sum(x^2) - sum(x)^2) / N^2, exact: with gravity on an axis an
+         * integer mean would be off by more than the vibration. */
+        mean = _window.sum[axis] / LAB_VIBRATION_WINDOW;
+        meanSquare = ((int64_t)_window.sumSquares[axis] * LAB_VIBRATION_WINDOW - (int64_t)_window.sum[axis] * _window.sum[axis]) /
+                     ((int64_t)LAB_VIBRATION_WINDOW * LAB_VIBRATION_WINDOW);
+        peak = _window.max[axis] - mean > mean - _window.min[axis] ? _window.max[axis] - mean : mean - _window.min[axis];
+
+        _aggregate.meanSquares[axis] += meanSquare > 0 ? (uint64_t)meanSquare : 0;
+        if ((uint32_t)peak > _aggregate.peak[axis])
+        {
+            _aggregate.peak[axis] = (uint32_t)peak;
+        }
+    }
+
+    _addBands();
+    _aggregate.windows++;
+
+    computeUs = (uint32_t)(esp_timer_get_time() - startUs);
+    if (computeUs > _aggregate.maxComputeUs)
+    {
+        _aggregate.maxComputeUs = computeUs;
+    }
+
+    vLabVibrationRestartWindow();
+}
+
+/*-----------------------------------------------------------*/
+
+void vLabVibrationRestartWindow(void)
+{
+    uint32_t axis = 0;
+
+    memset(&_window, 0, sizeof(_window));
+    for (axis = 0; axis < 3; axis++)
+    {
+        _window.min[axis] = INT16_MAX;
+        _window.max[axis] = INT16_MIN;
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+void vLabVibrationAddSamples(const lab_imu_sample_t *pSamples, size_t count)
+{
+    const lab_imu_sample_t *pSample = NULL;
+    uint32_t axis = 0;
+    uint32_t squares = 0;
+    size_t i = 0;
+
+    for (i = 0; i < count; i++)
+    {
+        pSample = &pSamples[i];
+        squares = 0;
+
+        if (_lastTimeUs != 0 && pSample->timeUs - _lastTimeUs > LAB_VIBRATION_MAX_GAP_US)
+        {
+            vLabVibrationRestartWindow();
+        }
+        _lastTimeUs = pSample->timeUs;
+
+        for (axis = 0; axis < 3; axis++)
+        {
+            int32_t value = pSample->accel[axis];
+
+            _window.sum[axis] += value;
+            _window.sumSquares[axis] += (uint64_t)(value * value);
+            if (value < _window.min[axis]) _window.min[axis] = (int16_t)value;
+            if (value > _window.max[axis]) _window.max[axis] = (int16_t)value;
+            squares += (uint32_t)(value * value);
+        }
+
+        _magnitude[_window.count] = (uint16_t)_isqrt(squares);
+
+        if (++_window.count == LAB_VIBRATION_WINDOW)
+        {
+            _closeWindow();
+        }
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+bool bLabVibrationTakeFeatures(lab_vibration_features_t *pFeatures)
+{
+    uint32_t axis = 0, b = 0, rms = 0;
+
+    if (_aggregate.windows == 0)
+    {
+        return false;
+    }
+
+    pFeatures->windows = _aggregate.windows;
+    pFeatures->maxComputeUs = _aggregate.maxComputeUs;
+
+    for (axis = 0; axis < 3; axis++)
+    {
+        rms = _isqrt(_aggregate.meanSquares[axis] / _aggregate.windows);
+        pFeatures->rmsMg[axis] = (uint16_t)LAB_VIBRATION_MG(rms);
+        pFeatures->peakMg[axis] = (uint16_t)LAB_VIBRATION_MG(_aggregate.peak[axis]);
+        pFeatures->crestX100[axis] = rms == 0 ? 0 : (uint16_t)(_aggregate.peak[axis] * 100 / rms);
+    }
+
+    for (b = 0; b < LAB_VIBRATION_BANDS; b++)
+    {
+        pFeatures->bandMg[b] = (uint16_t)LAB_VIBRATION_MG(_isqrt(_aggregate.bandMeanSquares[b] / _aggregate.windows));
+    }
+
+    memset(&_aggregate, 0, sizeof(_aggregate));
+
+    return true;
+}
+
+/*-----------------------------------------------------------*/
+
+static void _writeArray(lab_payload_writer_t *writer, const lab_payload_fragment_t *key, const uint16_t *pValues, uint32_t count)
+{
+    uint32_t i = 0;
+
+    vLabPayloadKey(writer, key);
+    vLabPayloadBeginArray(writer, count);
+    for (i = 0; i < count; i++)
+    {
+        vLabPayloadUint(writer, pValues[i]);
+    }
+    vLabPayloadEndArray(writer);
+}
+
+/*-----------------------------------------------------------*/
+
+size_t xLabVibrationToPayload(const lab_vibration_features_t *pFeatures, void *pBuffer, size_t size, lab_payload_encoding_t encoding)
+{
+    lab_payload_writer_t writer;
+
+    vLabPayloadInit(&writer, pBuffer, size, encoding);
+    vLabPayloadBeginMap(&writer, 5);
+    vLabPayloadKey(&writer, &_keyWindows);
+    vLabPayloadUint(&writer, pFeatures->windows);
+    _writeArray(&writer, &_keyRms, pFeatures->rmsMg, 3);
+    _writeArray(&writer, &_keyPeak, pFeatures->peakMg, 3);
+    _writeArray(&writer, &_keyCrest, pFeatures->crestX100, 3);
+    _writeArray(&writer, &_keyBands, pFeatures->bandMg, LAB_VIBRATION_BANDS);
+    vLabPayloadEndMap(&writer);
+
+    return xLabPayloadFinish(&writer);
+}
+
+/*-----------------------------------------------------------*/
+
+#if LAB_VIBRATION_PUBLISH_PERIOD_MS > 0
+
+/**
+ * @brief Publish the features as one QoS0 message on the vibration topic of
+ * the device. Nothing is sent, nor queued, while MQTT is down.
+ */
+static void _publishFeatures(const lab_vibration_features_t *pFeatures)
+{
+    IotMqttPublishInfo_t publishInfo = IOT_MQTT_PUBLISH_INFO_INITIALIZER;
+    lab_publish_buffer_t * pBuffer = NULL;
+
+    if (!bIsLabConnectionMqttConnected())
+    {
+        return;
+    }
+
+    pBuffer = pxLabConnectionAcquireBuffer();
+    if (pBuffer == NULL)
+    {
+        return;
+    }
+
+    publishInfo.qos = IOT_MQTT_QOS_0;
+    publishInfo.pPayload = pBuffer->payload;
+    publishInfo.payloadLength = xLabVibrationToPayload(pFeatures, pBuffer->payload, sizeof(pBuffer->payload),
+                                                       xLabConnectionGetTopicEncoding(LABCONNECTION_TOPIC_VIBRATION));
+
+    if (eLabConnectionSetTopic(&publishInfo, LABCONNECTION_TOPIC_VIBRATION) != ESP_OK || publishInfo.payloadLength == 0)
+    {
+        ESP_LOGE(TAG, "_publishFeatures: Failed to prepare the message");
+        vLabConnectionReleaseBuffer(pBuffer);
+        return;
+    }
+
+    eLabConnectionPublishBuffer(pBuffer, &publishInfo, NULL);
+}
+
+#endif
+
+/*-----------------------------------------------------------*/
+
+static void prvVibrationTask( void *pvParameters )
+{
+    static lab_imu_sample_t samples[LAB_VIBRATION_WINDOW / 4];
+    lab_imu_reader_t reader;
+    #if LAB_VIBRATION_PUBLISH_PERIOD_MS > 0
+        lab_vibration_features_t features;
+        TickType_t xLastPublish = xTaskGetTickCount();
+    #endif
+    uint32_t lost = 0;
+    size_t count = 0;
+
+    vLabImuReaderInit(&reader);
+
+    for( ;; )
+    {
+        vTaskDelay( pdMS_TO_TICKS( LAB_VIBRATION_READ_MS ) );
+
+        while ((count = xLabImuRead(&reader, samples, sizeof(samples) / sizeof(samples[0]))) > 0)
+        {
+            /* A window with a gap would show frequencies that are not there. */
+            if (reader.lost != lost)
+            {
+                ESP_LOGW(TAG, "Lost %u samples, restarting the window", reader.lost - lost);
+                lost = reader.lost;
+                vLabVibrationRestartWindow();
+            }
+
+            vLabVibrationAddSamples(samples, count);
+        }
+
+        #if LAB_VIBRATION_PUBLISH_PERIOD_MS > 0
+            if (xTaskGetTickCount() - xLastPublish >= pdMS_TO_TICKS( LAB_VIBRATION_PUBLISH_PERIOD_MS ) &&
+                bLabVibrationTakeFeatures(&features))
+            {
+                xLastPublish = xTaskGetTickCount();
+
+                ESP_LOGD(TAG, "%u windows, RMS %u/%u/%u mg, peak %u/%u/%u mg, %u us per window at most",
+                         features.windows, features.rmsMg[0], features.rmsMg[1], features.rmsMg[2],
+                         features.peakMg[0], features.peakMg[1], features.peakMg[2], features.maxComputeUs);
+
+                _publishFeatures(&features);
+            }
+        #endif
+    }
+
+    vTaskDelete( NULL );
+}
+
+/*-----------------------------------------------------------*/
+
+esp_err_t eLabVibrationInit(void)
+{
+    uint32_t n = 0;
+
+    if (_vibrationTaskHandle != NULL)
+    {
+        return ESP_OK;
+    }
+
+    for (n = 0; n < LAB_VIBRATION_WINDOW / 2; n++)
+    {
+        _cos[n] = _q15(cosf(2 * LAB_VIBRATION_PI * n / LAB_VIBRATION_WINDOW));
+        _sin[n] = _q15(sinf(2 * LAB_VIBRATION_PI * n / LAB_VIBRATION_WINDOW));
+    }
+    for (n = 0; n < LAB_VIBRATION_WINDOW; n++)
+    {
+        _hann[n] = _q15(0.5f - 0.5f * cosf(2 * LAB_VIBRATION_PI * n / LAB_VIBRATION_WINDOW));
+    }
+
+    vLabVibrationRestartWindow();
+    memset(&_aggregate, 0, sizeof(_aggregate));
+
+    if (xTaskCreate( prvVibrationTask,
+                     "VibrationTask",
+                     LAB_VIBRATION_TASK_STACK_SIZE,
+                     NULL,
+                     LAB_VIBRATION_TASK_PRIORITY,
+                     &_vibrationTaskHandle ) != pdPASS)
+    {
+        ESP_LOGE(TAG, "eLabVibrationInit: Failed to create the vibration task");
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
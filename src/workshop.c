@@ -27,6 +27,7 @@
 #include "driver/gpio.h"
 #include "esp_log.h"
 #include "esp_event.h"
+#include "esp_timer.h"
 
 #include "device.h"
 #include "lab_config.h"
@@ -41,6 +42,15 @@
 #endif
 
 #include "lab_connection.h"
+#include "lab_display.h"
+
+#if defined(DEVICE_HAS_BATTERY)
+    #include "lab_battery.h"
+#endif
+#if defined(DEVICE_HAS_ACCELEROMETER)
+    #include "lab_imu.h"
+    #include "lab_vibration.h"
+#endif
 
 /*-----------------------------------------------------------*/
 
@@ -88,6 +98,18 @@ esp_err_t eWorkshopRun(void)
 #if defined(DEVICE_HAS_MAIN_BUTTON)
     void prvWorkshopMainButtonEventHandler(void * handler_arg, esp_event_base_t base, int32_t id, void * event_data)
     {
+        uint32_t durationMs = 0;
+
+        #if defined(DEVICE_HAS_BUTTON_EVENT_DATA)
+        if ( event_data != NULL )
+        {
+            const device_button_event_t * event = (const device_button_event_t *)event_data;
+
+            durationMs = event->duration_ms;
+            ESP_LOGD(TAG, "Main Button event %d handled %lld us after the press", id, esp_timer_get_time() - event->press_time_us);
+        }
+        #endif
+
         if (base == BUTTON_MAIN_EVENT_BASE )
         {
             if ( id == BUTTON_CLICK )
@@ -98,10 +120,22 @@ esp_err_t eWorkshopRun(void)
             {
                 ESP_LOGI(TAG, "Main Button Held");
             }
+            if ( id == BUTTON_DOUBLE_CLICK )
+            {
+                ESP_LOGI(TAG, "Main Button Double Clicked");
+            }
+            if ( id == BUTTON_TRIPLE_CLICK )
+            {
+                ESP_LOGI(TAG, "Main Button Triple Clicked");
+            }
+            if ( id == BUTTON_LONG_PRESS )
+            {
+                ESP_LOGI(TAG, "Main Button Released after %u ms", durationMs);
+            }
         }
 
         #if defined(LABCONFIG_LAB1_AWS_IOT_BUTTON)|| defined(LABCONFIG_LAB2_SHADOW)
-        if ( eLab1Action( strMACAddr, id ) != ESP_OK ) 
+        if ( eLab1Action( strMACAddr, id, durationMs ) != ESP_OK ) 
         {
             ESP_LOGE(TAG, "Failed to run Lab1 Action");
         }
@@ -133,6 +167,69 @@ esp_err_t eWorkshopRun(void)
 
 /*-----------------------------------------------------------*/
 
+#if defined(DEVICE_HAS_ACCELEROMETER)
+    void prvWorkshopMotionEventHandler(void * handler_arg, esp_event_base_t base, int32_t id, void * event_data)
+    {
+        const lab_imu_motion_event_t * event = (const lab_imu_motion_event_t *)event_data;
+        uint32_t durationMs = ( event != NULL ) ? event->durationMs : 0;
+
+        if ( id == LABIMU_EVENT_MOTION_START )
+        {
+            ESP_LOGI(TAG, "Motion started");
+        }
+        if ( id == LABIMU_EVENT_MOTION_STOP )
+        {
+            ESP_LOGI(TAG, "Motion stopped after %u ms", durationMs);
+        }
+
+        #if defined(LABCONFIG_LAB1_AWS_IOT_BUTTON)|| defined(LABCONFIG_LAB2_SHADOW)
+        if ( eLab1Motion( strMACAddr, id == LABIMU_EVENT_MOTION_START, durationMs ) != ESP_OK )
+        {
+            ESP_LOGE(TAG, "Failed to publish the motion");
+        }
+        #endif
+    }
+#endif // defined(DEVICE_HAS_ACCELEROMETER)
+
+/*-----------------------------------------------------------*/
+
+#if defined(DEVICE_HAS_BATTERY)
+    void prvWorkshopBatteryEventHandler(void * handler_arg, esp_event_base_t base, int32_t id, void * event_data)
+    {
+        const lab_battery_event_t * event = (const lab_battery_event_t *)event_data;
+
+        ESP_LOGI(TAG, "Battery at %u%% (%u mV)%s", event->socPercent, event->millivolts,
+                 event->charging ? ", charging" : "");
+
+        #if defined(LABCONFIG_LAB2_SHADOW)
+        if ( eLab2ReportBattery( event->socPercent, event->charging, event->millivolts ) != ESP_OK )
+        {
+            ESP_LOGE(TAG, "Failed to report the battery");
+        }
+        #endif
+    }
+#endif // defined(DEVICE_HAS_BATTERY)
+
+/*-----------------------------------------------------------*/
+
+#if defined(DEVICE_HAS_DISPLAY)
+    static void prvWorkshopDisplayHeader(void)
+    {
+        eLabDisplaySetText(LABDISPLAY_WIDGET_TITLE, "Amazon FreeRTOS");
+        eLabDisplaySetText(LABDISPLAY_WIDGET_SUBTITLE, "workshop");
+
+        #if defined(LABCONFIG_LAB0_DO_NOTHING)
+            eLabDisplaySetText(LABDISPLAY_WIDGET_LAB, "LAB0 - DOES NOTHING");
+        #elif defined(LABCONFIG_LAB1_AWS_IOT_BUTTON)
+            eLabDisplaySetText(LABDISPLAY_WIDGET_LAB, "LAB1 - AWS IOT BUTTON");
+        #elif defined(LABCONFIG_LAB2_SHADOW)
+            eLabDisplaySetText(LABDISPLAY_WIDGET_LAB, "LAB2 - THING SHADOW");
+        #endif
+    }
+#endif // defined(DEVICE_HAS_DISPLAY)
+
+/*-----------------------------------------------------------*/
+
 esp_err_t eWorkshopInit(void)
 {
     esp_err_t res = ESP_FAIL;
@@ -143,6 +240,9 @@ esp_err_t eWorkshopInit(void)
 
     if (res ==  ESP_OK)
     {
+        #if defined(DEVICE_HAS_DISPLAY)
+            prvWorkshopDisplayHeader();
+        #endif // defined(DEVICE_HAS_DISPLAY)
 
         #if defined(DEVICE_HAS_MAIN_BUTTON)
             res = eDeviceRegisterButtonCallback(BUTTON_MAIN_EVENT_BASE, prvWorkshopMainButtonEventHandler);
@@ -160,9 +260,33 @@ esp_err_t eWorkshopInit(void)
             }
         #endif // defined(DEVICE_HAS_RESET_BUTTON)
 
+        #if defined(DEVICE_HAS_ACCELEROMETER)
+            res = eDeviceRegisterMotionCallback(prvWorkshopMotionEventHandler);
+            if (res !=  ESP_OK)
+            {
+                ESP_LOGE(TAG, "eWorkshopInit: Register motion ... failed");
+            }
+        #endif // defined(DEVICE_HAS_ACCELEROMETER)
+
+        #if defined(DEVICE_HAS_BATTERY)
+            res = eDeviceRegisterBatteryCallback(prvWorkshopBatteryEventHandler);
+            if (res !=  ESP_OK)
+            {
+                ESP_LOGE(TAG, "eWorkshopInit: Register battery ... failed");
+            }
+        #endif // defined(DEVICE_HAS_BATTERY)
+
         /* Init the labs */
         res = LAB_INIT( strMACAddr );
 
+        #if defined(DEVICE_HAS_ACCELEROMETER)
+            if (res == ESP_OK)
+            {
+                /* Publishes on the vibration topic once the lab is connected. */
+                res = eLabVibrationInit();
+            }
+        #endif // defined(DEVICE_HAS_ACCELEROMETER)
+
         if (res == ESP_OK) {
             ESP_LOGI(TAG, "eWorkshopInit: ... done");
         }